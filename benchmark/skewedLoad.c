@@ -0,0 +1,221 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides a benchmark with a skewed load - a few connections pipeline
+ * expensive LISTs while the others send single READs
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>     
+#include <string.h>     
+#include <time.h>
+#include <unistd.h>     
+#include <pthread.h>
+
+#include <termPaperLib.h>
+#include <binaryProtocol.h>
+
+// frames a heavy connection sends before it reads the answers
+#define PIPELINE_DEPTH 16
+
+typedef struct connection {
+  pthread_t thread;
+  int heavy;
+  long requests;
+} Connection;
+
+char *server_ip;
+unsigned short server_port;
+char *unix_path;
+int num_files;
+volatile int running = TRUE;
+
+int connect_to_server() {
+  if (unix_path != NULL) {
+    return create_unix_client_socket(unix_path);
+  }
+  return create_client_socket(server_port, server_ip);
+}
+
+/*
+ * Reads the answer of a request - exits if the server misbehaves
+ */
+void expect_response(int sock, int status) {
+  BinaryHeader header;
+  char *value;
+  if (!read_binary_response(sock, &header, &value)) {
+    log_error("Server closed the connection");
+    exit(1);
+  }
+  if (header.status != status) {
+    log_error("Unexpected status %d instead of %d", header.status, status);
+    exit(1);
+  }
+  free(value);
+}
+
+/*
+ * Sends LIST batches (heavy) or single READs (light) until the time is up
+ */
+void *run_connection(void *input) {
+  Connection *connection = (Connection *) input;
+  int sock = connect_to_server();
+  char key[16];
+  unsigned int seed = (unsigned int) (long) connection;
+
+  while (running) {
+    if (connection->heavy) {
+      int i;
+      for (i = 0; i < PIPELINE_DEPTH; i++) {
+        write_binary_request(sock, OP_LIST, i, NULL, NULL, 0);
+      }
+      for (i = 0; i < PIPELINE_DEPTH; i++) {
+        expect_response(sock, STATUS_OK);
+      }
+      connection->requests += PIPELINE_DEPTH;
+    } else {
+      snprintf(key, sizeof(key), "bench%d", rand_r(&seed) % num_files);
+      write_binary_request(sock, OP_READ, 0, key, NULL, 0);
+      expect_response(sock, STATUS_OK);
+      connection->requests++;
+    }
+  }
+  close(sock);
+  return NULL;
+}
+
+/*
+ * Creates (or deletes) the files the benchmark works on - pipelined
+ */
+void prepare_files(int opcode) {
+  int sock = connect_to_server();
+  char key[16];
+  int i;
+  for (i = 0; i < num_files; i++) {
+    snprintf(key, sizeof(key), "bench%d", i);
+    write_binary_request(sock, opcode, i, key, key, opcode == OP_CREATE ? strlen(key) : 0);
+    if (i % PIPELINE_DEPTH == PIPELINE_DEPTH - 1) {
+      int j;
+      for (j = 0; j < PIPELINE_DEPTH; j++) {
+        expect_response(sock, STATUS_OK);
+      }
+    }
+  }
+  for (i = 0; i < num_files % PIPELINE_DEPTH; i++) {
+    expect_response(sock, STATUS_OK);
+  }
+  close(sock);
+}
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void usage(const char *argv0, const char *msg) {
+  if (msg != NULL && strlen(msg) > 0) {
+    printf("%s\n\n", msg);
+  }
+  printf("Usage:\n");
+
+  char *usage = "";
+  char *ip_help = get_ip_help(&usage);
+  char *port_help = get_port_help(&usage);
+  char *unix_help = get_unix_path_help(&usage);
+  usage = join_with_seperator(usage, "[-c Connections] [-H Connections]", " ");
+  usage = join_with_seperator(usage, "[-f Files] [-t Seconds]", " ");
+  char *log_help = get_logging_help(&usage);
+  printf("%s %s\n\n", argv0, usage);
+
+  printf("Measures the throughput of the fileserver under a skewed load:\n");
+  printf("The heavy connections pipeline batches of %d LISTs, the others\n", PIPELINE_DEPTH);
+  printf("send one READ at a time. A running server at the given address is needed\n\n\n");
+
+  printf("%s\n", ip_help);
+  printf("%s\n", port_help);
+  printf("%s\n", unix_help);
+  printf("[-c Connections] Optional: Number of connections.\n");
+  printf("                  Default: 8\n\n");
+  printf("[-H Connections] Optional: Number of heavy connections.\n");
+  printf("                  Default: 1\n\n");
+  printf("[-f Files] Optional: Number of files - the cost of a LIST.\n");
+  printf("            Default: 1000\n\n");
+  printf("[-t Seconds] Optional: Duration of the measurement.\n");
+  printf("              Default: 5\n\n");
+  printf("%s\n\n", log_help);
+
+  printf("(c) Max Schrimpf - ZHAW 2014\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  if (is_help_requested(argc, argv)) {
+    usage(argv[0], "Help:");
+  }
+
+  server_ip = get_ip_with_default(argc, argv);
+  server_port = get_port_with_default(argc, argv);
+  unix_path = get_unix_path(argc, argv);
+  get_logging_properties(argc, argv);
+
+  int num_connections = get_number_with_default(argc, argv, "-c", 8);
+  int num_heavy = get_number_with_default(argc, argv, "-H", 1);
+  num_files = get_number_with_default(argc, argv, "-f", 1000);
+  int seconds = get_number_with_default(argc, argv, "-t", 5);
+  if (num_connections < 1 || num_heavy > num_connections || num_files < 1 || seconds < 1) {
+    usage(argv[0], "Invalid arguments");
+  }
+
+  prepare_files(OP_CREATE);
+
+  Connection *connections = calloc(num_connections, sizeof(Connection));
+  double start = now();
+  int i;
+  for (i = 0; i < num_connections; i++) {
+    connections[i].heavy = i < num_heavy;
+    int retcode = pthread_create(&connections[i].thread, NULL, run_connection, &connections[i]);
+    handle_thread_error(retcode, "Create connection thread", PROCESS_EXIT);
+  }
+
+  sleep(seconds);
+  running = FALSE;
+
+  long heavy_requests = 0;
+  long light_requests = 0;
+  for (i = 0; i < num_connections; i++) {
+    int retcode = pthread_join(connections[i].thread, NULL);
+    handle_thread_error(retcode, "Join connection thread", PROCESS_EXIT);
+    if (connections[i].heavy) {
+      heavy_requests += connections[i].requests;
+    } else {
+      light_requests += connections[i].requests;
+    }
+  }
+  double elapsed = now() - start;
+
+  prepare_files(OP_DELETE);
+
+  printf("%d connections (%d heavy), %d files, %.1f s\n", num_connections, num_heavy,
+         num_files, elapsed);
+  printf("LIST: %10.0f requests/s\n", heavy_requests / elapsed);
+  printf("READ: %10.0f requests/s\n", light_requests / elapsed);
+  printf("All:  %10.0f requests/s\n", (heavy_requests + light_requests) / elapsed);
+  free(connections);
+  return 0;
+}
@@ -34,6 +34,7 @@ void usage(const char *argv0, const char *msg) {
   char *usage = "[-c Line1] [-C Line2]";
   char *ip_help = get_ip_help(&usage);
   char *port_help = get_port_help(&usage);
+  char *unix_help = get_unix_path_help(&usage);
   char *log_help = get_logging_help(&usage);
   printf("Usage:\n");
   printf("%s %s\n\n", argv0, usage);
@@ -54,6 +55,7 @@ void usage(const char *argv0, const char *msg) {
   printf("                     if a first line is provided\n\n");
   printf("%s\n", ip_help);
   printf("%s\n", port_help);
+  printf("%s\n", unix_help);
   printf("%s\n\n", log_help);
 
   printf("(c) Max Schrimpf - ZHAW 2014\n");
@@ -69,6 +71,7 @@ int main(int argc, char *argv[]) {
 
   char *server_ip = get_ip_with_default(argc, argv);
   unsigned short server_port = get_port_with_default(argc, argv);
+  char *unix_path = get_unix_path(argc, argv);
   get_logging_properties(argc, argv);
 
   int sock;                        
@@ -143,7 +146,11 @@ int main(int argc, char *argv[]) {
       send = line;
     }
 
-    sock = create_client_socket(server_port, server_ip);
+    if (unix_path != NULL) {
+      sock = create_unix_client_socket(unix_path);
+    } else {
+      sock = create_client_socket(server_port, server_ip);
+    }
 
     log_debug("Sendling: '%s'\n", send);
     write_to_socket(sock, send);
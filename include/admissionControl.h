@@ -0,0 +1,79 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of the admission control that limits the number of
+ * concurrently served and waiting connections
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _ADMISSION_CONTROL_HEADER
+#define _ADMISSION_CONTROL_HEADER
+
+#include <pthread.h>
+
+enum admission { ADMITTED, QUEUED, REJECTED };
+
+// Connections beyond max_in_flight wait in a ring buffer until a serving
+// thread finishes - beyond max_queued they are rejected
+typedef struct AdmissionControl {
+  pthread_mutex_t mutex;
+  int max_in_flight;
+  int max_queued;
+  int in_flight;
+  void **queue;
+  int queue_head;
+  int queued;
+  long rejected;
+} AdmissionControl;
+
+/**
+ * Prepares the admission control with the given limits
+ */
+void init_admission_control(AdmissionControl *admission, int max_in_flight, 
+                            int max_queued);
+
+/**
+ * Decides about a new connection:
+ *  ADMITTED: the caller has to serve it (and call finish_admitted afterwards)
+ *  QUEUED:   the connection is handed to the next thread that finishes
+ *  REJECTED: the server is overloaded, the caller has to refuse it
+ */
+enum admission admit_connection(AdmissionControl *admission, void *connection);
+
+/**
+ * Called after an admitted connection was served
+ * returns the next queued connection that has to be served by the caller
+ * or NULL if the slot is free again
+ */
+void *finish_admitted(AdmissionControl *admission);
+
+/**
+ * Number of connections that are served right now
+ */
+int get_in_flight(AdmissionControl *admission);
+
+/**
+ * Number of connections that wait to be served
+ */
+int get_queued(AdmissionControl *admission);
+
+/**
+ * Number of connections that were rejected since the start
+ */
+long get_rejected(AdmissionControl *admission);
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of a bump allocator for short lived allocations
+ * that are released all at once after a request is answered
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _ARENA_HEADER
+#define _ARENA_HEADER
+
+#include <stdlib.h>
+
+#include <termPaperLib.h>
+
+// default size of an arena chunk - big enough for every request except
+// LIST on a large store
+#define ARENA_CHUNK_SIZE (4 * MAX_MSG_LEN)
+
+// alignment of all allocations
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaChunk {
+  size_t size;
+  size_t used;
+  struct ArenaChunk *next;
+  char memory[];
+} ArenaChunk;
+
+// called when the allocations of an arena become invalid - releases things
+// the arena does not own itself
+typedef struct ArenaCleanup {
+  void (*cleanup)(void *input);
+  void *input;
+  struct ArenaCleanup *next;
+} ArenaCleanup;
+
+// Chunks are never given back while the arena lives - a reset only rewinds
+// them, so a recycled arena does not allocate anymore
+typedef struct Arena {
+  ArenaChunk *first;
+  ArenaChunk *current;
+  ArenaCleanup *cleanups;
+  struct Arena *nextFree;
+} Arena;
+
+/**
+ * Returns a new arena with one chunk of the given size
+ */
+Arena *new_arena(size_t chunk_size);
+
+/**
+ * Frees an arena with all its chunks
+ */
+void free_arena(Arena *arena);
+
+/**
+ * Returns size bytes from the arena
+ * If arena is NULL the memory is allocated on the heap and has to be freed by
+ * the caller
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/**
+ * Grows the allocation at ptr from old_size to new_size bytes - in place if
+ * ptr was the last allocation, otherwise by copying it
+ * If arena is NULL this is a realloc
+ */
+void *arena_extend(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+
+/**
+ * Calls cleanup(input) with the next reset of the arena - arena must not be
+ * NULL
+ */
+void arena_on_reset(Arena *arena, void (*cleanup)(void *input), void *input);
+
+/**
+ * Runs the cleanups and invalidates all allocations of the arena
+ */
+void reset_arena(Arena *arena);
+
+/**
+ * Returns an unused arena from the pool of recycled arenas
+ */
+Arena *acquire_arena();
+
+/**
+ * Resets an arena and puts it back in the pool
+ */
+void release_arena(Arena *arena);
+
+#endif
@@ -0,0 +1,72 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of the asynchronous logger - threads append their
+ * lines to rings of their own, a flusher thread writes them
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _ASYNC_LOG_HEADER
+#define _ASYNC_LOG_HEADER
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// bytes of the ring of a thread - a power of 2
+#define LOG_RING_SIZE (64 * 1024)
+
+// max. time a line waits in its ring (ms)
+#define LOG_FLUSH_INTERVAL_MS 10
+
+// bytes collected per output before they are written
+#define LOG_BATCH_SIZE (256 * 1024)
+
+// Lines of one thread on their way to the flusher - only the thread appends
+// and only the flusher takes lines out, so neither locks
+typedef struct LogRing {
+  char data[LOG_RING_SIZE];
+  // appended and taken bytes - they only grow
+  uint64_t head;
+  uint64_t tail;
+  // lines that did not fit and were dropped
+  unsigned long dropped;
+  // set when the thread ended - the ring is reused once it is empty
+  int orphaned;
+  struct LogRing *next;
+} LogRing;
+
+/**
+ * Starts the flusher - from now on log lines are appended to the ring of
+ * the calling thread instead of being written by it. Pending lines are 
+ * written at exit
+ */
+void start_async_logging();
+
+/**
+ * Appends a line (with its \n) or a binary record for the file descriptor 
+ * to the ring of the calling thread. Returns FALSE if async logging is not 
+ * started, the caller writes the data itself then. If the ring is full the
+ * data is dropped
+ */
+int append_async_log(int fd, const char *line, size_t len);
+
+/**
+ * Writes all pending lines
+ */
+void flush_async_logs();
+
+#endif
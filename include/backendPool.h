@@ -0,0 +1,73 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of the pooled connections of the router to its
+ * backends
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _BACKEND_POOL_HEADER
+#define _BACKEND_POOL_HEADER
+
+#include <pthread.h>
+
+#include <binaryProtocol.h>
+
+// max. number of idle connections kept open to a backend
+#define MAX_IDLE_CONNECTIONS 32
+
+// a backend that doesn't answer for this long is given up (s)
+#define BACKEND_TIMEOUT 10
+
+// A server behind the router - requests are sent over binary connections 
+// that stay open and are reused by the next request
+typedef struct Backend {
+  char *name;
+  char *ip;
+  unsigned short port;
+  pthread_mutex_t mutex;
+  int idle[MAX_IDLE_CONNECTIONS];
+  int num_idle;
+  // connections opened and requests that reused an open one
+  unsigned long opened;
+  unsigned long reused;
+} Backend;
+
+/**
+ * Prepares a backend for Host:Port - returns FALSE if the name is invalid
+ */
+int init_backend(Backend *backend, const char *name);
+
+/**
+ * Sends a request frame to the backend and receives its response - the 
+ * value of the response is \000 terminated and has to be freed by the 
+ * caller. Returns FALSE if the backend could not be reached - only READs
+ * and LISTs are repeated, a change may have been applied before the
+ * connection broke
+ */
+int forward_to_backend(Backend *backend, const BinaryHeader *request, const char *key,
+                       const char *value, BinaryHeader *reply, char **reply_value);
+
+/**
+ * Sends a request without key and value (LIST) to all backends at once and
+ * receives their responses - the values have to be freed by the caller.
+ * Returns FALSE if a backend could not be reached, no value is left then
+ */
+int forward_to_all_backends(Backend *backends, int num_backends, const BinaryHeader *request,
+                            BinaryHeader *replies, char **reply_values);
+
+#endif
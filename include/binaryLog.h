@@ -0,0 +1,133 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of the binary log format - a line is stored as the
+ * id of its format and its raw arguments and formatted offline
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _BINARY_LOG_HEADER
+#define _BINARY_LOG_HEADER
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// start of a binary log file
+#define BINARY_LOG_MAGIC "TPBLOG01"
+#define BINARY_LOG_MAGIC_LEN 8
+
+// max. number of arguments of a format - more are logged preformatted
+#define MAX_LOG_ARGS 16
+
+enum log_record_type {
+  // a format was used for the first time: id, level, format string
+  LOG_DEFINITION = 1,
+  // a line: id, timestamp, arguments
+  LOG_ENTRY
+};
+
+// how an argument is fetched from the va_list
+enum log_arg_type {
+  LOG_ARG_NONE,
+  LOG_ARG_INT,
+  LOG_ARG_LONG,
+  LOG_ARG_LONG_LONG,
+  LOG_ARG_SIZE,
+  LOG_ARG_DOUBLE,
+  LOG_ARG_POINTER,
+  LOG_ARG_STRING
+};
+
+// A call site of a log function - its format gets an id with the first line
+// it logs. Lives in a static variable of the call site
+typedef struct LogFormat {
+  uint32_t id;
+  // the arguments can't be encoded - the line is formatted right away
+  uint8_t preformatted;
+  uint8_t num_args;
+  uint8_t arg_types[MAX_LOG_ARGS];
+} LogFormat;
+
+// type and length of a record - all numbers in host byte order, the log is
+// decoded on the machine that wrote it
+typedef struct LogRecordHeader {
+  uint32_t type;
+  uint32_t len;
+} LogRecordHeader;
+
+typedef struct LogDefinition {
+  uint32_t id;
+  uint32_t level;
+  // followed by the format without \000
+} LogDefinition;
+
+typedef struct LogEntry {
+  uint32_t id;
+  uint32_t reserved;
+  // CLOCK_REALTIME in ns
+  uint64_t timestamp;
+  // followed by the arguments: numbers as 8 bytes, strings as their 
+  // length (4 bytes) and their characters
+} LogEntry;
+
+// A conversion of a format - %% is one with LOG_ARG_NONE
+typedef struct LogConversion {
+  const char *start;
+  size_t len;
+  // width or precision are arguments (*)
+  int width_arg;
+  int precision_arg;
+  // precision of a string - -1 if there is none
+  int precision;
+  int type;
+} LogConversion;
+
+/**
+ * Finds the next conversion in format - returns FALSE if there is none.
+ * conversion->type is -1 for conversions that are not supported
+ */
+int next_log_conversion(const char *format, LogConversion *conversion);
+
+/**
+ * Prepares the format of a call site and returns TRUE if the calling thread
+ * assigned its id - it has to log the definition then
+ */
+int register_log_format(LogFormat *format, const char *msg);
+
+/**
+ * Encodes the definition of a registered format into buffer - returns its 
+ * length
+ */
+size_t encode_log_definition(const LogFormat *format, int level, const char *msg, 
+                             char *buffer, size_t size);
+
+/**
+ * Encodes a line into buffer - returns its length. Strings are cut so the
+ * record fits
+ */
+size_t encode_log_entry(const LogFormat *format, const char *msg, va_list argptr,
+                        char *buffer, size_t size);
+
+/**
+ * Formats the arguments of an entry with their format like printf - returns
+ * the length of the text or -1 if the arguments don't match the format
+ */
+int decode_log_entry(const char *msg, const char *args, size_t args_len, 
+                     char *text, size_t size);
+
+#endif
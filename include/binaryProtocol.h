@@ -0,0 +1,146 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of the length prefixed binary protocol that is 
+ * served alongside the text protocol
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _BINARY_PROTOCOL_HEADER
+#define _BINARY_PROTOCOL_HEADER
+
+#include <stdint.h>
+
+#include <store.h>
+#include <response.h>
+#include <lanes.h>
+
+// first byte of every frame - no text command starts with it
+#define BINARY_MAGIC 0xB1
+#define BINARY_VERSION 1
+
+// magic, version, opcode, status, key len, reserved, value len, request id 
+#define BINARY_HEADER_LEN 16
+
+// longest frame: header + filename + content
+#define MAX_BINARY_FRAME_LEN (BINARY_HEADER_LEN + MAX_BUFLEN + MAX_BUFLEN)
+
+// a LIST response holds all filenames of a server - longer ones are refused
+#define MAX_BINARY_LIST_LEN (64 * 1024 * 1024)
+
+// requests - the response echoes the opcode
+enum binary_opcode {
+  OP_LIST = 1,
+  OP_CREATE,
+  OP_READ,
+  OP_UPDATE,
+  OP_DELETE
+};
+
+// outcome of a request - only set in responses
+enum binary_status {
+  STATUS_OK = 0,
+  STATUS_FILEEXISTS,
+  STATUS_NOSUCHFILE,
+  STATUS_BAD_REQUEST,
+  STATUS_TOO_LONG,
+  // changes are only taken by the primary
+  STATUS_READONLY,
+  // the router could not reach the server of the file
+  STATUS_UNAVAILABLE
+};
+
+// A frame is the header followed by key_len bytes of the filename and 
+// value_len bytes of the content - all numbers in network byte order
+typedef struct BinaryHeader {
+  uint8_t version;
+  uint8_t opcode;
+  uint8_t status;
+  uint16_t key_len;
+  uint32_t value_len;
+  uint32_t request_id;
+} BinaryHeader;
+
+/**
+ * TRUE if the received data is a binary frame
+ */
+int is_binary_message(const char *msg);
+
+/**
+ * Reads the header at the start of a frame
+ */
+void decode_binary_header(const char *buffer, BinaryHeader *header);
+
+/**
+ * Writes BINARY_HEADER_LEN bytes of the header to buffer
+ */
+void encode_binary_header(const BinaryHeader *header, char *buffer);
+
+/**
+ * Checks the header of a request - returns STATUS_OK or the status to answer
+ */
+int validate_binary_header(const BinaryHeader *header);
+
+/**
+ * Length of the frame including its header
+ */
+size_t get_binary_frame_len(const BinaryHeader *header);
+
+/**
+ * Returns the text command (CMD_) of the request of a frame - CMD_INVALID
+ * for unknown opcodes
+ */
+int get_binary_command(const BinaryHeader *request);
+
+/**
+ * Returns the lane the request of a frame belongs to
+ */
+int classify_binary_message(const BinaryHeader *request);
+
+/**
+ * Handle the request of a frame on the given store
+ * the answer is collected in the given response
+ */
+void handle_binary_message(const BinaryHeader *request, const char *key, 
+                           const char *value, Store *store, Response *response);
+
+/**
+ * Answers a request with a status and a value - the value is referenced
+ */
+void respond_binary(const BinaryHeader *request, int status, const char *value, 
+                    size_t value_len, Response *response);
+
+/**
+ * Answers a request with a status and without value
+ */
+void reject_binary_message(const BinaryHeader *request, int status, 
+                           Response *response);
+
+/**
+ * Sends a request frame - returns FALSE if the server could not be reached
+ */
+int write_binary_request(int socket, int opcode, uint32_t request_id, 
+                         const char *key, const char *value, size_t value_len);
+
+/**
+ * Receives a response frame - the value is \000 terminated and has to be
+ * freed by the caller. Returns FALSE if no frame could be read or its value
+ * is longer than a file (MAX_BINARY_LIST_LEN for LIST)
+ */
+int read_binary_response(int socket, BinaryHeader *header, char **value);
+
+#endif
@@ -0,0 +1,64 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of a pool of fixed size, cache aligned buffers
+ * that are recycled instead of freed
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _BUFFER_POOL_HEADER
+#define _BUFFER_POOL_HEADER
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <termPaperLib.h>
+
+#define CACHE_LINE_SIZE 64
+
+// rounds a size up to a multiple of the cache line size
+#define CACHE_ALIGN(size) (((size) + CACHE_LINE_SIZE - 1) & ~((size_t) CACHE_LINE_SIZE - 1))
+
+// size of a buffer for a received message
+// + \000
+#define RECEIVE_BUFFER_SIZE CACHE_ALIGN(MAX_MSG_LEN + 1)
+
+typedef struct BufferPool {
+  pthread_mutex_t mutex;
+  size_t buffer_size;
+  // unused buffers are linked through their first bytes
+  void *free_buffers;
+  size_t num_free;
+  size_t num_allocated;
+} BufferPool;
+
+/**
+ * Prepares an empty pool for buffers of the given size
+ */
+void init_buffer_pool(BufferPool *pool, size_t buffer_size);
+
+/**
+ * Returns a cache aligned buffer - a recycled one if available
+ */
+void *acquire_buffer(BufferPool *pool);
+
+/**
+ * Gives a buffer back to the pool
+ */
+void release_buffer(BufferPool *pool, void *buffer);
+
+#endif
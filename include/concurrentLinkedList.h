@@ -23,8 +23,29 @@
 #define _CONCURRENT_LINKED_LIST
 
 #include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+#include <arena.h>
+#include <nodeHeap.h>
+
+// A response built from the payload of an element - shared by the element
+// and the readers that send it, freed with the last reference
+typedef struct CachedResponse {
+  long references;
+  NodeHeap *heap;
+  size_t len;
+  // the payload within data
+  size_t payload_offset;
+  size_t payload_len;
+  char data[];
+} CachedResponse;
+
+// Renders the response of an element into response->data and sets the
+// payload fields - if response is NULL it only returns the needed length
+typedef size_t (*ResponseBuilder)(const char *ID, const void *payload, 
+                                  size_t payload_size, CachedResponse *response);
+
 // Linked List of threads
 typedef struct ConcurrentListElement {
   size_t payload_size;
@@ -32,19 +53,49 @@ typedef struct ConcurrentListElement {
   pthread_mutex_t usageMutex;
   pthread_mutex_t content_mutex;
   char *ID;
+  // order of creation over all lists
+  unsigned long sequence;
+  // built by the first reader, dropped by a change of the payload
+  CachedResponse *cached_response;
+  // ID and payload are not owned by the list (e.g. in a mapped snapshot) - 
+  // the payload only until it is changed
+  int borrowed_ID;
+  int borrowed_payload;
+  // when the holders of the mutexes got them - only set with lock profiling
+  uint64_t used_at;
+  uint64_t content_used_at;
   struct ConcurrentListElement *nextEntry;
 } ConcurrentListElement;
 
 typedef struct ConcurrentLinkedList {
   pthread_mutex_t firstElementMutex;
+  // when the holder of firstElementMutex got it - only with lock profiling
+  uint64_t first_used_at;
   ConcurrentListElement *firstElement;
+  // memory of the elements - NULL for malloc
+  NodeHeap *heap;
 } ConcurrentLinkedList;
 
+// ID of an element and its position in the order of creation
+typedef struct ElementEntry {
+  unsigned long sequence;
+  char *ID;
+} ElementEntry;
+
+// Called for every element by visitAllElements - the content is locked
+typedef void (*ElementVisitor)(void *input, const char *ID, const void *payload,
+                               size_t payload_size, unsigned long sequence);
+
 /**
  * Returns a new List
  */
 ConcurrentLinkedList *newList() ;
 
+/**
+ * Returns a new List that keeps its elements on the given heap
+ */
+ConcurrentLinkedList *newListOnHeap(NodeHeap *heap) ;
+
 /*
  * Removes all elements that are currently in the list
  */
@@ -78,6 +129,34 @@ size_t getFirstListElement(ConcurrentLinkedList *list, void **payload);
  */
 size_t getElementByID(ConcurrentLinkedList *list, void **payload, char *ID);
 
+/**
+ * TRUE if an element with the given ID exists
+ */
+int containsListElement(ConcurrentLinkedList *list, char *ID);
+
+/**
+ * Same as getElementByID but the copy is allocated in the given arena
+ */
+size_t copyElementByID(ConcurrentLinkedList *list, void **payload, char *ID, Arena *arena);
+
+/**
+ * Returns a reference to the response of the element with the given ID - it
+ * is built on the first call, the following ones share it. NULL if there is
+ * no such element. The reference has to be released by the caller
+ */
+CachedResponse *useCachedResponse(ConcurrentLinkedList *list, char *ID, 
+                                  ResponseBuilder build);
+
+/**
+ * Adds count references to a response
+ */
+void referenceCachedResponse(CachedResponse *response, long count);
+
+/**
+ * Gives a reference back - the last one frees the response
+ */
+void releaseCachedResponse(CachedResponse *response);
+
 /**
  * Removes the first element of the List - if existing
  */
@@ -90,9 +169,38 @@ size_t removeListElementByID(ConcurrentLinkedList *list, char *ID);
 
 /**
  * Returnes a \n seperated list of element IDs
+ * The list has to be freed by the caller
  */
 size_t getAllElementIDs(ConcurrentLinkedList *list, char **IDs);
 
+/**
+ * Same as getAllElementIDs but the list is allocated in the given arena
+ */
+size_t copyAllElementIDs(ConcurrentLinkedList *list, char **IDs, Arena *arena);
+
+/**
+ * Returns the IDs of all elements with their sequence numbers 
+ * The entries (and IDs) are allocated in the given arena
+ */
+size_t copyAllElementEntries(ConcurrentLinkedList *list, ElementEntry **entries, 
+                             Arena *arena);
+
+/**
+ * Calls visit for every element in list order - only the visited element is
+ * locked, writers of the others are not stopped. Returns the number of 
+ * visited elements
+ */
+size_t visitAllElements(ConcurrentLinkedList *list, ElementVisitor visit, void *input);
+
+/**
+ * Adds an element that borrows its ID and payload behind last (NULL for an
+ * empty list) and returns it - no locking, only for lists that are not
+ * shared yet. The sequence numbers of new elements continue after it
+ */
+ConcurrentListElement *appendBorrowedElement(ConcurrentLinkedList *list, 
+    ConcurrentListElement *last, char *ID, void *payload, size_t payload_size, 
+    unsigned long sequence);
+
 /** 
  * Changes the payload of the first element found with the given ID
  */
@@ -0,0 +1,122 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of stackful coroutines that are scheduled on a few
+ * worker threads and wait for sockets via epoll instead of blocking
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _COROUTINE_HEADER
+#define _COROUTINE_HEADER
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// usable stack of a coroutine - mapped lazily, without a guard page. A 
+// canary at the bottom is checked whenever the coroutine hands back
+#define COROUTINE_STACK_SIZE (64 * 1024)
+
+// finished coroutines kept per worker for reuse
+#define MAX_POOLED_COROUTINES 256
+
+// Lets a thread or a coroutine wait until another thread is done with 
+// something - a waiting coroutine does not block its worker
+typedef struct Completion {
+  pthread_mutex_t mutex;
+  pthread_cond_t done_cond;
+  int done;
+  // the waiting coroutine - NULL if a thread waits
+  void *waiter;
+} Completion;
+
+// A piece of work a coroutine hands over - executed by its own worker or 
+// stolen by an idle one
+typedef struct WorkItem {
+  void (*task)(void *input);
+  void *input;
+  Completion done;
+} WorkItem;
+
+/**
+ * Starts the worker threads - each runs its coroutines and waits for their
+ * sockets with its own epoll instance. If pin_threads is set the n-th worker
+ * is pinned to the n+1-th CPU. If work_stealing is set idle workers execute
+ * the work items of busy ones
+ */
+void start_coroutine_scheduler(int num_workers, int pin_threads, int work_stealing);
+
+/**
+ * Runs routine(input) as a coroutine - the workers are used round robin
+ * returns 0 or an error number
+ */
+int spawn_coroutine(void (*routine)(void *input), void *input);
+
+/**
+ * TRUE if the caller runs in a coroutine
+ */
+int in_coroutine();
+
+/**
+ * Lets the other coroutines of the worker run
+ */
+void yield_coroutine();
+
+/**
+ * Ends the calling coroutine
+ */
+void exit_coroutine() __attribute__((noreturn));
+
+/**
+ * Number of coroutines that are currently running or waiting
+ */
+long get_live_coroutines();
+
+/**
+ * Prepares a completion that is not done
+ */
+void init_completion(Completion *completion);
+
+/**
+ * Waits until the completion is done
+ */
+void wait_for_completion(Completion *completion);
+
+/**
+ * Marks the completion as done and wakes the waiter - the completion must
+ * not be used afterwards, the waiter may already have released it
+ */
+void signal_completion(Completion *completion);
+
+/**
+ * Queues task(input) on the deque of the calling worker - it runs once the
+ * coroutines of the worker are parked or on an idle worker. The caller waits
+ * for item->done. Outside of a coroutine or if the deque is full the task 
+ * runs right away
+ */
+void submit_work(WorkItem *item, void (*task)(void *input), void *input);
+
+/**
+ * Same as recv, send and writev - on a non blocking socket a coroutine waits 
+ * for the socket instead of blocking its worker
+ */
+ssize_t co_recv(int socket, void *buffer, size_t len, int flags);
+ssize_t co_send(int socket, const void *buffer, size_t len, int flags);
+ssize_t co_writev(int socket, const struct iovec *parts, int num_parts);
+
+#endif
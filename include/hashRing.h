@@ -0,0 +1,59 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of a consistent hash ring that maps filenames to the
+ * backends of the router
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _HASH_RING_HEADER
+#define _HASH_RING_HEADER
+
+#include <stdint.h>
+
+// default number of points of a backend on the ring
+#define DEFAULT_VIRTUAL_NODES 64
+
+typedef struct RingPoint {
+  uint64_t hash;
+  int backend;
+} RingPoint;
+
+// Every backend owns the IDs between its points and the points before - 
+// adding or removing a backend only moves the IDs of its own points
+typedef struct HashRing {
+  RingPoint *points;
+  int num_points;
+} HashRing;
+
+/**
+ * Returns a ring with virtual_nodes points for each of the named backends -
+ * the points only depend on the names, not on their order
+ */
+HashRing *new_hash_ring(char **names, int num_backends, int virtual_nodes);
+
+/**
+ * Returns the position of a name on the ring - also used to spread filenames
+ */
+uint64_t hash_ring_key(const char *key);
+
+/**
+ * Returns the index of the backend that owns the ID
+ */
+int get_ring_backend(HashRing *ring, const char *ID);
+
+#endif
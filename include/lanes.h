@@ -0,0 +1,76 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of the priority lanes - separate queues and worker
+ * groups for cheap and expensive requests
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _LANES_HEADER
+#define _LANES_HEADER
+
+#include <pthread.h>
+
+#include <coroutine.h>
+
+// classes of requests
+enum lane {
+  // READ of a single file
+  LANE_POINT = 0,
+  // LIST over all files
+  LANE_SCAN,
+  // CREATE, UPDATE and DELETE
+  LANE_WRITE,
+  NUM_LANES
+};
+
+// a request that waits for a worker of its lane - lives on the stack of the
+// connection until it is done
+typedef struct LaneJob {
+  void (*task)(void *input);
+  void *input;
+  Completion done;
+  struct LaneJob *next;
+} LaneJob;
+
+typedef struct Lane {
+  const char *name;
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+  LaneJob *head;
+  LaneJob *tail;
+  int num_workers;
+} Lane;
+
+typedef struct Lanes {
+  // FALSE - requests are executed by the connection itself
+  int enabled;
+  Lane lanes[NUM_LANES];
+} Lanes;
+
+/**
+ * Parses the number of workers per lane - "points,scans,writes" like 4,1,2
+ * NULL disables the lanes. Starts the workers
+ */
+void start_lanes(Lanes *lanes, const char *weights);
+
+/**
+ * Executes task(input) on a worker of the lane and waits until it is done
+ */
+void run_in_lane(Lanes *lanes, int lane, void (*task)(void *input), void *input);
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of the lock profiling of the store - how long the
+ * threads wait for the locks of the lists and hold them, and which files
+ * are contended most
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _LOCK_PROFILE_HEADER
+#define _LOCK_PROFILE_HEADER
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// slots of the table of contended files - a power of 2
+#define HOT_KEY_SLOTS 4096
+
+// slots a file may take after the one of its hash - if they are taken by
+// other files its contention is not counted
+#define HOT_KEY_PROBES 8
+
+// characters of a filename kept in the report
+#define HOT_KEY_LEN 63
+
+enum lock_class {
+  // the first element of a list - taken by every lookup
+  LOCK_FIRST_ELEMENT,
+  // an element while it is passed hand over hand
+  LOCK_ELEMENT,
+  // the payload of an element
+  LOCK_ELEMENT_CONTENT,
+  NUM_LOCK_CLASSES
+};
+
+// The contention of one file
+typedef struct HotKey {
+  // hash of the full filename - 0 while the slot is free
+  uint64_t hash;
+  // acquisitions that had to wait and the time they waited (ns)
+  unsigned long contended;
+  unsigned long wait;
+  char key[HOT_KEY_LEN + 1];
+} HotKey;
+
+// number of hot keys in the report - 0 if the locks are not profiled
+extern int lock_profiling;
+
+/**
+ * Profiles the locks of all lists from now on - has to be called before
+ * the lists are used by other threads. STATS reports the num_hot_keys most
+ * contended files
+ */
+void start_lock_profiling(int num_hot_keys);
+
+/**
+ * Locks the mutex of a lock class and records the time it waited for it -
+ * key is the filename of the element or NULL. Returns 0 or an error number
+ * and the time it got the lock
+ */
+int lock_profiled_mutex(pthread_mutex_t *mutex, int lock_class, const char *key,
+                        uint64_t *locked_at);
+
+/**
+ * Records how long a lock was held - called right before the unlock
+ */
+void record_lock_hold(int lock_class, uint64_t locked_at);
+
+/**
+ * Copies the lock_profiling most contended files to keys (by the time waited)
+ * - returns their number
+ */
+int get_hot_keys(HotKey *keys);
+
+/**
+ * Returns the lower case name of a lock class
+ */
+const char *get_lock_class_name(int lock_class);
+
+#endif
@@ -22,11 +22,90 @@
 #ifndef _MESSAGE_PROCESSING_HEADER
 #define _MESSAGE_PROCESSING_HEADER
 
-#include <concurrentLinkedList.h>
+#include <store.h>
+#include <response.h>
+#include <lanes.h>
+
+// Response if the server is overloaded and refuses to serve a connection
+#define BUSY "BUSY\n"
+
+// Responses
+// Errors
+#define FILEEXISTS "FILEEXISTS\n"
+#define NOSUCHFILE "NOSUCHFILE\n"
+#define READONLY "READONLY\n"
+
+// Not used in the protocol
+#define COMMAND_UNKNOWN "COMMAND_UNKNOWN\n"
+#define FILENAME_TO_LONG "FILENAME_TO_LONG\n"
+#define CONTENT_TO_LONG "CONTENT_TO_LONG\n"
+
+// positive responses
+#define ACK "ACK"
+#define FILECREATED "FILECREATED\n"
+#define FILECONTENT "FILECONTENT"
+#define DELETED "DELETED\n"
+#define UPDATED "UPDATED\n"
+
+enum command {
+  CMD_LIST,
+  CMD_READ,
+  CMD_CREATE,
+  CMD_UPDATE,
+  CMD_DELETE,
+  CMD_STATS,
+  // a request that could not be parsed - only counted
+  CMD_INVALID,
+  NUM_COMMANDS
+};
+
+typedef struct file {
+  char length[SIZE_MAX_BUFLEN+1];
+  char filename[MAX_BUFLEN+1];
+  char content[MAX_BUFLEN+1];
+} File;
+
+// a parsed request that is ready to be executed
+typedef struct request {
+  int command;
+  File file;
+} Request;
+
+/**
+ * Returns the size of the content of a CREATE or UPDATE without \000 - 0 if
+ * it is invalid. The content is cut to the size
+ */
+size_t validate_size(char *len, char *content) ;
+
+/**
+ * Parses the given message into the request
+ * returns FALSE if the message was already answered in the response (errors)
+ */
+int parse_message(size_t msg_size, char *msg, Request *request, Response *response) ;
+
+/**
+ * Returns the lane a parsed request belongs to
+ */
+int classify_request(Request *request) ;
+
+/**
+ * Executes a parsed request on the given store
+ * the answer is collected in the given response
+ */
+void execute_request(Request *request, Store *store, Response *response) ;
+
+/**
+ * Renders the READ response of a file - the ResponseBuilder of all READs
+ * "FILECONTENT FILENAME LENGTH\nCONTENT\n"
+ */
+size_t build_read_response(const char *ID, const void *payload, size_t payload_size,
+                           CachedResponse *response) ;
 
 /**
- * Handle the given request on the given linked list
+ * Handle the given request on the given store
+ * the answer is collected in the given response
  */
-char *handle_message(size_t msg_size, char *msg, ConcurrentLinkedList *list) ;
+void handle_message(size_t msg_size, char *msg, Store *store, 
+                    Response *response) ;
 
 #endif
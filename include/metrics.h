@@ -0,0 +1,59 @@
+/*
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of the metrics endpoint - the counters of STATS
+ * served over HTTP in the text format of Prometheus
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _METRICS_HEADER
+#define _METRICS_HEADER
+
+#include <stdlib.h>
+
+#include <store.h>
+
+// max. length of an HTTP request - only the request line is looked at
+#define MAX_METRICS_REQUEST_LEN 4096
+
+// a scraper that doesn't send its request in time is dropped (s)
+#define METRICS_RECEIVE_TIMEOUT 1
+
+// histograms only show the buckets up to this latency (s) - the rest is +Inf
+#define METRICS_MAX_BUCKET_SECONDS 60
+
+// The text of a scrape - grows as lines are appended
+typedef struct MetricsText {
+  char *text;
+  size_t len;
+  size_t size;
+} MetricsText;
+
+/**
+ * Serves GET /metrics on the port from a thread of its own. The values are
+ * read without taking any lock of the request path - the number of files
+ * and their bytes are therefore only shown by STATS
+ */
+void start_metrics_listener(Store *store, unsigned short port);
+
+/**
+ * Renders the counters of the server in the text format of Prometheus -
+ * text has to be freed by the caller
+ */
+void render_metrics(Store *store, MetricsText *text);
+
+#endif
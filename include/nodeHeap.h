@@ -0,0 +1,61 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of a heap whose memory comes from one NUMA node
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _NODE_HEAP_HEADER
+#define _NODE_HEAP_HEADER
+
+#include <pthread.h>
+#include <stdlib.h>
+
+// size of the memory that is mapped at once
+#define HEAP_CHUNK_SIZE (1 << 20)
+
+// blocks of 32, 64 ... 2048 bytes - bigger blocks come from malloc
+#define HEAP_MIN_BLOCK_BITS 5
+#define HEAP_NUM_CLASSES 7
+
+// Blocks are carved from chunks that are bound to the node and go back to
+// the free list of their size class - chunks are never unmapped
+typedef struct NodeHeap {
+  pthread_mutex_t mutex;
+  int node;
+  void *free_blocks[HEAP_NUM_CLASSES];
+  char *chunk;
+  size_t chunk_used;
+} NodeHeap;
+
+/**
+ * Returns a heap that allocates from the given NUMA node
+ */
+NodeHeap *new_node_heap(int node);
+
+/**
+ * Returns size bytes from the heap
+ * If heap is NULL the memory is allocated with malloc
+ */
+void *heap_alloc(NodeHeap *heap, size_t size);
+
+/**
+ * Gives memory of heap_alloc back to the heap
+ */
+void heap_free(NodeHeap *heap, void *memory);
+
+#endif
@@ -0,0 +1,74 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of the CPU and NUMA node placement of threads and
+ * memory
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _PLACEMENT_HEADER
+#define _PLACEMENT_HEADER
+
+#include <stdlib.h>
+
+// max. number of NUMA nodes that are taken into account
+#define MAX_NODES 64
+
+/**
+ * Number of CPUs the process may run on
+ */
+int get_num_cpus();
+
+/**
+ * Number of NUMA nodes with CPUs - 1 if the system has no NUMA information
+ */
+int get_num_nodes();
+
+/**
+ * NUMA node of a CPU
+ */
+int get_node_of_cpu(int cpu);
+
+/**
+ * NUMA node the calling thread is currently running on
+ */
+int get_current_node();
+
+/**
+ * Restricts the calling thread to the n-th CPU of the process 
+ * returns 0 or an error number
+ */
+int pin_thread_to_cpu(int cpu);
+
+/**
+ * TRUE if the calling thread was pinned to a CPU by pin_thread_to_cpu
+ */
+int is_thread_pinned();
+
+/**
+ * Restricts the calling thread to the CPUs of a NUMA node
+ * returns 0 or an error number
+ */
+int pin_thread_to_node(int node);
+
+/**
+ * Lets the kernel take the (not yet touched) pages of the memory from the
+ * given NUMA node - returns 0 or an error number
+ */
+int bind_memory_to_node(void *memory, size_t len, int node);
+
+#endif
@@ -0,0 +1,120 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of the asynchronous replication of the changes of
+ * a primary to its followers
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _REPLICATION_HEADER
+#define _REPLICATION_HEADER
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <store.h>
+
+// a follower that lags more than this is dropped - it catches up again
+#define MAX_FOLLOWER_BACKLOG (64 * 1024 * 1024)
+
+// an idle primary sends a heartbeat this often (ms)
+#define REPLICATION_HEARTBEAT_MS 100
+
+// a follower that can't take data for this long is dropped (s)
+#define REPLICATION_SEND_TIMEOUT 10
+
+enum replication_record_type {
+  // WAL_CREATE, WAL_UPDATE and WAL_DELETE are used for the changes
+  REPLICATION_HEARTBEAT = 16,
+  // all files of the primary were sent - the live changes follow
+  REPLICATION_CAUGHT_UP
+};
+
+// followed by the ID and the payload (both with \000) - numbers in host 
+// byte order, primary and followers run on the same kind of machine
+typedef struct ReplicationHeader {
+  uint32_t type;
+  uint32_t ID_len;
+  uint32_t payload_size;
+  uint32_t reserved;
+  // position of the change on the primary - 0 while catching up
+  uint64_t lsn;
+  // when the primary published the change (us, CLOCK_REALTIME)
+  uint64_t timestamp;
+} ReplicationHeader;
+
+// a published change that was not sent to a follower yet
+typedef struct PendingChange {
+  size_t len;
+  struct PendingChange *next;
+  char data[];
+} PendingChange;
+
+typedef struct Follower {
+  int socket;
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+  PendingChange *head;
+  PendingChange *tail;
+  size_t backlog;
+  // set if the follower lagged too much - its sender closes the connection
+  int dropped;
+  struct Replication *replication;
+  struct Follower *next;
+} Follower;
+
+typedef struct Replication {
+  Store *store;
+  pthread_mutex_t mutex;
+  Follower *followers;
+  uint64_t next_lsn;
+  // follower side: applied position and publish time of the last change
+  uint64_t applied_lsn;
+  uint64_t applied_timestamp;
+  int caught_up;
+} Replication;
+
+/**
+ * Makes the store a primary - followers connect to the given port
+ */
+void start_replication_primary(Store *store, unsigned short port);
+
+/**
+ * Makes the store a follower of the primary at ip:port - it becomes read only
+ * for the clients, gets all files of the primary and applies its changes
+ */
+void start_replication_follower(Store *store, const char *ip, unsigned short port);
+
+/**
+ * Sends a change to all followers - changes of the same file have to be 
+ * published in the order they were applied
+ */
+void publish_change(Replication *replication, int type, const char *ID, 
+                    const void *payload, size_t payload_size);
+
+/**
+ * Follower side lag: time since the primary published the last applied 
+ * change or heartbeat (ms). -1 while catching up
+ */
+long get_replication_lag(Replication *replication);
+
+/**
+ * Position of the last published change and number of connected followers
+ */
+void get_replication_state(Replication *replication, uint64_t *lsn, int *followers);
+
+#endif
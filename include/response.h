@@ -0,0 +1,88 @@
+/*
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of a response builder that collects the pieces of a
+ * response and sends them with a single writev
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _RESPONSE_HEADER
+#define _RESPONSE_HEADER
+
+#include <stdlib.h>
+#include <sys/uio.h>
+
+#include <termPaperLib.h>
+#include <arena.h>
+
+// pieces (header, payload, trailer ...) a response holds itself - more are
+// taken from its arena
+#define MAX_RESPONSE_PARTS 8
+
+// max. lenght of a rendered header
+// Longest header: FILECONTENT FILENAME LENGTH\n
+#define MAX_HEADER_LEN (MAX_BUFLEN + SIZE_MAX_BUFLEN + MAX_OTHER)
+
+// A response is a list of references to its pieces - nothing is copied
+// until the kernel gathers them in writev
+typedef struct response {
+  struct iovec *parts;
+  int num_parts;
+  int max_parts;
+  struct iovec own_parts[MAX_RESPONSE_PARTS];
+  // set if a part could not be added - the response is never sent then
+  int incomplete;
+  size_t length;
+  // storage for the header if it has to be rendered (numbers, filenames)
+  char header[MAX_HEADER_LEN + 1];
+  // memory for copied payloads - lives until the response is sent
+  Arena *arena;
+  // set if the request was answered with an error - only counted
+  int failed;
+} Response;
+
+/**
+ * Prepares an empty response that uses the given arena for its payloads
+ */
+void init_response(Response *response, Arena *arena);
+
+/**
+ * Appends a reference to len bytes at part - the memory has to stay valid
+ * until the response is sent. Returns FALSE if a response without an arena
+ * has no room left, it is incomplete then
+ */
+int add_to_response(Response *response, const void *part, size_t len);
+
+/**
+ * Appends a reference to a \000 terminated string - see add_to_response
+ */
+int add_string_to_response(Response *response, const char *str);
+
+/**
+ * Renders the header of the response (printf like) into the response itself
+ * and appends it - can be used only once per response. See add_to_response
+ */
+int add_header_to_response(Response *response, const char *format, ...);
+
+/**
+ * Sends all parts of a response via one writev over the given socket
+ * returns FALSE if the client could not be reached or the response is 
+ * incomplete - nothing is sent then
+ */
+int write_response_to_socket(int client_socket, Response *response);
+
+#endif
@@ -0,0 +1,74 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of the snapshots of a store - written in the 
+ * background and mapped at startup
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _SNAPSHOT_HEADER
+#define _SNAPSHOT_HEADER
+
+#include <stdint.h>
+
+#include <store.h>
+
+#define SNAPSHOT_MAGIC "TPSNAP01"
+
+// entries start at multiples of it
+#define SNAPSHOT_ALIGNMENT 8
+
+// default time between two snapshots in s
+#define DEFAULT_SNAPSHOT_INTERVAL 60
+
+// The file is the header followed by the entries - numbers in host byte 
+// order, it is only read by the machine that wrote it
+typedef struct SnapshotHeader {
+  char magic[8];
+  uint32_t num_shards;
+  uint32_t reserved;
+  uint64_t num_files;
+} SnapshotHeader;
+
+// followed by the ID and the payload (both with \000) and the padding
+typedef struct SnapshotEntry {
+  uint64_t sequence;
+  uint32_t ID_len;
+  uint32_t payload_size;
+} SnapshotEntry;
+
+/**
+ * Writes all files of the store to path - the writers are not stopped, every
+ * file is written as it was when it was visited. The file is replaced 
+ * atomically. Returns the number of files or -1
+ */
+long write_snapshot(Store *store, const char *path);
+
+/**
+ * Maps the snapshot at path and adds its files to the empty store - the 
+ * files use the mapped memory until they are changed. Returns the number of
+ * files, 0 if there is no snapshot
+ */
+long load_snapshot(Store *store, const char *path);
+
+/**
+ * Starts a thread that writes a snapshot every interval seconds if the store
+ * was changed
+ */
+void start_snapshot_thread(Store *store, const char *path, long interval);
+
+#endif
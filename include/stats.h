@@ -0,0 +1,147 @@
+/*
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of the request statistics - every thread counts
+ * on its own, the counters are only summed up when they are shown
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _STATS_HEADER
+#define _STATS_HEADER
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <messageProcessing.h>
+#include <lockProfile.h>
+
+// buckets of a histogram: steps of 1 up to 4, then 4 buckets for every
+// power of 2 - the last one of the latencies (us) ends after 12 days
+#define LATENCY_SUB_BUCKETS 4
+#define LATENCY_BUCKETS 160
+
+// max. length of the lines of a STATS response
+#define MAX_STATS_LEN (16 * 1024)
+
+// Counters of one thread - only the thread writes them, so they are
+// incremented without atomic instructions. Kept when the thread ends and
+// continued by the next one
+typedef struct ThreadStats {
+  unsigned long requests[NUM_COMMANDS];
+  unsigned long errors[NUM_COMMANDS];
+  // latencies in us
+  unsigned long latency[NUM_COMMANDS][LATENCY_BUCKETS];
+  unsigned long latency_sum[NUM_COMMANDS];
+  unsigned long latency_max[NUM_COMMANDS];
+  unsigned long bytes_in;
+  unsigned long bytes_out;
+  // opened - closed connections of the thread, may be negative for one
+  long connections;
+  unsigned long connections_total;
+  // lock profiling - times in ns
+  unsigned long lock_acquisitions[NUM_LOCK_CLASSES];
+  unsigned long lock_contended[NUM_LOCK_CLASSES];
+  unsigned long lock_wait[NUM_LOCK_CLASSES][LATENCY_BUCKETS];
+  unsigned long lock_wait_sum[NUM_LOCK_CLASSES];
+  unsigned long lock_wait_max[NUM_LOCK_CLASSES];
+  unsigned long lock_hold[NUM_LOCK_CLASSES][LATENCY_BUCKETS];
+  unsigned long lock_hold_sum[NUM_LOCK_CLASSES];
+  unsigned long lock_hold_max[NUM_LOCK_CLASSES];
+  struct ThreadStats *next;
+  struct ThreadStats *nextFree;
+} ThreadStats;
+
+// The counters of all threads at one point in time
+typedef struct StatsSnapshot {
+  unsigned long requests[NUM_COMMANDS];
+  unsigned long errors[NUM_COMMANDS];
+  unsigned long latency[NUM_COMMANDS][LATENCY_BUCKETS];
+  unsigned long latency_sum[NUM_COMMANDS];
+  unsigned long latency_max[NUM_COMMANDS];
+  unsigned long bytes_in;
+  unsigned long bytes_out;
+  long connections;
+  unsigned long connections_total;
+  unsigned long lock_acquisitions[NUM_LOCK_CLASSES];
+  unsigned long lock_contended[NUM_LOCK_CLASSES];
+  unsigned long lock_wait[NUM_LOCK_CLASSES][LATENCY_BUCKETS];
+  unsigned long lock_wait_sum[NUM_LOCK_CLASSES];
+  unsigned long lock_wait_max[NUM_LOCK_CLASSES];
+  unsigned long lock_hold[NUM_LOCK_CLASSES][LATENCY_BUCKETS];
+  unsigned long lock_hold_sum[NUM_LOCK_CLASSES];
+  unsigned long lock_hold_max[NUM_LOCK_CLASSES];
+} StatsSnapshot;
+
+/**
+ * Returns the start time of a request for record_request
+ */
+uint64_t get_stats_time();
+
+/**
+ * Counts an answered request of the given command (CMD_) - failed is set if
+ * it was answered with an error
+ */
+void record_request(int command, int failed, size_t bytes_in, size_t bytes_out,
+                    uint64_t started);
+
+/**
+ * Counts an opened (TRUE) or closed connection
+ */
+void record_connection(int opened);
+
+/**
+ * Counts the acquisition of a lock of the class (LOCK_) - contended if it
+ * had to wait
+ */
+void record_lock_wait(int lock_class, int contended, uint64_t wait);
+
+/**
+ * Counts how long (ns) a lock of the class was held
+ */
+void record_lock_hold_time(int lock_class, uint64_t hold);
+
+/**
+ * Sums up the counters of all threads - the counters are read while they
+ * change, so a snapshot may miss the latest requests
+ */
+void take_stats_snapshot(StatsSnapshot *snapshot);
+
+/**
+ * Returns the value below which the given share (0 - 1) of the values of a
+ * histogram lie - the upper limit of its bucket, at most max
+ */
+unsigned long get_histogram_percentile(const unsigned long *histogram, 
+                                       unsigned long max, double share);
+
+/**
+ * Returns the latency (us) below which the given share (0 - 1) of the
+ * requests of the command was answered
+ */
+unsigned long get_latency_percentile(const StatsSnapshot *snapshot, int command,
+                                     double share);
+
+/**
+ * Returns the highest value of a histogram bucket
+ */
+unsigned long get_latency_bucket_limit(int bucket);
+
+/**
+ * Returns the lower case name of a command (CMD_)
+ */
+const char *get_command_name(int command);
+
+#endif
@@ -0,0 +1,204 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of the file store that is split into shards which
+ * are placed on the NUMA nodes
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _STORE_HEADER
+#define _STORE_HEADER
+
+#include <pthread.h>
+
+#include <arena.h>
+#include <concurrentLinkedList.h>
+#include <coroutine.h>
+#include <nodeHeap.h>
+#include <wal.h>
+
+// buckets of the reads in flight of a shard
+#define FLIGHT_BUCKETS 64
+
+// locks that order the changes of the same file
+#define CHANGE_STRIPES 256
+
+// result of a change on a follower - only the primary takes changes
+#define STORE_READONLY -1
+
+struct Replication;
+
+// A change that waits for the stripe - lives on the stack of its request
+typedef struct StripeWaiter {
+  Completion done;
+  struct StripeWaiter *next;
+} StripeWaiter;
+
+// Orders the changes of its files - a change keeps it while it waits for
+// the log, so a waiting coroutine must not block its worker
+typedef struct ChangeStripe {
+  pthread_mutex_t mutex;
+  int taken;
+  StripeWaiter *head;
+  StripeWaiter *tail;
+} ChangeStripe;
+
+// A READ that joined the lookup of another one - lives on its own stack
+typedef struct FlightWaiter {
+  Completion done;
+  // a reference for the waiter - NULL if there is no such file
+  CachedResponse *response;
+  struct FlightWaiter *next;
+} FlightWaiter;
+
+// A lookup of a file that is in progress - lives on the stack of its reader
+typedef struct Flight {
+  const char *ID;
+  FlightWaiter *waiters;
+  // FALSE once the file was changed - later READs start their own lookup
+  int linked;
+  struct Flight *next;
+} Flight;
+
+typedef struct FlightBucket {
+  pthread_mutex_t mutex;
+  Flight *first;
+} FlightBucket;
+
+// A shard owns the files whose names hash to it - its elements live in
+// memory of its node
+typedef struct Shard {
+  ConcurrentLinkedList *list;
+  NodeHeap *heap;
+  int node;
+  FlightBucket flights[FLIGHT_BUCKETS];
+} Shard;
+
+typedef struct Store {
+  int num_shards;
+  Shard *shards;
+  // move a thread to the node of the shard before it accesses the shard
+  int route_requests;
+  // READs that did the lookup and READs that shared the result of another
+  unsigned long executed_reads;
+  unsigned long coalesced_reads;
+  // number of CREATEs, UPDATEs and DELETEs so far
+  unsigned long changes;
+  // log of the changes - NULL if they are not logged
+  Wal *wal;
+  // followers of a primary or the primary of a follower - NULL if the store
+  // is not replicated
+  struct Replication *replication;
+  // set on followers - CREATE, UPDATE and DELETE are rejected
+  int read_only;
+  ChangeStripe change_stripes[CHANGE_STRIPES];
+} Store;
+
+/**
+ * Returns a store with num_shards shards that are spread over the NUMA nodes
+ */
+Store *new_store(int num_shards, int route_requests);
+
+/**
+ * Returns the index of the shard that owns the ID
+ */
+int get_shard_index(Store *store, const char *ID);
+
+/**
+ * Returns the list of the shard that owns the ID - if routing is enabled
+ * the calling thread is moved to the node of the shard
+ */
+ConcurrentLinkedList *route_to_shard(Store *store, const char *ID);
+
+/**
+ * Replays the write ahead log at path and logs all further changes to it
+ */
+void attach_store_wal(Store *store, const char *path, int durability);
+
+/**
+ * Starts a new log before a snapshot is written - the changes that are 
+ * logged later are applied after the snapshot started
+ */
+void start_store_checkpoint(Store *store);
+
+/**
+ * Deletes the log of the changes before the checkpoint once the snapshot is
+ * written
+ */
+void finish_store_checkpoint(Store *store);
+
+/**
+ * Same as appendUniqueListElement on the shard of the ID - the change is 
+ * logged and durable when the call returns and published to the followers.
+ * Returns STORE_READONLY on followers
+ */
+int create_store_file(Store *store, char *ID, void *payload, size_t payload_size);
+
+/**
+ * Same as updateListElementByID on the shard of the ID - the change is 
+ * logged and durable when the call returns and published to the followers.
+ * Returns STORE_READONLY on followers
+ */
+int update_store_file(Store *store, char *ID, void *payload, size_t payload_size);
+
+/**
+ * Same as removeListElementByID on the shard of the ID - the change is 
+ * logged and durable when the call returns and published to the followers.
+ * Returns STORE_READONLY on followers
+ */
+int delete_store_file(Store *store, char *ID);
+
+/**
+ * Applies a change of the given WAL_ type, logs it and publishes it to the
+ * followers - works on followers too. Returns the result of the list 
+ * operation
+ */
+int change_store_file(Store *store, int type, char *ID, void *payload, 
+                      size_t payload_size);
+
+/**
+ * Same as useCachedResponse on the shard of the ID - concurrent READs of the
+ * same file share one lookup, so all READs have to use the same builder.
+ * The reference is released with the next reset of the arena
+ */
+CachedResponse *use_store_response(Store *store, char *ID, ResponseBuilder build, 
+                                   Arena *arena);
+
+/**
+ * Number of changes of the store so far
+ */
+unsigned long get_store_changes(Store *store);
+
+/**
+ * Number of READs that did a lookup and READs that shared the lookup of 
+ * another one
+ */
+void get_store_read_counters(Store *store, unsigned long *executed, 
+                             unsigned long *coalesced);
+
+/**
+ * Counts the files of the store and the bytes of their payloads (with the
+ * \000 of the text protocol) - visits every file
+ */
+void get_store_usage(Store *store, size_t *files, size_t *payload_bytes);
+
+/**
+ * Same as copyAllElementIDs over all shards - in order of creation
+ */
+size_t copy_all_store_IDs(Store *store, char **IDs, Arena *arena);
+
+#endif
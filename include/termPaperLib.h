@@ -26,6 +26,8 @@
 #include <time.h>
 #include <fcntl.h>
 
+#include <binaryLog.h>
+
 #define TRUE 1
 #define FALSE 0
 
@@ -54,21 +56,61 @@
 // max. number of waiting socket connections
 #define MAX_PENDING_CONNECTIONS 100
 
-// frequency for finished request cleanup in seconds
-#define CLEANUP_FREQUENCY 10
+// default max. number of concurrently served connections
+#define DEFAULT_MAX_IN_FLIGHT 256
+
+// default max. number of accepted connections that wait to be served
+#define DEFAULT_MAX_QUEUED 1024
 
 // -------------------------------------------------------------------
 
 enum exit_type { PROCESS_EXIT, THREAD_EXIT, NO_EXIT };
-enum logging_type { NONE, WRITE_TO_FILE, WRITE_TO_STDOUT, WRITE_TO_STDERR };
+enum logging_type { NONE, WRITE_TO_FILE, WRITE_TO_STDOUT, WRITE_TO_STDERR, 
+                    BINARY_TO_FILE };
+enum logging_level { LEVEL_DEBUG, LEVEL_INFO, LEVEL_ERROR };
+
+// lowest level that is compiled in - calls below it vanish with their
+// arguments (make LOG_MIN_LEVEL=1 for a build without DEBUG)
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LEVEL_DEBUG
+#endif
+
+// outputs of the levels - set by get_logging_properties
+extern enum logging_type debug_type;
+extern enum logging_type info_type;
+extern enum logging_type error_type;
 
 /*
  * Logging functions for messages
- * on different levels
+ * on different levels - format is the call site for the binary log
  */
-void log_debug(const char *msg, ...) ;
-void log_info(const char *msg, ...) ;
-void log_error(const char *msg, ...) ;
+void write_debug_log(LogFormat *format, const char *msg, ...) ;
+void write_info_log(LogFormat *format, const char *msg, ...) ;
+void write_error_log(LogFormat *format, const char *msg, ...) ;
+
+/*
+ * The arguments are only evaluated and formatted if the level is logged
+ */
+#define log_debug(...) do { \
+    if (LOG_MIN_LEVEL <= LEVEL_DEBUG && debug_type != NONE) { \
+      static LogFormat log_format; \
+      write_debug_log(&log_format, __VA_ARGS__); \
+    } \
+  } while (0)
+
+#define log_info(...) do { \
+    if (LOG_MIN_LEVEL <= LEVEL_INFO && info_type != NONE) { \
+      static LogFormat log_format; \
+      write_info_log(&log_format, __VA_ARGS__); \
+    } \
+  } while (0)
+
+#define log_error(...) do { \
+    if (LOG_MIN_LEVEL <= LEVEL_ERROR && error_type != NONE) { \
+      static LogFormat log_format; \
+      write_error_log(&log_format, __VA_ARGS__); \
+    } \
+  } while (0)
 
 /**
  * Parses the commandline parameters for a IP
@@ -90,6 +132,29 @@ unsigned short get_port_with_default(int argc, char *argv[] );
  **/
 char *get_port_help(char **usage_text);
 
+/**
+ * Parses the commandline parameters for the path of a unix domain socket
+ * returns NULL if no path is given
+ **/
+char *get_unix_path(int argc, char *argv[]);
+
+/**
+ * returns a help text for the unix domain socket parameter
+ **/
+char *get_unix_path_help(char **usage_text);
+
+/**
+ * Parses the commandline parameters for a text option like -L 4,1,2
+ **/
+char *get_string_with_default(int argc, char *argv[], const char *option, 
+                              char *default_value);
+
+/**
+ * Parses the commandline parameters for a numeric option like -m 42
+ **/
+long get_number_with_default(int argc, char *argv[], const char *option, 
+                             long default_value);
+
 /**
  * Parses the commandline parameters for logging properties
  **/
@@ -105,6 +170,11 @@ char *get_logging_help(char **usage_text);
  */
 int is_help_requested(int argc, char *argv[]);
 
+/* 
+ * exits the process or the current thread - depending on the exit_type
+ */
+void exit_by_type(enum exit_type et);
+
 /* 
  * helper function for thread error handling
  */
@@ -126,6 +196,25 @@ int create_server_socket(int port_number) ;
  */
 int create_client_socket(int server_port, char *server_ip) ;
 
+/**
+ * Creates a unix domain socket that is bound to the given path and is 
+ * listening for incomming connections on it - a stale socket file is replaced,
+ * the process exits if any other file is in the way
+ **/
+int create_unix_server_socket(const char *path) ;
+
+/**
+ * connects to a server via the unix domain socket at the given path
+ */
+int create_unix_client_socket(const char *path) ;
+
+/* 
+ * Recive a message of up to max_len bytes via TCP/IP over a given socket 
+ * into the given buffer (which has to provide room for max_len + 1 bytes)
+ * returns 0 if nothing could be received
+ */
+size_t receive_from_socket(int client_socket, char *buffer, size_t max_len) ;
+
 /* 
  * Recive a message via TCP/IP over a given socket
  * the caller has to free the buffer for the result
@@ -141,4 +230,10 @@ void write_to_socket(int client_socket, const char *str);
  * Joins two strings with a given seperator and returns the concatinated string
  */
 char *join_with_seperator(const char *str1, const char *str2, const char *sep) ;
+
+/*
+ * Syncs the directory that holds path - a file created or renamed there 
+ * survives a crash. Returns 0 or -1 (errno is set)
+ */
+int sync_parent_directory(const char *path);
 #endif
@@ -0,0 +1,44 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header for detached threads that are counted while
+ * they are alive and reclaimed by the system as soon as they finish
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _THREAD_TRACKING_HEADER
+#define _THREAD_TRACKING_HEADER
+
+#include <pthread.h>
+
+/**
+ * Starts a detached thread that is counted as live until it returns or
+ * calls pthread_exit - returns the retcode of pthread_create
+ */
+int start_tracked_thread(void *(*routine)(void *), void *input);
+
+/**
+ * Number of tracked threads that are currently running
+ */
+long get_live_threads();
+
+/**
+ * Number of tracked threads that finished since the start of the process
+ */
+long get_finished_threads();
+
+#endif
@@ -0,0 +1,81 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of a hierarchical timer wheel with O(1) insert
+ * and cancel operations
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _TIMER_WHEEL_HEADER
+#define _TIMER_WHEEL_HEADER
+
+#include <pthread.h>
+
+// number of slots per level (has to be a power of 2)
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+// 4 levels of 64 slots cover 2^24 ticks 
+#define TIMER_LEVELS 4
+
+// default resolution of the timers in ms
+#define TIMER_TICK_MS 10
+
+typedef struct Timer {
+  struct Timer *next;
+  struct Timer *prev;
+  unsigned long expires;
+  // called by the timer thread while the wheel is locked - it must not
+  // block or use the wheel
+  void (*callback)(void *input);
+  void *input;
+} Timer;
+
+// Timers live in doubly linked lists - one per slot. Level 0 holds the timers
+// of the next 64 ticks, every further level 64 times as many. Timers of the
+// higher levels cascade down when the lower level wraps around
+typedef struct TimerWheel {
+  pthread_mutex_t mutex;
+  unsigned long current_tick;
+  long tick_ms;
+  Timer slots[TIMER_LEVELS][TIMER_SLOTS];
+  pthread_t thread;
+} TimerWheel;
+
+/**
+ * Prepares a wheel and starts the thread that advances it
+ */
+void start_timer_wheel(TimerWheel *wheel, long tick_ms);
+
+/**
+ * Prepares a timer that calls callback(input) when it expires
+ */
+void init_timer(Timer *timer, void (*callback)(void *input), void *input);
+
+/**
+ * Arms the timer to expire in timeout_ms - an already armed timer is 
+ * rearmed 
+ */
+void add_timer(TimerWheel *wheel, Timer *timer, long timeout_ms);
+
+/**
+ * Disarms the timer - after the return the callback won't be called
+ * (any more)
+ */
+void cancel_timer(TimerWheel *wheel, Timer *timer);
+
+#endif
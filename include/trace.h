@@ -0,0 +1,101 @@
+/*
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of the request tracing - the steps of sampled
+ * requests are recorded by every thread on its own and written as a trace
+ * that chrome://tracing and Perfetto can show
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _TRACE_HEADER
+#define _TRACE_HEADER
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// spans kept per thread - the oldest ones are overwritten, a power of 2
+#define TRACE_BUFFER_SPANS 1024
+
+// default: one of this many requests is traced
+#define DEFAULT_TRACE_SAMPLING 100
+
+enum trace_span_name {
+  // from the accept to the dump of the response
+  SPAN_REQUEST,
+  // waiting for a thread or coroutine after the accept
+  SPAN_ACCEPT,
+  SPAN_READ,
+  SPAN_PARSE,
+  // execution in the store including the wait for a lane
+  SPAN_EXECUTE,
+  SPAN_WRITE,
+  NUM_SPAN_NAMES
+};
+
+// A step of a traced request - times in ns of the monotonic clock
+typedef struct TraceSpan {
+  uint64_t start;
+  uint64_t duration;
+  unsigned long request;
+  int name;
+} TraceSpan;
+
+// The last spans of one thread - only the thread writes them. Kept when the
+// thread ends and continued by the next one
+typedef struct TraceBuffer {
+  TraceSpan spans[TRACE_BUFFER_SPANS];
+  // spans written so far - the latest TRACE_BUFFER_SPANS are in spans
+  unsigned long written;
+  // tid in the trace
+  int id;
+  struct TraceBuffer *next;
+  struct TraceBuffer *nextFree;
+} TraceBuffer;
+
+// one of trace_sampling requests is traced - 0 if tracing is off
+extern int trace_sampling;
+
+/**
+ * Traces one of sampling requests from now on. The trace is written to path
+ * on SIGUSR1 and every interval seconds if interval is positive - has to be
+ * called before any other thread is started
+ */
+void start_tracing(int sampling, const char *path, long interval);
+
+/**
+ * Decides if a request is traced - returns its ID or 0 if it is not
+ */
+unsigned long sample_trace();
+
+/**
+ * Returns the current time if the request is traced, 0 otherwise
+ */
+uint64_t get_trace_time(unsigned long request);
+
+/**
+ * Records a span of a traced request (ID of sample_trace, 0 to do nothing)
+ * from start until now - returns now as the start of the next span
+ */
+uint64_t record_span(unsigned long request, int name, uint64_t start);
+
+/**
+ * Writes the spans of all threads to path in the trace event format -
+ * returns their number or -1 on failure
+ */
+long write_trace(const char *path);
+
+#endif
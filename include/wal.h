@@ -0,0 +1,119 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of a write ahead log for the changes of the files
+ * with group commit
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _WAL_HEADER
+#define _WAL_HEADER
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <coroutine.h>
+
+// type, ID length, payload size, CRC32 of all of it
+#define WAL_RECORD_HEADER_LEN 16
+
+enum wal_record_type {
+  WAL_CREATE = 1,
+  WAL_UPDATE,
+  WAL_DELETE
+};
+
+enum durability {
+  // written, but not synced - survives a crash of the server, not of the OS
+  DURABILITY_NONE,
+  // synced by the log writer, which commits all waiting records at once
+  DURABILITY_BATCHED,
+  // synced by the log writer, every record on its own
+  DURABILITY_REQUEST
+};
+
+// A change on its way to the disk - lives on the stack of its request
+typedef struct WalRecord {
+  char header[WAL_RECORD_HEADER_LEN];
+  const char *ID;
+  size_t ID_len;
+  const void *payload;
+  size_t payload_size;
+  Completion done;
+  struct WalRecord *next;
+} WalRecord;
+
+// Applies a replayed change
+typedef void (*WalReplay)(void *input, int type, char *ID, void *payload, 
+                          size_t payload_size);
+
+typedef struct Wal {
+  int fd;
+  char *path;
+  // the records before the last checkpoint - path.old
+  char *old_path;
+  int durability;
+  // serializes the writes to the file
+  pthread_mutex_t write_mutex;
+  // records for the log writer
+  pthread_mutex_t queue_mutex;
+  pthread_cond_t not_empty;
+  WalRecord *head;
+  WalRecord *tail;
+  // written records and writes (group commits)
+  unsigned long records;
+  unsigned long commits;
+} Wal;
+
+/**
+ * Parses none, batched or request - returns -1 for anything else
+ */
+int parse_durability(const char *name);
+
+/**
+ * Replays the records of the log at path (after those of path.old if it is
+ * left), cuts off a torn last record and opens it for appending. The log 
+ * writer is started for DURABILITY_BATCHED and DURABILITY_REQUEST
+ */
+Wal *open_wal(const char *path, int durability, WalReplay replay, void *input);
+
+/**
+ * Logs a change - changes of the same file have to be appended in the order
+ * they were applied. The record has to live until wait_for_wal_record
+ */
+void append_wal_record(Wal *wal, WalRecord *record, int type, const char *ID, 
+                       const void *payload, size_t payload_size);
+
+/**
+ * Waits until the record is as durable as configured
+ */
+void wait_for_wal_record(Wal *wal, WalRecord *record);
+
+/**
+ * Moves the records so far to path.old and continues in a new log - no
+ * change may be between append_wal_record and wait_for_wal_record. Does 
+ * nothing if path.old is still there (the last checkpoint failed)
+ */
+void rotate_wal(Wal *wal);
+
+/**
+ * Deletes path.old - once a snapshot has all changes it holds
+ */
+void drop_old_wal(Wal *wal);
+
+#endif
@@ -0,0 +1,60 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the header of a work stealing deque (Chase-Lev) - the owner
+ * pushes and pops at the bottom, other threads steal from the top
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _WORK_DEQUE_HEADER
+#define _WORK_DEQUE_HEADER
+
+#include <bufferPool.h>
+
+// max. number of queued items (has to be a power of 2)
+#define WORK_DEQUE_CAPACITY 1024
+
+// top and bottom live on separate cache lines - thieves and owner don't
+// invalidate each others line on every operation
+typedef struct WorkDeque {
+  long top __attribute__((aligned(CACHE_LINE_SIZE)));
+  long bottom __attribute__((aligned(CACHE_LINE_SIZE)));
+  void *items[WORK_DEQUE_CAPACITY] __attribute__((aligned(CACHE_LINE_SIZE)));
+} WorkDeque;
+
+/**
+ * Prepares an empty deque
+ */
+void init_work_deque(WorkDeque *deque);
+
+/**
+ * Owner only: adds an item at the bottom - returns FALSE if the deque is full
+ */
+int push_work(WorkDeque *deque, void *item);
+
+/**
+ * Owner only: takes the newest item - NULL if the deque is empty
+ */
+void *pop_work(WorkDeque *deque);
+
+/**
+ * Any thread: takes the oldest item - NULL if the deque is empty or another 
+ * thread was faster
+ */
+void *steal_work(WorkDeque *deque);
+
+#endif
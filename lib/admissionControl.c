@@ -0,0 +1,99 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the admission control that limits the number of concurrently
+ * served and waiting connections
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+
+#include <termPaperLib.h>
+#include <admissionControl.h>
+
+void init_admission_control(AdmissionControl *admission, int max_in_flight, 
+                            int max_queued) {
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  admission->mutex = mutex;
+  admission->max_in_flight = max_in_flight;
+  admission->max_queued = max_queued;
+  admission->in_flight = 0;
+  admission->queue = malloc(sizeof(void *) * (max_queued > 0 ? max_queued : 1));
+  admission->queue_head = 0;
+  admission->queued = 0;
+  admission->rejected = 0;
+}
+
+void lock_admission(AdmissionControl *admission) {
+  int retcode = pthread_mutex_lock(&admission->mutex);
+  handle_thread_error(retcode, "lock admission mutex", THREAD_EXIT);
+}
+
+void unlock_admission(AdmissionControl *admission) {
+  int retcode = pthread_mutex_unlock(&admission->mutex);
+  handle_thread_error(retcode, "unlock admission mutex", THREAD_EXIT);
+}
+
+enum admission admit_connection(AdmissionControl *admission, void *connection) {
+  enum admission result;
+
+  lock_admission(admission);
+  if (admission->in_flight < admission->max_in_flight) {
+    admission->in_flight++;
+    result = ADMITTED;
+  } else if (admission->queued < admission->max_queued) {
+    int tail = (admission->queue_head + admission->queued) % admission->max_queued;
+    admission->queue[tail] = connection;
+    admission->queued++;
+    result = QUEUED;
+  } else {
+    admission->rejected++;
+    result = REJECTED;
+  }
+  unlock_admission(admission);
+
+  return result;
+}
+
+void *finish_admitted(AdmissionControl *admission) {
+  void *next = NULL;
+
+  lock_admission(admission);
+  if (admission->queued > 0) {
+    // the slot is handed over directly - in_flight stays the same
+    next = admission->queue[admission->queue_head];
+    admission->queue_head = (admission->queue_head + 1) % admission->max_queued;
+    admission->queued--;
+  } else {
+    admission->in_flight--;
+  }
+  unlock_admission(admission);
+
+  return next;
+}
+
+int get_in_flight(AdmissionControl *admission) {
+  return __atomic_load_n(&admission->in_flight, __ATOMIC_RELAXED);
+}
+
+int get_queued(AdmissionControl *admission) {
+  return __atomic_load_n(&admission->queued, __ATOMIC_RELAXED);
+}
+
+long get_rejected(AdmissionControl *admission) {
+  return __atomic_load_n(&admission->rejected, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,175 @@
+/*
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides a bump allocator for short lived allocations that are released
+ * all at once after a request is answered
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include <arena.h>
+
+// pool of released arenas
+pthread_mutex_t arena_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+Arena *free_arenas = NULL;
+
+size_t align_size(size_t size) {
+  return (size + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+}
+
+ArenaChunk *new_chunk(size_t size) {
+  ArenaChunk *chunk = malloc(sizeof(ArenaChunk) + size);
+  if (chunk == NULL) {
+    log_error("Allocation of an arena chunk with %zu bytes failed", size);
+    exit_by_type(PROCESS_EXIT);
+  }
+  chunk->size = size;
+  chunk->used = 0;
+  chunk->next = NULL;
+  return chunk;
+}
+
+Arena *new_arena(size_t chunk_size) {
+  Arena *arena = malloc(sizeof(Arena));
+  arena->first = new_chunk(chunk_size);
+  arena->current = arena->first;
+  arena->cleanups = NULL;
+  arena->nextFree = NULL;
+  return arena;
+}
+
+/*
+ * Runs the registered cleanups - the latest first
+ */
+void run_cleanups(Arena *arena) {
+  ArenaCleanup *cleanup = arena->cleanups;
+  arena->cleanups = NULL;
+  while (cleanup != NULL) {
+    cleanup->cleanup(cleanup->input);
+    cleanup = cleanup->next;
+  }
+}
+
+void free_arena(Arena *arena) {
+  run_cleanups(arena);
+  ArenaChunk *chunk = arena->first;
+  while (chunk != NULL) {
+    ArenaChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  free(arena);
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+  if (arena == NULL) {
+    return malloc(size);
+  }
+
+  size = align_size(size);
+  ArenaChunk *chunk = arena->current;
+
+  // use the chunks of former requests before allocating new ones
+  while (chunk->used + size > chunk->size) {
+    if (chunk->next == NULL) {
+      size_t chunk_size = arena->first->size;
+      if (chunk_size < size) {
+        chunk_size = size;
+      }
+      log_debug("Arena %p: new chunk with %zu bytes", arena, chunk_size);
+      chunk->next = new_chunk(chunk_size);
+    }
+    chunk = chunk->next;
+  }
+  arena->current = chunk;
+
+  void *memory = chunk->memory + chunk->used;
+  chunk->used += size;
+  return memory;
+}
+
+void *arena_extend(Arena *arena, void *ptr, size_t old_size, size_t new_size) {
+  if (arena == NULL) {
+    return realloc(ptr, new_size);
+  }
+
+  ArenaChunk *chunk = arena->current;
+  size_t old_aligned = align_size(old_size);
+  size_t new_aligned = align_size(new_size);
+
+  // the last allocation can simply grow
+  if ((char *) ptr + old_aligned == chunk->memory + chunk->used
+      && chunk->used - old_aligned + new_aligned <= chunk->size) {
+    chunk->used = chunk->used - old_aligned + new_aligned;
+    return ptr;
+  }
+
+  void *memory = arena_alloc(arena, new_size);
+  memcpy(memory, ptr, old_size);
+  return memory;
+}
+
+void arena_on_reset(Arena *arena, void (*cleanup)(void *input), void *input) {
+  ArenaCleanup *entry = arena_alloc(arena, sizeof(ArenaCleanup));
+  entry->cleanup = cleanup;
+  entry->input = input;
+  entry->next = arena->cleanups;
+  arena->cleanups = entry;
+}
+
+void reset_arena(Arena *arena) {
+  run_cleanups(arena);
+  ArenaChunk *chunk;
+  for (chunk = arena->first; chunk != NULL; chunk = chunk->next) {
+    chunk->used = 0;
+  }
+  arena->current = arena->first;
+}
+
+Arena *acquire_arena() {
+  int retcode = pthread_mutex_lock(&arena_pool_mutex);
+  handle_thread_error(retcode, "lock arena pool mutex", THREAD_EXIT);
+
+  Arena *arena = free_arenas;
+  if (arena != NULL) {
+    free_arenas = arena->nextFree;
+  }
+
+  retcode = pthread_mutex_unlock(&arena_pool_mutex);
+  handle_thread_error(retcode, "unlock arena pool mutex", THREAD_EXIT);
+
+  if (arena == NULL) {
+    arena = new_arena(ARENA_CHUNK_SIZE);
+    log_debug("Arena %p: created", arena);
+  }
+  return arena;
+}
+
+void release_arena(Arena *arena) {
+  reset_arena(arena);
+
+  int retcode = pthread_mutex_lock(&arena_pool_mutex);
+  handle_thread_error(retcode, "lock arena pool mutex", THREAD_EXIT);
+
+  arena->nextFree = free_arenas;
+  free_arenas = arena;
+
+  retcode = pthread_mutex_unlock(&arena_pool_mutex);
+  handle_thread_error(retcode, "unlock arena pool mutex", THREAD_EXIT);
+}
@@ -0,0 +1,287 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the asynchronous logger - threads append their lines to rings
+ * of their own, a flusher thread writes them
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <termPaperLib.h>
+#include <asyncLog.h>
+
+// outputs the flusher collects lines for - the log file, stdout and stderr
+#define MAX_LOG_OUTPUTS 8
+
+// A record in a ring is its header followed by the line (or binary record)
+typedef struct logRecord {
+  int32_t fd;
+  uint32_t len;
+} LogRecord;
+
+typedef struct logBatch {
+  int fd;
+  size_t len;
+  char data[LOG_BATCH_SIZE];
+} LogBatch;
+
+int async_logging = FALSE;
+
+// the rings of the threads and the empty rings of ended threads
+pthread_mutex_t log_rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+LogRing *log_rings = NULL;
+LogRing *free_log_rings = NULL;
+
+// wakes the flusher before its interval is over
+pthread_mutex_t flusher_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t flusher_wakeup = PTHREAD_COND_INITIALIZER;
+
+// only used by whoever holds log_rings_mutex
+LogBatch log_batches[MAX_LOG_OUTPUTS];
+int num_log_batches = 0;
+unsigned long reported_drops = 0;
+
+__thread LogRing *own_log_ring = NULL;
+pthread_key_t log_ring_key;
+
+/*
+ * Called when a thread ends - its ring is drained and reused
+ */
+void orphan_log_ring(void *input) {
+  LogRing *ring = (LogRing *) input;
+  __atomic_store_n(&ring->orphaned, TRUE, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns the ring of the calling thread - a recycled one if possible
+ */
+LogRing *get_own_log_ring() {
+  if (own_log_ring != NULL) {
+    return own_log_ring;
+  }
+
+  pthread_mutex_lock(&log_rings_mutex);
+  LogRing *ring = free_log_rings;
+  if (ring != NULL) {
+    free_log_rings = ring->next;
+  } else {
+    ring = malloc(sizeof(LogRing));
+    if (ring == NULL) {
+      pthread_mutex_unlock(&log_rings_mutex);
+      return NULL;
+    }
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+  }
+  ring->orphaned = FALSE;
+  ring->next = log_rings;
+  log_rings = ring;
+  pthread_mutex_unlock(&log_rings_mutex);
+
+  pthread_setspecific(log_ring_key, ring);
+  own_log_ring = ring;
+  return ring;
+}
+
+/*
+ * Copies len bytes into the ring at position - wraps around at the end
+ */
+void copy_into_ring(LogRing *ring, uint64_t position, const void *data, size_t len) {
+  size_t offset = position & (LOG_RING_SIZE - 1);
+  size_t first = LOG_RING_SIZE - offset < len ? LOG_RING_SIZE - offset : len;
+  memcpy(ring->data + offset, data, first);
+  memcpy(ring->data, (const char *) data + first, len - first);
+}
+
+void copy_from_ring(LogRing *ring, uint64_t position, void *data, size_t len) {
+  size_t offset = position & (LOG_RING_SIZE - 1);
+  size_t first = LOG_RING_SIZE - offset < len ? LOG_RING_SIZE - offset : len;
+  memcpy(data, ring->data + offset, first);
+  memcpy((char *) data + first, ring->data, len - first);
+}
+
+int append_async_log(int fd, const char *line, size_t len) {
+  if (!async_logging) {
+    return FALSE;
+  }
+  LogRing *ring = get_own_log_ring();
+  if (ring == NULL) {
+    return FALSE;
+  }
+
+  LogRecord record = { fd, len };
+  uint64_t head = ring->head;
+  uint64_t used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  if (used + sizeof(record) + len > LOG_RING_SIZE) {
+    __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+    return TRUE;
+  }
+  copy_into_ring(ring, head, &record, sizeof(record));
+  copy_into_ring(ring, head + sizeof(record), line, len);
+  __atomic_store_n(&ring->head, head + sizeof(record) + len, __ATOMIC_RELEASE);
+
+  // a lost wakeup only delays the lines until the interval is over
+  if (used + sizeof(record) + len > LOG_RING_SIZE / 2) {
+    pthread_cond_signal(&flusher_wakeup);
+  }
+  return TRUE;
+}
+
+/*
+ * Writes all of data - errors are ignored, there is nobody to tell
+ */
+void write_log_output(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t written = write(fd, data, len);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return;
+    }
+    data += written;
+    len -= written;
+  }
+}
+
+void write_log_batches() {
+  int i;
+  for (i = 0; i < num_log_batches; i++) {
+    write_log_output(log_batches[i].fd, log_batches[i].data, log_batches[i].len);
+    log_batches[i].len = 0;
+  }
+}
+
+/*
+ * Collects a record for its output - a full batch is written first
+ */
+void add_to_log_batch(int fd, LogRing *ring, uint64_t position, size_t len) {
+  LogBatch *batch = NULL;
+  int i;
+  for (i = 0; i < num_log_batches; i++) {
+    if (log_batches[i].fd == fd) {
+      batch = &log_batches[i];
+    }
+  }
+  if (batch == NULL) {
+    if (num_log_batches == MAX_LOG_OUTPUTS) {
+      write_log_batches();
+      num_log_batches = 0;
+    }
+    batch = &log_batches[num_log_batches++];
+    batch->fd = fd;
+    batch->len = 0;
+  }
+
+  if (batch->len + len > LOG_BATCH_SIZE) {
+    write_log_output(batch->fd, batch->data, batch->len);
+    batch->len = 0;
+  }
+  copy_from_ring(ring, position, batch->data + batch->len, len);
+  batch->len += len;
+}
+
+/*
+ * Takes all lines out of a ring - log_rings_mutex has to be locked
+ */
+void drain_log_ring(LogRing *ring) {
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint64_t tail = ring->tail;
+  while (tail < head) {
+    LogRecord record;
+    copy_from_ring(ring, tail, &record, sizeof(record));
+    add_to_log_batch(record.fd, ring, tail + sizeof(record), record.len);
+    tail += sizeof(record) + record.len;
+  }
+  __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+void flush_async_logs() {
+  pthread_mutex_lock(&log_rings_mutex);
+  unsigned long dropped = 0;
+  LogRing **link = &log_rings;
+  while (*link != NULL) {
+    LogRing *ring = *link;
+    // an orphaned ring gets no more lines once the flag is seen
+    int orphaned = __atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE);
+    drain_log_ring(ring);
+    dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+
+    if (orphaned) {
+      *link = ring->next;
+      ring->next = free_log_rings;
+      free_log_rings = ring;
+    } else {
+      link = &ring->next;
+    }
+  }
+  for (link = &free_log_rings; *link != NULL; link = &(*link)->next) {
+    dropped += (*link)->dropped;
+  }
+
+  if (dropped != reported_drops) {
+    char line[MAX_OTHER + 64];
+    int len = snprintf(line, sizeof(line), "ERROR: Logger: %lu lines dropped - rings full\n", 
+                       dropped - reported_drops);
+    write_log_output(STDERR_FILENO, line, len);
+    reported_drops = dropped;
+  }
+  write_log_batches();
+  pthread_mutex_unlock(&log_rings_mutex);
+}
+
+void *run_log_flusher(void *input) {
+  pthread_mutex_lock(&flusher_mutex);
+  while (TRUE) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += LOG_FLUSH_INTERVAL_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&flusher_wakeup, &flusher_mutex, &deadline);
+    flush_async_logs();
+  }
+  return NULL;
+}
+
+void start_async_logging() {
+  if (async_logging) {
+    return;
+  }
+  int retcode = pthread_key_create(&log_ring_key, orphan_log_ring);
+  handle_thread_error(retcode, "Create log ring key", PROCESS_EXIT);
+
+  // lines written so far must not come after the queued ones
+  fflush(NULL);
+
+  pthread_t thread;
+  retcode = pthread_create(&thread, NULL, run_log_flusher, NULL);
+  handle_thread_error(retcode, "Create log flusher", PROCESS_EXIT);
+  pthread_detach(thread);
+
+  atexit(flush_async_logs);
+  async_logging = TRUE;
+}
@@ -0,0 +1,214 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the pooled connections of the router to its backends
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <termPaperLib.h>
+#include <backendPool.h>
+
+int init_backend(Backend *backend, const char *name) {
+  const char *separator = strrchr(name, ':');
+  if (separator == NULL || separator == name || atoi(separator + 1) <= 0) {
+    return FALSE;
+  }
+
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  backend->name = strdup(name);
+  backend->ip = strndup(name, separator - name);
+  backend->port = atoi(separator + 1);
+  backend->mutex = mutex;
+  backend->num_idle = 0;
+  backend->opened = 0;
+  backend->reused = 0;
+  return TRUE;
+}
+
+void lock_backend(Backend *backend) {
+  int retcode = pthread_mutex_lock(&backend->mutex);
+  handle_thread_error(retcode, "lock backend mutex", THREAD_EXIT);
+}
+
+void unlock_backend(Backend *backend) {
+  int retcode = pthread_mutex_unlock(&backend->mutex);
+  handle_thread_error(retcode, "unlock backend mutex", THREAD_EXIT);
+}
+
+/*
+ * Returns a new connection to the backend - -1 if it can't be reached
+ */
+int open_backend_connection(Backend *backend) {
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = inet_addr(backend->ip);
+  address.sin_port = htons(backend->port);
+
+  int socket_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  handle_error(socket_fd, "socket() failed", PROCESS_EXIT);
+  if (connect(socket_fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+    log_error("Backend %s not reachable: %s", backend->name, strerror(errno));
+    close(socket_fd);
+    return -1;
+  }
+
+  // a hung backend must not keep the router threads forever
+  struct timeval timeout = { BACKEND_TIMEOUT, 0 };
+  setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  __atomic_add_fetch(&backend->opened, 1, __ATOMIC_RELAXED);
+  return socket_fd;
+}
+
+/*
+ * Returns FALSE if the backend closed the idle connection meanwhile (idle 
+ * timeout) - an idle connection has nothing to read
+ */
+int is_connection_open(int socket_fd) {
+  char byte;
+  ssize_t received = recv(socket_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/*
+ * Takes an idle connection that is still open - -1 if there is none
+ */
+int take_idle_connection(Backend *backend) {
+  while (TRUE) {
+    int socket_fd = -1;
+    lock_backend(backend);
+    if (backend->num_idle > 0) {
+      socket_fd = backend->idle[--backend->num_idle];
+    }
+    unlock_backend(backend);
+
+    if (socket_fd < 0 || is_connection_open(socket_fd)) {
+      return socket_fd;
+    }
+    close(socket_fd);
+  }
+}
+
+/*
+ * Keeps a connection for the next request - closes it if enough are idle
+ */
+void give_back_connection(Backend *backend, int socket_fd) {
+  lock_backend(backend);
+  if (backend->num_idle < MAX_IDLE_CONNECTIONS) {
+    backend->idle[backend->num_idle++] = socket_fd;
+    socket_fd = -1;
+  }
+  unlock_backend(backend);
+  if (socket_fd >= 0) {
+    close(socket_fd);
+  }
+}
+
+/*
+ * One request on one connection - FALSE if the connection broke
+ */
+int exchange_with_backend(int socket_fd, const BinaryHeader *request, const char *key,
+                          const char *value, BinaryHeader *reply, char **reply_value) {
+  return write_binary_request(socket_fd, request->opcode, request->request_id, key, 
+                              value, request->value_len)
+         && read_binary_response(socket_fd, reply, reply_value);
+}
+
+int forward_to_backend(Backend *backend, const BinaryHeader *request, const char *key,
+                       const char *value, BinaryHeader *reply, char **reply_value) {
+  // the backend may still close an idle connection right now - a READ or
+  // LIST is repeated once on a new one, a change may have been applied
+  int socket_fd = take_idle_connection(backend);
+  if (socket_fd >= 0) {
+    __atomic_add_fetch(&backend->reused, 1, __ATOMIC_RELAXED);
+    if (exchange_with_backend(socket_fd, request, key, value, reply, reply_value)) {
+      give_back_connection(backend, socket_fd);
+      return TRUE;
+    }
+    close(socket_fd);
+    if (request->opcode != OP_READ && request->opcode != OP_LIST) {
+      return FALSE;
+    }
+  }
+
+  socket_fd = open_backend_connection(backend);
+  if (socket_fd < 0) {
+    return FALSE;
+  }
+  if (!exchange_with_backend(socket_fd, request, key, value, reply, reply_value)) {
+    close(socket_fd);
+    return FALSE;
+  }
+  give_back_connection(backend, socket_fd);
+  return TRUE;
+}
+
+int forward_to_all_backends(Backend *backends, int num_backends, const BinaryHeader *request,
+                            BinaryHeader *replies, char **reply_values) {
+  int *sockets = malloc(num_backends * sizeof(int));
+  int i;
+
+  // all requests are sent before the first response is read - the backends
+  // work on them at the same time
+  for (i = 0; i < num_backends; i++) {
+    reply_values[i] = NULL;
+    sockets[i] = take_idle_connection(&backends[i]);
+    if (sockets[i] >= 0) {
+      __atomic_add_fetch(&backends[i].reused, 1, __ATOMIC_RELAXED);
+    } else {
+      sockets[i] = open_backend_connection(&backends[i]);
+    }
+    if (sockets[i] >= 0 && !write_binary_request(sockets[i], request->opcode, 
+                                                 request->request_id, NULL, NULL, 0)) {
+      close(sockets[i]);
+      sockets[i] = -1;
+    }
+  }
+
+  int reached = TRUE;
+  for (i = 0; i < num_backends; i++) {
+    if (sockets[i] >= 0 && read_binary_response(sockets[i], &replies[i], &reply_values[i])) {
+      give_back_connection(&backends[i], sockets[i]);
+      continue;
+    }
+    if (sockets[i] >= 0) {
+      close(sockets[i]);
+    }
+    // a stale connection - once more on its own
+    if (!forward_to_backend(&backends[i], request, NULL, NULL, &replies[i], 
+                            &reply_values[i])) {
+      reached = FALSE;
+    }
+  }
+  free(sockets);
+
+  if (!reached) {
+    for (i = 0; i < num_backends; i++) {
+      free(reply_values[i]);
+      reply_values[i] = NULL;
+    }
+  }
+  return reached;
+}
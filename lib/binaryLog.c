@@ -0,0 +1,385 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the binary log format - a line is stored as the id of its
+ * format and its raw arguments and formatted offline
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <termPaperLib.h>
+#include <binaryLog.h>
+
+// ids of the formats - 0 is not assigned yet
+uint32_t next_log_format_id = 1;
+
+int next_log_conversion(const char *format, LogConversion *conversion) {
+  const char *c = strchr(format, '%');
+  if (c == NULL) {
+    return FALSE;
+  }
+  conversion->start = c;
+  conversion->width_arg = FALSE;
+  conversion->precision_arg = FALSE;
+  conversion->precision = -1;
+  c++;
+
+  // flags and width
+  while (*c != '\000' && strchr("-+ #0", *c) != NULL) {
+    c++;
+  }
+  if (*c == '*') {
+    conversion->width_arg = TRUE;
+    c++;
+  }
+  while (*c >= '0' && *c <= '9') {
+    c++;
+  }
+  if (*c == '.') {
+    c++;
+    conversion->precision = 0;
+    if (*c == '*') {
+      conversion->precision_arg = TRUE;
+      conversion->precision = -1;
+      c++;
+    }
+    while (*c >= '0' && *c <= '9') {
+      conversion->precision = conversion->precision * 10 + (*c - '0');
+      c++;
+    }
+  }
+
+  // length modifier
+  int length = LOG_ARG_INT;
+  if (*c == 'h') {
+    c += c[1] == 'h' ? 2 : 1;
+  } else if (*c == 'l') {
+    length = c[1] == 'l' ? LOG_ARG_LONG_LONG : LOG_ARG_LONG;
+    c += c[1] == 'l' ? 2 : 1;
+  } else if (*c == 'z' || *c == 't') {
+    length = *c == 'z' ? LOG_ARG_SIZE : LOG_ARG_LONG;
+    c++;
+  } else if (*c == 'j') {
+    length = LOG_ARG_LONG_LONG;
+    c++;
+  } else if (*c == 'L') {
+    length = -1;
+    c++;
+  }
+
+  if (*c == '\000') {
+    conversion->type = -1;
+  } else if (*c == '%') {
+    conversion->type = LOG_ARG_NONE;
+  } else if (strchr("diuxXoc", *c) != NULL) {
+    conversion->type = length;
+  } else if (strchr("fFeEgGaA", *c) != NULL) {
+    conversion->type = length == LOG_ARG_INT || length == LOG_ARG_LONG ? LOG_ARG_DOUBLE : -1;
+  } else if (*c == 'p') {
+    conversion->type = LOG_ARG_POINTER;
+  } else if (*c == 's') {
+    conversion->type = length == LOG_ARG_INT ? LOG_ARG_STRING : -1;
+  } else {
+    conversion->type = -1;
+  }
+  if (*c != '\000') {
+    c++;
+  }
+  conversion->len = c - conversion->start;
+  return TRUE;
+}
+
+int register_log_format(LogFormat *format, const char *msg) {
+  if (__atomic_load_n(&format->id, __ATOMIC_ACQUIRE) != 0) {
+    return FALSE;
+  }
+
+  // racing threads fill in the same signature
+  LogFormat signature;
+  signature.preformatted = FALSE;
+  signature.num_args = 0;
+  LogConversion conversion;
+  const char *position = msg;
+  while (next_log_conversion(position, &conversion)) {
+    int needed = conversion.width_arg + conversion.precision_arg 
+                 + (conversion.type != LOG_ARG_NONE);
+    // * is only decoded for ints, doubles and strings
+    int star_supported = conversion.type == LOG_ARG_STRING
+        || ((conversion.type == LOG_ARG_INT || conversion.type == LOG_ARG_DOUBLE)
+            && !(conversion.width_arg && conversion.precision_arg));
+    if (conversion.type < 0 || signature.num_args + needed > MAX_LOG_ARGS
+        || ((conversion.width_arg || conversion.precision_arg) && !star_supported)) {
+      signature.preformatted = TRUE;
+      break;
+    }
+    if (conversion.width_arg) {
+      signature.arg_types[signature.num_args++] = LOG_ARG_INT;
+    }
+    if (conversion.precision_arg) {
+      signature.arg_types[signature.num_args++] = LOG_ARG_INT;
+    }
+    if (conversion.type != LOG_ARG_NONE) {
+      signature.arg_types[signature.num_args++] = conversion.type;
+    }
+    position = conversion.start + conversion.len;
+  }
+  format->preformatted = signature.preformatted;
+  format->num_args = signature.num_args;
+  memcpy(format->arg_types, signature.arg_types, signature.num_args);
+
+  uint32_t id = __atomic_fetch_add(&next_log_format_id, 1, __ATOMIC_RELAXED);
+  uint32_t unassigned = 0;
+  return __atomic_compare_exchange_n(&format->id, &unassigned, id, FALSE, 
+                                     __ATOMIC_RELEASE, __ATOMIC_ACQUIRE);
+}
+
+size_t encode_log_definition(const LogFormat *format, int level, const char *msg, 
+                             char *buffer, size_t size) {
+  // a preformatted line is its only argument
+  if (format->preformatted) {
+    msg = "%s";
+  }
+  size_t msg_len = strlen(msg);
+  size_t len = sizeof(LogRecordHeader) + sizeof(LogDefinition) + msg_len;
+  if (len > size) {
+    msg_len -= len - size;
+    len = size;
+  }
+
+  LogRecordHeader header = { LOG_DEFINITION, len - sizeof(LogRecordHeader) };
+  LogDefinition definition = { format->id, level };
+  memcpy(buffer, &header, sizeof(header));
+  memcpy(buffer + sizeof(header), &definition, sizeof(definition));
+  memcpy(buffer + sizeof(header) + sizeof(definition), msg, msg_len);
+  return len;
+}
+
+/*
+ * Appends a string with its length - cut to what is left of the buffer
+ */
+size_t encode_log_string(char *buffer, size_t used, size_t size, const char *str, 
+                         int precision) {
+  if (used + sizeof(uint32_t) > size) {
+    return used;
+  }
+  if (str == NULL) {
+    str = "(null)";
+  }
+  size_t len = precision >= 0 ? strnlen(str, precision) : strlen(str);
+  if (len > size - used - sizeof(uint32_t)) {
+    len = size - used - sizeof(uint32_t);
+  }
+  uint32_t encoded_len = len;
+  memcpy(buffer + used, &encoded_len, sizeof(encoded_len));
+  memcpy(buffer + used + sizeof(encoded_len), str, len);
+  return used + sizeof(encoded_len) + len;
+}
+
+size_t encode_log_entry(const LogFormat *format, const char *msg, va_list argptr,
+                        char *buffer, size_t size) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  LogEntry entry;
+  entry.id = format->id;
+  entry.reserved = 0;
+  entry.timestamp = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+
+  size_t used = sizeof(LogRecordHeader);
+  memcpy(buffer + used, &entry, sizeof(entry));
+  used += sizeof(entry);
+
+  if (format->preformatted) {
+    char line[MAX_LOG_LEN];
+    vsnprintf(line, sizeof(line), msg, argptr);
+    used = encode_log_string(buffer, used, size, line, -1);
+  } else {
+    // the precision of a string limits what is read of it
+    int precision = -1;
+    LogConversion conversion;
+    const char *position = msg;
+    int i;
+    for (i = 0; i < format->num_args && used + sizeof(uint64_t) <= size; i++) {
+      // types register_log_format never stores are logged as 0
+      int64_t number = 0;
+      double real;
+      switch (format->arg_types[i]) {
+        case LOG_ARG_INT:
+          number = va_arg(argptr, int);
+          precision = number;
+          break;
+        case LOG_ARG_LONG:
+          number = va_arg(argptr, long);
+          break;
+        case LOG_ARG_LONG_LONG:
+          number = va_arg(argptr, long long);
+          break;
+        case LOG_ARG_SIZE:
+          number = va_arg(argptr, size_t);
+          break;
+        case LOG_ARG_POINTER:
+          number = (int64_t) (uintptr_t) va_arg(argptr, void *);
+          break;
+        case LOG_ARG_DOUBLE:
+          real = va_arg(argptr, double);
+          memcpy(&number, &real, sizeof(number));
+          break;
+        case LOG_ARG_STRING:
+          // find the conversion of the string for a fixed precision
+          while (next_log_conversion(position, &conversion) 
+                 && conversion.type != LOG_ARG_STRING) {
+            position = conversion.start + conversion.len;
+          }
+          position = conversion.start + conversion.len;
+          if (!conversion.precision_arg) {
+            precision = conversion.precision;
+          }
+          used = encode_log_string(buffer, used, size, va_arg(argptr, const char *), 
+                                   precision);
+          precision = -1;
+          continue;
+      }
+      memcpy(buffer + used, &number, sizeof(number));
+      used += sizeof(number);
+    }
+  }
+
+  LogRecordHeader header = { LOG_ENTRY, used - sizeof(LogRecordHeader) };
+  memcpy(buffer, &header, sizeof(header));
+  return used;
+}
+
+/*
+ * Takes the next number of an entry - FALSE if there is none
+ */
+int take_log_number(const char **args, const char *end, int64_t *number) {
+  if (end - *args < (long) sizeof(*number)) {
+    return FALSE;
+  }
+  memcpy(number, *args, sizeof(*number));
+  *args += sizeof(*number);
+  return TRUE;
+}
+
+int decode_log_entry(const char *msg, const char *args, size_t args_len, 
+                     char *text, size_t size) {
+  const char *end = args + args_len;
+  size_t used = 0;
+  LogConversion conversion;
+
+  while (next_log_conversion(msg, &conversion)) {
+    // the text before the conversion
+    size_t literal = conversion.start - msg;
+    if (used + literal < size) {
+      memcpy(text + used, msg, literal);
+    }
+    used += literal;
+    msg = conversion.start + conversion.len;
+
+    char spec[MAX_OTHER * 4];
+    if (conversion.len >= sizeof(spec) || conversion.type < 0) {
+      return -1;
+    }
+    memcpy(spec, conversion.start, conversion.len);
+    spec[conversion.len] = '\000';
+
+    int64_t width = 0;
+    int64_t precision = 0;
+    if ((conversion.width_arg && !take_log_number(&args, end, &width))
+        || (conversion.precision_arg && !take_log_number(&args, end, &precision))) {
+      return -1;
+    }
+
+    char *out = used < size ? text + used : NULL;
+    size_t left = used < size ? size - used : 0;
+    int64_t number = 0;
+    double real;
+    int len;
+    uint32_t str_len;
+    switch (conversion.type) {
+      case LOG_ARG_NONE:
+        len = snprintf(out, left, "%%");
+        break;
+      case LOG_ARG_STRING:
+        if (end - args < (long) sizeof(str_len)) {
+          return -1;
+        }
+        memcpy(&str_len, args, sizeof(str_len));
+        args += sizeof(str_len);
+        if (end - args < (long) str_len) {
+          return -1;
+        }
+        // the string was cut to its precision already
+        spec[conversion.len - 1] = '\000';
+        if (conversion.width_arg) {
+          len = snprintf(out, left, "%*.*s", (int) width, (int) str_len, args);
+        } else {
+          // flags and width of the spec, the length as precision
+          char *dot = strchr(spec, '.');
+          if (dot != NULL) {
+            *dot = '\000';
+          }
+          char string_spec[MAX_OTHER * 4 + 8];
+          snprintf(string_spec, sizeof(string_spec), "%s.*s", spec);
+          len = snprintf(out, left, string_spec, (int) str_len, args);
+        }
+        args += str_len;
+        break;
+      default:
+        if (!take_log_number(&args, end, &number)) {
+          return -1;
+        }
+        if (conversion.width_arg && conversion.precision_arg) {
+          len = -1;
+        } else if (conversion.type == LOG_ARG_DOUBLE) {
+          memcpy(&real, &number, sizeof(real));
+          len = conversion.width_arg ? snprintf(out, left, spec, (int) width, real)
+              : conversion.precision_arg ? snprintf(out, left, spec, (int) precision, real)
+              : snprintf(out, left, spec, real);
+        } else if (conversion.type == LOG_ARG_POINTER) {
+          len = snprintf(out, left, spec, (void *) (uintptr_t) number);
+        } else if (conversion.type == LOG_ARG_INT) {
+          len = conversion.width_arg ? snprintf(out, left, spec, (int) width, (int) number)
+              : conversion.precision_arg ? snprintf(out, left, spec, (int) precision, (int) number)
+              : snprintf(out, left, spec, (int) number);
+        } else if (conversion.type == LOG_ARG_LONG) {
+          len = snprintf(out, left, spec, (long) number);
+        } else if (conversion.type == LOG_ARG_SIZE) {
+          len = snprintf(out, left, spec, (size_t) number);
+        } else {
+          len = snprintf(out, left, spec, (long long) number);
+        }
+        break;
+    }
+    if (len < 0) {
+      return -1;
+    }
+    used += len;
+  }
+
+  size_t literal = strlen(msg);
+  if (used + literal < size) {
+    memcpy(text + used, msg, literal);
+  }
+  used += literal;
+  if (size > 0) {
+    text[used < size ? used : size - 1] = '\000';
+  }
+  return used;
+}
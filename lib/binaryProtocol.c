@@ -0,0 +1,304 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the length prefixed binary protocol that is served alongside
+ * the text protocol
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+
+#include <termPaperLib.h>
+#include <binaryProtocol.h>
+#include <coroutine.h>
+#include <messageProcessing.h>
+
+int is_binary_message(const char *msg) {
+  return (unsigned char) msg[0] == BINARY_MAGIC;
+}
+
+void decode_binary_header(const char *buffer, BinaryHeader *header) {
+  uint16_t key_len;
+  uint32_t value_len, request_id;
+
+  // the frame may start at any offset of the buffer
+  memcpy(&key_len, buffer + 4, sizeof(key_len));
+  memcpy(&value_len, buffer + 8, sizeof(value_len));
+  memcpy(&request_id, buffer + 12, sizeof(request_id));
+
+  header->version = buffer[1];
+  header->opcode = buffer[2];
+  header->status = buffer[3];
+  header->key_len = ntohs(key_len);
+  header->value_len = ntohl(value_len);
+  header->request_id = ntohl(request_id);
+}
+
+void encode_binary_header(const BinaryHeader *header, char *buffer) {
+  uint16_t key_len = htons(header->key_len);
+  uint16_t reserved = 0;
+  uint32_t value_len = htonl(header->value_len);
+  uint32_t request_id = htonl(header->request_id);
+
+  buffer[0] = (char) BINARY_MAGIC;
+  buffer[1] = header->version;
+  buffer[2] = header->opcode;
+  buffer[3] = header->status;
+  memcpy(buffer + 4, &key_len, sizeof(key_len));
+  memcpy(buffer + 6, &reserved, sizeof(reserved));
+  memcpy(buffer + 8, &value_len, sizeof(value_len));
+  memcpy(buffer + 12, &request_id, sizeof(request_id));
+}
+
+int validate_binary_header(const BinaryHeader *header) {
+  if (header->version != BINARY_VERSION 
+      || header->opcode < OP_LIST || header->opcode > OP_DELETE) {
+    return STATUS_BAD_REQUEST;
+  }
+  if (header->key_len > MAX_BUFLEN || header->value_len > MAX_BUFLEN) {
+    return STATUS_TOO_LONG;
+  }
+  return STATUS_OK;
+}
+
+size_t get_binary_frame_len(const BinaryHeader *header) {
+  return BINARY_HEADER_LEN + header->key_len + header->value_len;
+}
+
+void respond_binary(const BinaryHeader *request, int status, const char *value, 
+                    size_t value_len, Response *response) {
+  BinaryHeader header;
+  header.version = BINARY_VERSION;
+  header.opcode = request->opcode;
+  header.status = status;
+  header.key_len = 0;
+  header.value_len = value_len;
+  header.request_id = request->request_id;
+  response->failed = status != STATUS_OK;
+
+  encode_binary_header(&header, response->header);
+  add_to_response(response, response->header, BINARY_HEADER_LEN);
+  add_to_response(response, value, value_len);
+}
+
+void reject_binary_message(const BinaryHeader *request, int status, 
+                           Response *response) {
+  respond_binary(request, status, NULL, 0, response);
+}
+
+/*
+ * Filenames have to be printable for the LIST of the text protocol
+ */
+int is_valid_key(const char *key, size_t key_len) {
+  if (key_len < 1) {
+    return FALSE;
+  }
+  size_t i;
+  for (i = 0; i < key_len; i++) {
+    if (!isgraph((unsigned char) key[i])) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/*
+ * Copies a field of the frame with a trailing \000 - the store expects 
+ * \000 terminated filenames and contents
+ */
+char *copy_field(const char *field, size_t len, Arena *arena) {
+  char *copy = arena_alloc(arena, len + 1);
+  memcpy(copy, field, len);
+  copy[len] = '\000';
+  return copy;
+}
+
+int get_binary_command(const BinaryHeader *request) {
+  switch (request->opcode) {
+    case OP_LIST:
+      return CMD_LIST;
+    case OP_CREATE:
+      return CMD_CREATE;
+    case OP_READ:
+      return CMD_READ;
+    case OP_UPDATE:
+      return CMD_UPDATE;
+    case OP_DELETE:
+      return CMD_DELETE;
+    default:
+      return CMD_INVALID;
+  }
+}
+
+int classify_binary_message(const BinaryHeader *request) {
+  switch (request->opcode) {
+    case OP_READ:
+      return LANE_POINT;
+    case OP_LIST:
+      return LANE_SCAN;
+    default:
+      return LANE_WRITE;
+  }
+}
+
+/*
+ * The status of a CREATE, UPDATE or DELETE with the given store result
+ */
+int binary_change_status(int result, int failed) {
+  if (result == STORE_READONLY) {
+    return STATUS_READONLY;
+  }
+  return result == 0 ? STATUS_OK : failed;
+}
+
+void handle_binary_message(const BinaryHeader *request, const char *key, 
+                           const char *value, Store *store, Response *response) {
+  if (request->opcode == OP_LIST) {
+    log_info("Performing binary LIST");
+
+    char *files;
+    copy_all_store_IDs(store, &files, response->arena);
+    // the IDs are preceded by \n
+    size_t len = strlen(files);
+    respond_binary(request, STATUS_OK, files + (len > 0), len - (len > 0), response);
+    return;
+  }
+
+  if (!is_valid_key(key, request->key_len)) {
+    reject_binary_message(request, STATUS_BAD_REQUEST, response);
+    return;
+  }
+  char *filename = copy_field(key, request->key_len, response->arena);
+
+  // files are stored with \000 like the text protocol does
+  size_t payload_size = request->value_len + 1;
+  char *content = NULL;
+  if (request->opcode == OP_CREATE || request->opcode == OP_UPDATE) {
+    // files with empty content are not possible in the text protocol either
+    if (request->value_len < 1) {
+      reject_binary_message(request, STATUS_BAD_REQUEST, response);
+      return;
+    }
+    content = copy_field(value, request->value_len, response->arena);
+  }
+
+  int status = STATUS_OK;
+  CachedResponse *cached;
+  switch (request->opcode) {
+    case OP_CREATE:
+      log_info("Performing binary CREATE %s %u", filename, request->value_len);
+      status = binary_change_status(create_store_file(store, filename, content, payload_size), STATUS_FILEEXISTS);
+      break;
+    case OP_READ:
+      log_info("Performing binary READ %s", filename);
+      // the content of the cached text response
+      cached = use_store_response(store, filename, build_read_response, response->arena);
+      if (cached != NULL) {
+        respond_binary(request, STATUS_OK, cached->data + cached->payload_offset, 
+                       cached->payload_len, response);
+        return;
+      }
+      status = STATUS_NOSUCHFILE;
+      break;
+    case OP_UPDATE:
+      log_info("Performing binary UPDATE %s %u", filename, request->value_len);
+      status = binary_change_status(update_store_file(store, filename, content, payload_size), STATUS_NOSUCHFILE);
+      break;
+    case OP_DELETE:
+      log_info("Performing binary DELETE %s", filename);
+      status = binary_change_status(delete_store_file(store, filename), STATUS_NOSUCHFILE);
+      break;
+  }
+  reject_binary_message(request, status, response);
+}
+
+int write_binary_request(int socket, int opcode, uint32_t request_id, 
+                         const char *key, const char *value, size_t value_len) {
+  BinaryHeader header;
+  header.version = BINARY_VERSION;
+  header.opcode = opcode;
+  header.status = STATUS_OK;
+  header.key_len = key != NULL ? strlen(key) : 0;
+  header.value_len = value_len;
+  header.request_id = request_id;
+
+  char encoded[BINARY_HEADER_LEN];
+  encode_binary_header(&header, encoded);
+
+  Response request;
+  init_response(&request, NULL);
+  add_to_response(&request, encoded, BINARY_HEADER_LEN);
+  add_to_response(&request, key, header.key_len);
+  add_to_response(&request, value, value_len);
+  return write_response_to_socket(socket, &request);
+}
+
+/*
+ * Receives exactly len bytes
+ */
+int read_fully(int socket, char *buffer, size_t len) {
+  while (len > 0) {
+    ssize_t received = co_recv(socket, buffer, len, 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return FALSE;
+    }
+    buffer += received;
+    len -= received;
+  }
+  return TRUE;
+}
+
+int read_binary_response(int socket, BinaryHeader *header, char **value) {
+  char encoded[BINARY_HEADER_LEN];
+  *value = NULL;
+
+  if (!read_fully(socket, encoded, BINARY_HEADER_LEN) || !is_binary_message(encoded)) {
+    log_error("No binary response received");
+    return FALSE;
+  }
+  decode_binary_header(encoded, header);
+
+  // the length comes from the peer
+  size_t max_len = header->opcode == OP_LIST ? MAX_BINARY_LIST_LEN : MAX_BUFLEN;
+  if (header->value_len > max_len) {
+    log_error("Binary response %u: value of %u bytes is too long", header->request_id,
+              header->value_len);
+    return FALSE;
+  }
+  *value = malloc(header->value_len + 1);
+  if (*value == NULL) {
+    log_error("Binary response %u: allocation of %u bytes failed", header->request_id,
+              header->value_len);
+    return FALSE;
+  }
+  if (!read_fully(socket, *value, header->value_len)) {
+    log_error("Binary response %u incomplete", header->request_id);
+    free(*value);
+    *value = NULL;
+    return FALSE;
+  }
+  (*value)[header->value_len] = '\000';
+  return TRUE;
+}
@@ -0,0 +1,67 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides a pool of fixed size, cache aligned buffers that are recycled
+ * instead of freed
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <bufferPool.h>
+
+void init_buffer_pool(BufferPool *pool, size_t buffer_size) {
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  pool->mutex = mutex;
+  pool->buffer_size = CACHE_ALIGN(buffer_size);
+  pool->free_buffers = NULL;
+  pool->num_free = 0;
+  pool->num_allocated = 0;
+}
+
+void *acquire_buffer(BufferPool *pool) {
+  int retcode = pthread_mutex_lock(&pool->mutex);
+  handle_thread_error(retcode, "lock buffer pool mutex", THREAD_EXIT);
+
+  void *buffer = pool->free_buffers;
+  if (buffer != NULL) {
+    pool->free_buffers = *(void **) buffer;
+    pool->num_free--;
+  } else {
+    pool->num_allocated++;
+  }
+
+  retcode = pthread_mutex_unlock(&pool->mutex);
+  handle_thread_error(retcode, "unlock buffer pool mutex", THREAD_EXIT);
+
+  if (buffer == NULL) {
+    retcode = posix_memalign(&buffer, CACHE_LINE_SIZE, pool->buffer_size);
+    handle_thread_error(retcode, "allocate pool buffer", PROCESS_EXIT);
+    log_debug("Buffer pool %p: new buffer %p", pool, buffer);
+  }
+  return buffer;
+}
+
+void release_buffer(BufferPool *pool, void *buffer) {
+  int retcode = pthread_mutex_lock(&pool->mutex);
+  handle_thread_error(retcode, "lock buffer pool mutex", THREAD_EXIT);
+
+  *(void **) buffer = pool->free_buffers;
+  pool->free_buffers = buffer;
+  pool->num_free++;
+
+  retcode = pthread_mutex_unlock(&pool->mutex);
+  handle_thread_error(retcode, "unlock buffer pool mutex", THREAD_EXIT);
+}
@@ -23,14 +23,24 @@
 
 #include <concurrentLinkedList.h> 
 #include <termPaperLib.h>
+#include <arena.h>
+#include <lockProfile.h>
 
 #include <string.h>
 
+// source of the sequence numbers of all elements
+unsigned long next_sequence = 0;
+
 ConcurrentLinkedList *newList() {
+  return newListOnHeap(NULL);
+}
+
+ConcurrentLinkedList *newListOnHeap(NodeHeap *heap) {
   ConcurrentLinkedList *list = malloc(sizeof(ConcurrentLinkedList));
   list->firstElement = NULL;
   pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
   list->firstElementMutex = mutex;
+  list->heap = heap;
   return list;
 }
 
@@ -38,7 +48,9 @@ ConcurrentLinkedList *newList() {
  * Indicate interrest for an element 
  */
 void useElement(ConcurrentListElement *element) {
-  int retcode = pthread_mutex_lock(&element->usageMutex);
+  int retcode = lock_profiling 
+      ? lock_profiled_mutex(&element->usageMutex, LOCK_ELEMENT, element->ID, &element->used_at)
+      : pthread_mutex_lock(&element->usageMutex);
   handle_thread_error(retcode, "lock emement mutex", THREAD_EXIT);
 }
 
@@ -46,7 +58,10 @@ void useElement(ConcurrentListElement *element) {
  * Indicate interrest for an elements content
  */
 void use_element_content(ConcurrentListElement *element) {
-  int retcode = pthread_mutex_lock(&element->content_mutex);
+  int retcode = lock_profiling 
+      ? lock_profiled_mutex(&element->content_mutex, LOCK_ELEMENT_CONTENT, element->ID, 
+                            &element->content_used_at)
+      : pthread_mutex_lock(&element->content_mutex);
   handle_thread_error(retcode, "lock emement content mutex", THREAD_EXIT);
 }
 
@@ -54,6 +69,9 @@ void use_element_content(ConcurrentListElement *element) {
  * Return an element 
  */
 void returnElement(ConcurrentListElement *element) {
+  if (lock_profiling) {
+    record_lock_hold(LOCK_ELEMENT, element->used_at);
+  }
   int retcode = pthread_mutex_unlock(&element->usageMutex);
   handle_thread_error(retcode, "unlock emement mutex", THREAD_EXIT);
 }
@@ -62,6 +80,9 @@ void returnElement(ConcurrentListElement *element) {
  * Return an elements content 
  */
 void return_element_content(ConcurrentListElement *element) {
+  if (lock_profiling) {
+    record_lock_hold(LOCK_ELEMENT_CONTENT, element->content_used_at);
+  }
   int retcode = pthread_mutex_unlock(&element->content_mutex);
   handle_thread_error(retcode, "unlock emement content mutex", THREAD_EXIT);
 }
@@ -72,7 +93,10 @@ void return_element_content(ConcurrentListElement *element) {
 void useFirstElement(ConcurrentLinkedList *list) {
 
   // As long as the list exists this lock will never end in nirvana
-  int retcode = pthread_mutex_lock(&list->firstElementMutex);
+  int retcode = lock_profiling 
+      ? lock_profiled_mutex(&list->firstElementMutex, LOCK_FIRST_ELEMENT, NULL, 
+                            &list->first_used_at)
+      : pthread_mutex_lock(&list->firstElementMutex);
   handle_thread_error(retcode, "lock first elements mutex", THREAD_EXIT);
 
   ConcurrentListElement *element = list->firstElement;
@@ -82,6 +106,9 @@ void useFirstElement(ConcurrentLinkedList *list) {
  * Return the first element of a list
  */
 void returnFirstElement(ConcurrentLinkedList *list) {
+  if (lock_profiling) {
+    record_lock_hold(LOCK_FIRST_ELEMENT, list->first_used_at);
+  }
 
   // As long as the list exists this lock will never end in nirvana
   int retcode = pthread_mutex_unlock(&list->firstElementMutex);
@@ -93,7 +120,7 @@ void returnFirstElement(ConcurrentLinkedList *list) {
  * no other thread can access the elemnt right now (the predecessor 
  * has to be locked)
  */
-ConcurrentListElement *removeElement(ConcurrentListElement *element) {
+ConcurrentListElement *removeElement(ConcurrentLinkedList *list, ConcurrentListElement *element) {
   useElement(element);
   use_element_content(element);
   ConcurrentListElement *next = element->nextEntry;
@@ -109,18 +136,26 @@ ConcurrentListElement *removeElement(ConcurrentListElement *element) {
   ret = pthread_mutex_destroy(&(element->content_mutex));
   handle_error(ret, "destroy content mutex failed", PROCESS_EXIT);
 
+  if (element->cached_response != NULL) {
+    releaseCachedResponse(element->cached_response);
+  }
   log_debug("Remove payload: %p", element->payload);
-  free(element->payload);
+  if (!element->borrowed_payload) {
+    heap_free(list->heap, element->payload);
+  }
   log_debug("     Remove ID: %p", element->ID);
-  free(element->ID);
+  if (!element->borrowed_ID) {
+    heap_free(list->heap, element->ID);
+  }
   log_debug("Remove element: %p", element);
-  free(element);
+  heap_free(list->heap, element);
   return next;
 }
 
-ConcurrentListElement *createElement(void **payload, size_t payload_size, char *ID) {
-    ConcurrentListElement *new = malloc(sizeof(ConcurrentListElement));
-    new->payload = malloc(payload_size);
+ConcurrentListElement *createElement(ConcurrentLinkedList *list, void **payload, 
+                                     size_t payload_size, char *ID) {
+    ConcurrentListElement *new = heap_alloc(list->heap, sizeof(ConcurrentListElement));
+    new->payload = heap_alloc(list->heap, payload_size);
     memcpy(new->payload, *payload, payload_size);
 
     log_debug("        Append payload: %p", *payload);
@@ -135,10 +170,14 @@ ConcurrentListElement *createElement(void **payload, size_t payload_size, char *
 
     // strlen + \000
     size_t ID_len = strlen(ID) + 1;
-    new->ID= malloc(ID_len);
+    new->ID= heap_alloc(list->heap, ID_len);
     memcpy(new->ID, ID, ID_len);
 
     new->payload_size=payload_size;
+    new->cached_response = NULL;
+    new->borrowed_ID = FALSE;
+    new->borrowed_payload = FALSE;
+    new->sequence = __atomic_fetch_add(&next_sequence, 1, __ATOMIC_RELAXED);
 
     return new;
 }
@@ -148,7 +187,7 @@ void removeAllElements(ConcurrentLinkedList *list) {
   ConcurrentListElement *first = list->firstElement;
 
   while(first != NULL ) {
-    list->firstElement = removeElement(first);
+    list->firstElement = removeElement(list, first);
     first = list->firstElement;
   }
   returnFirstElement(list);
@@ -159,7 +198,7 @@ void removeFirstListElement(ConcurrentLinkedList *list) {
   ConcurrentListElement *first = list->firstElement;
 
   if(first != NULL ) {
-    list->firstElement = removeElement(first);
+    list->firstElement = removeElement(list, first);
   }
   returnFirstElement(list);
 }
@@ -167,7 +206,7 @@ void removeFirstListElement(ConcurrentLinkedList *list) {
 void appendListElement(ConcurrentLinkedList *list, void **payload, 
     size_t payload_size, char* ID) {
 
-  ConcurrentListElement *new = createElement(payload, payload_size, ID);
+  ConcurrentListElement *new = createElement(list, payload, payload_size, ID);
 
   useFirstElement(list); 
   ConcurrentListElement *next = list->firstElement;
@@ -226,10 +265,36 @@ size_t getFirstListElement(ConcurrentLinkedList *list, void **payload) {
   return payload_size;
 }
 
+/*
+ * Appends \n and the ID to a buffer that grows exponentially 
+ */
+void append_ID(Arena *arena, char **buffer, size_t *used, size_t *capacity, const char *ID) {
+  size_t ID_len = strlen(ID);
+
+  // \n + ID + \000
+  if (*used + ID_len + 2 > *capacity) {
+    size_t old_capacity = *capacity;
+    while (*used + ID_len + 2 > *capacity) {
+      *capacity *= 2;
+    }
+    *buffer = arena_extend(arena, *buffer, old_capacity, *capacity);
+  }
+  (*buffer)[(*used)++] = '\n';
+  memcpy(*buffer + *used, ID, ID_len + 1);
+  *used += ID_len;
+}
+
 size_t getAllElementIDs(ConcurrentLinkedList *list, char **IDs) {
+  return copyAllElementIDs(list, IDs, NULL);
+}
+
+size_t copyAllElementIDs(ConcurrentLinkedList *list, char **IDs, Arena *arena) {
 
   size_t num_elem = 0;
-  char *buffer = "\000";
+  size_t used = 0;
+  size_t capacity = MAX_BUFLEN + 2;
+  char *buffer = arena_alloc(arena, capacity);
+  buffer[0] = '\000';
 
   useFirstElement(list); 
   ConcurrentListElement *next = list->firstElement;
@@ -240,7 +305,7 @@ size_t getAllElementIDs(ConcurrentLinkedList *list, char **IDs) {
     useElement(next);
 
     num_elem++;
-    buffer = join_with_seperator(buffer, next->ID, "\n");
+    append_ID(arena, &buffer, &used, &capacity, next->ID);
 
     returnFirstElement(list); 
     current = next;
@@ -250,7 +315,7 @@ size_t getAllElementIDs(ConcurrentLinkedList *list, char **IDs) {
       useElement(next);
 
       num_elem++;
-      buffer = join_with_seperator(buffer, next->ID, "\n");
+      append_ID(arena, &buffer, &used, &capacity, next->ID);
 
       returnElement(current);
       current = next;
@@ -266,6 +331,123 @@ size_t getAllElementIDs(ConcurrentLinkedList *list, char **IDs) {
   return num_elem;
 }
 
+/*
+ * Appends an entry to an array that grows exponentially
+ */
+void append_entry(Arena *arena, ElementEntry **entries, size_t *used, size_t *capacity, 
+                  ConcurrentListElement *element) {
+  if (*used == *capacity) {
+    *capacity *= 2;
+    *entries = arena_extend(arena, *entries, *used * sizeof(ElementEntry), 
+                            *capacity * sizeof(ElementEntry));
+  }
+  size_t ID_len = strlen(element->ID) + 1;
+  (*entries)[*used].ID = arena_alloc(arena, ID_len);
+  memcpy((*entries)[*used].ID, element->ID, ID_len);
+  (*entries)[*used].sequence = element->sequence;
+  (*used)++;
+}
+
+size_t copyAllElementEntries(ConcurrentLinkedList *list, ElementEntry **entries, 
+                             Arena *arena) {
+  size_t num_elem = 0;
+  size_t capacity = 16;
+  ElementEntry *buffer = arena_alloc(arena, capacity * sizeof(ElementEntry));
+
+  useFirstElement(list); 
+  ConcurrentListElement *next = list->firstElement;
+  ConcurrentListElement *current;
+
+  if(next != NULL ) {
+    useElement(next);
+    append_entry(arena, &buffer, &num_elem, &capacity, next);
+    returnFirstElement(list); 
+    current = next;
+    next = current->nextEntry;
+
+    while(next != NULL ) {
+      useElement(next);
+      append_entry(arena, &buffer, &num_elem, &capacity, next);
+      returnElement(current);
+      current = next;
+      next = current->nextEntry;
+    }
+    returnElement(current);
+  } else {
+    // Empty list
+    returnFirstElement(list); 
+  }
+
+  *entries = buffer;
+  return num_elem;
+}
+
+void visit_element(ConcurrentListElement *element, ElementVisitor visit, void *input) {
+  use_element_content(element);
+  visit(input, element->ID, element->payload, element->payload_size, element->sequence);
+  return_element_content(element);
+}
+
+size_t visitAllElements(ConcurrentLinkedList *list, ElementVisitor visit, void *input) {
+  size_t num_elem = 0;
+
+  useFirstElement(list); 
+  ConcurrentListElement *next = list->firstElement;
+  ConcurrentListElement *current;
+
+  if(next != NULL ) {
+    useElement(next);
+    returnFirstElement(list); 
+    visit_element(next, visit, input);
+    num_elem++;
+    current = next;
+    next = current->nextEntry;
+
+    while(next != NULL ) {
+      useElement(next);
+      returnElement(current);
+      visit_element(next, visit, input);
+      num_elem++;
+      current = next;
+      next = current->nextEntry;
+    }
+    returnElement(current);
+  } else {
+    // Empty list
+    returnFirstElement(list); 
+  }
+  return num_elem;
+}
+
+ConcurrentListElement *appendBorrowedElement(ConcurrentLinkedList *list, 
+    ConcurrentListElement *last, char *ID, void *payload, size_t payload_size, 
+    unsigned long sequence) {
+  ConcurrentListElement *new = heap_alloc(list->heap, sizeof(ConcurrentListElement));
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_mutex_t content_mutex = PTHREAD_MUTEX_INITIALIZER;
+  new->usageMutex = mutex; 
+  new->content_mutex = content_mutex;
+  new->nextEntry = NULL;
+  new->ID = ID;
+  new->payload = payload;
+  new->payload_size = payload_size;
+  new->cached_response = NULL;
+  new->borrowed_ID = TRUE;
+  new->borrowed_payload = TRUE;
+  new->sequence = sequence;
+
+  if (sequence >= next_sequence) {
+    next_sequence = sequence + 1;
+  }
+
+  if (last != NULL) {
+    last->nextEntry = new;
+  } else {
+    list->firstElement = new;
+  }
+  return new;
+}
+
 /**
  * Returns a element for the given ID (if existing)
  * this function keeps an active lock on the predecessor so 
@@ -318,6 +500,22 @@ ConcurrentListElement *useElementByID(ConcurrentLinkedList *list, ConcurrentList
 }
 
 size_t getElementByID(ConcurrentLinkedList *list, void **payload, char *ID) {
+  return copyElementByID(list, payload, ID, NULL);
+}
+
+int containsListElement(ConcurrentLinkedList *list, char *ID) {
+  ConcurrentListElement *predecessor;
+  ConcurrentListElement *elem = useElementByID(list, &predecessor, ID);
+
+  if(predecessor != NULL){
+    returnElement(predecessor);
+  } else {
+    returnFirstElement(list);
+  }
+  return elem != NULL;
+}
+
+size_t copyElementByID(ConcurrentLinkedList *list, void **payload, char *ID, Arena *arena) {
   size_t payload_size = 0; 
   *payload = NULL; 
 
@@ -330,7 +528,7 @@ size_t getElementByID(ConcurrentLinkedList *list, void **payload, char *ID) {
     use_element_content(elem);
     returnElement(elem);
     payload_size = elem->payload_size;
-    *payload = malloc(payload_size);
+    *payload = arena_alloc(arena, payload_size);
     memcpy(*payload, elem->payload, payload_size);
     return_element_content(elem);
   }
@@ -344,6 +542,55 @@ size_t getElementByID(ConcurrentLinkedList *list, void **payload, char *ID) {
   return payload_size;
 }
 
+CachedResponse *useCachedResponse(ConcurrentLinkedList *list, char *ID, 
+                                  ResponseBuilder build) {
+  CachedResponse *response = NULL;
+
+  ConcurrentListElement *elem;
+  ConcurrentListElement *predecessor;
+  elem = useElementByID(list, &predecessor, ID) ;
+
+  if (elem != NULL) {
+    useElement(elem);
+    use_element_content(elem);
+    returnElement(elem);
+  }
+
+  // Return other elements asap
+  if(predecessor != NULL){
+    returnElement(predecessor);
+  } else {
+    returnFirstElement(list);
+  }
+
+  if (elem != NULL) {
+    response = elem->cached_response;
+    if (response == NULL) {
+      size_t len = build(elem->ID, elem->payload, elem->payload_size, NULL);
+      response = heap_alloc(list->heap, sizeof(CachedResponse) + len);
+      // the reference of the element
+      response->references = 1;
+      response->heap = list->heap;
+      response->len = len;
+      build(elem->ID, elem->payload, elem->payload_size, response);
+      elem->cached_response = response;
+    }
+    referenceCachedResponse(response, 1);
+    return_element_content(elem);
+  }
+  return response;
+}
+
+void referenceCachedResponse(CachedResponse *response, long count) {
+  __atomic_add_fetch(&response->references, count, __ATOMIC_RELAXED);
+}
+
+void releaseCachedResponse(CachedResponse *response) {
+  if (__atomic_sub_fetch(&response->references, 1, __ATOMIC_ACQ_REL) == 0) {
+    heap_free(response->heap, response);
+  }
+}
+
 int appendUniqueListElement(ConcurrentLinkedList *list, void **payload, 
     size_t payload_size, char* ID) {
   int return_value = 0;
@@ -353,7 +600,7 @@ int appendUniqueListElement(ConcurrentLinkedList *list, void **payload,
   elem = useElementByID(list, &predecessor, ID) ;
 
   if (elem == NULL) {
-    ConcurrentListElement *new = createElement(payload, payload_size, ID);
+    ConcurrentListElement *new = createElement(list, payload, payload_size, ID);
 
     if(predecessor != NULL){
       predecessor->nextEntry = new;
@@ -380,7 +627,7 @@ size_t removeListElementByID(ConcurrentLinkedList *list, char *ID) {
   elem = useElementByID(list, &predecessor, ID) ;
 
   if (elem != NULL) {
-    ConcurrentListElement *next = removeElement(elem);
+    ConcurrentListElement *next = removeElement(list, elem);
     if (elem != NULL) {
       if(predecessor != NULL){
         predecessor->nextEntry = next;
@@ -423,11 +670,20 @@ size_t updateListElementByID(ConcurrentLinkedList *list, void **payload, size_t
 
   if (elem != NULL) {
 
-    free(elem->payload);
-    elem->payload = malloc(payload_size);
+    if (!elem->borrowed_payload) {
+      heap_free(list->heap, elem->payload);
+    }
+    elem->borrowed_payload = FALSE;
+    elem->payload = heap_alloc(list->heap, payload_size);
     memcpy(elem->payload, *payload, payload_size);
     elem->payload_size = payload_size;
+    // readers that still send the old response keep it alive
+    CachedResponse *cached_response = elem->cached_response;
+    elem->cached_response = NULL;
     return_element_content(elem);
+    if (cached_response != NULL) {
+      releaseCachedResponse(cached_response);
+    }
     return_value = 0;
   } 
 
@@ -0,0 +1,705 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides stackful coroutines that are scheduled on a few worker threads
+ * and wait for sockets via epoll instead of blocking
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <termPaperLib.h>
+#include <bufferPool.h>
+#include <placement.h>
+#include <workDeque.h>
+#include <coroutine.h>
+
+#ifndef __x86_64__
+#include <ucontext.h>
+#endif
+
+// max. number of socket events handled at once
+#define MAX_EVENTS 256
+
+// written to the lowest word of every stack - detects stack overflows
+#define STACK_CANARY 0xC0DEC0DEC0DEC0DEUL
+
+enum coroutine_state {
+  CO_RUNNABLE,
+  CO_WAITING,
+  CO_PARKED,
+  CO_FINISHED
+};
+
+#ifdef __x86_64__
+// the registers are saved on the stack itself
+typedef struct Context {
+  void *sp;
+} Context;
+#else
+typedef struct Context {
+  ucontext_t uc;
+} Context;
+#endif
+
+typedef struct Coroutine {
+  Context context;
+  void (*routine)(void *input);
+  void *input;
+  char *stack;
+  int state;
+  int wait_fd;
+  uint32_t wait_events;
+  struct Worker *worker;
+  struct Coroutine *next;
+} Coroutine;
+
+// a coroutine that was not yet picked up by its worker
+typedef struct Task {
+  void (*routine)(void *input);
+  void *input;
+  struct Task *next;
+} Task;
+
+// Every worker only runs its own coroutines - they never move to another
+// thread, so thread locals (errno!) stay valid across a wait. Only the work
+// items they submit are shared
+typedef struct Worker {
+  // work items submitted by the coroutines of this worker
+  WorkDeque deque;
+  // set while the worker blocks in epoll_wait - submitters wake it
+  int idle;
+  pthread_t thread;
+  int index;
+  int pin_thread;
+  int epoll_fd;
+  // wakes the worker if a coroutine was spawned
+  int wake_fd;
+  pthread_mutex_t inbox_mutex;
+  Task *inbox_head;
+  Task *inbox_tail;
+  // parked coroutines that were woken by other threads
+  Coroutine *woken;
+  Coroutine *run_head;
+  Coroutine *run_tail;
+  Coroutine *pool;
+  int pooled;
+  Context scheduler;
+} Worker;
+
+Worker *workers = NULL;
+int num_workers = 0;
+int work_stealing = FALSE;
+unsigned long next_worker = 0;
+long live_coroutines = 0;
+
+__thread Coroutine *current_coroutine = NULL;
+__thread Worker *current_worker = NULL;
+
+void run_current_coroutine();
+
+#ifdef __x86_64__
+/*
+ * Saves the callee saved registers on the current stack, switches the stack
+ * and restores the registers of the other side - no syscall needed
+ */
+void switch_context(Context *from, Context *to);
+void coroutine_trampoline();
+
+__asm__ (
+  ".text\n"
+  ".globl switch_context\n"
+  ".type switch_context, @function\n"
+  "switch_context:\n"
+  "  pushq %rbp\n"
+  "  pushq %rbx\n"
+  "  pushq %r12\n"
+  "  pushq %r13\n"
+  "  pushq %r14\n"
+  "  pushq %r15\n"
+  "  movq %rsp, (%rdi)\n"
+  "  movq (%rsi), %rsp\n"
+  "  popq %r15\n"
+  "  popq %r14\n"
+  "  popq %r13\n"
+  "  popq %r12\n"
+  "  popq %rbx\n"
+  "  popq %rbp\n"
+  "  ret\n"
+  ".size switch_context, .-switch_context\n"
+  ".globl coroutine_trampoline\n"
+  ".type coroutine_trampoline, @function\n"
+  "coroutine_trampoline:\n"
+  "  call run_current_coroutine\n"
+  "  ud2\n"
+  ".size coroutine_trampoline, .-coroutine_trampoline\n"
+);
+
+void init_context(Coroutine *coroutine) {
+  uintptr_t top = (uintptr_t) (coroutine->stack + COROUTINE_STACK_SIZE) & ~(uintptr_t) 15;
+
+  // 6 registers and the return address - the trampoline starts 16 byte aligned
+  void **sp = (void **) (top - 72);
+  memset(sp, 0, 6 * sizeof(void *));
+  sp[6] = (void *) coroutine_trampoline;
+  coroutine->context.sp = sp;
+}
+#else
+void switch_context(Context *from, Context *to) {
+  swapcontext(&from->uc, &to->uc);
+}
+
+void init_context(Coroutine *coroutine) {
+  getcontext(&coroutine->context.uc);
+  coroutine->context.uc.uc_stack.ss_sp = coroutine->stack;
+  coroutine->context.uc.uc_stack.ss_size = COROUTINE_STACK_SIZE;
+  coroutine->context.uc.uc_link = NULL;
+  makecontext(&coroutine->context.uc, run_current_coroutine, 0);
+}
+#endif
+
+void run_current_coroutine() {
+  Coroutine *coroutine = current_coroutine;
+  coroutine->routine(coroutine->input);
+  exit_coroutine();
+}
+
+void lock_inbox(Worker *worker) {
+  int retcode = pthread_mutex_lock(&worker->inbox_mutex);
+  handle_thread_error(retcode, "lock inbox mutex", PROCESS_EXIT);
+}
+
+void unlock_inbox(Worker *worker) {
+  int retcode = pthread_mutex_unlock(&worker->inbox_mutex);
+  handle_thread_error(retcode, "unlock inbox mutex", PROCESS_EXIT);
+}
+
+void push_runnable(Worker *worker, Coroutine *coroutine) {
+  coroutine->next = NULL;
+  if (worker->run_tail != NULL) {
+    worker->run_tail->next = coroutine;
+  } else {
+    worker->run_head = coroutine;
+  }
+  worker->run_tail = coroutine;
+}
+
+Coroutine *pop_runnable(Worker *worker) {
+  Coroutine *coroutine = worker->run_head;
+  if (coroutine != NULL) {
+    worker->run_head = coroutine->next;
+    if (worker->run_head == NULL) {
+      worker->run_tail = NULL;
+    }
+  }
+  return coroutine;
+}
+
+/*
+ * Returns a finished coroutine of the worker or maps a new stack
+ */
+Coroutine *new_coroutine(Worker *worker, Task *task) {
+  Coroutine *coroutine = worker->pool;
+  if (coroutine != NULL) {
+    worker->pool = coroutine->next;
+    worker->pooled--;
+  } else {
+    coroutine = malloc(sizeof(Coroutine));
+    // no guard page - adjacent stacks merge into one mapping, so 100k 
+    // coroutines don't exhaust the mappings of the process
+    coroutine->stack = mmap(NULL, COROUTINE_STACK_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (coroutine->stack == MAP_FAILED) {
+      handle_error(-1, "mmap() of a coroutine stack failed", PROCESS_EXIT);
+    }
+    *(unsigned long *) coroutine->stack = STACK_CANARY;
+  }
+
+  coroutine->routine = task->routine;
+  coroutine->input = task->input;
+  coroutine->state = CO_RUNNABLE;
+  coroutine->worker = worker;
+  init_context(coroutine);
+  return coroutine;
+}
+
+void retire_coroutine(Worker *worker, Coroutine *coroutine) {
+  __atomic_sub_fetch(&live_coroutines, 1, __ATOMIC_RELAXED);
+
+  if (worker->pooled < MAX_POOLED_COROUTINES) {
+    coroutine->next = worker->pool;
+    worker->pool = coroutine;
+    worker->pooled++;
+  } else {
+    munmap(coroutine->stack, COROUTINE_STACK_SIZE);
+    free(coroutine);
+  }
+}
+
+/*
+ * Lets epoll wake the coroutine once the socket is ready
+ */
+void arm_coroutine(Worker *worker, Coroutine *coroutine) {
+  struct epoll_event event;
+  event.events = coroutine->wait_events | EPOLLONESHOT;
+  event.data.ptr = coroutine;
+
+  if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, coroutine->wait_fd, &event) == 0) {
+    return;
+  }
+  if (errno == ENOENT 
+      && epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, coroutine->wait_fd, &event) == 0) {
+    return;
+  }
+  // the retry of the coroutine reports the error
+  push_runnable(worker, coroutine);
+}
+
+void resume_coroutine(Worker *worker, Coroutine *coroutine) {
+  current_coroutine = coroutine;
+  switch_context(&worker->scheduler, &coroutine->context);
+  current_coroutine = NULL;
+
+  if (*(unsigned long *) coroutine->stack != STACK_CANARY) {
+    log_error("Coroutine %p overflowed its stack of %d bytes", coroutine, 
+              COROUTINE_STACK_SIZE);
+    exit_by_type(PROCESS_EXIT);
+  }
+
+  switch (coroutine->state) {
+    case CO_RUNNABLE:
+      push_runnable(worker, coroutine);
+      break;
+    case CO_WAITING:
+      arm_coroutine(worker, coroutine);
+      break;
+    case CO_PARKED:
+      // the thread that wakes it puts it back
+      break;
+    case CO_FINISHED:
+      retire_coroutine(worker, coroutine);
+      break;
+  }
+}
+
+/*
+ * Turns the spawned tasks into runnable coroutines
+ */
+void take_inbox(Worker *worker) {
+  lock_inbox(worker);
+  Task *task = worker->inbox_head;
+  worker->inbox_head = NULL;
+  worker->inbox_tail = NULL;
+  Coroutine *woken = worker->woken;
+  worker->woken = NULL;
+  unlock_inbox(worker);
+
+  while (woken != NULL) {
+    Coroutine *next = woken->next;
+    woken->state = CO_RUNNABLE;
+    push_runnable(worker, woken);
+    woken = next;
+  }
+
+  while (task != NULL) {
+    Task *next = task->next;
+    push_runnable(worker, new_coroutine(worker, task));
+    free(task);
+    task = next;
+  }
+}
+
+/*
+ * Lets the worker of the coroutine know that there is something to do -
+ * returns 0 or an error number
+ */
+int wake_worker(Worker *worker) {
+  uint64_t wake = 1;
+  while (write(worker->wake_fd, &wake, sizeof(wake)) < 0) {
+    if (errno != EINTR) {
+      log_error("Worker %d: wake up failed", worker->index);
+      return errno;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Makes a parked coroutine runnable again - may be called from any thread.
+ * If the coroutine did not park yet it is resumed only after it parked, 
+ * since its own worker takes it out of the inbox
+ */
+void wake_coroutine(Coroutine *coroutine) {
+  Worker *worker = coroutine->worker;
+  // its own worker only runs one thing at a time - the coroutine is parked
+  if (worker == current_worker) {
+    coroutine->state = CO_RUNNABLE;
+    push_runnable(worker, coroutine);
+    return;
+  }
+
+  lock_inbox(worker);
+  coroutine->next = worker->woken;
+  worker->woken = coroutine;
+  unlock_inbox(worker);
+  wake_worker(worker);
+}
+
+void run_work_item(WorkItem *item) {
+  item->task(item->input);
+  signal_completion(&item->done);
+}
+
+/*
+ * Executes the items the coroutines of the worker submitted - newest first
+ */
+void run_own_work(Worker *worker) {
+  WorkItem *item;
+  while ((item = (WorkItem *) pop_work(&worker->deque)) != NULL) {
+    run_work_item(item);
+  }
+}
+
+/*
+ * Executes the oldest item of the first other worker that has one
+ * returns FALSE if there was nothing to steal
+ */
+int steal_other_work(Worker *worker) {
+  int i;
+  for (i = 1; i < num_workers; i++) {
+    Worker *victim = &workers[(worker->index + i) % num_workers];
+    WorkItem *item = (WorkItem *) steal_work(&victim->deque);
+    if (item != NULL) {
+      log_debug("Worker %d: stole work from worker %d", worker->index, victim->index);
+      run_work_item(item);
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/*
+ * Wakes one idle worker other than the caller so it can steal
+ */
+void wake_idle_worker(Worker *self) {
+  int i;
+  for (i = 1; i < num_workers; i++) {
+    Worker *worker = &workers[(self->index + i) % num_workers];
+    int idle = TRUE;
+    if (__atomic_compare_exchange_n(&worker->idle, &idle, FALSE, FALSE, 
+                                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      wake_worker(worker);
+      return;
+    }
+  }
+}
+
+void *run_worker(void *input) {
+  Worker *worker = (Worker *) input;
+  current_worker = worker;
+  log_info("Thread %ld: Hello from WORKER %d", (long) pthread_self(), worker->index);
+
+  if (worker->pin_thread) {
+    int retcode = pin_thread_to_cpu(worker->index + 1);
+    handle_thread_error(retcode, "Pin worker thread", NO_EXIT);
+  }
+
+  struct epoll_event events[MAX_EVENTS];
+  while (TRUE) {
+    take_inbox(worker);
+
+    // one round - coroutines that yield run again after the next poll
+    Coroutine *last = worker->run_tail;
+    Coroutine *coroutine;
+    while (last != NULL && (coroutine = pop_runnable(worker)) != NULL) {
+      resume_coroutine(worker, coroutine);
+      if (coroutine == last) {
+        break;
+      }
+    }
+
+    // all coroutines of the round are parked or waiting - execute what 
+    // they submitted, then help the others
+    run_own_work(worker);
+    if (work_stealing && worker->run_head == NULL && steal_other_work(worker)) {
+      continue;
+    }
+
+    // only block if nothing is left to run
+    int timeout = worker->run_head != NULL ? 0 : -1;
+    if (work_stealing && timeout < 0) {
+      // announce before the last look - a submitter either sees the flag
+      // or its item is seen here
+      __atomic_store_n(&worker->idle, TRUE, __ATOMIC_SEQ_CST);
+      if (steal_other_work(worker)) {
+        __atomic_store_n(&worker->idle, FALSE, __ATOMIC_RELAXED);
+        continue;
+      }
+    }
+    int num_events = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, timeout);
+    if (num_events < 0 && errno != EINTR) {
+      handle_error(num_events, "epoll_wait() failed", PROCESS_EXIT);
+    }
+    __atomic_store_n(&worker->idle, FALSE, __ATOMIC_RELAXED);
+
+    int i;
+    for (i = 0; i < num_events; i++) {
+      if (events[i].data.ptr == NULL) {
+        uint64_t spawned;
+        if (read(worker->wake_fd, &spawned, sizeof(spawned)) < 0) {
+          log_debug("Worker %d: nothing spawned", worker->index);
+        }
+      } else {
+        Coroutine *woken = (Coroutine *) events[i].data.ptr;
+        woken->state = CO_RUNNABLE;
+        push_runnable(worker, woken);
+      }
+    }
+  }
+  return NULL;
+}
+
+void start_coroutine_scheduler(int num, int pin_threads, int steal) {
+  num_workers = num;
+  work_stealing = steal;
+  int retcode = posix_memalign((void **) &workers, CACHE_LINE_SIZE, num_workers * sizeof(Worker));
+  handle_thread_error(retcode, "Allocate workers", PROCESS_EXIT);
+
+  int i;
+  for (i = 0; i < num_workers; i++) {
+    Worker *worker = &workers[i];
+    memset(worker, 0, sizeof(Worker));
+    worker->index = i;
+    worker->pin_thread = pin_threads;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    worker->inbox_mutex = mutex;
+    init_work_deque(&worker->deque);
+
+    worker->epoll_fd = epoll_create1(0);
+    handle_error(worker->epoll_fd, "epoll_create1() failed", PROCESS_EXIT);
+    worker->wake_fd = eventfd(0, EFD_NONBLOCK);
+    handle_error(worker->wake_fd, "eventfd() failed", PROCESS_EXIT);
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    retcode = epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wake_fd, &event);
+    handle_error(retcode, "epoll_ctl() of the wake fd failed", PROCESS_EXIT);
+
+    retcode = pthread_create(&worker->thread, NULL, run_worker, worker);
+    handle_thread_error(retcode, "Create worker thread", PROCESS_EXIT);
+  }
+}
+
+/*
+ * Takes a task out of the inbox - FALSE if the worker took it already
+ */
+int unqueue_task(Worker *worker, Task *task) {
+  lock_inbox(worker);
+  Task **link = &worker->inbox_head;
+  Task *previous = NULL;
+  while (*link != NULL && *link != task) {
+    previous = *link;
+    link = &previous->next;
+  }
+  int found = *link == task;
+  if (found) {
+    *link = task->next;
+    if (worker->inbox_tail == task) {
+      worker->inbox_tail = previous;
+    }
+  }
+  unlock_inbox(worker);
+  return found;
+}
+
+int spawn_coroutine(void (*routine)(void *input), void *input) {
+  Task *task = malloc(sizeof(Task));
+  if (task == NULL) {
+    return ENOMEM;
+  }
+  task->routine = routine;
+  task->input = input;
+  task->next = NULL;
+
+  Worker *worker = &workers[__atomic_fetch_add(&next_worker, 1, __ATOMIC_RELAXED) % num_workers];
+  __atomic_add_fetch(&live_coroutines, 1, __ATOMIC_RELAXED);
+
+  lock_inbox(worker);
+  if (worker->inbox_tail != NULL) {
+    worker->inbox_tail->next = task;
+  } else {
+    worker->inbox_head = task;
+  }
+  worker->inbox_tail = task;
+  unlock_inbox(worker);
+
+  int retcode = wake_worker(worker);
+  // the caller frees the input on an error - the task must not run then,
+  // unless the worker took it already after an earlier wake up
+  if (retcode != 0 && unqueue_task(worker, task)) {
+    __atomic_sub_fetch(&live_coroutines, 1, __ATOMIC_RELAXED);
+    free(task);
+    return retcode;
+  }
+  return 0;
+}
+
+int in_coroutine() {
+  return current_coroutine != NULL;
+}
+
+/*
+ * Hands the worker back to the scheduler - the state tells it what to do
+ */
+void switch_to_scheduler(Coroutine *coroutine, int state) {
+  coroutine->state = state;
+  switch_context(&coroutine->context, &coroutine->worker->scheduler);
+}
+
+void yield_coroutine() {
+  if (in_coroutine()) {
+    switch_to_scheduler(current_coroutine, CO_RUNNABLE);
+  }
+}
+
+void exit_coroutine() {
+  switch_to_scheduler(current_coroutine, CO_FINISHED);
+  // a finished coroutine is never resumed
+  __builtin_unreachable();
+}
+
+void init_completion(Completion *completion) {
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+  completion->mutex = mutex;
+  completion->done_cond = done_cond;
+  completion->done = FALSE;
+  completion->waiter = NULL;
+}
+
+void wait_for_completion(Completion *completion) {
+  int retcode = pthread_mutex_lock(&completion->mutex);
+  handle_thread_error(retcode, "lock completion mutex", THREAD_EXIT);
+
+  if (in_coroutine()) {
+    if (!completion->done) {
+      completion->waiter = current_coroutine;
+      retcode = pthread_mutex_unlock(&completion->mutex);
+      handle_thread_error(retcode, "unlock completion mutex", THREAD_EXIT);
+      switch_to_scheduler(current_coroutine, CO_PARKED);
+      return;
+    }
+  } else {
+    while (!completion->done) {
+      retcode = pthread_cond_wait(&completion->done_cond, &completion->mutex);
+      handle_thread_error(retcode, "wait for completion", THREAD_EXIT);
+    }
+  }
+
+  retcode = pthread_mutex_unlock(&completion->mutex);
+  handle_thread_error(retcode, "unlock completion mutex", THREAD_EXIT);
+}
+
+void signal_completion(Completion *completion) {
+  int retcode = pthread_mutex_lock(&completion->mutex);
+  handle_thread_error(retcode, "lock completion mutex", THREAD_EXIT);
+
+  completion->done = TRUE;
+  Coroutine *waiter = (Coroutine *) completion->waiter;
+  // a waiting thread can't return before the unlock
+  if (waiter == NULL) {
+    retcode = pthread_cond_signal(&completion->done_cond);
+    handle_thread_error(retcode, "signal completion", THREAD_EXIT);
+  }
+
+  retcode = pthread_mutex_unlock(&completion->mutex);
+  handle_thread_error(retcode, "unlock completion mutex", THREAD_EXIT);
+
+  if (waiter != NULL) {
+    wake_coroutine(waiter);
+  }
+}
+
+void submit_work(WorkItem *item, void (*task)(void *input), void *input) {
+  item->task = task;
+  item->input = input;
+  init_completion(&item->done);
+
+  Worker *worker = current_worker;
+  if (!in_coroutine() || !push_work(&worker->deque, item)) {
+    run_work_item(item);
+    return;
+  }
+
+  if (work_stealing) {
+    // pairs with the idle announcement of the worker
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    wake_idle_worker(worker);
+  }
+}
+
+long get_live_coroutines() {
+  return __atomic_load_n(&live_coroutines, __ATOMIC_RELAXED);
+}
+
+/*
+ * TRUE if the call failed only because the socket is not ready and the caller
+ * can wait for it
+ */
+int should_wait(ssize_t result) {
+  return result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && in_coroutine();
+}
+
+void wait_for_socket(int socket, uint32_t events) {
+  Coroutine *coroutine = current_coroutine;
+  coroutine->wait_fd = socket;
+  coroutine->wait_events = events;
+  switch_to_scheduler(coroutine, CO_WAITING);
+}
+
+ssize_t co_recv(int socket, void *buffer, size_t len, int flags) {
+  ssize_t result;
+  while (should_wait(result = recv(socket, buffer, len, flags))) {
+    wait_for_socket(socket, EPOLLIN | EPOLLRDHUP);
+  }
+  return result;
+}
+
+ssize_t co_send(int socket, const void *buffer, size_t len, int flags) {
+  ssize_t result;
+  while (should_wait(result = send(socket, buffer, len, flags))) {
+    wait_for_socket(socket, EPOLLOUT);
+  }
+  return result;
+}
+
+ssize_t co_writev(int socket, const struct iovec *parts, int num_parts) {
+  ssize_t result;
+  while (should_wait(result = writev(socket, parts, num_parts))) {
+    wait_for_socket(socket, EPOLLOUT);
+  }
+  return result;
+}
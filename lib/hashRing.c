@@ -0,0 +1,94 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides a consistent hash ring that maps filenames to the backends of the
+ * router
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <termPaperLib.h>
+#include <hashRing.h>
+
+/*
+ * FNV-1a with the finalizer of MurmurHash3 - FNV alone clusters the points 
+ * of similar names like "host:port#1" and "host:port#2"
+ */
+uint64_t hash_ring_key(const char *key) {
+  uint64_t hash = 14695981039346656037UL;
+  for (; *key != '\000'; key++) {
+    hash ^= (unsigned char) *key;
+    hash *= 1099511628211UL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdUL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53UL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+int compare_ring_points(const void *a, const void *b) {
+  uint64_t first = ((const RingPoint *) a)->hash;
+  uint64_t second = ((const RingPoint *) b)->hash;
+  return (first > second) - (first < second);
+}
+
+HashRing *new_hash_ring(char **names, int num_backends, int virtual_nodes) {
+  if (virtual_nodes < 1) {
+    virtual_nodes = 1;
+  }
+
+  HashRing *ring = malloc(sizeof(HashRing));
+  ring->num_points = num_backends * virtual_nodes;
+  ring->points = malloc(ring->num_points * sizeof(RingPoint));
+
+  char key[MAX_BUFLEN + 16];
+  int i, j;
+  for (i = 0; i < num_backends; i++) {
+    for (j = 0; j < virtual_nodes; j++) {
+      snprintf(key, sizeof(key), "%s#%d", names[i], j);
+      ring->points[i * virtual_nodes + j].hash = hash_ring_key(key);
+      ring->points[i * virtual_nodes + j].backend = i;
+    }
+  }
+  qsort(ring->points, ring->num_points, sizeof(RingPoint), compare_ring_points);
+  return ring;
+}
+
+int get_ring_backend(HashRing *ring, const char *ID) {
+  uint64_t hash = hash_ring_key(ID);
+
+  // first point at or after the hash - the ring wraps around
+  int low = 0;
+  int high = ring->num_points;
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    if (ring->points[middle].hash < hash) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low == ring->num_points) {
+    low = 0;
+  }
+  return ring->points[low].backend;
+}
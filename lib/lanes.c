@@ -0,0 +1,121 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the priority lanes - separate queues and worker groups for 
+ * cheap and expensive requests
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+
+#include <termPaperLib.h>
+#include <lanes.h>
+
+const char *lane_names[NUM_LANES] = { "POINT", "SCAN", "WRITE" };
+
+void lock_lane(Lane *lane) {
+  int retcode = pthread_mutex_lock(&lane->mutex);
+  handle_thread_error(retcode, "lock lane mutex", THREAD_EXIT);
+}
+
+void unlock_lane(Lane *lane) {
+  int retcode = pthread_mutex_unlock(&lane->mutex);
+  handle_thread_error(retcode, "unlock lane mutex", THREAD_EXIT);
+}
+
+void *run_lane_worker(void *input) {
+  Lane *lane = (Lane *) input;
+  log_info("Thread %ld: Hello from %s lane", (long) pthread_self(), lane->name);
+
+  while (TRUE) {
+    lock_lane(lane);
+    while (lane->head == NULL) {
+      int retcode = pthread_cond_wait(&lane->not_empty, &lane->mutex);
+      handle_thread_error(retcode, "wait for lane job", THREAD_EXIT);
+    }
+    LaneJob *job = lane->head;
+    lane->head = job->next;
+    if (lane->head == NULL) {
+      lane->tail = NULL;
+    }
+    unlock_lane(lane);
+
+    job->task(job->input);
+    signal_completion(&job->done);
+  }
+  return NULL;
+}
+
+void start_lanes(Lanes *lanes, const char *weights) {
+  int workers[NUM_LANES] = { 0, 0, 0 };
+  lanes->enabled = weights != NULL;
+
+  if (lanes->enabled) {
+    if (sscanf(weights, "%d,%d,%d", &workers[LANE_POINT], &workers[LANE_SCAN], 
+               &workers[LANE_WRITE]) != NUM_LANES
+        || workers[LANE_POINT] < 1 || workers[LANE_SCAN] < 1 || workers[LANE_WRITE] < 1) {
+      log_error("Lanes need at least one worker each: points,scans,writes - got %s", weights);
+      exit_by_type(PROCESS_EXIT);
+    }
+  }
+
+  int i, j;
+  for (i = 0; i < NUM_LANES; i++) {
+    Lane *lane = &lanes->lanes[i];
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+    lane->name = lane_names[i];
+    lane->mutex = mutex;
+    lane->not_empty = not_empty;
+    lane->head = NULL;
+    lane->tail = NULL;
+    lane->num_workers = workers[i];
+
+    for (j = 0; j < lane->num_workers; j++) {
+      pthread_t thread;
+      int retcode = pthread_create(&thread, NULL, run_lane_worker, lane);
+      handle_thread_error(retcode, "Create lane worker", PROCESS_EXIT);
+    }
+  }
+}
+
+void run_in_lane(Lanes *lanes, int lane_no, void (*task)(void *input), void *input) {
+  if (!lanes->enabled) {
+    task(input);
+    return;
+  }
+
+  LaneJob job;
+  job.task = task;
+  job.input = input;
+  job.next = NULL;
+  init_completion(&job.done);
+
+  Lane *lane = &lanes->lanes[lane_no];
+  lock_lane(lane);
+  if (lane->tail != NULL) {
+    lane->tail->next = &job;
+  } else {
+    lane->head = &job;
+  }
+  lane->tail = &job;
+  int retcode = pthread_cond_signal(&lane->not_empty);
+  handle_thread_error(retcode, "signal lane job", THREAD_EXIT);
+  unlock_lane(lane);
+
+  wait_for_completion(&job.done);
+}
@@ -0,0 +1,138 @@
+/*
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the lock profiling of the store - how long the threads wait
+ * for the locks of the lists and hold them, and which files are contended
+ * most
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <termPaperLib.h>
+#include <lockProfile.h>
+#include <hashRing.h>
+#include <stats.h>
+
+int lock_profiling = 0;
+
+// contended files - a slot is taken for good by the first file of its hash
+HotKey *hot_keys = NULL;
+
+void start_lock_profiling(int num_hot_keys) {
+  if (num_hot_keys < 1) {
+    return;
+  }
+  hot_keys = calloc(HOT_KEY_SLOTS, sizeof(HotKey));
+  if (hot_keys == NULL) {
+    log_error("Allocation of the hot keys failed");
+    exit_by_type(PROCESS_EXIT);
+  }
+  lock_profiling = num_hot_keys < HOT_KEY_SLOTS ? num_hot_keys : HOT_KEY_SLOTS;
+  log_info("Profiling the locks of the store");
+}
+
+/*
+ * Adds a contended acquisition to the slot of the file - the filename is
+ * copied by the thread that takes the slot, a report at the same time may
+ * show it incomplete
+ */
+void record_hot_key(const char *key, unsigned long wait) {
+  uint64_t hash = hash_ring_key(key);
+  if (hash == 0) {
+    hash = 1;
+  }
+
+  int i;
+  for (i = 0; i < HOT_KEY_PROBES; i++) {
+    HotKey *slot = &hot_keys[(hash + i) & (HOT_KEY_SLOTS - 1)];
+    uint64_t owner = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+    if (owner == 0 && __atomic_compare_exchange_n(&slot->hash, &owner, hash, FALSE,
+                                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      strncpy(slot->key, key, HOT_KEY_LEN);
+      owner = hash;
+    }
+    if (owner == hash) {
+      __atomic_add_fetch(&slot->contended, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&slot->wait, wait, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+}
+
+int lock_profiled_mutex(pthread_mutex_t *mutex, int lock_class, const char *key,
+                        uint64_t *locked_at) {
+  // most acquisitions don't wait - they are counted with a wait of 0
+  int retcode = pthread_mutex_trylock(mutex);
+  if (retcode == 0) {
+    *locked_at = get_stats_time();
+    record_lock_wait(lock_class, FALSE, 0);
+    return 0;
+  } else if (retcode != EBUSY) {
+    return retcode;
+  }
+
+  uint64_t started = get_stats_time();
+  retcode = pthread_mutex_lock(mutex);
+  *locked_at = get_stats_time();
+  if (retcode == 0) {
+    record_lock_wait(lock_class, TRUE, *locked_at - started);
+    if (key != NULL) {
+      record_hot_key(key, *locked_at - started);
+    }
+  }
+  return retcode;
+}
+
+void record_lock_hold(int lock_class, uint64_t locked_at) {
+  record_lock_hold_time(lock_class, get_stats_time() - locked_at);
+}
+
+int compare_hot_keys(const void *a, const void *b) {
+  unsigned long first = ((const HotKey *) a)->wait;
+  unsigned long second = ((const HotKey *) b)->wait;
+  return (first < second) - (first > second);
+}
+
+int get_hot_keys(HotKey *keys) {
+  if (!lock_profiling) {
+    return 0;
+  }
+
+  HotKey *taken = malloc(HOT_KEY_SLOTS * sizeof(HotKey));
+  int num_taken = 0;
+  int i;
+  for (i = 0; i < HOT_KEY_SLOTS; i++) {
+    if (__atomic_load_n(&hot_keys[i].hash, __ATOMIC_ACQUIRE) != 0) {
+      taken[num_taken] = hot_keys[i];
+      taken[num_taken].key[HOT_KEY_LEN] = '\000';
+      num_taken++;
+    }
+  }
+  qsort(taken, num_taken, sizeof(HotKey), compare_hot_keys);
+
+  int num_keys = num_taken < lock_profiling ? num_taken : lock_profiling;
+  memcpy(keys, taken, num_keys * sizeof(HotKey));
+  free(taken);
+  return num_keys;
+}
+
+const char *get_lock_class_name(int lock_class) {
+  static const char *names[] = { "first_element", "element", "element_content" };
+  return lock_class >= 0 && lock_class < NUM_LOCK_CLASSES ? names[lock_class] : "unknown";
+}
@@ -23,85 +23,65 @@
 
 #include <termPaperLib.h>
 #include <messageProcessing.h>
+#include <stats.h>
+#include <replication.h>
 
+#include <stdarg.h>
 #include <string.h>
 #include <stdio.h>
 
-// Responses
-// Errors
-#define FILEEXISTS "FILEEXISTS\n"
-#define NOSUCHFILE "NOSUCHFILE\n"
-
-// Not used in the protocol
-#define COMMAND_UNKNOWN "COMMAND_UNKNOWN\n"
-#define FILENAME_TO_LONG "FILENAME_TO_LONG\n"
-#define CONTENT_TO_LONG "CONTENT_TO_LONG\n"
-
-// positive responses
-#define ACK "ACK"
-#define FILECREATED "FILECREATED\n"
-#define FILECONTENT "FILECONTENT"
-#define DELETED "DELETED\n"
-#define UPDATED "UPDATED\n"
-
-
-typedef struct file {
-  char length[SIZE_MAX_BUFLEN+1];
-  char filename[MAX_BUFLEN+1];
-  char content[MAX_BUFLEN+1];
-} File;
-
 struct protocoll {
   int cs;
   int buflen;
-  File file;
+  Request *request;
 };
 
 
-#line 145 "lib/messageProcessing.rl"
+#line 131 "lib/messageProcessing.rl"
 
 
 
-#line 66 "lib/messageProcessing.c"
+#line 45 "lib/messageProcessing.c"
 static const char _protocoll_actions[] = {
 	0, 1, 0, 1, 2, 1, 3, 1, 
-	4, 1, 5, 1, 7, 1, 12, 2, 
-	1, 10, 2, 1, 11, 2, 3, 8, 
-	2, 3, 9, 2, 6, 0, 2, 6, 
-	2, 2, 6, 4
+	4, 1, 5, 1, 7, 1, 12, 1, 
+	13, 2, 1, 10, 2, 1, 11, 2, 
+	3, 8, 2, 3, 9, 2, 6, 0, 
+	2, 6, 2, 2, 6, 4
 };
 
 static const char _protocoll_key_offsets[] = {
-	0, 0, 5, 7, 8, 9, 10, 11, 
-	12, 14, 17, 19, 22, 24, 27, 28, 
-	29, 30, 31, 32, 33, 34, 35, 36, 
-	37, 39, 42, 43, 44, 45, 46, 47, 
-	48, 49, 50, 52, 55, 56, 57, 58, 
-	59, 60, 61, 63, 66, 68, 71, 73, 
-	76
+	0, 0, 6, 8, 9, 10, 11, 12, 
+	13, 15, 18, 20, 23, 25, 28, 29, 
+	30, 31, 32, 33, 34, 35, 36, 37, 
+	38, 40, 43, 44, 45, 46, 47, 48, 
+	49, 50, 51, 53, 56, 57, 58, 59, 
+	60, 61, 62, 63, 64, 65, 66, 67, 
+	69, 72, 74, 77, 79, 82
 };
 
 static const char _protocoll_trans_keys[] = {
-	67, 68, 76, 82, 85, 82, 100, 69, 
-	65, 84, 69, 32, 33, 126, 32, 33, 
-	126, 48, 57, 10, 48, 57, 32, 126, 
-	10, 32, 126, 105, 115, 116, 10, 69, 
-	76, 69, 84, 69, 32, 33, 126, 10, 
-	33, 126, 73, 83, 84, 10, 69, 65, 
-	68, 32, 33, 126, 10, 33, 126, 80, 
-	68, 65, 84, 69, 32, 33, 126, 32, 
+	67, 68, 76, 82, 83, 85, 82, 100, 
+	69, 65, 84, 69, 32, 33, 126, 32, 
 	33, 126, 48, 57, 10, 48, 57, 32, 
-	126, 10, 32, 126, 0
+	126, 10, 32, 126, 105, 115, 116, 10, 
+	69, 76, 69, 84, 69, 32, 33, 126, 
+	10, 33, 126, 73, 83, 84, 10, 69, 
+	65, 68, 32, 33, 126, 10, 33, 126, 
+	84, 65, 84, 83, 10, 80, 68, 65, 
+	84, 69, 32, 33, 126, 32, 33, 126, 
+	48, 57, 10, 48, 57, 32, 126, 10, 
+	32, 126, 0
 };
 
 static const char _protocoll_single_lengths[] = {
-	0, 5, 2, 1, 1, 1, 1, 1, 
+	0, 6, 2, 1, 1, 1, 1, 1, 
 	0, 1, 0, 1, 0, 1, 1, 1, 
 	1, 1, 1, 1, 1, 1, 1, 1, 
 	0, 1, 1, 1, 1, 1, 1, 1, 
 	1, 1, 0, 1, 1, 1, 1, 1, 
-	1, 1, 0, 1, 0, 1, 0, 1, 
-	0
+	1, 1, 1, 1, 1, 1, 1, 0, 
+	1, 0, 1, 0, 1, 0
 };
 
 static const char _protocoll_range_lengths[] = {
@@ -110,62 +90,64 @@ static const char _protocoll_range_lengths[] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 
 	1, 1, 0, 0, 0, 0, 0, 0, 
 	0, 0, 1, 1, 0, 0, 0, 0, 
-	0, 0, 1, 1, 1, 1, 1, 1, 
-	0
+	0, 0, 0, 0, 0, 0, 0, 1, 
+	1, 1, 1, 1, 1, 0
 };
 
 static const unsigned char _protocoll_index_offsets[] = {
-	0, 0, 6, 9, 11, 13, 15, 17, 
-	19, 21, 24, 26, 29, 31, 34, 36, 
-	38, 40, 42, 44, 46, 48, 50, 52, 
-	54, 56, 59, 61, 63, 65, 67, 69, 
-	71, 73, 75, 77, 80, 82, 84, 86, 
-	88, 90, 92, 94, 97, 99, 102, 104, 
-	107
+	0, 0, 7, 10, 12, 14, 16, 18, 
+	20, 22, 25, 27, 30, 32, 35, 37, 
+	39, 41, 43, 45, 47, 49, 51, 53, 
+	55, 57, 60, 62, 64, 66, 68, 70, 
+	72, 74, 76, 78, 81, 83, 85, 87, 
+	89, 91, 93, 95, 97, 99, 101, 103, 
+	105, 108, 110, 113, 115, 118
 };
 
 static const char _protocoll_trans_targs[] = {
-	2, 18, 26, 30, 36, 0, 3, 14, 
-	0, 4, 0, 5, 0, 6, 0, 7, 
-	0, 8, 0, 9, 0, 10, 9, 0, 
-	11, 0, 12, 11, 0, 13, 0, 48, 
-	13, 0, 15, 0, 16, 0, 17, 0, 
-	48, 0, 19, 0, 20, 0, 21, 0, 
-	22, 0, 23, 0, 24, 0, 25, 0, 
-	48, 25, 0, 27, 0, 28, 0, 29, 
-	0, 48, 0, 31, 0, 32, 0, 33, 
-	0, 34, 0, 35, 0, 48, 35, 0, 
-	37, 0, 38, 0, 39, 0, 40, 0, 
-	41, 0, 42, 0, 43, 0, 44, 43, 
-	0, 45, 0, 46, 45, 0, 47, 0, 
-	48, 47, 0, 0, 0
+	2, 18, 26, 30, 36, 41, 0, 3, 
+	14, 0, 4, 0, 5, 0, 6, 0, 
+	7, 0, 8, 0, 9, 0, 10, 9, 
+	0, 11, 0, 12, 11, 0, 13, 0, 
+	53, 13, 0, 15, 0, 16, 0, 17, 
+	0, 53, 0, 19, 0, 20, 0, 21, 
+	0, 22, 0, 23, 0, 24, 0, 25, 
+	0, 53, 25, 0, 27, 0, 28, 0, 
+	29, 0, 53, 0, 31, 0, 32, 0, 
+	33, 0, 34, 0, 35, 0, 53, 35, 
+	0, 37, 0, 38, 0, 39, 0, 40, 
+	0, 53, 0, 42, 0, 43, 0, 44, 
+	0, 45, 0, 46, 0, 47, 0, 48, 
+	0, 49, 48, 0, 50, 0, 51, 50, 
+	0, 52, 0, 53, 52, 0, 0, 0
 };
 
 static const char _protocoll_trans_actions[] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 
 	0, 0, 0, 0, 0, 0, 0, 0, 
-	0, 0, 0, 30, 0, 5, 3, 0, 
-	33, 0, 9, 7, 0, 27, 0, 18, 
-	1, 0, 0, 0, 0, 0, 0, 0, 
-	13, 0, 0, 0, 0, 0, 0, 0, 
-	0, 0, 0, 0, 0, 0, 30, 0, 
-	24, 3, 0, 0, 0, 0, 0, 0, 
-	0, 11, 0, 0, 0, 0, 0, 0, 
-	0, 0, 0, 30, 0, 21, 3, 0, 
+	0, 0, 0, 0, 32, 0, 5, 3, 
+	0, 35, 0, 9, 7, 0, 29, 0, 
+	20, 1, 0, 0, 0, 0, 0, 0, 
+	0, 15, 0, 0, 0, 0, 0, 0, 
+	0, 0, 0, 0, 0, 0, 0, 32, 
+	0, 26, 3, 0, 0, 0, 0, 0, 
+	0, 0, 11, 0, 0, 0, 0, 0, 
+	0, 0, 0, 0, 32, 0, 23, 3, 
 	0, 0, 0, 0, 0, 0, 0, 0, 
-	0, 0, 0, 0, 30, 0, 5, 3, 
-	0, 33, 0, 9, 7, 0, 27, 0, 
-	15, 1, 0, 0, 0
+	0, 13, 0, 0, 0, 0, 0, 0, 
+	0, 0, 0, 0, 0, 0, 0, 32, 
+	0, 5, 3, 0, 35, 0, 9, 7, 
+	0, 29, 0, 17, 1, 0, 0, 0
 };
 
 static const int protocoll_start = 1;
-static const int protocoll_first_final = 48;
+static const int protocoll_first_final = 53;
 static const int protocoll_error = 0;
 
 static const int protocoll_en_main = 1;
 
 
-#line 148 "lib/messageProcessing.rl"
+#line 134 "lib/messageProcessing.rl"
 /**
  * Since many bad people try to cause SigV ...
  */
@@ -215,22 +197,15 @@ size_t validate_size(char *len, char *content) {
  *      ACK NUM_FILES\n
  *      FILENAME\n
  */
-char *list_files(ConcurrentLinkedList *list) {
+void list_files(Store *store, Response *response) {
   log_info("Performing LIST");
 
-  // + \000
-  char len_c[SIZE_MAX_BUFLEN+1];
   char *files;
+  size_t len = copy_all_store_IDs(store, &files, response->arena);
 
-  size_t len = getAllElementIDs(list, &files);
-
-  snprintf(len_c, SIZE_MAX_BUFLEN, "%zu", len);
-
-  char *to_return = join_with_seperator(ACK,len_c," ");
-  to_return = join_with_seperator(to_return, files, "");
-  to_return = join_with_seperator(to_return,"", "\n");
-
-  return to_return;
+  add_header_to_response(response, "%s %zu", ACK, len);
+  add_string_to_response(response, files);
+  add_string_to_response(response, "\n");
 }
 
 /*
@@ -240,13 +215,17 @@ char *list_files(ConcurrentLinkedList *list) {
  *      FILEEXISTS\n
  *  or
  *      FILECREATED\n
+ *  or on a follower
+ *      READONLY\n
  */
-char *create_file(ConcurrentLinkedList *list, File *file) {
+void create_file(Store *store, File *file, Response *response) {
   char *to_return = FILECREATED;
 
   size_t payload_size = validate_size(file->length, file->content);
   if (payload_size < 1) {
-    return COMMAND_UNKNOWN;
+    add_string_to_response(response, COMMAND_UNKNOWN);
+    response->failed = TRUE;
+    return;
   }
 
   char *content = file->content;
@@ -260,11 +239,33 @@ char *create_file(ConcurrentLinkedList *list, File *file) {
   payload_size++;
 
 
-  if(0 != appendUniqueListElement(list, (void *) &content, payload_size, (file->filename))) {
+  int result = create_store_file(store, file->filename, content, payload_size);
+  if (result == STORE_READONLY) {
+    to_return = READONLY;
+    response->failed = TRUE;
+  } else if (result != 0) {
     to_return = FILEEXISTS;
+    response->failed = TRUE;
   } 
 
-  return to_return;
+  add_string_to_response(response, to_return);
+}
+
+size_t build_read_response(const char *ID, const void *payload, size_t payload_size,
+                           CachedResponse *response) {
+  // LENGTH without \000
+  size_t content_len = payload_size - 1;
+  if (response == NULL) {
+    return snprintf(NULL, 0, "%s %s %zu\n", FILECONTENT, ID, content_len) 
+           + content_len + 1;
+  }
+
+  int header_len = sprintf(response->data, "%s %s %zu\n", FILECONTENT, ID, content_len);
+  memcpy(response->data + header_len, payload, content_len);
+  response->data[header_len + content_len] = '\n';
+  response->payload_offset = header_len;
+  response->payload_len = content_len;
+  return response->len;
 }
 
 /*
@@ -276,29 +277,18 @@ char *create_file(ConcurrentLinkedList *list, File *file) {
  *      FILECONTENT FILENAME LENGTH\n
  *      CONTENT
  */
-char *read_file(ConcurrentLinkedList *list, File *file) {
+void read_file(Store *store, File *file, Response *response) {
   log_info("Performing READ %s", file->filename);
 
-  char *payload;
-  char *to_return = NOSUCHFILE;
-  size_t payload_size = getElementByID(list, (void *) &payload, file->filename );
-
-  // Payload check for files with size 0 
-  if (payload_size > 0 ) {
-    // + \000
-    char len_c[SIZE_MAX_BUFLEN+1];
-
-    // return LENGTH without \000
-    payload_size--;
-    snprintf(len_c, (SIZE_MAX_BUFLEN +1), "%zu", payload_size);
-
-    log_debug("strlen filename = %zu", strlen(file->filename));
-    to_return = join_with_seperator(FILECONTENT, file->filename, " ");
-    to_return = join_with_seperator(to_return, len_c," ");
-    to_return = join_with_seperator(to_return, payload,"\n");
-    to_return = join_with_seperator(to_return,"", "\n");
-  } 
-  return to_return;
+  // prebuilt by the first READ since the last change
+  CachedResponse *cached = use_store_response(store, file->filename, 
+                                              build_read_response, response->arena);
+  if (cached != NULL) {
+    add_to_response(response, cached->data, cached->len);
+  } else {
+    add_string_to_response(response, NOSUCHFILE);
+    response->failed = TRUE;
+  }
 }
 
 /*
@@ -308,14 +298,18 @@ char *read_file(ConcurrentLinkedList *list, File *file) {
  *      NOSUCHFILE\n
  *  or
  *      UPDATED\n
+ *  or on a follower
+ *      READONLY\n
  */
-char *update_file(ConcurrentLinkedList *list, File *file) {
+void update_file(Store *store, File *file, Response *response) {
 
   char *to_return = UPDATED;
 
   size_t payload_size = validate_size(file->length, file->content);
   if (payload_size < 1) {
-    return COMMAND_UNKNOWN;
+    add_string_to_response(response, COMMAND_UNKNOWN);
+    response->failed = TRUE;
+    return;
   }
 
   char *content = file->content;
@@ -325,11 +319,16 @@ char *update_file(ConcurrentLinkedList *list, File *file) {
   // save string with \000
   payload_size++;
 
-  if(0 != updateListElementByID(list, (void *) &content, payload_size, (file->filename))) {
+  int result = update_store_file(store, file->filename, content, payload_size);
+  if (result == STORE_READONLY) {
+    to_return = READONLY;
+    response->failed = TRUE;
+  } else if (result != 0) {
     to_return = NOSUCHFILE;
+    response->failed = TRUE;
   } 
 
-  return to_return;
+  add_string_to_response(response, to_return);
 }
 
 /*
@@ -339,37 +338,179 @@ char *update_file(ConcurrentLinkedList *list, File *file) {
  *      NOSUCHFILE\n
  *  or
  *      DELETED\n
+ *  or on a follower
+ *      READONLY\n
  */
-char *delete_file(ConcurrentLinkedList *list, File *file) {
+void delete_file(Store *store, File *file, Response *response) {
   log_info("Performing DELETE %s", file->filename);
 
   char *to_return = DELETED;
 
-  if(0 != removeListElementByID(list, (file->filename))) {
+  int result = delete_store_file(store, file->filename);
+  if (result == STORE_READONLY) {
+    to_return = READONLY;
+    response->failed = TRUE;
+  } else if (result != 0) {
     to_return = NOSUCHFILE;
+    response->failed = TRUE;
   } 
 
-  return to_return;
+  add_string_to_response(response, to_return);
+}
+
+/*
+ * Appends a line (printf like) to the text of a STATS response
+ */
+void append_stats_line(char *text, size_t *len, int *num_lines, const char *format, ...) {
+  va_list argptr;
+  va_start(argptr, format);
+  int line_len = vsnprintf(text + *len, MAX_STATS_LEN - *len, format, argptr);
+  va_end(argptr);
+
+  if (line_len > 0 && *len + line_len < MAX_STATS_LEN) {
+    *len += line_len;
+    (*num_lines)++;
+  } else {
+    text[*len] = '\000';
+  }
+}
+
+/*
+ * Appends the wait and hold times (ns) of the lock classes and the most
+ * contended files with the number of contended acquisitions and the time
+ * waited for them (us)
+ */
+void append_lock_stats(StatsSnapshot *snapshot, char *text, size_t *len, int *num_lines,
+                       Arena *arena) {
+  int lock_class;
+  for (lock_class = 0; lock_class < NUM_LOCK_CLASSES; lock_class++) {
+    const char *name = get_lock_class_name(lock_class);
+    unsigned long *wait = snapshot->lock_wait[lock_class];
+    unsigned long wait_max = snapshot->lock_wait_max[lock_class];
+    unsigned long *hold = snapshot->lock_hold[lock_class];
+    unsigned long hold_max = snapshot->lock_hold_max[lock_class];
+    append_stats_line(text, len, num_lines, "lock_%s_acquisitions %lu\n", name, 
+                      snapshot->lock_acquisitions[lock_class]);
+    append_stats_line(text, len, num_lines, "lock_%s_contended %lu\n", name, 
+                      snapshot->lock_contended[lock_class]);
+    append_stats_line(text, len, num_lines, "lock_%s_wait_p50_ns %lu\n", name, 
+                      get_histogram_percentile(wait, wait_max, 0.5));
+    append_stats_line(text, len, num_lines, "lock_%s_wait_p99_ns %lu\n", name, 
+                      get_histogram_percentile(wait, wait_max, 0.99));
+    append_stats_line(text, len, num_lines, "lock_%s_wait_max_ns %lu\n", name, wait_max);
+    append_stats_line(text, len, num_lines, "lock_%s_hold_p50_ns %lu\n", name, 
+                      get_histogram_percentile(hold, hold_max, 0.5));
+    append_stats_line(text, len, num_lines, "lock_%s_hold_p99_ns %lu\n", name, 
+                      get_histogram_percentile(hold, hold_max, 0.99));
+    append_stats_line(text, len, num_lines, "lock_%s_hold_max_ns %lu\n", name, hold_max);
+  }
+
+  HotKey *keys = arena_alloc(arena, lock_profiling * sizeof(HotKey));
+  int num_keys = get_hot_keys(keys);
+  int i;
+  for (i = 0; i < num_keys; i++) {
+    append_stats_line(text, len, num_lines, "lock_hot_key %s %lu %lu\n", keys[i].key, 
+                      keys[i].contended, keys[i].wait / 1000);
+  }
+}
+
+/*
+ * Show the counters of the server - the latencies in us from the received
+ * request to the sent response
+ * Possible response:
+ *
+ *      STATS NUM_LINES\n
+ *      NAME VALUE\n
+ */
+void show_stats(Store *store, Response *response) {
+  log_info("Performing STATS");
+
+  StatsSnapshot *snapshot = arena_alloc(response->arena, sizeof(StatsSnapshot));
+  take_stats_snapshot(snapshot);
+  size_t files, payload_bytes;
+  get_store_usage(store, &files, &payload_bytes);
+  unsigned long executed_reads, coalesced_reads;
+  get_store_read_counters(store, &executed_reads, &coalesced_reads);
+
+  char *text = arena_alloc(response->arena, MAX_STATS_LEN);
+  size_t len = 0;
+  int num_lines = 0;
+  text[0] = '\000';
+  append_stats_line(text, &len, &num_lines, "connections_active %ld\n", snapshot->connections);
+  append_stats_line(text, &len, &num_lines, "connections_total %lu\n", 
+                    snapshot->connections_total);
+  append_stats_line(text, &len, &num_lines, "bytes_in %lu\n", snapshot->bytes_in);
+  append_stats_line(text, &len, &num_lines, "bytes_out %lu\n", snapshot->bytes_out);
+  append_stats_line(text, &len, &num_lines, "files %zu\n", files);
+  append_stats_line(text, &len, &num_lines, "payload_bytes %zu\n", payload_bytes);
+  append_stats_line(text, &len, &num_lines, "reads_executed %lu\n", executed_reads);
+  append_stats_line(text, &len, &num_lines, "reads_coalesced %lu\n", coalesced_reads);
+  append_stats_line(text, &len, &num_lines, "changes %lu\n", get_store_changes(store));
+  if (store->wal != NULL) {
+    append_stats_line(text, &len, &num_lines, "wal_records %lu\n", 
+                      __atomic_load_n(&store->wal->records, __ATOMIC_RELAXED));
+    append_stats_line(text, &len, &num_lines, "wal_commits %lu\n", 
+                      __atomic_load_n(&store->wal->commits, __ATOMIC_RELAXED));
+  }
+  if (store->replication != NULL && store->read_only) {
+    append_stats_line(text, &len, &num_lines, "replication_lsn %lu\n", (unsigned long)
+                      __atomic_load_n(&store->replication->applied_lsn, __ATOMIC_RELAXED));
+    append_stats_line(text, &len, &num_lines, "replication_lag_ms %ld\n", 
+                      get_replication_lag(store->replication));
+  } else if (store->replication != NULL) {
+    uint64_t lsn;
+    int followers;
+    get_replication_state(store->replication, &lsn, &followers);
+    append_stats_line(text, &len, &num_lines, "replication_lsn %lu\n", (unsigned long) lsn);
+    append_stats_line(text, &len, &num_lines, "replication_followers %d\n", followers);
+  }
+
+  int command;
+  for (command = 0; command < NUM_COMMANDS; command++) {
+    const char *name = get_command_name(command);
+    append_stats_line(text, &len, &num_lines, "%s_requests %lu\n", name, 
+                      snapshot->requests[command]);
+    append_stats_line(text, &len, &num_lines, "%s_errors %lu\n", name, 
+                      snapshot->errors[command]);
+    append_stats_line(text, &len, &num_lines, "%s_latency_p50_us %lu\n", name, 
+                      get_latency_percentile(snapshot, command, 0.5));
+    append_stats_line(text, &len, &num_lines, "%s_latency_p90_us %lu\n", name, 
+                      get_latency_percentile(snapshot, command, 0.9));
+    append_stats_line(text, &len, &num_lines, "%s_latency_p99_us %lu\n", name, 
+                      get_latency_percentile(snapshot, command, 0.99));
+    append_stats_line(text, &len, &num_lines, "%s_latency_p999_us %lu\n", name, 
+                      get_latency_percentile(snapshot, command, 0.999));
+    append_stats_line(text, &len, &num_lines, "%s_latency_max_us %lu\n", name, 
+                      snapshot->latency_max[command]);
+  }
+
+  if (lock_profiling) {
+    append_lock_stats(snapshot, text, &len, &num_lines, response->arena);
+  }
+
+  add_header_to_response(response, "STATS %d\n", num_lines);
+  add_to_response(response, text, len);
 }
 
-char *handle_message(size_t msg_size, char *msg, ConcurrentLinkedList *file_list) {
+int parse_message(size_t msg_size, char *msg, Request *request, Response *response) {
 
   struct protocoll protocoll;
   struct protocoll *fsm = &protocoll;
   fsm->buflen = 0;
+  fsm->request = request;
 
   
-#line 363 "lib/messageProcessing.c"
+#line 504 "lib/messageProcessing.c"
 	{
 	 fsm->cs = protocoll_start;
 	}
 
-#line 341 "lib/messageProcessing.rl"
+#line 486 "lib/messageProcessing.rl"
 
   char *p = msg;
   char *pe = p + msg_size;
   
-#line 373 "lib/messageProcessing.c"
+#line 514 "lib/messageProcessing.c"
 	{
 	int _klen;
 	unsigned int _trans;
@@ -443,92 +584,100 @@ _match:
 		switch ( *_acts++ )
 		{
 	case 0:
-#line 66 "lib/messageProcessing.rl"
+#line 45 "lib/messageProcessing.rl"
 	{
     if ( fsm->buflen < MAX_BUFLEN ) {
-      fsm->file.content[fsm->buflen] = (*p);
+      fsm->request->file.content[fsm->buflen] = (*p);
     }
     fsm->buflen++;
   }
 	break;
 	case 1:
-#line 72 "lib/messageProcessing.rl"
+#line 51 "lib/messageProcessing.rl"
 	{
     if ( fsm->buflen <= MAX_BUFLEN ) {
-      fsm->file.content[fsm->buflen++] = '\000';
+      fsm->request->file.content[fsm->buflen++] = '\000';
     } else {
-      return CONTENT_TO_LONG;
+      add_string_to_response(response, CONTENT_TO_LONG);
+      response->failed = TRUE;
+      return FALSE;
     }
   }
 	break;
 	case 2:
-#line 81 "lib/messageProcessing.rl"
+#line 62 "lib/messageProcessing.rl"
 	{
     if ( fsm->buflen < MAX_BUFLEN ) {
-      fsm->file.filename[fsm->buflen] = (*p);
+      fsm->request->file.filename[fsm->buflen] = (*p);
     }
     fsm->buflen++;
   }
 	break;
 	case 3:
-#line 88 "lib/messageProcessing.rl"
+#line 69 "lib/messageProcessing.rl"
 	{
     if ( fsm->buflen <= MAX_BUFLEN ) {
-      fsm->file.filename[fsm->buflen++] = '\000';
+      fsm->request->file.filename[fsm->buflen++] = '\000';
     } else {
-      return FILENAME_TO_LONG;
+      add_string_to_response(response, FILENAME_TO_LONG);
+      response->failed = TRUE;
+      return FALSE;
     }
   }
 	break;
 	case 4:
-#line 97 "lib/messageProcessing.rl"
+#line 80 "lib/messageProcessing.rl"
 	{
     if ( fsm->buflen < SIZE_MAX_BUFLEN ) {
-      fsm->file.length[fsm->buflen] = (*p);
+      fsm->request->file.length[fsm->buflen] = (*p);
     }
     fsm->buflen++;
   }
 	break;
 	case 5:
-#line 104 "lib/messageProcessing.rl"
+#line 87 "lib/messageProcessing.rl"
 	{
     if ( fsm->buflen <= SIZE_MAX_BUFLEN ) {
-      fsm->file.length[fsm->buflen++] = '\000';
+      fsm->request->file.length[fsm->buflen++] = '\000';
     } 
   // File Len will be validated later
   }
 	break;
 	case 6:
-#line 112 "lib/messageProcessing.rl"
+#line 95 "lib/messageProcessing.rl"
 	{ 
     fsm->buflen = 0; 
   }
 	break;
 	case 7:
-#line 122 "lib/messageProcessing.rl"
-	{ return list_files(file_list); }
+#line 105 "lib/messageProcessing.rl"
+	{ fsm->request->command = CMD_LIST; return TRUE; }
 	break;
 	case 8:
-#line 123 "lib/messageProcessing.rl"
-	{ return read_file(file_list, &fsm->file); }
+#line 106 "lib/messageProcessing.rl"
+	{ fsm->request->command = CMD_READ; return TRUE; }
 	break;
 	case 9:
-#line 124 "lib/messageProcessing.rl"
-	{ return delete_file(file_list, &fsm->file); }
+#line 107 "lib/messageProcessing.rl"
+	{ fsm->request->command = CMD_DELETE; return TRUE; }
 	break;
 	case 10:
-#line 125 "lib/messageProcessing.rl"
-	{ return update_file(file_list, &fsm->file); }
+#line 108 "lib/messageProcessing.rl"
+	{ fsm->request->command = CMD_UPDATE; return TRUE; }
 	break;
 	case 11:
-#line 126 "lib/messageProcessing.rl"
-	{ return create_file(file_list, &fsm->file); }
+#line 109 "lib/messageProcessing.rl"
+	{ fsm->request->command = CMD_CREATE; return TRUE; }
 	break;
 	case 12:
-#line 133 "lib/messageProcessing.rl"
-	{ return "FTW ;-)\n"; }
+#line 110 "lib/messageProcessing.rl"
+	{ fsm->request->command = CMD_STATS; return TRUE; }
+	break;
+	case 13:
+#line 118 "lib/messageProcessing.rl"
+	{ add_string_to_response(response, "FTW ;-)\n"); return FALSE; }
 	break;
-#line 532 "lib/messageProcessing.c"
+#line 681 "lib/messageProcessing.c"
 		}
 	}
 
@@ -541,9 +690,54 @@ _again:
 	_out: {}
 	}
 
-#line 345 "lib/messageProcessing.rl"
+#line 490 "lib/messageProcessing.rl"
 
   // save  default
   log_error( "Command unknown: '%s'", msg);
-  return COMMAND_UNKNOWN;
+  add_string_to_response(response, COMMAND_UNKNOWN);
+  response->failed = TRUE;
+  return FALSE;
+}
+
+int classify_request(Request *request) {
+  switch (request->command) {
+    case CMD_READ:
+      return LANE_POINT;
+    case CMD_LIST:
+    case CMD_STATS:
+      return LANE_SCAN;
+    default:
+      return LANE_WRITE;
+  }
+}
+
+void execute_request(Request *request, Store *store, Response *response) {
+  switch (request->command) {
+    case CMD_LIST:
+      list_files(store, response);
+      break;
+    case CMD_READ:
+      read_file(store, &request->file, response);
+      break;
+    case CMD_CREATE:
+      create_file(store, &request->file, response);
+      break;
+    case CMD_UPDATE:
+      update_file(store, &request->file, response);
+      break;
+    case CMD_DELETE:
+      delete_file(store, &request->file, response);
+      break;
+    case CMD_STATS:
+      show_stats(store, response);
+      break;
+  }
+}
+
+void handle_message(size_t msg_size, char *msg, Store *store, 
+                    Response *response) {
+  Request request;
+  if (parse_message(msg_size, msg, &request, response)) {
+    execute_request(&request, store, response);
+  }
 }
@@ -21,38 +21,17 @@
 
 #include <termPaperLib.h>
 #include <messageProcessing.h>
+#include <stats.h>
+#include <replication.h>
 
+#include <stdarg.h>
 #include <string.h>
 #include <stdio.h>
 
-// Responses
-// Errors
-#define FILEEXISTS "FILEEXISTS\n"
-#define NOSUCHFILE "NOSUCHFILE\n"
-
-// Not used in the protocol
-#define COMMAND_UNKNOWN "COMMAND_UNKNOWN\n"
-#define FILENAME_TO_LONG "FILENAME_TO_LONG\n"
-#define CONTENT_TO_LONG "CONTENT_TO_LONG\n"
-
-// positive responses
-#define ACK "ACK"
-#define FILECREATED "FILECREATED\n"
-#define FILECONTENT "FILECONTENT"
-#define DELETED "DELETED\n"
-#define UPDATED "UPDATED\n"
-
-
-typedef struct file {
-  char length[SIZE_MAX_BUFLEN+1];
-  char filename[MAX_BUFLEN+1];
-  char content[MAX_BUFLEN+1];
-} File;
-
 struct protocoll {
   int cs;
   int buflen;
-  File file;
+  Request *request;
 };
 
 %%{
@@ -65,45 +44,49 @@ struct protocoll {
 # Append the current character to the content buffer
   action append_content {
     if ( fsm->buflen < MAX_BUFLEN ) {
-      fsm->file.content[fsm->buflen] = fc;
+      fsm->request->file.content[fsm->buflen] = fc;
     }
     fsm->buflen++;
   }
   action term_content {
     if ( fsm->buflen <= MAX_BUFLEN ) {
-      fsm->file.content[fsm->buflen++] = '\000';
+      fsm->request->file.content[fsm->buflen++] = '\000';
     } else {
-      return CONTENT_TO_LONG;
+      add_string_to_response(response, CONTENT_TO_LONG);
+      response->failed = TRUE;
+      return FALSE;
     }
   }
 
 # Append the current character to the filename buffer
   action append_filename {
     if ( fsm->buflen < MAX_BUFLEN ) {
-      fsm->file.filename[fsm->buflen] = fc;
+      fsm->request->file.filename[fsm->buflen] = fc;
     }
     fsm->buflen++;
   }
 
   action term_filename {
     if ( fsm->buflen <= MAX_BUFLEN ) {
-      fsm->file.filename[fsm->buflen++] = '\000';
+      fsm->request->file.filename[fsm->buflen++] = '\000';
     } else {
-      return FILENAME_TO_LONG;
+      add_string_to_response(response, FILENAME_TO_LONG);
+      response->failed = TRUE;
+      return FALSE;
     }
   }
 
 # Append the current character to the length buffer
   action append_length {
     if ( fsm->buflen < SIZE_MAX_BUFLEN ) {
-      fsm->file.length[fsm->buflen] = fc;
+      fsm->request->file.length[fsm->buflen] = fc;
     }
     fsm->buflen++;
   }
 
   action term_length {
     if ( fsm->buflen <= SIZE_MAX_BUFLEN ) {
-      fsm->file.length[fsm->buflen++] = '\000';
+      fsm->request->file.length[fsm->buflen++] = '\000';
     } 
   // File Len will be validated later
   }
@@ -119,23 +102,26 @@ struct protocoll {
   content = (alnum | ' ' | punct )+ >init $append_content %term_content;
 
 # action definitions
-  action list { return list_files(file_list); }
-  action read { return read_file(file_list, &fsm->file); }
-  action delete { return delete_file(file_list, &fsm->file); }
-  action update { return update_file(file_list, &fsm->file); }
-  action create { return create_file(file_list, &fsm->file); }
+  action list { fsm->request->command = CMD_LIST; return TRUE; }
+  action read { fsm->request->command = CMD_READ; return TRUE; }
+  action delete { fsm->request->command = CMD_DELETE; return TRUE; }
+  action update { fsm->request->command = CMD_UPDATE; return TRUE; }
+  action create { fsm->request->command = CMD_CREATE; return TRUE; }
+  action stats { fsm->request->command = CMD_STATS; return TRUE; }
 
 # Machine definition
   list = 'LIST\n'  @list;
+  stats = 'STATS\n'  @stats;
   read = 'READ ' . filename . '\n' @read;
   delete = 'DELETE ' . filename . '\n' @delete;
 # small instructor test ... will anyone ever see this?
-  special = 'Cdist\n' @{ return "FTW ;-)\n"; };
+  special = 'Cdist\n' @{ add_string_to_response(response, "FTW ;-)\n"); return FALSE; };
   update = 'UPDATE ' . filename . ' ' . length . '\n' content . '\n' @update;
   create = 'CREATE ' . filename . ' ' . length . '\n' content . '\n' @create;
 
 main := ( 
           list | 
+          stats | 
           read | 
           update |
           special |
@@ -194,22 +180,15 @@ size_t validate_size(char *len, char *content) {
  *      ACK NUM_FILES\n
  *      FILENAME\n
  */
-char *list_files(ConcurrentLinkedList *list) {
+void list_files(Store *store, Response *response) {
   log_info("Performing LIST");
 
-  // + \000
-  char len_c[SIZE_MAX_BUFLEN+1];
   char *files;
+  size_t len = copy_all_store_IDs(store, &files, response->arena);
 
-  size_t len = getAllElementIDs(list, &files);
-
-  snprintf(len_c, SIZE_MAX_BUFLEN, "%zu", len);
-
-  char *to_return = join_with_seperator(ACK,len_c," ");
-  to_return = join_with_seperator(to_return, files, "");
-  to_return = join_with_seperator(to_return,"", "\n");
-
-  return to_return;
+  add_header_to_response(response, "%s %zu", ACK, len);
+  add_string_to_response(response, files);
+  add_string_to_response(response, "\n");
 }
 
 /*
@@ -219,13 +198,17 @@ char *list_files(ConcurrentLinkedList *list) {
  *      FILEEXISTS\n
  *  or
  *      FILECREATED\n
+ *  or on a follower
+ *      READONLY\n
  */
-char *create_file(ConcurrentLinkedList *list, File *file) {
+void create_file(Store *store, File *file, Response *response) {
   char *to_return = FILECREATED;
 
   size_t payload_size = validate_size(file->length, file->content);
   if (payload_size < 1) {
-    return COMMAND_UNKNOWN;
+    add_string_to_response(response, COMMAND_UNKNOWN);
+    response->failed = TRUE;
+    return;
   }
 
   char *content = file->content;
@@ -239,11 +222,33 @@ char *create_file(ConcurrentLinkedList *list, File *file) {
   payload_size++;
 
 
-  if(0 != appendUniqueListElement(list, (void *) &content, payload_size, (file->filename))) {
+  int result = create_store_file(store, file->filename, content, payload_size);
+  if (result == STORE_READONLY) {
+    to_return = READONLY;
+    response->failed = TRUE;
+  } else if (result != 0) {
     to_return = FILEEXISTS;
+    response->failed = TRUE;
   } 
 
-  return to_return;
+  add_string_to_response(response, to_return);
+}
+
+size_t build_read_response(const char *ID, const void *payload, size_t payload_size,
+                           CachedResponse *response) {
+  // LENGTH without \000
+  size_t content_len = payload_size - 1;
+  if (response == NULL) {
+    return snprintf(NULL, 0, "%s %s %zu\n", FILECONTENT, ID, content_len) 
+           + content_len + 1;
+  }
+
+  int header_len = sprintf(response->data, "%s %s %zu\n", FILECONTENT, ID, content_len);
+  memcpy(response->data + header_len, payload, content_len);
+  response->data[header_len + content_len] = '\n';
+  response->payload_offset = header_len;
+  response->payload_len = content_len;
+  return response->len;
 }
 
 /*
@@ -255,29 +260,18 @@ char *create_file(ConcurrentLinkedList *list, File *file) {
  *      FILECONTENT FILENAME LENGTH\n
  *      CONTENT
  */
-char *read_file(ConcurrentLinkedList *list, File *file) {
+void read_file(Store *store, File *file, Response *response) {
   log_info("Performing READ %s", file->filename);
 
-  char *payload;
-  char *to_return = NOSUCHFILE;
-  size_t payload_size = getElementByID(list, (void *) &payload, file->filename );
-
-  // Payload check for files with size 0 
-  if (payload_size > 0 ) {
-    // + \000
-    char len_c[SIZE_MAX_BUFLEN+1];
-
-    // return LENGTH without \000
-    payload_size--;
-    snprintf(len_c, (SIZE_MAX_BUFLEN +1), "%zu", payload_size);
-
-    log_debug("strlen filename = %zu", strlen(file->filename));
-    to_return = join_with_seperator(FILECONTENT, file->filename, " ");
-    to_return = join_with_seperator(to_return, len_c," ");
-    to_return = join_with_seperator(to_return, payload,"\n");
-    to_return = join_with_seperator(to_return,"", "\n");
-  } 
-  return to_return;
+  // prebuilt by the first READ since the last change
+  CachedResponse *cached = use_store_response(store, file->filename, 
+                                              build_read_response, response->arena);
+  if (cached != NULL) {
+    add_to_response(response, cached->data, cached->len);
+  } else {
+    add_string_to_response(response, NOSUCHFILE);
+    response->failed = TRUE;
+  }
 }
 
 /*
@@ -287,14 +281,18 @@ char *read_file(ConcurrentLinkedList *list, File *file) {
  *      NOSUCHFILE\n
  *  or
  *      UPDATED\n
+ *  or on a follower
+ *      READONLY\n
  */
-char *update_file(ConcurrentLinkedList *list, File *file) {
+void update_file(Store *store, File *file, Response *response) {
 
   char *to_return = UPDATED;
 
   size_t payload_size = validate_size(file->length, file->content);
   if (payload_size < 1) {
-    return COMMAND_UNKNOWN;
+    add_string_to_response(response, COMMAND_UNKNOWN);
+    response->failed = TRUE;
+    return;
   }
 
   char *content = file->content;
@@ -304,11 +302,16 @@ char *update_file(ConcurrentLinkedList *list, File *file) {
   // save string with \000
   payload_size++;
 
-  if(0 != updateListElementByID(list, (void *) &content, payload_size, (file->filename))) {
+  int result = update_store_file(store, file->filename, content, payload_size);
+  if (result == STORE_READONLY) {
+    to_return = READONLY;
+    response->failed = TRUE;
+  } else if (result != 0) {
     to_return = NOSUCHFILE;
+    response->failed = TRUE;
   } 
 
-  return to_return;
+  add_string_to_response(response, to_return);
 }
 
 /*
@@ -318,24 +321,166 @@ char *update_file(ConcurrentLinkedList *list, File *file) {
  *      NOSUCHFILE\n
  *  or
  *      DELETED\n
+ *  or on a follower
+ *      READONLY\n
  */
-char *delete_file(ConcurrentLinkedList *list, File *file) {
+void delete_file(Store *store, File *file, Response *response) {
   log_info("Performing DELETE %s", file->filename);
 
   char *to_return = DELETED;
 
-  if(0 != removeListElementByID(list, (file->filename))) {
+  int result = delete_store_file(store, file->filename);
+  if (result == STORE_READONLY) {
+    to_return = READONLY;
+    response->failed = TRUE;
+  } else if (result != 0) {
     to_return = NOSUCHFILE;
+    response->failed = TRUE;
   } 
 
-  return to_return;
+  add_string_to_response(response, to_return);
 }
 
-char *handle_message(size_t msg_size, char *msg, ConcurrentLinkedList *file_list) {
+/*
+ * Appends a line (printf like) to the text of a STATS response
+ */
+void append_stats_line(char *text, size_t *len, int *num_lines, const char *format, ...) {
+  va_list argptr;
+  va_start(argptr, format);
+  int line_len = vsnprintf(text + *len, MAX_STATS_LEN - *len, format, argptr);
+  va_end(argptr);
+
+  if (line_len > 0 && *len + line_len < MAX_STATS_LEN) {
+    *len += line_len;
+    (*num_lines)++;
+  } else {
+    text[*len] = '\000';
+  }
+}
+
+/*
+ * Appends the wait and hold times (ns) of the lock classes and the most
+ * contended files with the number of contended acquisitions and the time
+ * waited for them (us)
+ */
+void append_lock_stats(StatsSnapshot *snapshot, char *text, size_t *len, int *num_lines,
+                       Arena *arena) {
+  int lock_class;
+  for (lock_class = 0; lock_class < NUM_LOCK_CLASSES; lock_class++) {
+    const char *name = get_lock_class_name(lock_class);
+    unsigned long *wait = snapshot->lock_wait[lock_class];
+    unsigned long wait_max = snapshot->lock_wait_max[lock_class];
+    unsigned long *hold = snapshot->lock_hold[lock_class];
+    unsigned long hold_max = snapshot->lock_hold_max[lock_class];
+    append_stats_line(text, len, num_lines, "lock_%s_acquisitions %lu\n", name, 
+                      snapshot->lock_acquisitions[lock_class]);
+    append_stats_line(text, len, num_lines, "lock_%s_contended %lu\n", name, 
+                      snapshot->lock_contended[lock_class]);
+    append_stats_line(text, len, num_lines, "lock_%s_wait_p50_ns %lu\n", name, 
+                      get_histogram_percentile(wait, wait_max, 0.5));
+    append_stats_line(text, len, num_lines, "lock_%s_wait_p99_ns %lu\n", name, 
+                      get_histogram_percentile(wait, wait_max, 0.99));
+    append_stats_line(text, len, num_lines, "lock_%s_wait_max_ns %lu\n", name, wait_max);
+    append_stats_line(text, len, num_lines, "lock_%s_hold_p50_ns %lu\n", name, 
+                      get_histogram_percentile(hold, hold_max, 0.5));
+    append_stats_line(text, len, num_lines, "lock_%s_hold_p99_ns %lu\n", name, 
+                      get_histogram_percentile(hold, hold_max, 0.99));
+    append_stats_line(text, len, num_lines, "lock_%s_hold_max_ns %lu\n", name, hold_max);
+  }
+
+  HotKey *keys = arena_alloc(arena, lock_profiling * sizeof(HotKey));
+  int num_keys = get_hot_keys(keys);
+  int i;
+  for (i = 0; i < num_keys; i++) {
+    append_stats_line(text, len, num_lines, "lock_hot_key %s %lu %lu\n", keys[i].key, 
+                      keys[i].contended, keys[i].wait / 1000);
+  }
+}
+
+/*
+ * Show the counters of the server - the latencies in us from the received
+ * request to the sent response
+ * Possible response:
+ *
+ *      STATS NUM_LINES\n
+ *      NAME VALUE\n
+ */
+void show_stats(Store *store, Response *response) {
+  log_info("Performing STATS");
+
+  StatsSnapshot *snapshot = arena_alloc(response->arena, sizeof(StatsSnapshot));
+  take_stats_snapshot(snapshot);
+  size_t files, payload_bytes;
+  get_store_usage(store, &files, &payload_bytes);
+  unsigned long executed_reads, coalesced_reads;
+  get_store_read_counters(store, &executed_reads, &coalesced_reads);
+
+  char *text = arena_alloc(response->arena, MAX_STATS_LEN);
+  size_t len = 0;
+  int num_lines = 0;
+  text[0] = '\000';
+  append_stats_line(text, &len, &num_lines, "connections_active %ld\n", snapshot->connections);
+  append_stats_line(text, &len, &num_lines, "connections_total %lu\n", 
+                    snapshot->connections_total);
+  append_stats_line(text, &len, &num_lines, "bytes_in %lu\n", snapshot->bytes_in);
+  append_stats_line(text, &len, &num_lines, "bytes_out %lu\n", snapshot->bytes_out);
+  append_stats_line(text, &len, &num_lines, "files %zu\n", files);
+  append_stats_line(text, &len, &num_lines, "payload_bytes %zu\n", payload_bytes);
+  append_stats_line(text, &len, &num_lines, "reads_executed %lu\n", executed_reads);
+  append_stats_line(text, &len, &num_lines, "reads_coalesced %lu\n", coalesced_reads);
+  append_stats_line(text, &len, &num_lines, "changes %lu\n", get_store_changes(store));
+  if (store->wal != NULL) {
+    append_stats_line(text, &len, &num_lines, "wal_records %lu\n", 
+                      __atomic_load_n(&store->wal->records, __ATOMIC_RELAXED));
+    append_stats_line(text, &len, &num_lines, "wal_commits %lu\n", 
+                      __atomic_load_n(&store->wal->commits, __ATOMIC_RELAXED));
+  }
+  if (store->replication != NULL && store->read_only) {
+    append_stats_line(text, &len, &num_lines, "replication_lsn %lu\n", (unsigned long)
+                      __atomic_load_n(&store->replication->applied_lsn, __ATOMIC_RELAXED));
+    append_stats_line(text, &len, &num_lines, "replication_lag_ms %ld\n", 
+                      get_replication_lag(store->replication));
+  } else if (store->replication != NULL) {
+    uint64_t lsn;
+    int followers;
+    get_replication_state(store->replication, &lsn, &followers);
+    append_stats_line(text, &len, &num_lines, "replication_lsn %lu\n", (unsigned long) lsn);
+    append_stats_line(text, &len, &num_lines, "replication_followers %d\n", followers);
+  }
+
+  int command;
+  for (command = 0; command < NUM_COMMANDS; command++) {
+    const char *name = get_command_name(command);
+    append_stats_line(text, &len, &num_lines, "%s_requests %lu\n", name, 
+                      snapshot->requests[command]);
+    append_stats_line(text, &len, &num_lines, "%s_errors %lu\n", name, 
+                      snapshot->errors[command]);
+    append_stats_line(text, &len, &num_lines, "%s_latency_p50_us %lu\n", name, 
+                      get_latency_percentile(snapshot, command, 0.5));
+    append_stats_line(text, &len, &num_lines, "%s_latency_p90_us %lu\n", name, 
+                      get_latency_percentile(snapshot, command, 0.9));
+    append_stats_line(text, &len, &num_lines, "%s_latency_p99_us %lu\n", name, 
+                      get_latency_percentile(snapshot, command, 0.99));
+    append_stats_line(text, &len, &num_lines, "%s_latency_p999_us %lu\n", name, 
+                      get_latency_percentile(snapshot, command, 0.999));
+    append_stats_line(text, &len, &num_lines, "%s_latency_max_us %lu\n", name, 
+                      snapshot->latency_max[command]);
+  }
+
+  if (lock_profiling) {
+    append_lock_stats(snapshot, text, &len, &num_lines, response->arena);
+  }
+
+  add_header_to_response(response, "STATS %d\n", num_lines);
+  add_to_response(response, text, len);
+}
+
+int parse_message(size_t msg_size, char *msg, Request *request, Response *response) {
 
   struct protocoll protocoll;
   struct protocoll *fsm = &protocoll;
   fsm->buflen = 0;
+  fsm->request = request;
 
   %% write init;
 
@@ -345,5 +490,50 @@ char *handle_message(size_t msg_size, char *msg, ConcurrentLinkedList *file_list
 
   // save  default
   log_error( "Command unknown: '%s'", msg);
-  return COMMAND_UNKNOWN;
+  add_string_to_response(response, COMMAND_UNKNOWN);
+  response->failed = TRUE;
+  return FALSE;
+}
+
+int classify_request(Request *request) {
+  switch (request->command) {
+    case CMD_READ:
+      return LANE_POINT;
+    case CMD_LIST:
+    case CMD_STATS:
+      return LANE_SCAN;
+    default:
+      return LANE_WRITE;
+  }
+}
+
+void execute_request(Request *request, Store *store, Response *response) {
+  switch (request->command) {
+    case CMD_LIST:
+      list_files(store, response);
+      break;
+    case CMD_READ:
+      read_file(store, &request->file, response);
+      break;
+    case CMD_CREATE:
+      create_file(store, &request->file, response);
+      break;
+    case CMD_UPDATE:
+      update_file(store, &request->file, response);
+      break;
+    case CMD_DELETE:
+      delete_file(store, &request->file, response);
+      break;
+    case CMD_STATS:
+      show_stats(store, response);
+      break;
+  }
+}
+
+void handle_message(size_t msg_size, char *msg, Store *store, 
+                    Response *response) {
+  Request request;
+  if (parse_message(msg_size, msg, &request, response)) {
+    execute_request(&request, store, response);
+  }
 }
@@ -0,0 +1,319 @@
+/*
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the metrics endpoint - the counters of STATS served over HTTP
+ * in the text format of Prometheus
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <termPaperLib.h>
+#include <metrics.h>
+#include <stats.h>
+#include <replication.h>
+
+typedef struct MetricsListener {
+  Store *store;
+  int server_socket;
+} MetricsListener;
+
+/*
+ * Appends a line (printf like) to the text of a scrape
+ */
+void append_metrics_line(MetricsText *text, const char *format, ...) {
+  while (TRUE) {
+    va_list argptr;
+    va_start(argptr, format);
+    int line_len = vsnprintf(text->text + text->len, text->size - text->len, format, argptr);
+    va_end(argptr);
+    if (line_len < 0) {
+      text->text[text->len] = '\000';
+      return;
+    } else if (text->len + line_len < text->size) {
+      text->len += line_len;
+      return;
+    }
+
+    text->size *= 2;
+    text->text = realloc(text->text, text->size);
+    if (text->text == NULL) {
+      log_error("Allocation of the metrics failed");
+      exit_by_type(PROCESS_EXIT);
+    }
+  }
+}
+
+/*
+ * Appends the HELP and TYPE lines of a metric
+ */
+void append_metrics_family(MetricsText *text, const char *name, const char *type,
+                           const char *help) {
+  append_metrics_line(text, "# HELP termpaper_%s %s\n", name, help);
+  append_metrics_line(text, "# TYPE termpaper_%s %s\n", name, type);
+}
+
+/*
+ * Appends a metric without labels
+ */
+void append_metrics_value(MetricsText *text, const char *name, const char *type,
+                          const char *help, double value) {
+  append_metrics_family(text, name, type, help);
+  append_metrics_line(text, "termpaper_%s %.17g\n", name, value);
+}
+
+/*
+ * Appends a histogram of stats.h as a histogram with the given label - unit
+ * is the length of a step of the histogram in seconds. Only the limits of
+ * the powers of 2 become buckets, so every scrape has the same ones
+ */
+void append_metrics_histogram(MetricsText *text, const char *name, const char *label,
+                              const char *label_value, const unsigned long *histogram,
+                              unsigned long sum, double unit) {
+  unsigned long count = 0;
+  int bucket;
+  for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+    count += histogram[bucket];
+    unsigned long limit = get_latency_bucket_limit(bucket);
+    if (bucket % LATENCY_SUB_BUCKETS == LATENCY_SUB_BUCKETS - 1
+        && limit * unit <= METRICS_MAX_BUCKET_SECONDS) {
+      append_metrics_line(text, "termpaper_%s_bucket{%s=\"%s\",le=\"%.9g\"} %lu\n", name,
+                          label, label_value, limit * unit, count);
+    }
+  }
+  append_metrics_line(text, "termpaper_%s_bucket{%s=\"%s\",le=\"+Inf\"} %lu\n", name, label,
+                      label_value, count);
+  append_metrics_line(text, "termpaper_%s_sum{%s=\"%s\"} %.9g\n", name, label, label_value,
+                      sum * unit);
+  append_metrics_line(text, "termpaper_%s_count{%s=\"%s\"} %lu\n", name, label, label_value,
+                      count);
+}
+
+void render_metrics(Store *store, MetricsText *text) {
+  text->size = MAX_STATS_LEN;
+  text->len = 0;
+  text->text = malloc(text->size);
+  if (text->text == NULL) {
+    log_error("Allocation of the metrics failed");
+    exit_by_type(PROCESS_EXIT);
+  }
+  text->text[0] = '\000';
+
+  StatsSnapshot *snapshot = malloc(sizeof(StatsSnapshot));
+  if (snapshot == NULL) {
+    log_error("Allocation of the metrics snapshot failed");
+    exit_by_type(PROCESS_EXIT);
+  }
+  take_stats_snapshot(snapshot);
+  unsigned long executed_reads, coalesced_reads;
+  get_store_read_counters(store, &executed_reads, &coalesced_reads);
+
+  append_metrics_value(text, "connections_active", "gauge", "Open client connections",
+                       snapshot->connections);
+  append_metrics_value(text, "connections_total", "counter", "Accepted client connections",
+                       snapshot->connections_total);
+  append_metrics_value(text, "received_bytes_total", "counter", "Bytes of the requests",
+                       snapshot->bytes_in);
+  append_metrics_value(text, "sent_bytes_total", "counter", "Bytes of the responses",
+                       snapshot->bytes_out);
+  append_metrics_value(text, "reads_executed_total", "counter", "READs that did a lookup",
+                       executed_reads);
+  append_metrics_value(text, "reads_coalesced_total", "counter",
+                       "READs that shared the lookup of another one", coalesced_reads);
+  append_metrics_value(text, "changes_total", "counter", "Changes of the store",
+                       get_store_changes(store));
+  if (store->wal != NULL) {
+    append_metrics_value(text, "wal_records_total", "counter", "Written log records",
+                         __atomic_load_n(&store->wal->records, __ATOMIC_RELAXED));
+    append_metrics_value(text, "wal_commits_total", "counter", "Group commits of the log",
+                         __atomic_load_n(&store->wal->commits, __ATOMIC_RELAXED));
+  }
+  if (store->replication != NULL && store->read_only) {
+    append_metrics_value(text, "replication_lsn", "gauge", "Last applied change",
+        __atomic_load_n(&store->replication->applied_lsn, __ATOMIC_RELAXED));
+    long lag = get_replication_lag(store->replication);
+    if (lag >= 0) {
+      append_metrics_value(text, "replication_lag_seconds", "gauge",
+                           "Time since the primary published the last applied change",
+                           lag / 1000.0);
+    }
+  } else if (store->replication != NULL) {
+    append_metrics_value(text, "replication_lsn", "gauge", "Last published change",
+        __atomic_load_n(&store->replication->next_lsn, __ATOMIC_RELAXED) - 1);
+  }
+
+  int command;
+  append_metrics_family(text, "requests_total", "counter", "Answered requests");
+  for (command = 0; command < NUM_COMMANDS; command++) {
+    append_metrics_line(text, "termpaper_requests_total{command=\"%s\"} %lu\n",
+                        get_command_name(command), snapshot->requests[command]);
+  }
+  append_metrics_family(text, "request_errors_total", "counter",
+                        "Requests answered with an error");
+  for (command = 0; command < NUM_COMMANDS; command++) {
+    append_metrics_line(text, "termpaper_request_errors_total{command=\"%s\"} %lu\n",
+                        get_command_name(command), snapshot->errors[command]);
+  }
+  append_metrics_family(text, "request_duration_seconds", "histogram",
+                        "Time from the received request to the sent response");
+  for (command = 0; command < NUM_COMMANDS; command++) {
+    append_metrics_histogram(text, "request_duration_seconds", "command",
+                             get_command_name(command), snapshot->latency[command],
+                             snapshot->latency_sum[command], 1e-6);
+  }
+
+  if (lock_profiling) {
+    int lock_class;
+    append_metrics_family(text, "lock_acquisitions_total", "counter",
+                          "Acquisitions of the locks of the store");
+    for (lock_class = 0; lock_class < NUM_LOCK_CLASSES; lock_class++) {
+      append_metrics_line(text, "termpaper_lock_acquisitions_total{lock=\"%s\"} %lu\n",
+                          get_lock_class_name(lock_class),
+                          snapshot->lock_acquisitions[lock_class]);
+    }
+    append_metrics_family(text, "lock_contended_total", "counter",
+                          "Acquisitions that had to wait");
+    for (lock_class = 0; lock_class < NUM_LOCK_CLASSES; lock_class++) {
+      append_metrics_line(text, "termpaper_lock_contended_total{lock=\"%s\"} %lu\n",
+                          get_lock_class_name(lock_class),
+                          snapshot->lock_contended[lock_class]);
+    }
+    append_metrics_family(text, "lock_wait_seconds", "histogram", "Time waited for a lock");
+    for (lock_class = 0; lock_class < NUM_LOCK_CLASSES; lock_class++) {
+      append_metrics_histogram(text, "lock_wait_seconds", "lock",
+                               get_lock_class_name(lock_class), snapshot->lock_wait[lock_class],
+                               snapshot->lock_wait_sum[lock_class], 1e-9);
+    }
+    append_metrics_family(text, "lock_hold_seconds", "histogram", "Time a lock was held");
+    for (lock_class = 0; lock_class < NUM_LOCK_CLASSES; lock_class++) {
+      append_metrics_histogram(text, "lock_hold_seconds", "lock",
+                               get_lock_class_name(lock_class), snapshot->lock_hold[lock_class],
+                               snapshot->lock_hold_sum[lock_class], 1e-9);
+    }
+  }
+
+  free(snapshot);
+}
+
+/*
+ * Sends all bytes - returns FALSE if the scraper is gone
+ */
+int send_metrics(int socket, const char *buffer, size_t len) {
+  while (len > 0) {
+    ssize_t sent = send(socket, buffer, len, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return FALSE;
+    }
+    buffer += sent;
+    len -= sent;
+  }
+  return TRUE;
+}
+
+void send_metrics_response(int socket, const char *status, const char *body, size_t len) {
+  char header[256];
+  int header_len = snprintf(header, sizeof(header),
+                            "HTTP/1.0 %s\r\n"
+                            "Content-Type: text/plain; version=0.0.4\r\n"
+                            "Content-Length: %zu\r\n"
+                            "Connection: close\r\n\r\n", status, len);
+  if (send_metrics(socket, header, header_len)) {
+    send_metrics(socket, body, len);
+  }
+}
+
+/*
+ * Answers one HTTP request - only GET /metrics is known
+ */
+void serve_metrics_request(Store *store, int socket) {
+  char request[MAX_METRICS_REQUEST_LEN + 1];
+  size_t len = 0;
+  request[0] = '\000';
+  while (len < MAX_METRICS_REQUEST_LEN && strstr(request, "\r\n\r\n") == NULL
+         && strstr(request, "\n\n") == NULL) {
+    ssize_t received = recv(socket, request + len, MAX_METRICS_REQUEST_LEN - len, 0);
+    if (received <= 0) {
+      break;
+    }
+    len += received;
+    request[len] = '\000';
+  }
+
+  if (strncmp(request, "GET ", 4) != 0) {
+    const char *body = "Only GET is supported\n";
+    send_metrics_response(socket, "405 Method Not Allowed", body, strlen(body));
+    return;
+  }
+  const char *path = request + 4;
+  size_t path_len = strcspn(path, " ?\r\n");
+  if (path_len != strlen("/metrics") || strncmp(path, "/metrics", path_len) != 0) {
+    const char *body = "Metrics are served at /metrics\n";
+    send_metrics_response(socket, "404 Not Found", body, strlen(body));
+    return;
+  }
+
+  MetricsText text;
+  render_metrics(store, &text);
+  send_metrics_response(socket, "200 OK", text.text, text.len);
+  free(text.text);
+}
+
+/*
+ * Serves the scrapers one after the other - they are few and a scrape
+ * takes no lock, so the request threads never wait for it
+ */
+void *accept_scrapers(void *input) {
+  MetricsListener *listener = (MetricsListener *) input;
+
+  while (TRUE) {
+    int socket = accept(listener->server_socket, NULL, NULL);
+    if (socket < 0) {
+      handle_error(socket, "accept() of a scraper failed", NO_EXIT);
+      continue;
+    }
+
+    // a stalled scraper must not keep the others waiting
+    struct timeval timeout = { METRICS_RECEIVE_TIMEOUT, 0 };
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    serve_metrics_request(listener->store, socket);
+    close(socket);
+  }
+  pthread_exit(NULL);
+}
+
+void start_metrics_listener(Store *store, unsigned short port) {
+  MetricsListener *listener = malloc(sizeof(MetricsListener));
+  if (listener == NULL) {
+    log_error("Allocation of the metrics listener failed");
+    exit_by_type(PROCESS_EXIT);
+  }
+  listener->store = store;
+  listener->server_socket = create_server_socket(port);
+
+  pthread_t thread;
+  int retcode = pthread_create(&thread, NULL, accept_scrapers, listener);
+  handle_thread_error(retcode, "Create metrics listener", PROCESS_EXIT);
+  pthread_detach(thread);
+  log_info("Metrics: served at http://localhost:%u/metrics", port);
+}
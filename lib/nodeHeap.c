@@ -0,0 +1,140 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides a heap whose memory comes from one NUMA node
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include <sys/mman.h>
+
+#include <termPaperLib.h>
+#include <placement.h>
+#include <nodeHeap.h>
+
+// size class of blocks that come from malloc
+#define MALLOC_CLASS (-1)
+
+// precedes every block - keeps the payload 16 byte aligned
+typedef struct BlockHeader {
+  long size_class;
+  long unused;
+} BlockHeader;
+
+NodeHeap *new_node_heap(int node) {
+  NodeHeap *heap = malloc(sizeof(NodeHeap));
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  heap->mutex = mutex;
+  heap->node = node;
+  memset(heap->free_blocks, 0, sizeof(heap->free_blocks));
+  heap->chunk = NULL;
+  heap->chunk_used = HEAP_CHUNK_SIZE;
+  return heap;
+}
+
+size_t get_block_size(int size_class) {
+  return (size_t) 1 << (HEAP_MIN_BLOCK_BITS + size_class);
+}
+
+int get_size_class(size_t size) {
+  int size_class = 0;
+  while (size_class < HEAP_NUM_CLASSES && get_block_size(size_class) < size) {
+    size_class++;
+  }
+  return size_class < HEAP_NUM_CLASSES ? size_class : MALLOC_CLASS;
+}
+
+/*
+ * Maps a new chunk - the pages are placed on the node of the heap as soon as
+ * they are touched the first time
+ * has to be called with the heap locked
+ */
+void new_heap_chunk(NodeHeap *heap) {
+  void *chunk = mmap(NULL, HEAP_CHUNK_SIZE, PROT_READ | PROT_WRITE, 
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (chunk == MAP_FAILED) {
+    handle_error(-1, "mmap() of a heap chunk failed", PROCESS_EXIT);
+  }
+
+  int retcode = bind_memory_to_node(chunk, HEAP_CHUNK_SIZE, heap->node);
+  if (retcode != 0) {
+    log_debug("Heap %p: mbind to node %d failed (%d) - using first touch", 
+              heap, heap->node, retcode);
+  }
+  heap->chunk = chunk;
+  heap->chunk_used = 0;
+}
+
+void *heap_alloc(NodeHeap *heap, size_t size) {
+  if (heap == NULL) {
+    return malloc(size);
+  }
+
+  int size_class = get_size_class(size + sizeof(BlockHeader));
+  BlockHeader *block;
+
+  if (size_class == MALLOC_CLASS) {
+    block = malloc(sizeof(BlockHeader) + size);
+  } else {
+    int retcode = pthread_mutex_lock(&heap->mutex);
+    handle_thread_error(retcode, "lock heap mutex", THREAD_EXIT);
+
+    block = heap->free_blocks[size_class];
+    if (block != NULL) {
+      heap->free_blocks[size_class] = *(void **) block;
+    } else {
+      size_t block_size = get_block_size(size_class);
+      if (heap->chunk_used + block_size > HEAP_CHUNK_SIZE) {
+        new_heap_chunk(heap);
+      }
+      block = (BlockHeader *) (heap->chunk + heap->chunk_used);
+      heap->chunk_used += block_size;
+    }
+
+    retcode = pthread_mutex_unlock(&heap->mutex);
+    handle_thread_error(retcode, "unlock heap mutex", THREAD_EXIT);
+  }
+
+  block->size_class = size_class;
+  return block + 1;
+}
+
+void heap_free(NodeHeap *heap, void *memory) {
+  if (heap == NULL) {
+    free(memory);
+    return;
+  }
+  if (memory == NULL) {
+    return;
+  }
+
+  BlockHeader *block = (BlockHeader *) memory - 1;
+  int size_class = block->size_class;
+  if (size_class == MALLOC_CLASS) {
+    free(block);
+    return;
+  }
+
+  int retcode = pthread_mutex_lock(&heap->mutex);
+  handle_thread_error(retcode, "lock heap mutex", THREAD_EXIT);
+
+  *(void **) block = heap->free_blocks[size_class];
+  heap->free_blocks[size_class] = block;
+
+  retcode = pthread_mutex_unlock(&heap->mutex);
+  handle_thread_error(retcode, "unlock heap mutex", THREAD_EXIT);
+}
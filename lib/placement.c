@@ -0,0 +1,177 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the CPU and NUMA node placement of threads and memory
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include <termPaperLib.h>
+#include <placement.h>
+
+#define NODE_CPULIST "/sys/devices/system/node/node%d/cpulist"
+
+// topology - read once
+pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+int num_nodes = 1;
+int num_cpus = 0;
+// CPUs the process may use in ascending order
+int cpus[CPU_SETSIZE];
+int node_of_cpu[CPU_SETSIZE];
+cpu_set_t node_cpus[MAX_NODES];
+
+// set once the thread was pinned to a CPU (-P) - it is never moved then
+__thread int pinned_to_cpu = FALSE;
+
+/*
+ * Parses a cpulist like 0-3,8-11 into a cpu set
+ */
+int parse_cpulist(FILE *file, cpu_set_t *set) {
+  int first, last, found = FALSE;
+  CPU_ZERO(set);
+
+  while (fscanf(file, "%d", &first) == 1) {
+    last = first;
+    int c = fgetc(file);
+    if (c == '-') {
+      if (fscanf(file, "%d", &last) != 1) {
+        break;
+      }
+      c = fgetc(file);
+    }
+    for (; first <= last && first < CPU_SETSIZE; first++) {
+      CPU_SET(first, set);
+      found = TRUE;
+    }
+    if (c != ',') {
+      break;
+    }
+  }
+  return found;
+}
+
+void read_topology() {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    CPU_ZERO(&allowed);
+    CPU_SET(0, &allowed);
+  }
+
+  int cpu;
+  for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    node_of_cpu[cpu] = 0;
+    if (CPU_ISSET(cpu, &allowed)) {
+      cpus[num_cpus++] = cpu;
+    }
+  }
+
+  // without NUMA information everything belongs to node 0
+  node_cpus[0] = allowed;
+
+  int node;
+  char path[MAX_BUFLEN];
+  for (node = 0; node < MAX_NODES; node++) {
+    snprintf(path, MAX_BUFLEN, NODE_CPULIST, node);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+      break;
+    }
+    int found = parse_cpulist(file, &node_cpus[node]);
+    fclose(file);
+
+    // memory only nodes are not used
+    if (!found) {
+      break;
+    }
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &node_cpus[node])) {
+        node_of_cpu[cpu] = node;
+      }
+    }
+    num_nodes = node + 1;
+  }
+  log_info("Placement: %d CPUs on %d NUMA nodes", num_cpus, num_nodes);
+}
+
+void init_topology() {
+  int retcode = pthread_once(&topology_once, read_topology);
+  handle_thread_error(retcode, "read topology", PROCESS_EXIT);
+}
+
+int get_num_cpus() {
+  init_topology();
+  return num_cpus;
+}
+
+int get_num_nodes() {
+  init_topology();
+  return num_nodes;
+}
+
+int get_node_of_cpu(int cpu) {
+  init_topology();
+  if (cpu < 0 || cpu >= CPU_SETSIZE) {
+    return 0;
+  }
+  return node_of_cpu[cpu];
+}
+
+int get_current_node() {
+  return get_node_of_cpu(sched_getcpu());
+}
+
+int pin_thread_to_cpu(int cpu) {
+  init_topology();
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpus[cpu % num_cpus], &set);
+  int retcode = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (retcode == 0) {
+    pinned_to_cpu = TRUE;
+  }
+  return retcode;
+}
+
+int is_thread_pinned() {
+  return pinned_to_cpu;
+}
+
+int pin_thread_to_node(int node) {
+  init_topology();
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), 
+                                &node_cpus[node % num_nodes]);
+}
+
+int bind_memory_to_node(void *memory, size_t len, int node) {
+  init_topology();
+  unsigned long nodemask = 1UL << (node % num_nodes);
+
+  // preferred instead of bind - a full node must not fail the allocation
+  if (syscall(SYS_mbind, memory, len, MPOL_PREFERRED, &nodemask, 
+              sizeof(nodemask) * 8, 0) != 0) {
+    return errno;
+  }
+  return 0;
+}
@@ -0,0 +1,608 @@
+/*
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the asynchronous replication of the changes of a primary to
+ * its followers
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <termPaperLib.h>
+#include <replication.h>
+
+// time between two connection attempts of a follower (s)
+#define RECONNECT_DELAY 1
+
+typedef struct replicationListener {
+  Replication *replication;
+  int server_socket;
+} ReplicationListener;
+
+typedef struct primaryAddress {
+  Replication *replication;
+  char *ip;
+  unsigned short port;
+} PrimaryAddress;
+
+// the files a follower had when it connected - they are served while it
+// catches up, those the primary did not send are deleted afterwards
+typedef struct staleFiles {
+  Arena *arena;
+  // \n before every ID
+  char *IDs;
+  size_t num_IDs;
+  // the IDs of the catch up
+  char **received;
+  size_t num_received;
+  size_t capacity;
+} StaleFiles;
+
+uint64_t get_replication_time() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+Replication *new_replication(Store *store) {
+  Replication *replication = malloc(sizeof(Replication));
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  replication->store = store;
+  replication->mutex = mutex;
+  replication->followers = NULL;
+  replication->next_lsn = 1;
+  replication->applied_lsn = 0;
+  replication->applied_timestamp = 0;
+  replication->caught_up = FALSE;
+  return replication;
+}
+
+void lock_replication_mutex(pthread_mutex_t *mutex) {
+  int retcode = pthread_mutex_lock(mutex);
+  handle_thread_error(retcode, "lock replication mutex", THREAD_EXIT);
+}
+
+void unlock_replication_mutex(pthread_mutex_t *mutex) {
+  int retcode = pthread_mutex_unlock(mutex);
+  handle_thread_error(retcode, "unlock replication mutex", THREAD_EXIT);
+}
+
+/*
+ * Encodes a record - ID and payload are copied with their \000
+ */
+PendingChange *new_pending_change(int type, const char *ID, const void *payload,
+                                  size_t payload_size, uint64_t lsn) {
+  size_t ID_len = ID != NULL ? strlen(ID) + 1 : 0;
+  size_t len = sizeof(ReplicationHeader) + ID_len + payload_size;
+  PendingChange *change = malloc(sizeof(PendingChange) + len);
+  if (change == NULL) {
+    log_error("Replication: allocation of a record with %zu bytes failed", len);
+    exit_by_type(PROCESS_EXIT);
+  }
+
+  ReplicationHeader header;
+  header.type = type;
+  header.ID_len = ID_len;
+  header.payload_size = payload_size;
+  header.reserved = 0;
+  header.lsn = lsn;
+  header.timestamp = get_replication_time();
+  memcpy(change->data, &header, sizeof(header));
+  memcpy(change->data + sizeof(header), ID, ID_len);
+  memcpy(change->data + sizeof(header) + ID_len, payload, payload_size);
+
+  change->len = len;
+  change->next = NULL;
+  return change;
+}
+
+void free_pending_changes(PendingChange *change) {
+  while (change != NULL) {
+    PendingChange *next = change->next;
+    free(change);
+    change = next;
+  }
+}
+
+/*
+ * Writes all of data - returns FALSE if the follower is gone or stalled
+ */
+int send_to_follower(int socket, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t sent = send(socket, data, len, 0);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return FALSE;
+    }
+    data += sent;
+    len -= sent;
+  }
+  return TRUE;
+}
+
+void publish_change(Replication *replication, int type, const char *ID,
+                    const void *payload, size_t payload_size) {
+  // nobody listens - a follower that registers later gets the change with
+  // its catch up, it was applied already
+  if (__atomic_load_n(&replication->followers, __ATOMIC_ACQUIRE) == NULL) {
+    __atomic_add_fetch(&replication->next_lsn, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  lock_replication_mutex(&replication->mutex);
+  uint64_t lsn = __atomic_fetch_add(&replication->next_lsn, 1, __ATOMIC_RELAXED);
+  Follower *follower;
+  for (follower = replication->followers; follower != NULL; follower = follower->next) {
+    PendingChange *change = new_pending_change(type, ID, payload, payload_size, lsn);
+
+    lock_replication_mutex(&follower->mutex);
+    if (follower->dropped) {
+      free(change);
+    } else if (follower->backlog + change->len > MAX_FOLLOWER_BACKLOG) {
+      // it has to start over - better than keeping its changes forever
+      log_error("Replication: follower %d lags more than %d bytes - dropped",
+                follower->socket, MAX_FOLLOWER_BACKLOG);
+      follower->dropped = TRUE;
+      free(change);
+    } else {
+      if (follower->tail != NULL) {
+        follower->tail->next = change;
+      } else {
+        follower->head = change;
+      }
+      follower->tail = change;
+      follower->backlog += change->len;
+    }
+    int retcode = pthread_cond_signal(&follower->not_empty);
+    handle_thread_error(retcode, "signal follower", THREAD_EXIT);
+    unlock_replication_mutex(&follower->mutex);
+  }
+  unlock_replication_mutex(&replication->mutex);
+}
+
+/*
+ * Waits for the next changes of a follower - a heartbeat if there were none
+ * for a while. Returns NULL if the follower was dropped
+ */
+PendingChange *take_pending_changes(Follower *follower) {
+  lock_replication_mutex(&follower->mutex);
+  if (follower->head == NULL && !follower->dropped) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += REPLICATION_HEARTBEAT_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    int retcode = 0;
+    while (follower->head == NULL && !follower->dropped && retcode != ETIMEDOUT) {
+      retcode = pthread_cond_timedwait(&follower->not_empty, &follower->mutex, &deadline);
+    }
+  }
+
+  PendingChange *changes = NULL;
+  int dropped = follower->dropped;
+  if (!dropped) {
+    changes = follower->head;
+    follower->head = NULL;
+    follower->tail = NULL;
+    follower->backlog = 0;
+  }
+  unlock_replication_mutex(&follower->mutex);
+
+  // everything published so far was sent
+  if (changes == NULL && !dropped) {
+    uint64_t lsn = __atomic_load_n(&follower->replication->next_lsn, __ATOMIC_RELAXED) - 1;
+    changes = new_pending_change(REPLICATION_HEARTBEAT, NULL, NULL, 0, lsn);
+  }
+  return changes;
+}
+
+/*
+ * Takes the follower out of the list of its primary and frees it
+ */
+void remove_follower(Follower *follower) {
+  Replication *replication = follower->replication;
+  lock_replication_mutex(&replication->mutex);
+  Follower **link = &replication->followers;
+  while (*link != follower) {
+    link = &(*link)->next;
+  }
+  __atomic_store_n(link, follower->next, __ATOMIC_RELEASE);
+  unlock_replication_mutex(&replication->mutex);
+
+  log_info("Replication: follower %d disconnected", follower->socket);
+  close(follower->socket);
+  free_pending_changes(follower->head);
+  free(follower);
+}
+
+/*
+ * Sends one record - returns FALSE if the follower is gone or stalled
+ */
+int send_record(Follower *follower, int type, const char *ID, const void *payload,
+                size_t payload_size) {
+  PendingChange *record = new_pending_change(type, ID, payload, payload_size, 0);
+  int sent = send_to_follower(follower->socket, record->data, record->len);
+  free(record);
+  return sent;
+}
+
+/*
+ * Sends all files before the live changes - one at a time, only their IDs are
+ * copied up front. Changes published meanwhile wait in the backlog of the 
+ * follower, which is dropped if the catch up takes too long
+ */
+int send_catch_up(Follower *follower) {
+  Store *store = follower->replication->store;
+  Arena *arena = new_arena(ARENA_CHUNK_SIZE);
+  char *IDs;
+  copy_all_store_IDs(store, &IDs, arena);
+
+  unsigned long num_files = 0;
+  int sent = TRUE;
+  char *position;
+  char *ID = strtok_r(IDs, "\n", &position);
+  while (ID != NULL && sent && !__atomic_load_n(&follower->dropped, __ATOMIC_RELAXED)) {
+    void *payload;
+    size_t payload_size = getElementByID(route_to_shard(store, ID), &payload, ID);
+    // NULL if it was deleted since the IDs were copied
+    if (payload != NULL) {
+      sent = send_record(follower, WAL_CREATE, ID, payload, payload_size);
+      free(payload);
+      num_files++;
+    }
+    ID = strtok_r(NULL, "\n", &position);
+  }
+  free_arena(arena);
+
+  if (!sent || __atomic_load_n(&follower->dropped, __ATOMIC_RELAXED)) {
+    return FALSE;
+  }
+  log_info("Replication: follower %d got %lu files - sending the live changes",
+           follower->socket, num_files);
+  return send_record(follower, REPLICATION_CAUGHT_UP, NULL, NULL, 0);
+}
+
+void *send_changes(void *input) {
+  Follower *follower = (Follower *) input;
+
+  if (!send_catch_up(follower)) {
+    remove_follower(follower);
+    pthread_exit(NULL);
+  }
+
+  PendingChange *changes;
+  while ((changes = take_pending_changes(follower)) != NULL) {
+    PendingChange *change;
+    int sent = TRUE;
+    for (change = changes; change != NULL && sent; change = change->next) {
+      sent = send_to_follower(follower->socket, change->data, change->len);
+    }
+    free_pending_changes(changes);
+    if (!sent) {
+      break;
+    }
+  }
+
+  remove_follower(follower);
+  pthread_exit(NULL);
+}
+
+/*
+ * Registers a new follower - its sender streams all files before the changes
+ * published from now on
+ */
+void add_follower(Replication *replication, int socket) {
+  Follower *follower = malloc(sizeof(Follower));
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+  follower->socket = socket;
+  follower->mutex = mutex;
+  follower->not_empty = not_empty;
+  follower->head = NULL;
+  follower->tail = NULL;
+  follower->backlog = 0;
+  follower->dropped = FALSE;
+  follower->replication = replication;
+
+  // changes from now on are queued - a change that is in the catch up too is
+  // applied twice, which gives the same file
+  lock_replication_mutex(&replication->mutex);
+  follower->next = replication->followers;
+  __atomic_store_n(&replication->followers, follower, __ATOMIC_RELEASE);
+  unlock_replication_mutex(&replication->mutex);
+  log_info("Replication: follower %d connected - catching up", socket);
+
+  pthread_t thread;
+  int retcode = pthread_create(&thread, NULL, send_changes, follower);
+  handle_thread_error(retcode, "Create replication sender", PROCESS_EXIT);
+  pthread_detach(thread);
+}
+
+void *accept_followers(void *input) {
+  ReplicationListener *listener = (ReplicationListener *) input;
+
+  while (TRUE) {
+    int socket = accept(listener->server_socket, NULL, NULL);
+    if (socket < 0) {
+      handle_error(socket, "accept() of a follower failed", NO_EXIT);
+      continue;
+    }
+
+    // a stalled follower must not keep its sender forever
+    struct timeval timeout = { REPLICATION_SEND_TIMEOUT, 0 };
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    add_follower(listener->replication, socket);
+  }
+  pthread_exit(NULL);
+}
+
+void start_replication_primary(Store *store, unsigned short port) {
+  ReplicationListener *listener = malloc(sizeof(ReplicationListener));
+  listener->replication = new_replication(store);
+  listener->server_socket = create_server_socket(port);
+  store->replication = listener->replication;
+
+  pthread_t thread;
+  int retcode = pthread_create(&thread, NULL, accept_followers, listener);
+  handle_thread_error(retcode, "Create replication listener", PROCESS_EXIT);
+  pthread_detach(thread);
+  log_info("Replication: primary - followers connect to port %u", port);
+}
+
+/*
+ * Reads exactly len bytes - returns FALSE if the primary is gone
+ */
+int receive_from_primary(int socket, void *buffer, size_t len) {
+  char *position = (char *) buffer;
+  while (len > 0) {
+    ssize_t received = recv(socket, position, len, 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return FALSE;
+    }
+    position += received;
+    len -= received;
+  }
+  return TRUE;
+}
+
+/*
+ * Returns a socket connected to the primary - -1 if it can't be reached
+ */
+int connect_to_primary(PrimaryAddress *primary) {
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = inet_addr(primary->ip);
+  address.sin_port = htons(primary->port);
+
+  int socket_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  handle_error(socket_fd, "socket() failed", PROCESS_EXIT);
+  if (connect(socket_fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+    close(socket_fd);
+    return -1;
+  }
+  return socket_fd;
+}
+
+void init_stale_files(Store *store, StaleFiles *stale) {
+  stale->arena = new_arena(ARENA_CHUNK_SIZE);
+  stale->num_IDs = copy_all_store_IDs(store, &stale->IDs, stale->arena);
+  stale->received = NULL;
+  stale->num_received = 0;
+  stale->capacity = 0;
+}
+
+/*
+ * Remembers a file of the catch up - not needed if the follower was empty
+ */
+void add_received_file(StaleFiles *stale, const char *ID) {
+  if (stale->num_IDs == 0) {
+    return;
+  }
+  if (stale->num_received == stale->capacity) {
+    size_t capacity = stale->capacity > 0 ? 2 * stale->capacity : 1024;
+    stale->received = arena_extend(stale->arena, stale->received,
+                                   stale->capacity * sizeof(char *),
+                                   capacity * sizeof(char *));
+    stale->capacity = capacity;
+  }
+  size_t len = strlen(ID) + 1;
+  char *copy = arena_alloc(stale->arena, len);
+  memcpy(copy, ID, len);
+  stale->received[stale->num_received++] = copy;
+}
+
+int compare_received_IDs(const void *a, const void *b) {
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+ * Deletes the files the primary no longer has - called once the catch up is
+ * applied, before any live change. Returns their number
+ */
+unsigned long delete_stale_files(Store *store, StaleFiles *stale) {
+  if (stale->num_IDs == 0) {
+    return 0;
+  }
+  qsort(stale->received, stale->num_received, sizeof(char *), compare_received_IDs);
+
+  unsigned long deleted = 0;
+  char *position;
+  char *ID = strtok_r(stale->IDs, "\n", &position);
+  while (ID != NULL) {
+    if (bsearch(&ID, stale->received, stale->num_received, sizeof(char *),
+                compare_received_IDs) == NULL) {
+      change_store_file(store, WAL_DELETE, ID, NULL, 0);
+      deleted++;
+    }
+    ID = strtok_r(NULL, "\n", &position);
+  }
+  return deleted;
+}
+
+/*
+ * A change may come with the catch up and again as live change - the files
+ * are created or changed as needed so both give the same file
+ */
+void apply_replicated_change(Store *store, int type, char *ID, void *payload,
+                             size_t payload_size) {
+  switch (type) {
+    case WAL_CREATE:
+    case WAL_UPDATE:
+      if (change_store_file(store, WAL_UPDATE, ID, payload, payload_size) != 0) {
+        change_store_file(store, WAL_CREATE, ID, payload, payload_size);
+      }
+      break;
+    case WAL_DELETE:
+      change_store_file(store, WAL_DELETE, ID, NULL, 0);
+      break;
+  }
+}
+
+/*
+ * Applies the changes of the primary until the connection breaks - returns
+ * the number of applied changes
+ */
+unsigned long follow_primary(Replication *replication, int socket) {
+  unsigned long applied = 0;
+  // the longest ID and content of a file, both with \000
+  char *buffer = malloc(2 * (MAX_BUFLEN + 1));
+  if (buffer == NULL) {
+    log_error("Replication: allocation of the receive buffer failed");
+    return 0;
+  }
+  StaleFiles stale;
+  init_stale_files(replication->store, &stale);
+  int caught_up = FALSE;
+
+  ReplicationHeader header;
+  while (receive_from_primary(socket, &header, sizeof(header))) {
+    // a corrupt stream - the follower connects and catches up again
+    if (header.ID_len > MAX_BUFLEN + 1 || header.payload_size > MAX_BUFLEN + 1) {
+      log_error("Replication: record of %u + %u bytes from the primary - too long",
+                header.ID_len, header.payload_size);
+      break;
+    }
+    size_t len = (size_t) header.ID_len + header.payload_size;
+    if (!receive_from_primary(socket, buffer, len)) {
+      break;
+    }
+
+    int is_change = header.type == WAL_CREATE || header.type == WAL_UPDATE
+                    || header.type == WAL_DELETE;
+    if (is_change) {
+      if (header.ID_len < 2 || buffer[header.ID_len - 1] != '\000') {
+        log_error("Replication: invalid record from the primary");
+        break;
+      }
+      apply_replicated_change(replication->store, header.type, buffer,
+                              buffer + header.ID_len, header.payload_size);
+      if (!caught_up) {
+        add_received_file(&stale, buffer);
+      }
+      applied++;
+    } else if (header.type == REPLICATION_CAUGHT_UP) {
+      unsigned long deleted = delete_stale_files(replication->store, &stale);
+      log_info("Replication: caught up with the primary - %lu files, %lu stale ones deleted",
+               applied, deleted);
+      caught_up = TRUE;
+      __atomic_store_n(&replication->caught_up, TRUE, __ATOMIC_RELAXED);
+    }
+
+    // the copied files have no position - the live changes, heartbeats and 
+    // the end of the catch up have
+    if (header.lsn != 0 || !is_change) {
+      __atomic_store_n(&replication->applied_lsn, header.lsn, __ATOMIC_RELAXED);
+      __atomic_store_n(&replication->applied_timestamp, header.timestamp,
+                       __ATOMIC_RELAXED);
+    }
+  }
+  free_arena(stale.arena);
+  free(buffer);
+  return applied;
+}
+
+void *run_follower(void *input) {
+  PrimaryAddress *primary = (PrimaryAddress *) input;
+  Replication *replication = primary->replication;
+
+  while (TRUE) {
+    int socket = connect_to_primary(primary);
+    if (socket < 0) {
+      log_error("Replication: primary %s:%u not reachable: %s", primary->ip,
+                primary->port, strerror(errno));
+      sleep(RECONNECT_DELAY);
+      continue;
+    }
+
+    log_info("Replication: connected to the primary %s:%u", primary->ip, primary->port);
+    __atomic_store_n(&replication->caught_up, FALSE, __ATOMIC_RELAXED);
+    unsigned long applied = follow_primary(replication, socket);
+    close(socket);
+
+    log_error("Replication: lost the primary after %lu changes - reconnecting", applied);
+    sleep(RECONNECT_DELAY);
+  }
+  pthread_exit(NULL);
+}
+
+void start_replication_follower(Store *store, const char *ip, unsigned short port) {
+  PrimaryAddress *primary = malloc(sizeof(PrimaryAddress));
+  primary->replication = new_replication(store);
+  primary->ip = strdup(ip);
+  primary->port = port;
+  store->replication = primary->replication;
+  store->read_only = TRUE;
+
+  pthread_t thread;
+  int retcode = pthread_create(&thread, NULL, run_follower, primary);
+  handle_thread_error(retcode, "Create replication follower", PROCESS_EXIT);
+  pthread_detach(thread);
+  log_info("Replication: follower of %s:%u - read only", ip, port);
+}
+
+long get_replication_lag(Replication *replication) {
+  if (!__atomic_load_n(&replication->caught_up, __ATOMIC_RELAXED)) {
+    return -1;
+  }
+  uint64_t published = __atomic_load_n(&replication->applied_timestamp, __ATOMIC_RELAXED);
+  uint64_t now = get_replication_time();
+  return now > published ? (long) ((now - published) / 1000) : 0;
+}
+
+void get_replication_state(Replication *replication, uint64_t *lsn, int *followers) {
+  lock_replication_mutex(&replication->mutex);
+  *lsn = __atomic_load_n(&replication->next_lsn, __ATOMIC_RELAXED) - 1;
+  *followers = 0;
+  Follower *follower;
+  for (follower = replication->followers; follower != NULL; follower = follower->next) {
+    (*followers)++;
+  }
+  unlock_replication_mutex(&replication->mutex);
+}
@@ -0,0 +1,127 @@
+/*
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides a response builder that collects references to the pieces of
+ * a response and sends them with a single writev
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <response.h>
+#include <coroutine.h>
+
+void init_response(Response *response, Arena *arena) {
+  response->parts = response->own_parts;
+  response->num_parts = 0;
+  response->max_parts = MAX_RESPONSE_PARTS;
+  response->incomplete = FALSE;
+  response->length = 0;
+  response->header[0] = '\000';
+  response->arena = arena;
+  response->failed = FALSE;
+}
+
+/*
+ * Doubles the room for parts - FALSE without an arena, nobody would free it
+ */
+int grow_response_parts(Response *response) {
+  if (response->arena == NULL) {
+    return FALSE;
+  }
+  struct iovec *parts = arena_alloc(response->arena, 
+                                    2 * response->max_parts * sizeof(struct iovec));
+  memcpy(parts, response->parts, response->num_parts * sizeof(struct iovec));
+  response->parts = parts;
+  response->max_parts *= 2;
+  return TRUE;
+}
+
+int add_to_response(Response *response, const void *part, size_t len) {
+  if (len == 0) {
+    return TRUE;
+  }
+  if (response->num_parts == response->max_parts && !grow_response_parts(response)) {
+    log_error("Response has more than %d parts - it is not sent", response->max_parts);
+    response->incomplete = TRUE;
+    response->failed = TRUE;
+    return FALSE;
+  }
+
+  // writev does not modify the referenced memory
+  response->parts[response->num_parts].iov_base = (void *) part;
+  response->parts[response->num_parts].iov_len = len;
+  response->num_parts++;
+  response->length += len;
+  return TRUE;
+}
+
+int add_string_to_response(Response *response, const char *str) {
+  return add_to_response(response, str, strlen(str));
+}
+
+int add_header_to_response(Response *response, const char *format, ...) {
+  va_list argptr;
+  va_start(argptr, format);
+  int len = vsnprintf(response->header, MAX_HEADER_LEN + 1, format, argptr);
+  va_end(argptr);
+
+  if (len > MAX_HEADER_LEN) {
+    len = MAX_HEADER_LEN;
+  }
+  return add_to_response(response, response->header, len);
+}
+
+int write_response_to_socket(int client_socket, Response *response) {
+  log_debug("write_response client_socket = %d parts = %d len = %zu", client_socket,
+      response->num_parts, response->length);
+  // a truncated response would look valid to the client
+  if (response->incomplete) {
+    log_error("Response incomplete - closing the connection");
+    return FALSE;
+  }
+
+  struct iovec *parts = response->parts;
+  int num_parts = response->num_parts;
+
+  // writev may return early (signals, full buffers) - continue where it stopped
+  while (num_parts > 0) {
+    ssize_t sent = co_writev(client_socket, parts, num_parts);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      log_error("Send message to client failed");
+      return FALSE;
+    }
+
+    while (num_parts > 0 && (size_t) sent >= parts->iov_len) {
+      sent -= parts->iov_len;
+      parts++;
+      num_parts--;
+    }
+    if (num_parts > 0) {
+      parts->iov_base = (char *) parts->iov_base + sent;
+      parts->iov_len -= sent;
+    }
+  }
+  return TRUE;
+}
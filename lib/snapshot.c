@@ -0,0 +1,261 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the snapshots of a store - written in the background and 
+ * mapped at startup
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <termPaperLib.h>
+#include <snapshot.h>
+
+// stdio buffer of the writer - few syscalls while an element is locked
+#define SNAPSHOT_BUFFER_SIZE (1024 * 1024)
+
+typedef struct snapshotWriter {
+  FILE *file;
+  uint64_t num_files;
+  int failed;
+} SnapshotWriter;
+
+typedef struct snapshotThread {
+  Store *store;
+  char *path;
+  long interval;
+} SnapshotThread;
+
+size_t get_padding(size_t len) {
+  return (SNAPSHOT_ALIGNMENT - len % SNAPSHOT_ALIGNMENT) % SNAPSHOT_ALIGNMENT;
+}
+
+/*
+ * Appends one file - called with the content of the element locked
+ */
+void write_entry(void *input, const char *ID, const void *payload, 
+                 size_t payload_size, unsigned long sequence) {
+  SnapshotWriter *writer = (SnapshotWriter *) input;
+  static const char padding[SNAPSHOT_ALIGNMENT];
+
+  SnapshotEntry entry;
+  entry.sequence = sequence;
+  entry.ID_len = strlen(ID) + 1;
+  entry.payload_size = payload_size;
+
+  size_t len = sizeof(entry) + entry.ID_len + payload_size;
+  size_t pad = get_padding(len);
+  if (fwrite(&entry, sizeof(entry), 1, writer->file) != 1
+      || fwrite(ID, entry.ID_len, 1, writer->file) != 1
+      || fwrite(payload, payload_size, 1, writer->file) != 1
+      || fwrite(padding, 1, pad, writer->file) != pad) {
+    writer->failed = TRUE;
+  }
+  writer->num_files++;
+}
+
+long write_snapshot(Store *store, const char *path) {
+  size_t path_len = strlen(path);
+  char *temp_path = malloc(path_len + 5);
+  memcpy(temp_path, path, path_len);
+  memcpy(temp_path + path_len, ".tmp", 5);
+
+  SnapshotWriter writer;
+  writer.num_files = 0;
+  writer.failed = FALSE;
+  writer.file = fopen(temp_path, "w");
+  if (writer.file == NULL) {
+    log_error("Snapshot: open of %s failed: %s", temp_path, strerror(errno));
+    free(temp_path);
+    return -1;
+  }
+  setvbuf(writer.file, NULL, _IOFBF, SNAPSHOT_BUFFER_SIZE);
+
+  // the number of files is known at the end
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.num_shards = store->num_shards;
+  if (fwrite(&header, sizeof(header), 1, writer.file) != 1) {
+    writer.failed = TRUE;
+  }
+
+  int i;
+  for (i = 0; i < store->num_shards && !writer.failed; i++) {
+    visitAllElements(store->shards[i].list, write_entry, &writer);
+  }
+
+  header.num_files = writer.num_files;
+  if (writer.failed
+      || fseek(writer.file, 0, SEEK_SET) != 0
+      || fwrite(&header, sizeof(header), 1, writer.file) != 1
+      || fflush(writer.file) != 0
+      || fdatasync(fileno(writer.file)) != 0) {
+    writer.failed = TRUE;
+  }
+  if (fclose(writer.file) != 0) {
+    writer.failed = TRUE;
+  }
+
+  // a crash leaves either the old or the new snapshot
+  if (writer.failed || rename(temp_path, path) != 0) {
+    log_error("Snapshot: write of %s failed: %s", temp_path, strerror(errno));
+    unlink(temp_path);
+    free(temp_path);
+    return -1;
+  }
+  free(temp_path);
+
+  // until the rename is durable the log still needs the older changes
+  if (sync_parent_directory(path) != 0) {
+    log_error("Snapshot: sync of the directory of %s failed: %s", path, strerror(errno));
+    return -1;
+  }
+  return writer.num_files;
+}
+
+/*
+ * Returns the entry at offset if it fits into the mapping - NULL otherwise
+ */
+SnapshotEntry *get_entry(char *mapping, size_t size, size_t offset, size_t *next) {
+  if (offset + sizeof(SnapshotEntry) > size) {
+    return NULL;
+  }
+  SnapshotEntry *entry = (SnapshotEntry *) (mapping + offset);
+  size_t len = sizeof(SnapshotEntry) + (size_t) entry->ID_len + entry->payload_size;
+  if (entry->ID_len < 2 || entry->payload_size < 1 || offset + len > size) {
+    return NULL;
+  }
+
+  // both are used as strings
+  char *ID = (char *) (entry + 1);
+  if (ID[entry->ID_len - 1] != '\000' || ID[entry->ID_len + entry->payload_size - 1] != '\000') {
+    return NULL;
+  }
+  *next = offset + len + get_padding(len);
+  return entry;
+}
+
+int compare_snapshot_entries(const void *a, const void *b) {
+  uint64_t first = (*(SnapshotEntry * const *) a)->sequence;
+  uint64_t second = (*(SnapshotEntry * const *) b)->sequence;
+  return (first > second) - (first < second);
+}
+
+long load_snapshot(Store *store, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0 && errno == ENOENT) {
+    log_info("Snapshot: no snapshot at %s", path);
+    return 0;
+  }
+  handle_error(fd, "Open of the snapshot failed", PROCESS_EXIT);
+
+  struct stat stats;
+  int retcode = fstat(fd, &stats);
+  handle_error(retcode, "fstat() of the snapshot failed", PROCESS_EXIT);
+  size_t size = stats.st_size;
+  if (size < sizeof(SnapshotHeader)) {
+    log_error("Snapshot: %s is no snapshot", path);
+    exit_by_type(PROCESS_EXIT);
+  }
+
+  // never unmapped - the files point into it until they are changed
+  char *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mapping == MAP_FAILED) {
+    handle_error(-1, "mmap() of the snapshot failed", PROCESS_EXIT);
+  }
+  close(fd);
+
+  SnapshotHeader *header = (SnapshotHeader *) mapping;
+  if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+      || header->num_files > size / sizeof(SnapshotEntry)) {
+    log_error("Snapshot: %s is no snapshot", path);
+    exit_by_type(PROCESS_EXIT);
+  }
+
+  // a different sharding mixes the lists - they have to be sorted again
+  SnapshotEntry **entries = malloc(header->num_files * sizeof(SnapshotEntry *));
+  size_t offset = sizeof(SnapshotHeader);
+  uint64_t i;
+  for (i = 0; i < header->num_files; i++) {
+    entries[i] = get_entry(mapping, size, offset, &offset);
+    if (entries[i] == NULL) {
+      log_error("Snapshot: %s is corrupt at offset %zu", path, offset);
+      exit_by_type(PROCESS_EXIT);
+    }
+  }
+  if (header->num_shards != (uint32_t) store->num_shards) {
+    qsort(entries, header->num_files, sizeof(SnapshotEntry *), compare_snapshot_entries);
+  }
+
+  ConcurrentListElement **last = calloc(store->num_shards, sizeof(ConcurrentListElement *));
+  for (i = 0; i < header->num_files; i++) {
+    char *ID = (char *) (entries[i] + 1);
+    int shard = get_shard_index(store, ID);
+    last[shard] = appendBorrowedElement(store->shards[shard].list, last[shard], ID, 
+                                        ID + entries[i]->ID_len, entries[i]->payload_size, 
+                                        entries[i]->sequence);
+  }
+  free(last);
+  free(entries);
+
+  log_info("Snapshot: %llu files mapped from %s", (unsigned long long) header->num_files, path);
+  return header->num_files;
+}
+
+void *run_snapshots(void *input) {
+  SnapshotThread *snapshots = (SnapshotThread *) input;
+  log_info("Thread %ld: Hello from SNAPSHOTS", (long) pthread_self());
+
+  unsigned long written_changes = get_store_changes(snapshots->store);
+  while (TRUE) {
+    sleep(snapshots->interval);
+
+    unsigned long changes = get_store_changes(snapshots->store);
+    if (changes == written_changes) {
+      continue;
+    }
+    // the log only has to keep the changes the snapshot may miss
+    start_store_checkpoint(snapshots->store);
+    long num_files = write_snapshot(snapshots->store, snapshots->path);
+    if (num_files >= 0) {
+      finish_store_checkpoint(snapshots->store);
+      log_info("Snapshot: %ld files written to %s", num_files, snapshots->path);
+      written_changes = changes;
+    }
+  }
+  return NULL;
+}
+
+void start_snapshot_thread(Store *store, const char *path, long interval) {
+  SnapshotThread *snapshots = malloc(sizeof(SnapshotThread));
+  snapshots->store = store;
+  snapshots->path = strdup(path);
+  snapshots->interval = interval > 0 ? interval : DEFAULT_SNAPSHOT_INTERVAL;
+
+  pthread_t thread;
+  int retcode = pthread_create(&thread, NULL, run_snapshots, snapshots);
+  handle_thread_error(retcode, "Create snapshot thread", PROCESS_EXIT);
+  pthread_detach(thread);
+}
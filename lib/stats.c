@@ -0,0 +1,262 @@
+/*
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the request statistics - every thread counts on its own, the
+ * counters are only summed up when they are shown
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include <stats.h>
+
+// the counters of all threads that ever counted - they are never freed
+pthread_mutex_t thread_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+ThreadStats *all_thread_stats = NULL;
+ThreadStats *free_thread_stats = NULL;
+
+__thread ThreadStats *own_thread_stats = NULL;
+pthread_key_t thread_stats_key;
+pthread_once_t thread_stats_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Called when a thread ends - the next thread continues its counters
+ */
+void orphan_thread_stats(void *input) {
+  ThreadStats *stats = (ThreadStats *) input;
+  pthread_mutex_lock(&thread_stats_mutex);
+  stats->nextFree = free_thread_stats;
+  free_thread_stats = stats;
+  pthread_mutex_unlock(&thread_stats_mutex);
+}
+
+void create_thread_stats_key() {
+  int retcode = pthread_key_create(&thread_stats_key, orphan_thread_stats);
+  handle_thread_error(retcode, "Create thread stats key", PROCESS_EXIT);
+}
+
+/*
+ * Returns the counters of the calling thread - those of an ended thread if
+ * possible
+ */
+ThreadStats *get_own_thread_stats() {
+  if (own_thread_stats != NULL) {
+    return own_thread_stats;
+  }
+  pthread_once(&thread_stats_once, create_thread_stats_key);
+
+  pthread_mutex_lock(&thread_stats_mutex);
+  ThreadStats *stats = free_thread_stats;
+  if (stats != NULL) {
+    free_thread_stats = stats->nextFree;
+  } else {
+    stats = calloc(1, sizeof(ThreadStats));
+    if (stats == NULL) {
+      log_error("Allocation of thread stats failed");
+      exit_by_type(PROCESS_EXIT);
+    }
+    stats->next = all_thread_stats;
+    // readers walk the list without the mutex
+    __atomic_store_n(&all_thread_stats, stats, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&thread_stats_mutex);
+
+  pthread_setspecific(thread_stats_key, stats);
+  own_thread_stats = stats;
+  return stats;
+}
+
+/*
+ * Adds to a counter of the calling thread - a plain add that readers never
+ * see torn
+ */
+void add_to_stats_counter(unsigned long *counter, unsigned long value) {
+  __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+/*
+ * Raises a maximum of the calling thread
+ */
+void raise_stats_max(unsigned long *max, unsigned long value) {
+  if (value > *max) {
+    __atomic_store_n(max, value, __ATOMIC_RELAXED);
+  }
+}
+
+uint64_t get_stats_time() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+int get_latency_bucket(unsigned long value) {
+  if (value < LATENCY_SUB_BUCKETS) {
+    return value;
+  }
+  int msb = 63 - __builtin_clzl(value);
+  int bucket = (msb - 1) * LATENCY_SUB_BUCKETS
+               + ((value >> (msb - 2)) & (LATENCY_SUB_BUCKETS - 1));
+  return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+unsigned long get_latency_bucket_limit(int bucket) {
+  if (bucket < LATENCY_SUB_BUCKETS) {
+    return bucket;
+  }
+  int msb = bucket / LATENCY_SUB_BUCKETS + 1;
+  unsigned long lower = (unsigned long) (LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS)
+                        << (msb - 2);
+  return lower + (1UL << (msb - 2)) - 1;
+}
+
+void record_request(int command, int failed, size_t bytes_in, size_t bytes_out,
+                    uint64_t started) {
+  ThreadStats *stats = get_own_thread_stats();
+  unsigned long latency = (get_stats_time() - started) / 1000;
+
+  add_to_stats_counter(&stats->requests[command], 1);
+  if (failed) {
+    add_to_stats_counter(&stats->errors[command], 1);
+  }
+  add_to_stats_counter(&stats->latency[command][get_latency_bucket(latency)], 1);
+  add_to_stats_counter(&stats->latency_sum[command], latency);
+  raise_stats_max(&stats->latency_max[command], latency);
+  add_to_stats_counter(&stats->bytes_in, bytes_in);
+  add_to_stats_counter(&stats->bytes_out, bytes_out);
+}
+
+void record_connection(int opened) {
+  ThreadStats *stats = get_own_thread_stats();
+  __atomic_store_n(&stats->connections, stats->connections + (opened ? 1 : -1),
+                   __ATOMIC_RELAXED);
+  if (opened) {
+    add_to_stats_counter(&stats->connections_total, 1);
+  }
+}
+
+void record_lock_wait(int lock_class, int contended, uint64_t wait) {
+  ThreadStats *stats = get_own_thread_stats();
+  add_to_stats_counter(&stats->lock_acquisitions[lock_class], 1);
+  if (contended) {
+    add_to_stats_counter(&stats->lock_contended[lock_class], 1);
+  }
+  add_to_stats_counter(&stats->lock_wait[lock_class][get_latency_bucket(wait)], 1);
+  add_to_stats_counter(&stats->lock_wait_sum[lock_class], wait);
+  raise_stats_max(&stats->lock_wait_max[lock_class], wait);
+}
+
+void record_lock_hold_time(int lock_class, uint64_t hold) {
+  ThreadStats *stats = get_own_thread_stats();
+  add_to_stats_counter(&stats->lock_hold[lock_class][get_latency_bucket(hold)], 1);
+  add_to_stats_counter(&stats->lock_hold_sum[lock_class], hold);
+  raise_stats_max(&stats->lock_hold_max[lock_class], hold);
+}
+
+/*
+ * Adds a counter of a thread to the snapshot
+ */
+void sum_stats_counter(unsigned long *sum, unsigned long *counter) {
+  *sum += __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+void sum_stats_max(unsigned long *sum, unsigned long *max) {
+  unsigned long value = __atomic_load_n(max, __ATOMIC_RELAXED);
+  if (value > *sum) {
+    *sum = value;
+  }
+}
+
+void sum_stats_histogram(unsigned long *sum, unsigned long *histogram) {
+  int bucket;
+  for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+    sum_stats_counter(&sum[bucket], &histogram[bucket]);
+  }
+}
+
+void take_stats_snapshot(StatsSnapshot *snapshot) {
+  memset(snapshot, 0, sizeof(StatsSnapshot));
+
+  ThreadStats *stats;
+  for (stats = __atomic_load_n(&all_thread_stats, __ATOMIC_ACQUIRE); stats != NULL;
+       stats = stats->next) {
+    int command, lock_class;
+    for (command = 0; command < NUM_COMMANDS; command++) {
+      sum_stats_counter(&snapshot->requests[command], &stats->requests[command]);
+      sum_stats_counter(&snapshot->errors[command], &stats->errors[command]);
+      sum_stats_counter(&snapshot->latency_sum[command], &stats->latency_sum[command]);
+      sum_stats_histogram(snapshot->latency[command], stats->latency[command]);
+      sum_stats_max(&snapshot->latency_max[command], &stats->latency_max[command]);
+    }
+    for (lock_class = 0; lock_class < NUM_LOCK_CLASSES; lock_class++) {
+      sum_stats_counter(&snapshot->lock_acquisitions[lock_class], 
+                        &stats->lock_acquisitions[lock_class]);
+      sum_stats_counter(&snapshot->lock_contended[lock_class], 
+                        &stats->lock_contended[lock_class]);
+      sum_stats_histogram(snapshot->lock_wait[lock_class], stats->lock_wait[lock_class]);
+      sum_stats_counter(&snapshot->lock_wait_sum[lock_class], &stats->lock_wait_sum[lock_class]);
+      sum_stats_max(&snapshot->lock_wait_max[lock_class], &stats->lock_wait_max[lock_class]);
+      sum_stats_histogram(snapshot->lock_hold[lock_class], stats->lock_hold[lock_class]);
+      sum_stats_counter(&snapshot->lock_hold_sum[lock_class], &stats->lock_hold_sum[lock_class]);
+      sum_stats_max(&snapshot->lock_hold_max[lock_class], &stats->lock_hold_max[lock_class]);
+    }
+    sum_stats_counter(&snapshot->bytes_in, &stats->bytes_in);
+    sum_stats_counter(&snapshot->bytes_out, &stats->bytes_out);
+    sum_stats_counter(&snapshot->connections_total, &stats->connections_total);
+    snapshot->connections += __atomic_load_n(&stats->connections, __ATOMIC_RELAXED);
+  }
+}
+
+unsigned long get_histogram_percentile(const unsigned long *histogram, 
+                                       unsigned long max, double share) {
+  unsigned long total = 0;
+  int bucket;
+  for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+    total += histogram[bucket];
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  // the request at the rank of the share - at least the first one
+  unsigned long rank = (unsigned long) (share * total + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  unsigned long seen = 0;
+  for (bucket = 0; bucket < LATENCY_BUCKETS - 1; bucket++) {
+    seen += histogram[bucket];
+    if (seen >= rank) {
+      break;
+    }
+  }
+  unsigned long limit = get_latency_bucket_limit(bucket);
+  return limit < max ? limit : max;
+}
+
+unsigned long get_latency_percentile(const StatsSnapshot *snapshot, int command,
+                                     double share) {
+  return get_histogram_percentile(snapshot->latency[command], 
+                                  snapshot->latency_max[command], share);
+}
+
+const char *get_command_name(int command) {
+  static const char *names[] = { "list", "read", "create", "update", "delete",
+                                 "stats", "invalid" };
+  return command >= 0 && command < NUM_COMMANDS ? names[command] : "unknown";
+}
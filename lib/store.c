@@ -0,0 +1,488 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the file store that is split into shards which are placed on 
+ * the NUMA nodes
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include <termPaperLib.h>
+#include <placement.h>
+#include <store.h>
+#include <replication.h>
+
+// node the calling thread was moved to - -1 if it was never routed
+__thread int routed_node = -1;
+
+Store *new_store(int num_shards, int route_requests) {
+  if (num_shards < 1) {
+    num_shards = 1;
+  }
+
+  Store *store = malloc(sizeof(Store));
+  store->num_shards = num_shards;
+  store->shards = malloc(num_shards * sizeof(Shard));
+  store->route_requests = route_requests;
+
+  int num_nodes = get_num_nodes();
+  int i;
+  for (i = 0; i < num_shards; i++) {
+    store->shards[i].node = i % num_nodes;
+    store->shards[i].heap = new_node_heap(store->shards[i].node);
+    store->shards[i].list = newListOnHeap(store->shards[i].heap);
+
+    int j;
+    for (j = 0; j < FLIGHT_BUCKETS; j++) {
+      pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+      store->shards[i].flights[j].mutex = mutex;
+      store->shards[i].flights[j].first = NULL;
+    }
+  }
+  store->executed_reads = 0;
+  store->coalesced_reads = 0;
+  store->changes = 0;
+  store->wal = NULL;
+  store->replication = NULL;
+  store->read_only = FALSE;
+  for (i = 0; i < CHANGE_STRIPES; i++) {
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    store->change_stripes[i].mutex = mutex;
+    store->change_stripes[i].taken = FALSE;
+    store->change_stripes[i].head = NULL;
+    store->change_stripes[i].tail = NULL;
+  }
+  log_info("Store: %d shards on %d nodes", num_shards, num_nodes);
+  return store;
+}
+
+/*
+ * FNV-1a
+ */
+unsigned long hash_ID(const char *ID) {
+  unsigned long hash = 14695981039346656037UL;
+  for (; *ID != '\000'; ID++) {
+    hash ^= (unsigned char) *ID;
+    hash *= 1099511628211UL;
+  }
+  return hash;
+}
+
+/*
+ * Moves the calling thread to the node of the shard if routing is enabled
+ */
+void route_to_node(Store *store, Shard *shard) {
+  // a pinned thread or a coroutine worker serves files of all nodes in place
+  if (store->route_requests && routed_node != shard->node && !is_thread_pinned()
+      && !in_coroutine()) {
+    int retcode = pin_thread_to_node(shard->node);
+    if (retcode == 0) {
+      routed_node = shard->node;
+    } else {
+      handle_thread_error(retcode, "Route thread to node", NO_EXIT);
+    }
+  }
+}
+
+int get_shard_index(Store *store, const char *ID) {
+  return hash_ID(ID) % store->num_shards;
+}
+
+ConcurrentLinkedList *route_to_shard(Store *store, const char *ID) {
+  Shard *shard = &store->shards[hash_ID(ID) % store->num_shards];
+  route_to_node(store, shard);
+  return shard->list;
+}
+
+/*
+ * The bucket of the reads in flight of an ID - the shard is chosen by the
+ * lower bits of the hash, the bucket by the upper ones
+ */
+FlightBucket *get_flight_bucket(Store *store, const char *ID, Shard **shard) {
+  unsigned long hash = hash_ID(ID);
+  *shard = &store->shards[hash % store->num_shards];
+  return &(*shard)->flights[(hash >> 32) % FLIGHT_BUCKETS];
+}
+
+void lock_flights(FlightBucket *bucket) {
+  int retcode = pthread_mutex_lock(&bucket->mutex);
+  handle_thread_error(retcode, "lock flight mutex", THREAD_EXIT);
+}
+
+void unlock_flights(FlightBucket *bucket) {
+  int retcode = pthread_mutex_unlock(&bucket->mutex);
+  handle_thread_error(retcode, "unlock flight mutex", THREAD_EXIT);
+}
+
+/*
+ * Takes a flight out of its bucket - the bucket has to be locked
+ */
+void unlink_flight(FlightBucket *bucket, Flight *flight) {
+  Flight **link = &bucket->first;
+  while (*link != flight) {
+    link = &(*link)->next;
+  }
+  *link = flight->next;
+  flight->linked = FALSE;
+}
+
+void release_store_response(void *input) {
+  releaseCachedResponse((CachedResponse *) input);
+}
+
+/*
+ * The reference of the caller is given back with the reset of the arena
+ */
+CachedResponse *keep_until_reset(CachedResponse *response, Arena *arena) {
+  if (response != NULL) {
+    arena_on_reset(arena, release_store_response, response);
+  }
+  return response;
+}
+
+CachedResponse *use_store_response(Store *store, char *ID, ResponseBuilder build, 
+                                   Arena *arena) {
+  Shard *shard;
+  FlightBucket *bucket = get_flight_bucket(store, ID, &shard);
+
+  lock_flights(bucket);
+  Flight *flight;
+  for (flight = bucket->first; flight != NULL; flight = flight->next) {
+    if (strcmp(flight->ID, ID) == 0) {
+      break;
+    }
+  }
+
+  // a lookup is in progress - wait for its result
+  if (flight != NULL) {
+    FlightWaiter waiter;
+    init_completion(&waiter.done);
+    waiter.next = flight->waiters;
+    flight->waiters = &waiter;
+    unlock_flights(bucket);
+
+    __atomic_add_fetch(&store->coalesced_reads, 1, __ATOMIC_RELAXED);
+    wait_for_completion(&waiter.done);
+    return keep_until_reset(waiter.response, arena);
+  }
+
+  Flight own;
+  own.ID = ID;
+  own.waiters = NULL;
+  own.linked = TRUE;
+  own.next = bucket->first;
+  bucket->first = &own;
+  unlock_flights(bucket);
+
+  __atomic_add_fetch(&store->executed_reads, 1, __ATOMIC_RELAXED);
+  route_to_node(store, shard);
+  CachedResponse *response = useCachedResponse(shard->list, ID, build);
+
+  // nobody can join anymore
+  lock_flights(bucket);
+  if (own.linked) {
+    unlink_flight(bucket, &own);
+  }
+  FlightWaiter *waiter = own.waiters;
+  unlock_flights(bucket);
+
+  while (waiter != NULL) {
+    FlightWaiter *next = waiter->next;
+    if (response != NULL) {
+      referenceCachedResponse(response, 1);
+    }
+    waiter->response = response;
+    signal_completion(&waiter->done);
+    waiter = next;
+  }
+  return keep_until_reset(response, arena);
+}
+
+/*
+ * Called after a file was created, changed or deleted - READs that arrive 
+ * later don't join lookups that may have missed the change. The change is
+ * counted
+ */
+void forget_store_reads(Store *store, const char *ID) {
+  __atomic_add_fetch(&store->changes, 1, __ATOMIC_RELAXED);
+
+  Shard *shard;
+  FlightBucket *bucket = get_flight_bucket(store, ID, &shard);
+
+  lock_flights(bucket);
+  Flight *flight = bucket->first;
+  while (flight != NULL) {
+    Flight *next = flight->next;
+    if (strcmp(flight->ID, ID) == 0) {
+      unlink_flight(bucket, flight);
+    }
+    flight = next;
+  }
+  unlock_flights(bucket);
+}
+
+/*
+ * Changes of the same file are logged, applied and replicated in one order -
+ * the stripe is handed over to the waiters in the order they arrived
+ */
+void lock_stripe(ChangeStripe *stripe) {
+  int retcode = pthread_mutex_lock(&stripe->mutex);
+  handle_thread_error(retcode, "lock change stripe", THREAD_EXIT);
+  if (!stripe->taken) {
+    stripe->taken = TRUE;
+    retcode = pthread_mutex_unlock(&stripe->mutex);
+    handle_thread_error(retcode, "unlock change stripe", THREAD_EXIT);
+    return;
+  }
+
+  StripeWaiter waiter;
+  init_completion(&waiter.done);
+  waiter.next = NULL;
+  if (stripe->tail != NULL) {
+    stripe->tail->next = &waiter;
+  } else {
+    stripe->head = &waiter;
+  }
+  stripe->tail = &waiter;
+  retcode = pthread_mutex_unlock(&stripe->mutex);
+  handle_thread_error(retcode, "unlock change stripe", THREAD_EXIT);
+
+  // a coroutine is parked, its worker serves the others meanwhile
+  wait_for_completion(&waiter.done);
+}
+
+ChangeStripe *lock_change_stripe(Store *store, const char *ID) {
+  ChangeStripe *stripe = &store->change_stripes[(hash_ID(ID) >> 16) % CHANGE_STRIPES];
+  lock_stripe(stripe);
+  return stripe;
+}
+
+void unlock_change_stripe(ChangeStripe *stripe) {
+  int retcode = pthread_mutex_lock(&stripe->mutex);
+  handle_thread_error(retcode, "lock change stripe", THREAD_EXIT);
+  StripeWaiter *next = stripe->head;
+  if (next != NULL) {
+    stripe->head = next->next;
+    if (stripe->head == NULL) {
+      stripe->tail = NULL;
+    }
+  } else {
+    stripe->taken = FALSE;
+  }
+  retcode = pthread_mutex_unlock(&stripe->mutex);
+  handle_thread_error(retcode, "unlock change stripe", THREAD_EXIT);
+
+  // the stripe stays taken for the next one
+  if (next != NULL) {
+    signal_completion(&next->done);
+  }
+}
+
+int change_store_file(Store *store, int type, char *ID, void *payload, 
+                      size_t payload_size) {
+  ConcurrentLinkedList *list = route_to_shard(store, ID);
+  ChangeStripe *stripe = lock_change_stripe(store, ID);
+
+  // readers must not see a change that a crash could still take back - it
+  // is logged before it is applied. Only the changes of the stripe change 
+  // the file, so the check holds until then
+  if (store->wal != NULL) {
+    int exists = containsListElement(list, ID);
+    if (type == WAL_CREATE ? exists : !exists) {
+      unlock_change_stripe(stripe);
+      return 1;
+    }
+    WalRecord record;
+    append_wal_record(store->wal, &record, type, ID, payload, payload_size);
+    wait_for_wal_record(store->wal, &record);
+  }
+
+  int result;
+  switch (type) {
+    case WAL_CREATE:
+      result = appendUniqueListElement(list, &payload, payload_size, ID);
+      break;
+    case WAL_UPDATE:
+      result = updateListElementByID(list, &payload, payload_size, ID);
+      break;
+    default:
+      result = removeListElementByID(list, ID);
+      payload = NULL;
+      payload_size = 0;
+      break;
+  }
+
+  if (result == 0) {
+    forget_store_reads(store, ID);
+    if (store->replication != NULL) {
+      publish_change(store->replication, type, ID, payload, payload_size);
+    }
+  }
+  unlock_change_stripe(stripe);
+  return result;
+}
+
+int create_store_file(Store *store, char *ID, void *payload, size_t payload_size) {
+  if (store->read_only) {
+    return STORE_READONLY;
+  }
+  return change_store_file(store, WAL_CREATE, ID, payload, payload_size);
+}
+
+int update_store_file(Store *store, char *ID, void *payload, size_t payload_size) {
+  if (store->read_only) {
+    return STORE_READONLY;
+  }
+  return change_store_file(store, WAL_UPDATE, ID, payload, payload_size);
+}
+
+int delete_store_file(Store *store, char *ID) {
+  if (store->read_only) {
+    return STORE_READONLY;
+  }
+  return change_store_file(store, WAL_DELETE, ID, NULL, 0);
+}
+
+/*
+ * Applies a change of the log - the WAL is not attached yet, nothing is 
+ * logged again
+ */
+void replay_store_change(void *input, int type, char *ID, void *payload, 
+                         size_t payload_size) {
+  change_store_file((Store *) input, type, ID, payload, payload_size);
+}
+
+void attach_store_wal(Store *store, const char *path, int durability) {
+  store->wal = open_wal(path, durability, replay_store_change, store);
+}
+
+void start_store_checkpoint(Store *store) {
+  if (store->wal == NULL) {
+    return;
+  }
+
+  // with all stripes no change is logged but not applied yet
+  ChangeStripe *stripes[CHANGE_STRIPES];
+  int i;
+  for (i = 0; i < CHANGE_STRIPES; i++) {
+    stripes[i] = &store->change_stripes[i];
+    lock_stripe(stripes[i]);
+  }
+  rotate_wal(store->wal);
+  for (i = 0; i < CHANGE_STRIPES; i++) {
+    unlock_change_stripe(stripes[i]);
+  }
+}
+
+void finish_store_checkpoint(Store *store) {
+  if (store->wal != NULL) {
+    drop_old_wal(store->wal);
+  }
+}
+
+unsigned long get_store_changes(Store *store) {
+  return __atomic_load_n(&store->changes, __ATOMIC_RELAXED);
+}
+
+void get_store_read_counters(Store *store, unsigned long *executed, 
+                             unsigned long *coalesced) {
+  *executed = __atomic_load_n(&store->executed_reads, __ATOMIC_RELAXED);
+  *coalesced = __atomic_load_n(&store->coalesced_reads, __ATOMIC_RELAXED);
+}
+
+/*
+ * Counts a file and its payload for get_store_usage
+ */
+void count_store_file(void *input, const char *ID, const void *payload,
+                      size_t payload_size, unsigned long sequence) {
+  (void) ID;
+  (void) payload;
+  (void) sequence;
+  size_t *usage = (size_t *) input;
+  usage[0]++;
+  usage[1] += payload_size;
+}
+
+void get_store_usage(Store *store, size_t *files, size_t *payload_bytes) {
+  size_t usage[2] = { 0, 0 };
+  int i;
+  for (i = 0; i < store->num_shards; i++) {
+    visitAllElements(store->shards[i].list, count_store_file, usage);
+  }
+  *files = usage[0];
+  *payload_bytes = usage[1];
+}
+
+int compare_entries(const void *a, const void *b) {
+  unsigned long first = ((const ElementEntry *) a)->sequence;
+  unsigned long second = ((const ElementEntry *) b)->sequence;
+  return (first > second) - (first < second);
+}
+
+size_t copy_all_store_IDs(Store *store, char **IDs, Arena *arena) {
+  if (store->num_shards == 1) {
+    return copyAllElementIDs(store->shards[0].list, IDs, arena);
+  }
+
+  // collect the entries of all shards
+  size_t num_elem = 0;
+  size_t len = 0;
+  ElementEntry *all = NULL;
+  int i;
+  for (i = 0; i < store->num_shards; i++) {
+    ElementEntry *entries;
+    size_t num = copyAllElementEntries(store->shards[i].list, &entries, arena);
+    if (num > 0) {
+      all = arena_extend(arena, all, num_elem * sizeof(ElementEntry), 
+                         (num_elem + num) * sizeof(ElementEntry));
+      memcpy(all + num_elem, entries, num * sizeof(ElementEntry));
+      num_elem += num;
+    }
+    // without an arena the entries are malloc'ed - their IDs live on in all
+    if (arena == NULL) {
+      free(entries);
+    }
+  }
+  qsort(all, num_elem, sizeof(ElementEntry), compare_entries);
+
+  // \n + ID for every element
+  size_t j;
+  for (j = 0; j < num_elem; j++) {
+    len += strlen(all[j].ID) + 1;
+  }
+  char *buffer = arena_alloc(arena, len + 1);
+  char *position = buffer;
+  for (j = 0; j < num_elem; j++) {
+    *position++ = '\n';
+    size_t ID_len = strlen(all[j].ID);
+    memcpy(position, all[j].ID, ID_len);
+    position += ID_len;
+  }
+  *position = '\000';
+
+  // without an arena only the buffer is left to the caller
+  if (arena == NULL) {
+    for (j = 0; j < num_elem; j++) {
+      free(all[j].ID);
+    }
+    free(all);
+  }
+
+  *IDs = buffer;
+  return num_elem;
+}
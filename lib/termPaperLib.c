@@ -21,15 +21,20 @@
  */
 
 #include <errno.h> 
+#include <fcntl.h>
 #include <pthread.h> 
 #include <stdio.h> 
 #include <stdlib.h> 
 #include <string.h> 
 #include <arpa/inet.h>  
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h> 
 #include <stdarg.h>
 
 #include <termPaperLib.h>
+#include <coroutine.h>
+#include <asyncLog.h>
 
 // Found no other way to store these parameters
 enum logging_type debug_type;
@@ -43,6 +48,10 @@ void exit_by_type(enum exit_type et) {
       exit(1);
       break;
     case THREAD_EXIT:
+      // a coroutine must not end the worker thread it runs on
+      if (in_coroutine()) {
+        exit_coroutine();
+      }
       pthread_exit(NULL);
       break;
     case NO_EXIT:
@@ -55,19 +64,30 @@ void exit_by_type(enum exit_type et) {
   }
 }
 
-void log_by_type(const char* to_log, enum logging_type lt) {
+/*
+ * Writes a line or a binary record (with its \n) - handed to the flusher if
+ * it runs
+ */
+void log_by_type(const char* to_log, size_t len, enum logging_type lt) {
   switch (lt) {
     case NONE:
       break;
     case WRITE_TO_FILE:
-      fprintf(log_file, "%s\n", to_log);
-      fflush(log_file);
+    case BINARY_TO_FILE:
+      if (!append_async_log(fileno(log_file), to_log, len)) {
+        fwrite(to_log, 1, len, log_file);
+        fflush(log_file);
+      }
       break;
     case WRITE_TO_STDOUT:
-      printf("%s\n", to_log);
+      if (!append_async_log(STDOUT_FILENO, to_log, len)) {
+        fwrite(to_log, 1, len, stdout);
+      }
       break;
     case WRITE_TO_STDERR:
-      fprintf(stderr, "%s\n", to_log);
+      if (!append_async_log(STDERR_FILENO, to_log, len)) {
+        fwrite(to_log, 1, len, stderr);
+      }
       break;
     default:
       printf("Unknown logging_type: %d", lt);
@@ -76,39 +96,82 @@ void log_by_type(const char* to_log, enum logging_type lt) {
   }
 }
 
-void log_debug(const char *msg, ...) {
-  // + \000
-  char log_line[MAX_LOG_LEN+1];
+/*
+ * Formats a log line with the given prefix into a buffer on the stack
+ * so logging never allocates
+ */
+void log_with_prefix(const char *prefix, enum logging_type lt, const char *msg, 
+                     va_list argptr) {
+  // prefix + ' ' + \n + \000
+  char log_line[MAX_LOG_LEN+MAX_OTHER+2];
+  int prefix_len = snprintf(log_line, MAX_OTHER+1, "%s ", prefix);
+  int len = vsnprintf(log_line + prefix_len, MAX_LOG_LEN, msg, argptr);
+  if (len < 0) {
+    len = 0;
+  } else if (len > MAX_LOG_LEN - 1) {
+    len = MAX_LOG_LEN - 1;
+  }
+  log_line[prefix_len + len] = '\n';
+
+  log_by_type(log_line, prefix_len + len + 1, lt);
+}
+
+/*
+ * Stores the format id and the raw arguments instead of formatting them -
+ * the format itself is logged once by the first line that uses it
+ */
+void log_binary(LogFormat *format, int level, const char *msg, va_list argptr) {
+  char record[MAX_LOG_LEN+MAX_OTHER+2];
+  if (register_log_format(format, msg)) {
+    // not handed to the flusher - a full ring would drop it, and the entries
+    // of the format could never be decoded
+    size_t len = encode_log_definition(format, level, msg, record, sizeof(record));
+    fwrite(record, 1, len, log_file);
+    fflush(log_file);
+  }
+  log_by_type(record, encode_log_entry(format, msg, argptr, record, sizeof(record)),
+              BINARY_TO_FILE);
+}
+
+/*
+ * Logs a message of a level in the configured format
+ */
+void log_with_level(LogFormat *format, int level, const char *prefix, 
+                    enum logging_type lt, const char *msg, va_list argptr) {
+  if (lt == BINARY_TO_FILE) {
+    log_binary(format, level, msg, argptr);
+  } else {
+    log_with_prefix(prefix, lt, msg, argptr);
+  }
+}
+
+void write_debug_log(LogFormat *format, const char *msg, ...) {
   va_list argptr;
   va_start(argptr, msg);
-  vsnprintf(log_line, MAX_LOG_LEN, msg, argptr);
+  log_with_level(format, LEVEL_DEBUG, "DEBUG:", debug_type, msg, argptr);
   va_end(argptr);
-
-  log_by_type(join_with_seperator("DEBUG:", log_line, " "), debug_type);
 }
-void log_info(const char *msg, ...) {
-  // + \000
-  char log_line[MAX_LOG_LEN+1];
+
+void write_info_log(LogFormat *format, const char *msg, ...) {
   va_list argptr;
   va_start(argptr, msg);
-  vsnprintf(log_line, MAX_LOG_LEN, msg, argptr);
+  log_with_level(format, LEVEL_INFO, "INFO:", info_type, msg, argptr);
   va_end(argptr);
-
-  log_by_type(join_with_seperator("INFO:", log_line, " "), info_type);
 }
 
-void log_error(const char *msg, ...) {
-  // + \000
-  char log_line[MAX_LOG_LEN+1];
+void write_error_log(LogFormat *format, const char *msg, ...) {
   va_list argptr;
   va_start(argptr, msg);
-  vsnprintf(log_line, MAX_LOG_LEN, msg, argptr);
+  log_with_level(format, LEVEL_ERROR, "ERROR:", error_type, msg, argptr);
   va_end(argptr);
-
-  log_by_type(join_with_seperator("ERROR:", log_line, " "), error_type);
 }
 
-int open_logfile(const char *pathname) {
+/*
+ * Opens the log file of the program - all levels that log to the file
+ * have to use the same format
+ */
+int open_logfile(const char *pathname, int binary) {
+  static int binary_log_file = FALSE;
   if (log_file == NULL) {
 
     pathname = join_with_seperator(pathname, ".log", "");
@@ -117,7 +180,16 @@ int open_logfile(const char *pathname) {
       printf("something went wrong while opening the log file '%s' - exiting\n", pathname);
       exit_by_type(PROCESS_EXIT);
     }
+    binary_log_file = binary;
+    if (binary) {
+      fwrite(BINARY_LOG_MAGIC, 1, BINARY_LOG_MAGIC_LEN, log_file);
+      fflush(log_file);
+    }
+  } else if (binary != binary_log_file) {
+    printf("the log file can't be written as text and binary - exiting\n");
+    exit_by_type(PROCESS_EXIT);
   }
+  return binary;
 }
 
 enum logging_type get_log_type(int i, char *filename) {
@@ -126,7 +198,7 @@ enum logging_type get_log_type(int i, char *filename) {
       return NONE;
       break;
     case 1:
-      open_logfile(filename);
+      open_logfile(filename, FALSE);
       return WRITE_TO_FILE;
       break;
     case 2:
@@ -135,6 +207,10 @@ enum logging_type get_log_type(int i, char *filename) {
     case 3:
       return WRITE_TO_STDERR;
       break;
+    case 4:
+      open_logfile(filename, TRUE);
+      return BINARY_TO_FILE;
+      break;
     default:
       log_error("Unknown log_level: %d", i);
       exit(2);
@@ -195,8 +271,8 @@ void handle_error_myerrno(long return_code, int myerrno, const char *msg,
       log_error("%s", msg);
     } 
     log_error("Return code=%ld", return_code);
-    log_error("Errno=%d", error_str);
-    log_error("Message=%s", myerrno);
+    log_error("Errno=%d", myerrno);
+    log_error("Message=%s", error_str);
 
     exit_by_type(et);
   }
@@ -272,23 +348,91 @@ int create_server_socket(int port_number) {
   return server_socket;
 }
 
+/*
+ * Fills the address of a unix domain socket
+ */
+unsigned int get_unix_address(const char *path, struct sockaddr_un *address) {
+  memset(address, 0, sizeof(struct sockaddr_un));
+  address->sun_family = AF_UNIX;
+
+  if (strlen(path) >= sizeof(address->sun_path)) {
+    log_error("unix socket path too long: %s", path);
+    exit_by_type(PROCESS_EXIT);
+  }
+  strcpy(address->sun_path, path);
+  return sizeof(struct sockaddr_un);
+}
+
+int create_unix_client_socket(const char *path) {
+  struct sockaddr_un server_address;
+  unsigned int address_len = get_unix_address(path, &server_address);
+
+  int client_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+  handle_error(client_socket, "socket() failed", PROCESS_EXIT);
+
+  int retcode = connect(client_socket, (struct sockaddr *) &server_address, address_len);
+  handle_error(retcode, "connect() failed\n", PROCESS_EXIT);
+
+  return client_socket;
+}
+
+int create_unix_server_socket(const char *path) {
+  struct sockaddr_un server_address;
+  unsigned int address_len = get_unix_address(path, &server_address);
+
+  int server_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+  handle_error(server_socket, "socket() failed", PROCESS_EXIT);
+
+  // the socket of a former run would make bind fail - any other file is kept
+  struct stat stats;
+  if (lstat(path, &stats) == 0) {
+    if (!S_ISSOCK(stats.st_mode)) {
+      log_error("%s exists and is no socket - not replaced", path);
+      exit_by_type(PROCESS_EXIT);
+    }
+    int retcode = unlink(path);
+    handle_error(retcode, "unlink() of the old socket failed", PROCESS_EXIT);
+  } else if (errno != ENOENT) {
+    handle_error(-1, "lstat() of the socket path failed", PROCESS_EXIT);
+  }
+
+  int retcode = bind(server_socket, (struct sockaddr *) &server_address, address_len);
+  handle_error(retcode, "bind() failed", PROCESS_EXIT);
+
+  retcode = listen(server_socket, MAX_PENDING_CONNECTIONS);
+  handle_error(retcode, "listen() failed", PROCESS_EXIT);
+
+  return server_socket;
+}
+
+size_t receive_from_socket(int client_socket, char *buffer, size_t max_len) {
+
+  log_debug("receive client_socket = %d",client_socket);
+
+  /* Receive up to the max_len bytes from the sender */
+  ssize_t bytes_received = co_recv(client_socket, buffer, max_len, 0);
+  if (bytes_received <= 0) {
+    log_error("recv() failed or connection closed prematurely");
+    return 0;
+  }
+  //bad people may send strings that are not \000 terminated
+  buffer[bytes_received] = '\000';
+
+  return bytes_received;
+}
+
 size_t read_from_socket(int client_socket, char **result) {
 
   log_debug("read_and_store_string client_socket = %d",client_socket);
   // CONTENT + FILENAME + other stuff 
   size_t message_max_len = MAX_MSG_LEN;
   char buffer[message_max_len+1];
-  size_t bytes_received = 0;
 
-  /* Receive up to the read_len bytes from the sender */
-  bytes_received = recv(client_socket, buffer, message_max_len,0);
-  if (bytes_received <= 0) {
-    log_error("recv() failed or connection closed prematurely");
+  size_t bytes_received = receive_from_socket(client_socket, buffer, message_max_len);
+  if (bytes_received == 0) {
     close(client_socket);
     exit_by_type(THREAD_EXIT);
   }
-  //bad people may send strings that are not \000 terminated
-  buffer[bytes_received] = '\000';
 
   *result = (char *) malloc(bytes_received+1);
   strncpy(*result, buffer, bytes_received+1);
@@ -300,7 +444,7 @@ void write_to_socket(int client_socket, const char *str) {
   int len = strlen(str);
 
   log_debug("write_string client_socket = %d",client_socket);
-  size_t partial_len = send(client_socket, str, len, 0);
+  size_t partial_len = co_send(client_socket, str, len, 0);
   if (partial_len != len) {
     log_error("Send message to client failed");
     close(client_socket);
@@ -341,7 +485,8 @@ char *get_logging_help(char **usage_text) {
   strn_add(&help_text, " Possible log Outputs: 0 = No logging" );
   strn_add(&help_text, "                       1 = Logfile" );
   strn_add(&help_text, "                       2 = stdout" );
-  strn_add(&help_text, "                       3 = stderr\n" );
+  strn_add(&help_text, "                       3 = stderr" );
+  strn_add(&help_text, "                       4 = Binary logfile (see decode)\n" );
 
   return help_text;
 }
@@ -373,6 +518,71 @@ unsigned short get_port_with_default(int argc, char *argv[]) {
   return to_return;
 }
 
+char *get_unix_path_help(char **usage_text) {
+  *usage_text=join_with_seperator(*usage_text, "[-u Path]", " ");
+
+  char *help_text = join_with_seperator( 
+      "[-u Path] Optional: Uses the unix domain socket at the given path.",
+      "           Default: TCP only\n", "\n");
+
+  return help_text;
+}
+
+char *get_unix_path(int argc, char *argv[]) {
+  char *to_return = NULL;
+
+  int i;
+  for (i = 1; i < argc; i++)  {
+    if (strcmp(argv[i], "-u") == 0)  {
+      if (i + 2 <= argc )  {
+        i++;
+        to_return = argv[i];  
+      } else {
+        die_with_error("please provide a path if you're using -u");
+      }
+    } 
+  }
+  return to_return;
+}
+
+char *get_string_with_default(int argc, char *argv[], const char *option, 
+                              char *default_value) {
+  char *to_return = default_value;
+
+  int i;
+  for (i = 1; i < argc; i++)  {
+    if (strcmp(argv[i], option) == 0)  {
+      if (i + 2 <= argc )  {
+        i++;
+        to_return = argv[i];  
+      } else {
+        log_error("please provide a value if you're using %s", option);
+        exit_by_type(PROCESS_EXIT);
+      }
+    } 
+  }
+  return to_return;
+}
+
+long get_number_with_default(int argc, char *argv[], const char *option, 
+                             long default_value) {
+  long to_return = default_value;
+
+  int i;
+  for (i = 1; i < argc; i++)  {
+    if (strcmp(argv[i], option) == 0)  {
+      if (i + 2 <= argc )  {
+        i++;
+        to_return = atol(argv[i]);  
+      } else {
+        log_error("please provide a value if you're using %s", option);
+        exit_by_type(PROCESS_EXIT);
+      }
+    } 
+  }
+  return to_return;
+}
+
 char *get_ip_help(char **usage_text) {
   *usage_text=join_with_seperator(*usage_text, "[-a IP]", " ");
 
@@ -400,3 +610,17 @@ char *get_ip_with_default(int argc, char *argv[]) {
   return to_return;
 }
 
+int sync_parent_directory(const char *path) {
+  const char *separator = strrchr(path, '/');
+  char *directory = separator == NULL ? strdup(".") : strndup(path, separator - path + 1);
+  int fd = open(directory, O_RDONLY | O_DIRECTORY);
+  free(directory);
+  if (fd < 0) {
+    return -1;
+  }
+  int retcode = fsync(fd);
+  int error = errno;
+  close(fd);
+  errno = error;
+  return retcode;
+}
@@ -0,0 +1,85 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides detached threads that are counted while they are alive and
+ * reclaimed by the system as soon as they finish
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+
+#include <termPaperLib.h>
+#include <threadTracking.h>
+
+typedef struct trackedThread {
+  void *(*routine)(void *);
+  void *input;
+} TrackedThread;
+
+long live_threads = 0;
+long finished_threads = 0;
+
+/*
+ * Runs as cleanup handler so pthread_exit is counted as well
+ */
+void thread_finished(void *unused) {
+  __atomic_sub_fetch(&live_threads, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&finished_threads, 1, __ATOMIC_RELAXED);
+}
+
+void *run_tracked_thread(void *input) {
+  TrackedThread tracked = *(TrackedThread *) input;
+  free(input);
+
+  void *result;
+  pthread_cleanup_push(thread_finished, NULL);
+  result = tracked.routine(tracked.input);
+  pthread_cleanup_pop(TRUE);
+
+  return result;
+}
+
+int start_tracked_thread(void *(*routine)(void *), void *input) {
+  TrackedThread *tracked = malloc(sizeof(TrackedThread));
+  tracked->routine = routine;
+  tracked->input = input;
+
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+
+  // count before the thread runs - it may finish before pthread_create returns
+  __atomic_add_fetch(&live_threads, 1, __ATOMIC_RELAXED);
+
+  pthread_t thread;
+  int retcode = pthread_create(&thread, &attributes, run_tracked_thread, tracked);
+  pthread_attr_destroy(&attributes);
+
+  if (retcode != 0) {
+    __atomic_sub_fetch(&live_threads, 1, __ATOMIC_RELAXED);
+    free(tracked);
+  }
+  return retcode;
+}
+
+long get_live_threads() {
+  return __atomic_load_n(&live_threads, __ATOMIC_RELAXED);
+}
+
+long get_finished_threads() {
+  return __atomic_load_n(&finished_threads, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,194 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides a hierarchical timer wheel with O(1) insert and cancel 
+ * operations
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <time.h>
+#include <unistd.h>
+
+#include <termPaperLib.h>
+#include <timerWheel.h>
+
+#define SLOT_MASK (TIMER_SLOTS - 1)
+
+// max. number of ticks a timer can be set in the future
+#define MAX_TIMER_TICKS ((1UL << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1)
+
+void lock_wheel(TimerWheel *wheel) {
+  int retcode = pthread_mutex_lock(&wheel->mutex);
+  handle_thread_error(retcode, "lock timer wheel mutex", THREAD_EXIT);
+}
+
+void unlock_wheel(TimerWheel *wheel) {
+  int retcode = pthread_mutex_unlock(&wheel->mutex);
+  handle_thread_error(retcode, "unlock timer wheel mutex", THREAD_EXIT);
+}
+
+int is_armed(Timer *timer) {
+  return timer->next != NULL;
+}
+
+void unlink_timer(Timer *timer) {
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->next = NULL;
+  timer->prev = NULL;
+}
+
+void link_timer(Timer *head, Timer *timer) {
+  timer->next = head;
+  timer->prev = head->prev;
+  head->prev->next = timer;
+  head->prev = timer;
+}
+
+/*
+ * Puts a timer in the slot of the level that covers its distance
+ * has to be called with the wheel locked
+ */
+void place_timer(TimerWheel *wheel, Timer *timer) {
+  unsigned long distance = timer->expires - wheel->current_tick;
+
+  int level = 0;
+  while (level < TIMER_LEVELS - 1 
+      && distance >= (1UL << (TIMER_SLOT_BITS * (level + 1)))) {
+    level++;
+  }
+  int slot = (timer->expires >> (TIMER_SLOT_BITS * level)) & SLOT_MASK;
+  link_timer(&wheel->slots[level][slot], timer);
+}
+
+/*
+ * Moves the timers of one slot of a higher level to the lower levels
+ * returns the slot index
+ */
+int cascade(TimerWheel *wheel, int level) {
+  int slot = (wheel->current_tick >> (TIMER_SLOT_BITS * level)) & SLOT_MASK;
+  Timer *head = &wheel->slots[level][slot];
+
+  while (head->next != head) {
+    Timer *timer = head->next;
+    unlink_timer(timer);
+    place_timer(wheel, timer);
+  }
+  return slot;
+}
+
+/*
+ * Advances the wheel by one tick and fires the expired timers
+ * has to be called with the wheel locked
+ */
+void advance_wheel(TimerWheel *wheel) {
+  int slot = wheel->current_tick & SLOT_MASK;
+
+  // level 0 wrapped around - fetch the timers of the next 64 ticks
+  int level = 1;
+  if (slot == 0) {
+    while (level < TIMER_LEVELS && cascade(wheel, level) == 0) {
+      level++;
+    }
+  }
+
+  Timer *head = &wheel->slots[0][slot];
+  while (head->next != head) {
+    Timer *timer = head->next;
+    unlink_timer(timer);
+    timer->callback(timer->input);
+  }
+  wheel->current_tick++;
+}
+
+unsigned long now_in_ticks(TimerWheel *wheel) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec * 1000 + now.tv_nsec / 1000000) / wheel->tick_ms;
+}
+
+void *run_timer_wheel(void *input) {
+  TimerWheel *wheel = (TimerWheel *) input;
+  log_info("Thread %ld: Hello from TIMER", (long) pthread_self());
+
+  unsigned long start = now_in_ticks(wheel);
+  while (TRUE) {
+    usleep(wheel->tick_ms * 1000);
+
+    // catch up if the thread was not scheduled in time
+    unsigned long target = now_in_ticks(wheel) - start;
+    lock_wheel(wheel);
+    while (wheel->current_tick <= target) {
+      advance_wheel(wheel);
+    }
+    unlock_wheel(wheel);
+  }
+  return NULL;
+}
+
+void start_timer_wheel(TimerWheel *wheel, long tick_ms) {
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  wheel->mutex = mutex;
+  wheel->current_tick = 0;
+  wheel->tick_ms = tick_ms;
+
+  int level, slot;
+  for (level = 0; level < TIMER_LEVELS; level++) {
+    for (slot = 0; slot < TIMER_SLOTS; slot++) {
+      wheel->slots[level][slot].next = &wheel->slots[level][slot];
+      wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+    }
+  }
+
+  int retcode = pthread_create(&wheel->thread, NULL, run_timer_wheel, wheel);
+  handle_thread_error(retcode, "Create timer thread", PROCESS_EXIT);
+}
+
+void init_timer(Timer *timer, void (*callback)(void *input), void *input) {
+  timer->next = NULL;
+  timer->prev = NULL;
+  timer->expires = 0;
+  timer->callback = callback;
+  timer->input = input;
+}
+
+void add_timer(TimerWheel *wheel, Timer *timer, long timeout_ms) {
+  // rounded up to full ticks - the current tick is already partly over
+  unsigned long ticks = (timeout_ms + wheel->tick_ms - 1) / wheel->tick_ms;
+  if (ticks < 1) {
+    ticks = 1;
+  }
+  if (ticks > MAX_TIMER_TICKS) {
+    ticks = MAX_TIMER_TICKS;
+  }
+
+  lock_wheel(wheel);
+  if (is_armed(timer)) {
+    unlink_timer(timer);
+  }
+  timer->expires = wheel->current_tick + ticks;
+  place_timer(wheel, timer);
+  unlock_wheel(wheel);
+}
+
+void cancel_timer(TimerWheel *wheel, Timer *timer) {
+  lock_wheel(wheel);
+  if (is_armed(timer)) {
+    unlink_timer(timer);
+  }
+  unlock_wheel(wheel);
+}
@@ -0,0 +1,257 @@
+/*
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides the request tracing - the steps of sampled requests are
+ * recorded by every thread on its own and written as a trace that
+ * chrome://tracing and Perfetto can show
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <termPaperLib.h>
+#include <trace.h>
+#include <stats.h>
+
+int trace_sampling = 0;
+
+// requests seen while tracing - every trace_sampling-th is traced
+unsigned long trace_requests = 0;
+
+// the buffers of all threads that ever traced - they are never freed
+pthread_mutex_t trace_buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+TraceBuffer *all_trace_buffers = NULL;
+TraceBuffer *free_trace_buffers = NULL;
+int num_trace_buffers = 0;
+
+__thread TraceBuffer *own_trace_buffer = NULL;
+pthread_key_t trace_buffer_key;
+pthread_once_t trace_buffer_once = PTHREAD_ONCE_INIT;
+
+typedef struct TraceThread {
+  char *path;
+  long interval;
+} TraceThread;
+
+/*
+ * Called when a thread ends - the next thread continues its buffer
+ */
+void orphan_trace_buffer(void *input) {
+  TraceBuffer *buffer = (TraceBuffer *) input;
+  pthread_mutex_lock(&trace_buffers_mutex);
+  buffer->nextFree = free_trace_buffers;
+  free_trace_buffers = buffer;
+  pthread_mutex_unlock(&trace_buffers_mutex);
+}
+
+void create_trace_buffer_key() {
+  int retcode = pthread_key_create(&trace_buffer_key, orphan_trace_buffer);
+  handle_thread_error(retcode, "Create trace buffer key", PROCESS_EXIT);
+}
+
+/*
+ * Returns the buffer of the calling thread - that of an ended thread if
+ * possible
+ */
+TraceBuffer *get_own_trace_buffer() {
+  if (own_trace_buffer != NULL) {
+    return own_trace_buffer;
+  }
+  pthread_once(&trace_buffer_once, create_trace_buffer_key);
+
+  pthread_mutex_lock(&trace_buffers_mutex);
+  TraceBuffer *buffer = free_trace_buffers;
+  if (buffer != NULL) {
+    free_trace_buffers = buffer->nextFree;
+  } else {
+    buffer = calloc(1, sizeof(TraceBuffer));
+    if (buffer == NULL) {
+      log_error("Allocation of a trace buffer failed");
+      exit_by_type(PROCESS_EXIT);
+    }
+    buffer->id = ++num_trace_buffers;
+    buffer->next = all_trace_buffers;
+    // the writer walks the list without the mutex
+    __atomic_store_n(&all_trace_buffers, buffer, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&trace_buffers_mutex);
+
+  pthread_setspecific(trace_buffer_key, buffer);
+  own_trace_buffer = buffer;
+  return buffer;
+}
+
+unsigned long sample_trace() {
+  if (!trace_sampling) {
+    return 0;
+  }
+  unsigned long request = __atomic_add_fetch(&trace_requests, 1, __ATOMIC_RELAXED);
+  return request % trace_sampling == 0 ? request : 0;
+}
+
+uint64_t get_trace_time(unsigned long request) {
+  return request ? get_stats_time() : 0;
+}
+
+uint64_t record_span(unsigned long request, int name, uint64_t start) {
+  if (!request) {
+    return 0;
+  }
+  uint64_t now = get_stats_time();
+  TraceBuffer *buffer = get_own_trace_buffer();
+  unsigned long written = buffer->written;
+  TraceSpan *span = &buffer->spans[written & (TRACE_BUFFER_SPANS - 1)];
+  span->start = start;
+  span->duration = now - start;
+  span->request = request;
+  span->name = name;
+  // the writer only shows spans that were complete before it copied them
+  __atomic_store_n(&buffer->written, written + 1, __ATOMIC_RELEASE);
+  return now;
+}
+
+/*
+ * Writes the spans of a buffer that were not overwritten while they were
+ * copied - returns their number
+ */
+long write_trace_buffer(FILE *file, TraceBuffer *buffer, TraceSpan *spans, int *first) {
+  static const char *names[] = { "request", "accept", "read", "parse", "execute", "write" };
+
+  unsigned long end = __atomic_load_n(&buffer->written, __ATOMIC_ACQUIRE);
+  unsigned long begin = end > TRACE_BUFFER_SPANS ? end - TRACE_BUFFER_SPANS : 0;
+  memcpy(spans, buffer->spans, sizeof(buffer->spans));
+  unsigned long overwritten = __atomic_load_n(&buffer->written, __ATOMIC_ACQUIRE);
+  // the next span goes to the slot of the oldest one - it may be half written
+  if (overwritten >= TRACE_BUFFER_SPANS && overwritten - TRACE_BUFFER_SPANS + 1 > begin) {
+    begin = overwritten - TRACE_BUFFER_SPANS + 1;
+  }
+
+  long num_spans = 0;
+  unsigned long i;
+  for (i = begin; i < end; i++) {
+    TraceSpan *span = &spans[i & (TRACE_BUFFER_SPANS - 1)];
+    if (span->name < 0 || span->name >= NUM_SPAN_NAMES) {
+      continue;
+    }
+    fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":%d,"
+            "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"request\":%lu}}",
+            *first ? "" : ",", names[span->name], (int) getpid(), buffer->id,
+            span->start / 1000.0, span->duration / 1000.0, span->request);
+    *first = FALSE;
+    num_spans++;
+  }
+  return num_spans;
+}
+
+long write_trace(const char *path) {
+  size_t path_len = strlen(path);
+  char *temp_path = malloc(path_len + 5);
+  memcpy(temp_path, path, path_len);
+  memcpy(temp_path + path_len, ".tmp", 5);
+
+  FILE *file = fopen(temp_path, "w");
+  if (file == NULL) {
+    log_error("Trace: open of %s failed: %s", temp_path, strerror(errno));
+    free(temp_path);
+    return -1;
+  }
+
+  TraceSpan *spans = malloc(TRACE_BUFFER_SPANS * sizeof(TraceSpan));
+  long num_spans = 0;
+  int first = TRUE;
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  TraceBuffer *buffer;
+  for (buffer = __atomic_load_n(&all_trace_buffers, __ATOMIC_ACQUIRE); buffer != NULL;
+       buffer = buffer->next) {
+    num_spans += write_trace_buffer(file, buffer, spans, &first);
+  }
+  fprintf(file, "\n]}\n");
+  free(spans);
+
+  int failed = ferror(file);
+  if (fclose(file) != 0) {
+    failed = TRUE;
+  }
+
+  // a reader sees either the old or the new trace
+  if (failed || rename(temp_path, path) != 0) {
+    log_error("Trace: write of %s failed: %s", temp_path, strerror(errno));
+    unlink(temp_path);
+    free(temp_path);
+    return -1;
+  }
+  free(temp_path);
+  return num_spans;
+}
+
+/*
+ * Writes the trace on SIGUSR1 and every interval seconds - the signal is
+ * blocked in all other threads, so it never interrupts a request
+ */
+void *run_trace_writer(void *input) {
+  TraceThread *writer = (TraceThread *) input;
+  log_info("Thread %ld: Hello from TRACE", (long) pthread_self());
+
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+  while (TRUE) {
+    struct timespec interval = { writer->interval, 0 };
+    int signal = writer->interval > 0 ? sigtimedwait(&signals, NULL, &interval)
+                                      : sigwaitinfo(&signals, NULL);
+    if (signal < 0 && errno == EINTR) {
+      continue;
+    }
+
+    long num_spans = write_trace(writer->path);
+    if (num_spans >= 0) {
+      log_info("Trace: %ld spans written to %s", num_spans, writer->path);
+    }
+  }
+  return NULL;
+}
+
+void start_tracing(int sampling, const char *path, long interval) {
+  if (sampling < 1) {
+    return;
+  }
+
+  // inherited by all threads that are started later
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+  int retcode = pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  handle_thread_error(retcode, "Block the trace signal", PROCESS_EXIT);
+
+  TraceThread *writer = malloc(sizeof(TraceThread));
+  writer->path = strdup(path);
+  writer->interval = interval;
+
+  pthread_t thread;
+  retcode = pthread_create(&thread, NULL, run_trace_writer, writer);
+  handle_thread_error(retcode, "Create trace thread", PROCESS_EXIT);
+  pthread_detach(thread);
+
+  trace_sampling = sampling;
+  log_info("Trace: tracing 1 of %d requests - kill -USR1 %d writes %s", sampling,
+           (int) getpid(), path);
+}
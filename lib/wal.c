@@ -0,0 +1,386 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides a write ahead log for the changes of the files with group
+ * commit
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <termPaperLib.h>
+#include <wal.h>
+
+// every record needs the header, the ID and the payload - writev takes up
+// to 1024 parts
+#define MAX_RECORDS_PER_WRITE 256
+
+uint32_t crc_table[256];
+
+void init_crc_table() {
+  uint32_t i;
+  for (i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    int bit;
+    for (bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    crc_table[i] = crc;
+  }
+}
+
+/*
+ * CRC32 (IEEE) - start with 0
+ */
+uint32_t update_crc(uint32_t crc, const void *data, size_t len) {
+  const unsigned char *bytes = (const unsigned char *) data;
+  crc = ~crc;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    crc = crc_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+int parse_durability(const char *name) {
+  if (strcmp(name, "none") == 0) {
+    return DURABILITY_NONE;
+  }
+  if (strcmp(name, "batched") == 0) {
+    return DURABILITY_BATCHED;
+  }
+  if (strcmp(name, "request") == 0) {
+    return DURABILITY_REQUEST;
+  }
+  return -1;
+}
+
+void lock_wal_mutex(pthread_mutex_t *mutex) {
+  int retcode = pthread_mutex_lock(mutex);
+  handle_thread_error(retcode, "lock wal mutex", THREAD_EXIT);
+}
+
+void unlock_wal_mutex(pthread_mutex_t *mutex) {
+  int retcode = pthread_mutex_unlock(mutex);
+  handle_thread_error(retcode, "unlock wal mutex", THREAD_EXIT);
+}
+
+/*
+ * Renders the header of a record - the ID is logged with its \000
+ */
+void encode_record(WalRecord *record, int type, const char *ID, 
+                   const void *payload, size_t payload_size) {
+  uint32_t fields[3];
+  fields[0] = type;
+  fields[1] = strlen(ID) + 1;
+  fields[2] = payload_size;
+  memcpy(record->header, fields, sizeof(fields));
+
+  uint32_t crc = update_crc(0, fields, sizeof(fields));
+  crc = update_crc(crc, ID, fields[1]);
+  crc = update_crc(crc, payload, payload_size);
+  memcpy(record->header + sizeof(fields), &crc, sizeof(crc));
+
+  record->ID = ID;
+  record->ID_len = fields[1];
+  record->payload = payload;
+  record->payload_size = payload_size;
+  record->next = NULL;
+}
+
+/*
+ * Writes all parts - writev may stop early
+ */
+void write_parts(Wal *wal, struct iovec *parts, int num_parts) {
+  while (num_parts > 0) {
+    ssize_t written = writev(wal->fd, parts, num_parts);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    // a change that can't be logged must not be acknowledged
+    handle_error(written, "write to the write ahead log failed", PROCESS_EXIT);
+
+    while (num_parts > 0 && (size_t) written >= parts->iov_len) {
+      written -= parts->iov_len;
+      parts++;
+      num_parts--;
+    }
+    if (num_parts > 0) {
+      parts->iov_base = (char *) parts->iov_base + written;
+      parts->iov_len -= written;
+    }
+  }
+}
+
+/*
+ * Writes a chain of records with as few writes as possible - the write mutex
+ * has to be locked. Returns the number of records
+ */
+unsigned long write_records(Wal *wal, WalRecord *record) {
+  struct iovec parts[MAX_RECORDS_PER_WRITE * 3];
+  unsigned long num_records = 0;
+
+  while (record != NULL) {
+    int num_parts = 0;
+    for (; record != NULL && num_parts < MAX_RECORDS_PER_WRITE * 3; record = record->next) {
+      parts[num_parts].iov_base = record->header;
+      parts[num_parts++].iov_len = WAL_RECORD_HEADER_LEN;
+      parts[num_parts].iov_base = (void *) record->ID;
+      parts[num_parts++].iov_len = record->ID_len;
+      parts[num_parts].iov_base = (void *) record->payload;
+      parts[num_parts++].iov_len = record->payload_size;
+      num_records++;
+    }
+    write_parts(wal, parts, num_parts);
+  }
+  return num_records;
+}
+
+void sync_wal(Wal *wal) {
+  int retcode = fdatasync(wal->fd);
+  handle_error(retcode, "fdatasync() of the write ahead log failed", PROCESS_EXIT);
+}
+
+/*
+ * Commits all records that arrived while the last batch was written with one
+ * write and one sync - for DURABILITY_REQUEST every record with its own
+ */
+void *run_log_writer(void *input) {
+  Wal *wal = (Wal *) input;
+  log_info("Thread %ld: Hello from LOG WRITER", (long) pthread_self());
+
+  while (TRUE) {
+    lock_wal_mutex(&wal->queue_mutex);
+    while (wal->head == NULL) {
+      int retcode = pthread_cond_wait(&wal->not_empty, &wal->queue_mutex);
+      handle_thread_error(retcode, "wait for wal records", THREAD_EXIT);
+    }
+    WalRecord *batch = wal->head;
+    wal->head = NULL;
+    wal->tail = NULL;
+    unlock_wal_mutex(&wal->queue_mutex);
+
+    lock_wal_mutex(&wal->write_mutex);
+    unsigned long num_records = 0;
+    unsigned long num_commits = 0;
+    if (wal->durability == DURABILITY_BATCHED) {
+      num_records = write_records(wal, batch);
+      sync_wal(wal);
+      num_commits = 1;
+    } else {
+      WalRecord *record;
+      for (record = batch; record != NULL; record = record->next) {
+        WalRecord *next = record->next;
+        record->next = NULL;
+        num_records += write_records(wal, record);
+        sync_wal(wal);
+        num_commits++;
+        record->next = next;
+      }
+    }
+    unlock_wal_mutex(&wal->write_mutex);
+
+    __atomic_add_fetch(&wal->records, num_records, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&wal->commits, num_commits, __ATOMIC_RELAXED);
+    log_debug("Log writer: %lu records committed", num_records);
+
+    // the records are gone once their requests are woken
+    while (batch != NULL) {
+      WalRecord *next = batch->next;
+      signal_completion(&batch->done);
+      batch = next;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Applies the valid records of the log - returns the length of the valid part
+ */
+size_t replay_records(const char *log, size_t size, WalReplay replay, void *input) {
+  size_t offset = 0;
+  unsigned long num_records = 0;
+
+  while (offset + WAL_RECORD_HEADER_LEN <= size) {
+    uint32_t fields[3];
+    uint32_t crc;
+    memcpy(fields, log + offset, sizeof(fields));
+    memcpy(&crc, log + offset + sizeof(fields), sizeof(crc));
+
+    size_t len = WAL_RECORD_HEADER_LEN + (size_t) fields[1] + fields[2];
+    if (fields[0] < WAL_CREATE || fields[0] > WAL_DELETE || fields[1] < 2 
+        || offset + len > size) {
+      break;
+    }
+    const char *ID = log + offset + WAL_RECORD_HEADER_LEN;
+    const char *payload = ID + fields[1];
+    uint32_t expected = update_crc(0, fields, sizeof(fields));
+    expected = update_crc(expected, ID, fields[1] + fields[2]);
+    if (crc != expected || ID[fields[1] - 1] != '\000') {
+      break;
+    }
+
+    replay(input, fields[0], (char *) ID, (void *) payload, fields[2]);
+    num_records++;
+    offset += len;
+  }
+  log_info("WAL: %lu records replayed", num_records);
+  return offset;
+}
+
+/*
+ * Replays the valid records of an open log - returns the length of the valid
+ * part and the size of the file
+ */
+size_t replay_wal_file(int fd, size_t *size, WalReplay replay, void *input) {
+  struct stat stats;
+  int retcode = fstat(fd, &stats);
+  handle_error(retcode, "fstat() of the write ahead log failed", PROCESS_EXIT);
+  *size = stats.st_size;
+  if (stats.st_size == 0) {
+    return 0;
+  }
+
+  char *log = mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (log == MAP_FAILED) {
+    handle_error(-1, "mmap() of the write ahead log failed", PROCESS_EXIT);
+  }
+  size_t valid = replay_records(log, stats.st_size, replay, input);
+  munmap(log, stats.st_size);
+  return valid;
+}
+
+Wal *open_wal(const char *path, int durability, WalReplay replay, void *input) {
+  init_crc_table();
+
+  Wal *wal = malloc(sizeof(Wal));
+  wal->durability = durability;
+  wal->head = NULL;
+  wal->tail = NULL;
+  wal->records = 0;
+  wal->commits = 0;
+
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+  wal->write_mutex = mutex;
+  wal->queue_mutex = mutex;
+  wal->not_empty = not_empty;
+
+  wal->path = strdup(path);
+  wal->old_path = malloc(strlen(path) + 5);
+  sprintf(wal->old_path, "%s.old", path);
+
+  // the snapshot misses the records of a failed checkpoint - they come first
+  size_t size;
+  int old_fd = open(wal->old_path, O_RDONLY);
+  if (old_fd >= 0) {
+    replay_wal_file(old_fd, &size, replay, input);
+    close(old_fd);
+  } else if (errno != ENOENT) {
+    handle_error(old_fd, "Open of the old write ahead log failed", PROCESS_EXIT);
+  }
+
+  wal->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+  handle_error(wal->fd, "Open of the write ahead log failed", PROCESS_EXIT);
+
+  // a crash during a write leaves a torn record - new ones follow the valid
+  size_t valid = replay_wal_file(wal->fd, &size, replay, input);
+  int retcode;
+  if (valid < size) {
+    log_error("WAL: cutting off %zu bytes of a torn record", size - valid);
+    retcode = ftruncate(wal->fd, valid);
+    handle_error(retcode, "ftruncate() of the write ahead log failed", PROCESS_EXIT);
+  }
+
+  // a sync must not block the worker of a coroutine - the writer does it
+  if (durability != DURABILITY_NONE) {
+    pthread_t writer;
+    retcode = pthread_create(&writer, NULL, run_log_writer, wal);
+    handle_thread_error(retcode, "Create log writer thread", PROCESS_EXIT);
+    pthread_detach(writer);
+  }
+  return wal;
+}
+
+void append_wal_record(Wal *wal, WalRecord *record, int type, const char *ID, 
+                       const void *payload, size_t payload_size) {
+  encode_record(record, type, ID, type == WAL_DELETE ? NULL : payload, 
+                type == WAL_DELETE ? 0 : payload_size);
+
+  if (wal->durability == DURABILITY_NONE) {
+    lock_wal_mutex(&wal->write_mutex);
+    write_records(wal, record);
+    unlock_wal_mutex(&wal->write_mutex);
+    __atomic_add_fetch(&wal->records, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  init_completion(&record->done);
+  lock_wal_mutex(&wal->queue_mutex);
+  if (wal->tail != NULL) {
+    wal->tail->next = record;
+  } else {
+    wal->head = record;
+  }
+  wal->tail = record;
+  int retcode = pthread_cond_signal(&wal->not_empty);
+  handle_thread_error(retcode, "signal wal records", THREAD_EXIT);
+  unlock_wal_mutex(&wal->queue_mutex);
+}
+
+void wait_for_wal_record(Wal *wal, WalRecord *record) {
+  // a coroutine is parked, its worker serves the others meanwhile
+  if (wal->durability != DURABILITY_NONE) {
+    wait_for_completion(&record->done);
+  }
+}
+
+void rotate_wal(Wal *wal) {
+  lock_wal_mutex(&wal->write_mutex);
+  // the records of the failed checkpoint are not in a snapshot yet
+  if (access(wal->old_path, F_OK) == 0) {
+    unlock_wal_mutex(&wal->write_mutex);
+    return;
+  }
+
+  sync_wal(wal);
+  int retcode = rename(wal->path, wal->old_path);
+  handle_error(retcode, "rename() of the write ahead log failed", PROCESS_EXIT);
+  int fd = open(wal->path, O_RDWR | O_CREAT | O_APPEND, 0644);
+  handle_error(fd, "Open of the write ahead log failed", PROCESS_EXIT);
+  // a renamed or created log survives a crash
+  if (sync_parent_directory(wal->path) != 0) {
+    log_error("WAL: sync of the directory of %s failed: %s", wal->path, strerror(errno));
+  }
+  close(wal->fd);
+  wal->fd = fd;
+  unlock_wal_mutex(&wal->write_mutex);
+  log_info("WAL: rotated to %s", wal->old_path);
+}
+
+void drop_old_wal(Wal *wal) {
+  if (unlink(wal->old_path) != 0 && errno != ENOENT) {
+    log_error("WAL: delete of %s failed: %s", wal->old_path, strerror(errno));
+  }
+}
@@ -0,0 +1,88 @@
+/* 
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides a work stealing deque (Chase-Lev) - the owner pushes and pops
+ * at the bottom, other threads steal from the top
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <termPaperLib.h>
+#include <workDeque.h>
+
+// The orderings follow "Correct and Efficient Work-Stealing for Weak Memory
+// Models" (Le, Pop, Cohen, Zappa Nardelli - PPoPP 2013)
+
+#define SLOT(deque, i) (&(deque)->items[(i) & (WORK_DEQUE_CAPACITY - 1)])
+
+void init_work_deque(WorkDeque *deque) {
+  deque->top = 0;
+  deque->bottom = 0;
+}
+
+int push_work(WorkDeque *deque, void *item) {
+  long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+  long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+  if (bottom - top >= WORK_DEQUE_CAPACITY) {
+    return FALSE;
+  }
+
+  __atomic_store_n(SLOT(deque, bottom), item, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+  return TRUE;
+}
+
+void *pop_work(WorkDeque *deque) {
+  long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  long top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+  // empty
+  if (top > bottom) {
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  void *item = __atomic_load_n(SLOT(deque, bottom), __ATOMIC_RELAXED);
+  if (top == bottom) {
+    // the last item - race against the thieves
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, FALSE, 
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      item = NULL;
+    }
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+  }
+  return item;
+}
+
+void *steal_work(WorkDeque *deque) {
+  long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+
+  if (top >= bottom) {
+    return NULL;
+  }
+
+  void *item = __atomic_load_n(SLOT(deque, top), __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, FALSE, 
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return NULL;
+  }
+  return item;
+}
@@ -0,0 +1,200 @@
+/*
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides a tool that turns a binary log back into text
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <termPaperLib.h>
+#include <binaryLog.h>
+
+// a logged format and the level of its call site
+typedef struct DecodedFormat {
+  char *msg;
+  uint32_t level;
+} DecodedFormat;
+
+// an entry of the log - the threads flush their lines in batches, so they
+// are sorted by time before printing
+typedef struct DecodedEntry {
+  uint64_t timestamp;
+  size_t offset;
+  uint32_t id;
+  const char *args;
+  size_t args_len;
+} DecodedEntry;
+
+void usage(const char *argv0, const char *msg) {
+  if (msg != NULL && strlen(msg) > 0) {
+    printf("%s\n\n", msg);
+  }
+  printf("Usage:\n");
+  printf("%s -f Path [-t 1]\n\n", argv0);
+
+  printf("Turns the binary log of a server or router (logging option 4)\n");
+  printf("back into text. The lines are printed in the order they were logged\n\n\n");
+
+  printf("-f Path Binary log file that should be decoded\n\n");
+  printf("[-t 1] Optional: Prefix every line with the time it was logged\n\n");
+
+  printf("(c) Max Schrimpf - ZHAW 2014\n");
+  exit(1);
+}
+
+int compare_decoded_entries(const void *a, const void *b) {
+  const DecodedEntry *first = a;
+  const DecodedEntry *second = b;
+  if (first->timestamp != second->timestamp) {
+    return first->timestamp < second->timestamp ? -1 : 1;
+  }
+  // lines of the same thread keep their order
+  return first->offset < second->offset ? -1 : first->offset > second->offset;
+}
+
+/*
+ * Reads the whole file into memory
+ */
+char *read_log_file(const char *path, size_t *len) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    handle_error(-1, "fopen() of the log file failed", PROCESS_EXIT);
+  }
+  size_t size = MAX_MSG_LEN;
+  char *content = malloc(size);
+  *len = 0;
+  size_t read;
+  while ((read = fread(content + *len, 1, size - *len, file)) > 0) {
+    *len += read;
+    if (*len == size) {
+      size *= 2;
+      content = realloc(content, size);
+    }
+  }
+  fclose(file);
+  return content;
+}
+
+int main(int argc, char *argv[]) {
+  if (is_help_requested(argc, argv)) {
+    usage(argv[0], "Help:");
+  }
+
+  char *path = get_string_with_default(argc, argv, "-f", NULL);
+  if (path == NULL) {
+    usage(argv[0], "Please provide the log file with -f Path");
+  }
+  int with_time = get_number_with_default(argc, argv, "-t", FALSE);
+
+  size_t len;
+  char *content = read_log_file(path, &len);
+  if (len < BINARY_LOG_MAGIC_LEN || memcmp(content, BINARY_LOG_MAGIC, BINARY_LOG_MAGIC_LEN)) {
+    printf("%s is not a binary log\n", path);
+    exit(1);
+  }
+
+  // the definitions are in the file before the first line of their id is
+  // flushed - but a line of another thread may be flushed before it
+  size_t formats_size = 64;
+  DecodedFormat *formats = calloc(formats_size, sizeof(DecodedFormat));
+  size_t num_entries = 0;
+  size_t entries_size = 1024;
+  DecodedEntry *entries = malloc(entries_size * sizeof(DecodedEntry));
+
+  size_t offset = BINARY_LOG_MAGIC_LEN;
+  while (offset + sizeof(LogRecordHeader) <= len) {
+    LogRecordHeader header;
+    memcpy(&header, content + offset, sizeof(header));
+    const char *record = content + offset + sizeof(header);
+    if (header.len > len - offset - sizeof(header)) {
+      fprintf(stderr, "Log ends with an incomplete record at %zu\n", offset);
+      break;
+    }
+
+    if (header.type == LOG_DEFINITION && header.len >= sizeof(LogDefinition)) {
+      LogDefinition definition;
+      memcpy(&definition, record, sizeof(definition));
+      while (definition.id >= formats_size) {
+        formats = realloc(formats, 2 * formats_size * sizeof(DecodedFormat));
+        memset(formats + formats_size, 0, formats_size * sizeof(DecodedFormat));
+        formats_size *= 2;
+      }
+      size_t msg_len = header.len - sizeof(definition);
+      formats[definition.id].msg = malloc(msg_len + 1);
+      memcpy(formats[definition.id].msg, record + sizeof(definition), msg_len);
+      formats[definition.id].msg[msg_len] = '\000';
+      formats[definition.id].level = definition.level;
+    } else if (header.type == LOG_ENTRY && header.len >= sizeof(LogEntry)) {
+      if (num_entries == entries_size) {
+        entries_size *= 2;
+        entries = realloc(entries, entries_size * sizeof(DecodedEntry));
+      }
+      DecodedEntry *decoded = &entries[num_entries++];
+      memcpy(&decoded->id, record + offsetof(LogEntry, id), sizeof(decoded->id));
+      memcpy(&decoded->timestamp, record + offsetof(LogEntry, timestamp),
+             sizeof(decoded->timestamp));
+      decoded->offset = offset;
+      decoded->args = record + sizeof(LogEntry);
+      decoded->args_len = header.len - sizeof(LogEntry);
+    } else {
+      fprintf(stderr, "Unknown record of type %u at %zu\n", header.type, offset);
+    }
+    offset += sizeof(header) + header.len;
+  }
+
+  qsort(entries, num_entries, sizeof(DecodedEntry), compare_decoded_entries);
+
+  static const char *prefixes[] = { "DEBUG:", "INFO:", "ERROR:" };
+  char text[MAX_LOG_LEN];
+  size_t i;
+  for (i = 0; i < num_entries; i++) {
+    uint32_t id = entries[i].id;
+    if (id >= formats_size || formats[id].msg == NULL) {
+      fprintf(stderr, "Line with the unknown format %u\n", id);
+      continue;
+    }
+    if (decode_log_entry(formats[id].msg, entries[i].args, entries[i].args_len,
+                         text, sizeof(text)) < 0) {
+      fprintf(stderr, "Line does not match its format '%s'\n", formats[id].msg);
+      continue;
+    }
+
+    if (with_time) {
+      time_t seconds = entries[i].timestamp / 1000000000;
+      struct tm local;
+      localtime_r(&seconds, &local);
+      char date[32];
+      strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &local);
+      printf("%s.%06lu ", date, (unsigned long) (entries[i].timestamp % 1000000000) / 1000);
+    }
+    const char *prefix = formats[id].level <= LEVEL_ERROR ? prefixes[formats[id].level] : "?:";
+    printf("%s %s\n", prefix, text);
+  }
+
+  free(entries);
+  for (i = 0; i < formats_size; i++) {
+    free(formats[i].msg);
+  }
+  free(formats);
+  free(content);
+  exit(0);
+}
@@ -20,16 +20,30 @@
  */
 
 #include <arpa/inet.h>  
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>     
 #include <string.h>     
 #include <unistd.h>     
 #include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include <termPaperLib.h>
+#include <binaryProtocol.h>
 
 // max 9999 testcases
 #define MAX_TESTNUM 4
+// the restart, replication and routing tests (-x)
+#define MAX_PROCESS_ARGS 16
+#define STARTUP_WAIT 5
+#define CONVERGENCE_WAIT 5
+#define SNAPSHOT_WAIT 3
+#define ROUTER_BACKENDS 2
+#define ROUTER_FILES 20
 typedef struct payload {
   pthread_barrier_t *start;
   pthread_barrier_t *target;
@@ -57,6 +71,8 @@ void handle_barrier_wait_error(int retcode, char *desc) {
 // Global stuff - it is only a test ...
 char *server_ip;
 unsigned short server_port;
+char *unix_path;
+char *binary_dir;
 int num_testcases;
 int num_testcases_success;
 int num_testcases_fail;
@@ -66,12 +82,19 @@ int num_concurrent_testcases;
 int num_concurrent_testcases_success;
 int num_concurrent_testcases_fail;
 
+int connect_to_server() {
+  if (unix_path != NULL) {
+    return create_unix_client_socket(unix_path);
+  }
+  return create_client_socket(server_port, server_ip);
+}
+
 // poss1 = 0
 // poss2 = 1
 // neither = 2
 int run_not_sure_testcase(const char *input, const char *poss1, const char *poss2, char* desc) {
   int to_return = 0;
-  int sock = create_client_socket(server_port, server_ip);
+  int sock = connect_to_server();
 
   write_to_socket(sock, input);
 
@@ -102,9 +125,8 @@ int run_not_sure_testcase(const char *input, const char *poss1, const char *poss
   return to_return;
 }
 
-int run_concurrent_testcase(const char *input, const char *expected, char* desc) {
+int run_testcase_on_socket(int sock, const char *input, const char *expected, char* desc) {
   int to_return = 0;
-  int sock = create_client_socket(server_port, server_ip);
 
   write_to_socket(sock, input);
 
@@ -130,6 +152,10 @@ int run_concurrent_testcase(const char *input, const char *expected, char* desc)
   return to_return;
 }
 
+int run_concurrent_testcase(const char *input, const char *expected, char* desc) {
+  return run_testcase_on_socket(connect_to_server(), input, expected, desc);
+}
+
 void *run_concurrent_test(void *input) {
 
   pthread_detach(pthread_self());
@@ -563,6 +589,88 @@ void runTestcases() {
   runTestcase("DELETE hack2\n", "DELETED\n");
   runTestcase("LIST\n", "ACK 0\n");
 }
+/*
+ * Reads the next binary response and compares it to the expectation
+ */
+void checkBinaryResponse(int sock, uint32_t request_id, int status, const char *value) {
+  num_testcases++;
+
+  BinaryHeader header;
+  char *received;
+  if (read_binary_response(sock, &header, &received) 
+      && header.request_id == request_id && header.status == status
+      && strcmp(received, value) == 0) {
+    log_info("Binary testcase %u: OK!", request_id);
+    num_testcases_success++;
+  } else {
+    log_info("Binary testcase %u: FAILED!", request_id);
+    log_info("Expected: id %u status %d '%s'", request_id, status, value);
+    if (received != NULL) {
+      log_info("Recived : id %u status %d '%s'", header.request_id, header.status, received);
+    }
+    num_testcases_fail++;
+  }
+  free(received);
+}
+
+void runBinaryTestcases() {
+  // all requests are pipelined - the answers have to arrive in order
+  int sock = connect_to_server();
+  write_binary_request(sock, OP_LIST, 1, NULL, NULL, 0);
+  write_binary_request(sock, OP_CREATE, 2, "bin1", "hello", 5);
+  write_binary_request(sock, OP_CREATE, 3, "bin1", "hello", 5);
+  write_binary_request(sock, OP_READ, 4, "bin1", NULL, 0);
+  write_binary_request(sock, OP_UPDATE, 5, "bin1", "hello world", 11);
+  write_binary_request(sock, OP_CREATE, 6, "bin2", "x", 1);
+  write_binary_request(sock, OP_READ, 7, "bin1", NULL, 0);
+  write_binary_request(sock, OP_LIST, 8, NULL, NULL, 0);
+  write_binary_request(sock, OP_UPDATE, 9, "nobin", "x", 1);
+  write_binary_request(sock, OP_CREATE, 10, "bin3", "", 0);
+
+  checkBinaryResponse(sock, 1, STATUS_OK, "");
+  checkBinaryResponse(sock, 2, STATUS_OK, "");
+  checkBinaryResponse(sock, 3, STATUS_FILEEXISTS, "");
+  checkBinaryResponse(sock, 4, STATUS_OK, "hello");
+  checkBinaryResponse(sock, 5, STATUS_OK, "");
+  checkBinaryResponse(sock, 6, STATUS_OK, "");
+  checkBinaryResponse(sock, 7, STATUS_OK, "hello world");
+  checkBinaryResponse(sock, 8, STATUS_OK, "bin1\nbin2");
+  checkBinaryResponse(sock, 9, STATUS_NOSUCHFILE, "");
+  checkBinaryResponse(sock, 10, STATUS_BAD_REQUEST, "");
+
+  // both protocols work on the same files
+  runTestcase("READ bin1\n", "FILECONTENT bin1 11\nhello world\n");
+  runTestcase("DELETE bin2\n", "DELETED\n");
+
+  write_binary_request(sock, OP_DELETE, 11, "bin1", NULL, 0);
+  write_binary_request(sock, OP_READ, 12, "bin1", NULL, 0);
+  write_binary_request(sock, OP_DELETE, 13, "bin2", NULL, 0);
+  checkBinaryResponse(sock, 11, STATUS_OK, "");
+  checkBinaryResponse(sock, 12, STATUS_NOSUCHFILE, "");
+  checkBinaryResponse(sock, 13, STATUS_NOSUCHFILE, "");
+  close(sock);
+
+  // a pipeline longer than one batch of the server
+  sock = connect_to_server();
+  char key[16];
+  int i;
+  for (i = 0; i < 40; i++) {
+    snprintf(key, sizeof(key), "pipe%d", i);
+    write_binary_request(sock, OP_CREATE, i, key, key, strlen(key));
+    write_binary_request(sock, OP_READ, i, key, NULL, 0);
+    write_binary_request(sock, OP_DELETE, i, key, NULL, 0);
+  }
+  for (i = 0; i < 40; i++) {
+    snprintf(key, sizeof(key), "pipe%d", i);
+    checkBinaryResponse(sock, i, STATUS_OK, "");
+    checkBinaryResponse(sock, i, STATUS_OK, key);
+    checkBinaryResponse(sock, i, STATUS_OK, "");
+  }
+  close(sock);
+
+  runTestcase("LIST\n", "ACK 0\n");
+}
+
 void *run(void *input) {
 
   pthread_detach(pthread_self());
@@ -585,6 +693,58 @@ void *run(void *input) {
   free(payload);
   pthread_exit(NULL);
 }
+/*
+ * The counters of STATS depend on the tests before - only the number of
+ * lines and the counted CREATEs are checked
+ */
+void runStatsTestcase() {
+  num_testcases++;
+
+  int sock = connect_to_server();
+  write_to_socket(sock, "STATS\n");
+  char *received;
+  read_from_socket(sock, &received);
+
+  // the lines may be longer than one message - read until all arrived
+  int num_lines = -1;
+  sscanf(received, "STATS %d\n", &num_lines);
+  int lines = 0;
+  char *line;
+  for (line = strchr(received, '\n'); line != NULL; line = strchr(line + 1, '\n')) {
+    lines++;
+  }
+  while (num_lines >= 0 && lines <= num_lines) {
+    char *more;
+    read_from_socket(sock, &more);
+    for (line = strchr(more, '\n'); line != NULL; line = strchr(line + 1, '\n')) {
+      lines++;
+    }
+    char *joined = join_with_seperator(received, more, "");
+    free(received);
+    free(more);
+    received = joined;
+  }
+  close(sock);
+
+  lines = 0;
+  unsigned long creates = 0;
+  for (line = strchr(received, '\n'); line != NULL && line[1] != '\000'; 
+       line = strchr(line + 1, '\n')) {
+    lines++;
+    sscanf(line + 1, "create_requests %lu", &creates);
+  }
+
+  if (num_lines == lines && creates > 0) {
+    log_info("Testcase STATS: OK!");
+    num_testcases_success++;
+  } else {
+    log_info("Testcase STATS: FAILED!");
+    log_info("Recived : '%s'", received);
+    num_testcases_fail++;
+  }
+  free(received);
+}
+
 void runConcurrencyTest(size_t num) {
   pthread_t threads[num];
   pthread_barrier_t create_barr;
@@ -594,16 +754,16 @@ void runConcurrencyTest(size_t num) {
   pthread_mutex_t create_mutex = PTHREAD_MUTEX_INITIALIZER;
   pthread_mutex_t delete_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-  int retcode = pthread_barrier_init(&create_barr, NULL, num);
+  int retcode = pthread_barrier_init(&create_barr, NULL, num + 1);
   handle_thread_error(retcode, "Create CREATE barrier", PROCESS_EXIT);
 
-  retcode = pthread_barrier_init(&update_barr, NULL, num);
+  retcode = pthread_barrier_init(&update_barr, NULL, num + 1);
   handle_thread_error(retcode, "Create UPDATE barrier", PROCESS_EXIT);
 
-  retcode = pthread_barrier_init(&delete_barr, NULL, num);
+  retcode = pthread_barrier_init(&delete_barr, NULL, num + 1);
   handle_thread_error(retcode, "Create DELETE barrier", PROCESS_EXIT);
 
-  retcode = pthread_barrier_init(&target_barr, NULL, num);
+  retcode = pthread_barrier_init(&target_barr, NULL, num + 1);
   handle_thread_error(retcode, "Create TARGET barrier", PROCESS_EXIT);
 
   Payload2 *payload = malloc(sizeof(Payload2));
@@ -666,10 +826,10 @@ void runConcurrentTestcases(size_t num) {
   pthread_barrier_t start;
   pthread_barrier_t target;
 
-  int retcode = pthread_barrier_init(&start, NULL, num);
+  int retcode = pthread_barrier_init(&start, NULL, num + 1);
   handle_thread_error(retcode, "Create START barrier", PROCESS_EXIT);
 
-  retcode = pthread_barrier_init(&target, NULL, num);
+  retcode = pthread_barrier_init(&target, NULL, num + 1);
   handle_thread_error(retcode, "Create TARGET barrier", PROCESS_EXIT);
 
   int i; 
@@ -698,6 +858,434 @@ void runConcurrentTestcases(size_t num) {
 //  handle_thread_error(retcode, "Destroy TARGET barrier", PROCESS_EXIT);
 }
 
+/*
+ * Kills the process without giving it a chance to clean up - like a crash
+ */
+void stop_process(pid_t pid) {
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+}
+
+/*
+ * Starts program of the binary directory on the given port with the further
+ * arguments (terminated with NULL) - returns once it accepts connections
+ */
+pid_t start_process(const char *program, unsigned short port, ...) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", binary_dir, program);
+  char port_arg[8];
+  snprintf(port_arg, sizeof(port_arg), "%u", port);
+
+  // the expected errors of the tests are not logged either
+  char *args[MAX_PROCESS_ARGS] = { path, "-p", port_arg, "-i", "0", "-e", "0" };
+  int num_args = 7;
+  va_list more_args;
+  va_start(more_args, port);
+  char *arg;
+  while ((arg = va_arg(more_args, char *)) != NULL && num_args < MAX_PROCESS_ARGS - 1) {
+    args[num_args++] = arg;
+  }
+  va_end(more_args);
+  args[num_args] = NULL;
+
+  pid_t pid = fork();
+  handle_error(pid, "fork() failed", PROCESS_EXIT);
+  if (pid == 0) {
+    execv(path, args);
+    log_error("execv() of %s failed: %s", path, strerror(errno));
+    _exit(1);
+  }
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = inet_addr(server_ip);
+  address.sin_port = htons(port);
+
+  int tries;
+  for (tries = 0; tries < STARTUP_WAIT * 10; tries++) {
+    if (waitpid(pid, NULL, WNOHANG) == pid) {
+      log_info("%s exited at startup", path);
+      return -1;
+    }
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    handle_error(sock, "socket() failed", PROCESS_EXIT);
+    int connected = connect(sock, (struct sockaddr *) &address, sizeof(address)) == 0;
+    close(sock);
+    if (connected) {
+      return pid;
+    }
+    usleep(100 * 1000);
+  }
+  log_info("%s does not accept connections on port %u", path, port);
+  stop_process(pid);
+  return -1;
+}
+
+/*
+ * Every started process gets a port of its own - a port isn't free again
+ * right after the process is killed
+ */
+unsigned short next_test_port() {
+  static unsigned short port = 0;
+  port = port == 0 ? server_port + 1 : port + 1;
+  return port;
+}
+
+void count_testcase(int failed) {
+  num_testcases++;
+  if (failed) {
+    num_testcases_fail++;
+  } else {
+    num_testcases_success++;
+  }
+}
+
+void runTestcaseOn(unsigned short port, const char *input, const char *expected) {
+  char testcase_char[MAX_TESTNUM];
+  snprintf(testcase_char, MAX_TESTNUM, "%03d", num_testcases + 1);
+
+  int sock = create_client_socket(port, server_ip);
+  count_testcase(run_testcase_on_socket(sock, input, expected, testcase_char) != 0);
+}
+
+void runFileTestcase(const char *path, int expected) {
+  int exists = access(path, F_OK) == 0;
+  if (exists != expected) {
+    log_info("Testcase %03d: FAILED! %s %s", num_testcases + 1, path,
+             exists ? "exists" : "does not exist");
+  } else {
+    log_info("Testcase %03d: OK!", num_testcases + 1);
+  }
+  count_testcase(exists != expected);
+}
+
+void runStartTestcase(pid_t pid, const char *desc) {
+  if (pid < 0) {
+    log_info("Testcase %03d: FAILED! Could not start %s", num_testcases + 1, desc);
+  } else {
+    log_info("Testcase %03d: OK!", num_testcases + 1);
+  }
+  count_testcase(pid < 0);
+}
+
+int compare_filenames(const void *a, const void *b) {
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+ * Sorts the files of a LIST response in place - the store lists them in no
+ * particular order
+ */
+void sort_list_response(char *response) {
+  char *files = strchr(response, '\n');
+  if (files == NULL) {
+    return;
+  }
+  files++;
+
+  size_t num_files = 0;
+  char *c;
+  for (c = files; *c != '\000'; c++) {
+    num_files += *c == '\n';
+  }
+  if (num_files == 0) {
+    return;
+  }
+
+  char *copy = strdup(files);
+  char *names[num_files];
+  size_t i = 0;
+  char *save_ptr;
+  char *name = strtok_r(copy, "\n", &save_ptr);
+  while (name != NULL && i < num_files) {
+    names[i++] = name;
+    name = strtok_r(NULL, "\n", &save_ptr);
+  }
+  qsort(names, i, sizeof(char *), compare_filenames);
+
+  size_t j;
+  for (j = 0; j < i; j++) {
+    size_t len = strlen(names[j]);
+    memcpy(files, names[j], len);
+    files[len] = '\n';
+    files += len + 1;
+  }
+  free(copy);
+}
+
+char *query_server(unsigned short port, const char *input) {
+  int sock = create_client_socket(port, server_ip);
+  write_to_socket(sock, input);
+
+  char *buffer_ptr[1];
+  read_from_socket(sock, buffer_ptr);
+  close(sock);
+  return *buffer_ptr;
+}
+
+/*
+ * Compares the files of the server with the expected (sorted) LIST response -
+ * retried for a while since a follower applies the changes in the background
+ */
+void runListTestcase(unsigned short port, const char *expected) {
+  char *response = NULL;
+  int tries;
+  for (tries = 0; tries < CONVERGENCE_WAIT * 10; tries++) {
+    free(response);
+    response = query_server(port, "LIST\n");
+    sort_list_response(response);
+    if (strcmp(response, expected) == 0) {
+      break;
+    }
+    usleep(100 * 1000);
+  }
+
+  int failed = strcmp(response, expected) != 0;
+  if (failed) {
+    log_info("Testcase %03d: FAILED!", num_testcases + 1);
+    log_info("send: 'LIST' to port %u", port);
+    log_info("Expected: '%s'", expected);
+    log_info("Recived : '%s'", response);
+  } else {
+    log_info("Testcase %03d: OK!", num_testcases + 1);
+  }
+  count_testcase(failed);
+  free(response);
+}
+
+long count_listed_files(unsigned short port) {
+  char *response = query_server(port, "LIST\n");
+  long num_files = -1;
+  sscanf(response, "ACK %ld", &num_files);
+  free(response);
+  return num_files;
+}
+
+/*
+ * The files of a killed server are restored from its write ahead log - the
+ * rotated log of a failed snapshot too - and from its snapshot
+ */
+void runRestartTestcases() {
+  char dir[] = "/tmp/termPaperTestXXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    handle_error(-1, "mkdtemp() failed", PROCESS_EXIT);
+  }
+  char wal[PATH_MAX];
+  char old_wal[PATH_MAX];
+  char snapshot[PATH_MAX];
+  char temp_snapshot[PATH_MAX];
+  snprintf(wal, sizeof(wal), "%s/wal", dir);
+  snprintf(old_wal, sizeof(old_wal), "%s/wal.old", dir);
+  snprintf(snapshot, sizeof(snapshot), "%s/snapshot", dir);
+  snprintf(temp_snapshot, sizeof(temp_snapshot), "%s/snapshot.tmp", dir);
+
+  // WAL replay
+  log_debug("---------------------------------------------------");
+  log_debug("replay of the write ahead log");
+  unsigned short port = next_test_port();
+  pid_t pid = start_process("run", port, "-l", wal, "-D", "request", NULL);
+  runStartTestcase(pid, "the server with a write ahead log");
+  if (pid > 0) {
+    runTestcaseOn(port, "CREATE walA 3\nabc\n", "FILECREATED\n");
+    runTestcaseOn(port, "CREATE walB 3\ndef\n", "FILECREATED\n");
+    runTestcaseOn(port, "CREATE walC 3\nghi\n", "FILECREATED\n");
+    runTestcaseOn(port, "UPDATE walA 5\nabcde\n", "UPDATED\n");
+    runTestcaseOn(port, "DELETE walB\n", "DELETED\n");
+    stop_process(pid);
+
+    port = next_test_port();
+    pid = start_process("run", port, "-l", wal, "-D", "request", NULL);
+    runStartTestcase(pid, "the server on the write ahead log");
+  }
+  if (pid > 0) {
+    runListTestcase(port, "ACK 2\nwalA\nwalC\n");
+    runTestcaseOn(port, "READ walA\n", "FILECONTENT walA 5\nabcde\n");
+    runTestcaseOn(port, "READ walB\n", "NOSUCHFILE\n");
+    runTestcaseOn(port, "READ walC\n", "FILECONTENT walC 3\nghi\n");
+    stop_process(pid);
+  }
+
+  // the log is rotated before a snapshot, the old one is kept until the
+  // snapshot is written - it can't be while its temporary file is a directory
+  log_debug("---------------------------------------------------");
+  log_debug("rotation of the write ahead log");
+  mkdir(temp_snapshot, 0755);
+  port = next_test_port();
+  pid = start_process("run", port, "-l", wal, "-D", "request", "-s", snapshot,
+                      "-n", "1", NULL);
+  runStartTestcase(pid, "the server with a snapshot and a write ahead log");
+  if (pid > 0) {
+    runTestcaseOn(port, "CREATE walD 3\njkl\n", "FILECREATED\n");
+    sleep(SNAPSHOT_WAIT);
+    runTestcaseOn(port, "CREATE walE 3\nmno\n", "FILECREATED\n");
+    stop_process(pid);
+    runFileTestcase(old_wal, TRUE);
+    runFileTestcase(snapshot, FALSE);
+
+    port = next_test_port();
+    pid = start_process("run", port, "-l", wal, "-D", "request", "-s", snapshot,
+                        "-n", "1", NULL);
+    runStartTestcase(pid, "the server on the rotated write ahead log");
+  }
+  if (pid > 0) {
+    runListTestcase(port, "ACK 4\nwalA\nwalC\nwalD\nwalE\n");
+    runTestcaseOn(port, "READ walD\n", "FILECONTENT walD 3\njkl\n");
+
+    // now the snapshot of the next change can be written and the old log
+    // is deleted
+    rmdir(temp_snapshot);
+    runTestcaseOn(port, "UPDATE walD 3\njkl\n", "UPDATED\n");
+    sleep(SNAPSHOT_WAIT);
+    stop_process(pid);
+    runFileTestcase(old_wal, FALSE);
+    runFileTestcase(snapshot, TRUE);
+  }
+
+  // snapshot load - without the log only the snapshot has the files
+  log_debug("---------------------------------------------------");
+  log_debug("load of the snapshot");
+  unlink(wal);
+  port = next_test_port();
+  pid = start_process("run", port, "-s", snapshot, "-n", "1", NULL);
+  runStartTestcase(pid, "the server on the snapshot");
+  if (pid > 0) {
+    runListTestcase(port, "ACK 4\nwalA\nwalC\nwalD\nwalE\n");
+    runTestcaseOn(port, "READ walE\n", "FILECONTENT walE 3\nmno\n");
+    runTestcaseOn(port, "DELETE walC\n", "DELETED\n");
+    runTestcaseOn(port, "CREATE snapA 3\npqr\n", "FILECREATED\n");
+    sleep(SNAPSHOT_WAIT);
+    stop_process(pid);
+
+    port = next_test_port();
+    pid = start_process("run", port, "-s", snapshot, "-n", "1", NULL);
+    runStartTestcase(pid, "the server on the new snapshot");
+  }
+  if (pid > 0) {
+    runListTestcase(port, "ACK 4\nsnapA\nwalA\nwalD\nwalE\n");
+    runTestcaseOn(port, "READ snapA\n", "FILECONTENT snapA 3\npqr\n");
+    stop_process(pid);
+  }
+
+  unlink(wal);
+  unlink(old_wal);
+  unlink(snapshot);
+  rmdir(temp_snapshot);
+  rmdir(dir);
+}
+
+/*
+ * A follower copies the files the primary had before and applies the later
+ * changes
+ */
+void runReplicationTestcases() {
+  log_debug("---------------------------------------------------");
+  log_debug("replication to a follower");
+  unsigned short port = next_test_port();
+  unsigned short replication_port = next_test_port();
+  char replication_arg[8];
+  snprintf(replication_arg, sizeof(replication_arg), "%u", replication_port);
+  pid_t primary = start_process("run", port, "-r", replication_arg, NULL);
+  runStartTestcase(primary, "the primary");
+  if (primary < 0) {
+    return;
+  }
+
+  runTestcaseOn(port, "CREATE replA 3\nabc\n", "FILECREATED\n");
+  runTestcaseOn(port, "CREATE replB 3\ndef\n", "FILECREATED\n");
+  runTestcaseOn(port, "CREATE replC 3\nghi\n", "FILECREATED\n");
+
+  char primary_arg[32];
+  snprintf(primary_arg, sizeof(primary_arg), "%s:%u", server_ip, replication_port);
+  unsigned short follower_port = next_test_port();
+  pid_t follower = start_process("run", follower_port, "-f", primary_arg, NULL);
+  runStartTestcase(follower, "the follower");
+  if (follower > 0) {
+    // catch-up
+    runListTestcase(follower_port, "ACK 3\nreplA\nreplB\nreplC\n");
+    runTestcaseOn(follower_port, "READ replB\n", "FILECONTENT replB 3\ndef\n");
+
+    // changes after the catch-up
+    runTestcaseOn(port, "UPDATE replA 5\nabcde\n", "UPDATED\n");
+    runTestcaseOn(port, "DELETE replB\n", "DELETED\n");
+    runTestcaseOn(port, "CREATE replD 3\njkl\n", "FILECREATED\n");
+    runListTestcase(follower_port, "ACK 3\nreplA\nreplC\nreplD\n");
+    runTestcaseOn(follower_port, "READ replA\n", "FILECONTENT replA 5\nabcde\n");
+    runTestcaseOn(follower_port, "CREATE replE 3\nmno\n", "READONLY\n");
+    stop_process(follower);
+  }
+  stop_process(primary);
+}
+
+/*
+ * The router spreads the files over the servers of its hash ring and joins
+ * their LISTs
+ */
+void runRouterTestcases() {
+  log_debug("---------------------------------------------------");
+  log_debug("routing to several servers");
+  unsigned short ports[ROUTER_BACKENDS];
+  pid_t backends[ROUTER_BACKENDS];
+  char backend_list[ROUTER_BACKENDS * 32] = "";
+  int started = TRUE;
+  int i;
+  for (i = 0; i < ROUTER_BACKENDS; i++) {
+    ports[i] = next_test_port();
+    backends[i] = start_process("run", ports[i], NULL);
+    runStartTestcase(backends[i], "a server of the router");
+    started = started && backends[i] > 0;
+    snprintf(backend_list + strlen(backend_list), sizeof(backend_list) - strlen(backend_list),
+             "%s%s:%u", i > 0 ? "," : "", server_ip, ports[i]);
+  }
+
+  unsigned short port = next_test_port();
+  pid_t router = started ? start_process("router", port, "-b", backend_list, NULL) : -1;
+  runStartTestcase(router, "the router");
+  if (router > 0) {
+    char request[64];
+    char response[64];
+    char expected[ROUTER_FILES * 16] = "";
+    snprintf(expected, sizeof(expected), "ACK %d\n", ROUTER_FILES);
+    for (i = 0; i < ROUTER_FILES; i++) {
+      snprintf(request, sizeof(request), "CREATE route%02d 2\n%02d\n", i, i);
+      runTestcaseOn(port, request, "FILECREATED\n");
+      snprintf(expected + strlen(expected), sizeof(expected) - strlen(expected),
+               "route%02d\n", i);
+    }
+    runListTestcase(port, expected);
+    for (i = 0; i < ROUTER_FILES; i++) {
+      snprintf(request, sizeof(request), "READ route%02d\n", i);
+      snprintf(response, sizeof(response), "FILECONTENT route%02d 2\n%02d\n", i, i);
+      runTestcaseOn(port, request, response);
+    }
+
+    // every file is on one server and every server got some
+    long num_files = 0;
+    int all_used = TRUE;
+    for (i = 0; i < ROUTER_BACKENDS; i++) {
+      long backend_files = count_listed_files(ports[i]);
+      num_files += backend_files;
+      all_used = all_used && backend_files > 0;
+    }
+    if (num_files != ROUTER_FILES || !all_used) {
+      log_info("Testcase %03d: FAILED! %ld files on the servers", num_testcases + 1,
+               num_files);
+    } else {
+      log_info("Testcase %03d: OK!", num_testcases + 1);
+    }
+    count_testcase(num_files != ROUTER_FILES || !all_used);
+
+    runTestcaseOn(port, "DELETE route00\n", "DELETED\n");
+    runTestcaseOn(port, "READ route00\n", "NOSUCHFILE\n");
+    stop_process(router);
+  }
+  for (i = 0; i < ROUTER_BACKENDS; i++) {
+    if (backends[i] > 0) {
+      stop_process(backends[i]);
+    }
+  }
+}
+
 void usage(const char *argv0, const char *msg) {
   if (msg != NULL && strlen(msg) > 0) {
     printf("%s\n\n", msg);
@@ -707,6 +1295,8 @@ void usage(const char *argv0, const char *msg) {
   char *usage = "";
   char *ip_help = get_ip_help(&usage);
   char *port_help = get_port_help(&usage);
+  char *unix_help = get_unix_path_help(&usage);
+  usage = join_with_seperator(usage, "[-x Dir]", " ");
   char *log_help = get_logging_help(&usage);
   printf("%s %s\n\n", argv0, usage);
 
@@ -715,6 +1305,11 @@ void usage(const char *argv0, const char *msg) {
 
   printf("%s\n", ip_help);
   printf("%s\n", port_help);
+  printf("%s\n", unix_help);
+  printf("[-x Dir] Optional: Also restart servers on their write ahead log and\n");
+  printf("          snapshot, follow a primary and route to several servers with\n");
+  printf("          the run and router of Dir. They get the ports after Port\n");
+  printf("          Default: Only the running server is tested\n\n");
   printf("%s\n\n", log_help);
 
   printf("(c) Max Schrimpf - ZHAW 2014\n");
@@ -730,6 +1325,8 @@ int main(int argc, char *argv[]) {
 
   server_ip = get_ip_with_default(argc, argv);
   server_port = get_port_with_default(argc, argv);
+  unix_path = get_unix_path(argc, argv);
+  binary_dir = get_string_with_default(argc, argv, "-x", NULL);
   get_logging_properties(argc, argv);
 
   num_testcases = 0;
@@ -744,6 +1341,13 @@ int main(int argc, char *argv[]) {
   runConcurrentTestcases(999);
   runConcurrencyTest(200);
   runTestcases();
+  runBinaryTestcases();
+  runStatsTestcase();
+  if (binary_dir != NULL) {
+    runRestartTestcases();
+    runReplicationTestcases();
+    runRouterTestcases();
+  }
 
   retcode = pthread_mutex_destroy(&concurrent_stat_lock);
   handle_error(retcode, "destroy mutex failed", PROCESS_EXIT);
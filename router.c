@@ -0,0 +1,367 @@
+/*
+ * This file is part of the concurrent programming in C term paper
+ *
+ * It provides a router that spreads the files over several servers by a
+ * consistent hash of their names
+ * Copyright (C) 2014 Max Schrimpf
+ *
+ * The file is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * The file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the project. if not, write to the Free Software Foundation, Inc.
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <termPaperLib.h>
+#include <messageProcessing.h>
+#include <binaryProtocol.h>
+#include <backendPool.h>
+#include <hashRing.h>
+#include <threadTracking.h>
+#include <asyncLog.h>
+
+// the backends and who owns which file
+typedef struct router {
+  Backend *backends;
+  int num_backends;
+  HashRing *ring;
+} Router;
+
+typedef struct routerConnection {
+  Router *router;
+  int socket;
+} RouterConnection;
+
+void usage(char *programName, char *msg) {
+  if (msg != NULL && strlen(msg) > 0) {
+    printf("%s\n\n", msg);
+  }
+  printf("Usage:\n");
+
+  char *usage =  "";
+  char *port_help = get_port_help(&usage);
+  usage = join_with_seperator(usage, "-b Host:Port[,Host:Port...] [-v Points]", " ");
+  char *log_help = get_logging_help(&usage);
+  printf("%s %s\n\n", programName, usage);
+
+  printf("Router for the term paper in concurrent C programming\n");
+  printf("Spreads the files over several servers - every file lives on the\n");
+  printf("server its name hashes to, LIST asks all servers. Speaks the text\n");
+  printf("and the binary protocol, the servers are asked via binary connections\n");
+  printf("that are kept open\n\n\n");
+
+  printf("%s\n", port_help);
+  printf("-b Host:Port[,Host:Port...] Servers the files are spread over\n\n");
+  printf("[-v Points] Optional: Number of points of a server on the hash ring\n");
+  printf("             Default: %d\n\n", DEFAULT_VIRTUAL_NODES);
+  printf("%s\n\n", log_help);
+
+  printf("(c) Max Schrimpf - ZHAW 2014\n");
+
+  exit(1);
+}
+
+/*
+ * Sends a request to the backend of its file - LIST to all of them, their
+ * files are joined in the order of the backends
+ */
+int route_request(Router *router, const BinaryHeader *request, const char *key,
+                  const char *value, BinaryHeader *reply, char **reply_value) {
+  if (request->opcode != OP_LIST) {
+    Backend *backend = &router->backends[get_ring_backend(router->ring, key)];
+    log_debug("Routing %s to %s", key, backend->name);
+    return forward_to_backend(backend, request, key, value, reply, reply_value);
+  }
+
+  BinaryHeader replies[router->num_backends];
+  char *values[router->num_backends];
+  if (!forward_to_all_backends(router->backends, router->num_backends, request,
+                               replies, values)) {
+    return FALSE;
+  }
+
+  size_t len = 0;
+  int i;
+  for (i = 0; i < router->num_backends; i++) {
+    len += replies[i].value_len + 1;
+  }
+  char *files = malloc(len + 1);
+  size_t used = 0;
+  for (i = 0; i < router->num_backends; i++) {
+    if (replies[i].value_len > 0) {
+      if (used > 0) {
+        files[used++] = '\n';
+      }
+      memcpy(files + used, values[i], replies[i].value_len);
+      used += replies[i].value_len;
+    }
+    free(values[i]);
+  }
+  files[used] = '\000';
+
+  *reply = replies[0];
+  reply->value_len = used;
+  *reply_value = files;
+  return TRUE;
+}
+
+/*
+ * Answers a text request - it is sent to the backend as binary frame and the
+ * response is rendered like the server does
+ */
+void route_text_request(Router *router, char *buffer, size_t len, Response *response) {
+  Request request;
+  if (!parse_message(len, buffer, &request, response)) {
+    return;
+  }
+  // the counters belong to the servers
+  if (request.command == CMD_STATS) {
+    add_string_to_response(response, COMMAND_UNKNOWN);
+    return;
+  }
+
+  static const int opcodes[] = { OP_LIST, OP_READ, OP_CREATE, OP_UPDATE, OP_DELETE };
+  BinaryHeader header;
+  header.version = BINARY_VERSION;
+  header.opcode = opcodes[request.command];
+  header.status = STATUS_OK;
+  header.key_len = request.command != CMD_LIST ? strlen(request.file.filename) : 0;
+  header.value_len = 0;
+  header.request_id = 0;
+  if (request.command == CMD_CREATE || request.command == CMD_UPDATE) {
+    header.value_len = validate_size(request.file.length, request.file.content);
+    if (header.value_len < 1) {
+      add_string_to_response(response, COMMAND_UNKNOWN);
+      return;
+    }
+  }
+
+  BinaryHeader reply;
+  char *value;
+  if (!route_request(router, &header, request.file.filename, request.file.content,
+                     &reply, &value)) {
+    add_string_to_response(response, BUSY);
+    return;
+  }
+  // freed with the arena of the response
+  char *copy = arena_alloc(response->arena, reply.value_len + 1);
+  memcpy(copy, value, reply.value_len + 1);
+  free(value);
+
+  switch (reply.status) {
+    case STATUS_OK:
+      break;
+    case STATUS_FILEEXISTS:
+      add_string_to_response(response, FILEEXISTS);
+      return;
+    case STATUS_NOSUCHFILE:
+      add_string_to_response(response, NOSUCHFILE);
+      return;
+    case STATUS_READONLY:
+      add_string_to_response(response, READONLY);
+      return;
+    default:
+      add_string_to_response(response, COMMAND_UNKNOWN);
+      return;
+  }
+
+  size_t num_files = 0;
+  size_t i;
+  switch (request.command) {
+    case CMD_LIST:
+      for (i = 0; i < reply.value_len; i++) {
+        num_files += copy[i] == '\n';
+      }
+      num_files += reply.value_len > 0;
+      add_header_to_response(response, "%s %zu%s", ACK, num_files,
+                             reply.value_len > 0 ? "\n" : "");
+      add_to_response(response, copy, reply.value_len);
+      add_string_to_response(response, "\n");
+      break;
+    case CMD_READ:
+      add_header_to_response(response, "%s %s %u\n", FILECONTENT, request.file.filename,
+                             reply.value_len);
+      add_to_response(response, copy, reply.value_len);
+      add_string_to_response(response, "\n");
+      break;
+    case CMD_CREATE:
+      add_string_to_response(response, FILECREATED);
+      break;
+    case CMD_UPDATE:
+      add_string_to_response(response, UPDATED);
+      break;
+    case CMD_DELETE:
+      add_string_to_response(response, DELETED);
+      break;
+  }
+}
+
+/*
+ * Answers binary frames one after the other until the client closes the
+ * connection or sends an invalid frame
+ */
+void route_binary_connection(RouterConnection *connection, char *buffer, size_t buffered) {
+  Arena *arena = acquire_arena();
+
+  while (TRUE) {
+    size_t frame_len = 0;
+    BinaryHeader header;
+    int status = STATUS_OK;
+    if (buffered >= BINARY_HEADER_LEN) {
+      decode_binary_header(buffer, &header);
+      status = is_binary_message(buffer) ? validate_binary_header(&header)
+                                         : STATUS_BAD_REQUEST;
+      frame_len = get_binary_frame_len(&header);
+    }
+
+    Response response;
+    init_response(&response, arena);
+    if (status != STATUS_OK) {
+      log_error("Invalid binary frame - closing connection");
+      reject_binary_message(&header, status, &response);
+      write_response_to_socket(connection->socket, &response);
+      break;
+    }
+
+    if (frame_len > 0 && buffered >= frame_len) {
+      // the ring hashes the filename with \000
+      char *key = arena_alloc(arena, header.key_len + 1);
+      memcpy(key, buffer + BINARY_HEADER_LEN, header.key_len);
+      key[header.key_len] = '\000';
+
+      BinaryHeader reply;
+      // only set by a routed request
+      char *value = NULL;
+      if (header.opcode != OP_LIST && header.key_len < 1) {
+        reject_binary_message(&header, STATUS_BAD_REQUEST, &response);
+      } else if (route_request(connection->router, &header, key,
+                               buffer + BINARY_HEADER_LEN + header.key_len, &reply, &value)) {
+        respond_binary(&header, reply.status, value, reply.value_len, &response);
+      } else {
+        reject_binary_message(&header, STATUS_UNAVAILABLE, &response);
+      }
+      int sent = write_response_to_socket(connection->socket, &response);
+      free(value);
+      reset_arena(arena);
+      if (!sent) {
+        break;
+      }
+
+      buffered -= frame_len;
+      memmove(buffer, buffer + frame_len, buffered);
+      continue;
+    }
+
+    ssize_t received = recv(connection->socket, buffer + buffered, MAX_MSG_LEN - buffered, 0);
+    if (received <= 0) {
+      break;
+    }
+    buffered += received;
+  }
+  release_arena(arena);
+}
+
+void *handle_router_connection(void *input) {
+  RouterConnection *connection = (RouterConnection *) input;
+  char *buffer = malloc(MAX_MSG_LEN + 1);
+
+  size_t received = receive_from_socket(connection->socket, buffer, MAX_MSG_LEN);
+  if (received > 0 && is_binary_message(buffer)) {
+    route_binary_connection(connection, buffer, received);
+  } else if (received > 0) {
+    Arena *arena = acquire_arena();
+    Response response;
+    init_response(&response, arena);
+    route_text_request(connection->router, buffer, received, &response);
+    write_response_to_socket(connection->socket, &response);
+    release_arena(arena);
+  }
+
+  close(connection->socket);
+  free(buffer);
+  free(connection);
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  char *programName = argv[0];
+
+  if (is_help_requested(argc, argv)) {
+    usage(programName, "Help: ");
+  }
+
+  get_logging_properties(argc, argv);
+  // requests don't wait for the log output
+  start_async_logging();
+
+  char *backend_list = get_string_with_default(argc, argv, "-b", NULL);
+  if (backend_list == NULL) {
+    usage(programName, "Please provide the servers with -b Host:Port[,Host:Port...]");
+  }
+
+  Router router;
+  router.num_backends = 1;
+  char *c;
+  for (c = backend_list; *c != '\000'; c++) {
+    router.num_backends += *c == ',';
+  }
+  router.backends = malloc(router.num_backends * sizeof(Backend));
+  char **names = malloc(router.num_backends * sizeof(char *));
+
+  int i = 0;
+  char *name = strtok(backend_list, ",");
+  while (name != NULL) {
+    if (!init_backend(&router.backends[i], name)) {
+      usage(programName, "Servers have to be given as Host:Port");
+    }
+    names[i] = router.backends[i].name;
+    i++;
+    name = strtok(NULL, ",");
+  }
+  if (i != router.num_backends) {
+    usage(programName, "Servers have to be given as Host:Port");
+  }
+
+  router.ring = new_hash_ring(names, router.num_backends,
+      get_number_with_default(argc, argv, "-v", DEFAULT_VIRTUAL_NODES));
+  log_info("ROUTER: %d servers, %d points on the ring", router.num_backends,
+           router.ring->num_points);
+
+  // a client or backend that vanishes during a write must not kill the router
+  signal(SIGPIPE, SIG_IGN);
+
+  int server_socket = create_server_socket(get_port_with_default(argc, argv));
+  while (TRUE) {
+    RouterConnection *connection = malloc(sizeof(RouterConnection));
+    connection->router = &router;
+    connection->socket = accept(server_socket, NULL, NULL);
+    if (connection->socket < 0) {
+      handle_error(connection->socket, "accept() failed", NO_EXIT);
+      free(connection);
+      continue;
+    }
+
+    int retcode = start_tracked_thread(handle_router_connection, connection);
+    if (retcode != 0) {
+      handle_thread_error(retcode, "Start router connection", NO_EXIT);
+      close(connection->socket);
+      free(connection);
+    }
+  }
+  exit(0);
+}
@@ -22,27 +22,106 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/resource.h>
 
 #include <termPaperLib.h>
-#include <concurrentLinkedList.h>
+#include <store.h>
+#include <placement.h>
 #include <messageProcessing.h>
+#include <binaryProtocol.h>
+#include <coroutine.h>
+#include <bufferPool.h>
+#include <threadTracking.h>
+#include <asyncLog.h>
+#include <admissionControl.h>
+#include <timerWheel.h>
+#include <snapshot.h>
+#include <replication.h>
+#include <stats.h>
+#include <lockProfile.h>
+#include <metrics.h>
+#include <trace.h>
+
+// default timeouts in ms
+#define DEFAULT_READ_TIMEOUT 10000
+#define DEFAULT_WRITE_TIMEOUT 10000
+#define DEFAULT_IDLE_TIMEOUT 60000
+
+// max. number of pipelined frames of a connection executed at once
+#define MAX_PIPELINED_FRAMES 16
+
+// pause of a listener after a failed accept() - e.g. all files are open (ms)
+#define ACCEPT_BACKOFF 10
+
+// files open besides the connections: listeners, logs, WAL, followers...
+#define RESERVED_FILES 64
+
+// the state shared by all connections
+typedef struct server {
+  Store *store;
+  BufferPool receive_buffers;
+  AdmissionControl admission;
+  TimerWheel timers;
+  long read_timeout;
+  long write_timeout;
+  long idle_timeout;
+  // pin the threads to CPUs - the listeners get the first one
+  int pin_threads;
+  unsigned long next_cpu;
+  // serve the connections as coroutines on this many threads - 0 = threads
+  int coroutine_workers;
+  // idle workers execute the pipelined requests of busy ones
+  int work_stealing;
+  Lanes lanes;
+} Server;
+
+// a text request on its way through a lane
+typedef struct textExecution {
+  Request request;
+  Store *store;
+  Response *response;
+} TextExecution;
+
+// a binary request on its way through a lane
+typedef struct binaryExecution {
+  BinaryHeader *header;
+  const char *key;
+  Store *store;
+  Response *response;
+} BinaryExecution;
+
+// a pipelined binary request - lives in its own arena
+typedef struct binaryJob {
+  BinaryHeader header;
+  BinaryExecution execution;
+  Response response;
+  WorkItem work;
+} BinaryJob;
 
 // all informations that are needed to handle requests
 typedef struct payload {
   int socket;
-  struct sockaddr_in client_address; 
-  ConcurrentLinkedList *file_list;
+  // TCP or unix domain socket
+  struct sockaddr_storage client_address; 
+  Server *server;
+  // deadline of the current read or write on the socket
+  Timer deadline;
+  // only set while tracing
+  uint64_t accepted_at;
 } Payload;
 
 typedef struct listenerPayload {
-  int port_number;
-  ConcurrentLinkedList *threadList;
-  ConcurrentLinkedList *file_list;
+  int server_socket;
+  Server *server;
 } ListenerPayload;
 
 void usage(char *programName, char *msg) {
@@ -53,14 +132,89 @@ void usage(char *programName, char *msg) {
 
   char *usage =  "";
   char *port_help = get_port_help(&usage);
+  char *unix_help = get_unix_path_help(&usage);
+  usage = join_with_seperator(usage, "[-m Connections] [-q Connections]", " ");
+  usage = join_with_seperator(usage, "[-R Timeout] [-W Timeout] [-I Timeout]", " ");
+  usage = join_with_seperator(usage, "[-S Shards] [-P 0|1] [-N 0|1] [-k Workers]", " ");
+  usage = join_with_seperator(usage, "[-w 0|1] [-L Points,Scans,Writes]", " ");
+  usage = join_with_seperator(usage, "[-s Path] [-n Seconds]", " ");
+  usage = join_with_seperator(usage, "[-l Path] [-D none|batched|request]", " ");
+  usage = join_with_seperator(usage, "[-r Port] [-f Host:Port] [-C Files]", " ");
+  usage = join_with_seperator(usage, "[-M Port] [-T Path] [-t Rate] [-Y Seconds]", " ");
   char *log_help = get_logging_help(&usage);
   printf("%s %s\n\n", programName, usage);
 
   printf("Server for the term paper in concurrent C programming\n");
   printf("Will start a virtual file server that accepts connections via\n");
-  printf("TCP\n\n\n");
+  printf("TCP and optionally via a unix domain socket\n\n\n");
 
   printf("%s\n", port_help);
+  printf("%s\n", unix_help);
+  printf("[-m Connections] Optional: Max. number of concurrently served connections.\n");
+  printf("                  Default: %d\n\n", DEFAULT_MAX_IN_FLIGHT);
+  printf("[-q Connections] Optional: Max. number of connections waiting to be served.\n");
+  printf("                  Further connections are answered with BUSY\n");
+  printf("                  Default: %d\n\n", DEFAULT_MAX_QUEUED);
+  printf("[-R Timeout] Optional: Max. time in ms a client may take to send its\n");
+  printf("              request before the connection is closed. 0 = no timeout\n");
+  printf("              Default: %d\n\n", DEFAULT_READ_TIMEOUT);
+  printf("[-W Timeout] Optional: Max. time in ms a client may take to receive the\n");
+  printf("              response before the connection is closed. 0 = no timeout\n");
+  printf("              Default: %d\n\n", DEFAULT_WRITE_TIMEOUT);
+  printf("[-I Timeout] Optional: Max. time in ms a binary protocol connection may\n");
+  printf("              wait for its next request. 0 = no timeout\n");
+  printf("              Default: %d\n\n", DEFAULT_IDLE_TIMEOUT);
+  printf("[-S Shards] Optional: Number of parts the files are split into. The parts\n");
+  printf("             are spread over the NUMA nodes and allocate their memory there\n");
+  printf("             Default: Number of NUMA nodes\n\n");
+  printf("[-P 0|1] Optional: Pin the listener and the connection threads to CPUs\n");
+  printf("          Default: 0\n\n");
+  printf("[-N 0|1] Optional: Move a thread to the NUMA node of a file before the\n");
+  printf("          file is accessed - not for threads pinned with -P or coroutines\n");
+  printf("          Default: 0\n\n");
+  printf("[-k Workers] Optional: Serve the connections as coroutines on the given\n");
+  printf("              number of threads instead of one thread per connection\n");
+  printf("              Default: 0 (one thread per connection)\n\n");
+  printf("[-w 0|1] Optional: With several workers idle workers execute the\n");
+  printf("          pipelined binary READs and LISTs of busy ones (not with lanes)\n");
+  printf("          Default: 1\n\n");
+  printf("[-L Points,Scans,Writes] Optional: Execute READs, LISTs and changes in\n");
+  printf("              separate lanes with the given number of threads each, so\n");
+  printf("              READs are not delayed by expensive requests. E.g. 4,1,2\n");
+  printf("              Default: No lanes - the connection executes its requests\n\n");
+  printf("[-s Path] Optional: Snapshot file - the files are mapped from it at startup\n");
+  printf("           and written to it in the background after changes\n");
+  printf("           Default: No snapshots\n\n");
+  printf("[-n Seconds] Optional: Time between two snapshots.\n");
+  printf("              Default: %d\n\n", DEFAULT_SNAPSHOT_INTERVAL);
+  printf("[-l Path] Optional: Write ahead log - replayed at startup (after the\n");
+  printf("           snapshot), all CREATEs, UPDATEs and DELETEs are appended\n");
+  printf("           Default: No log\n\n");
+  printf("[-D none|batched|request] Optional: When a logged change is acknowledged:\n");
+  printf("           none: after the write, batched: after the sync of a group\n");
+  printf("           of changes, request: after a sync of its own\n");
+  printf("           Default: batched\n\n");
+  printf("[-r Port] Optional: Port for followers - all changes are sent to them\n");
+  printf("           Default: No replication\n\n");
+  printf("[-f Host:Port] Optional: Follow the primary at Host:Port (its -r port).\n");
+  printf("           The files of the primary are copied and its changes applied,\n");
+  printf("           CREATE, UPDATE and DELETE are answered with READONLY.\n");
+  printf("           Not with -s, -l or -r\n");
+  printf("           Default: Not a follower\n\n");
+  printf("[-C Files] Optional: Profile the locks of the store - STATS shows how\n");
+  printf("           long they were waited for and held and the given number of\n");
+  printf("           most contended files\n");
+  printf("           Default: 0 (no profiling)\n\n");
+  printf("[-M Port] Optional: Serve the counters of STATS over HTTP at\n");
+  printf("           http://Host:Port/metrics in the text format of Prometheus\n");
+  printf("           Default: No metrics endpoint\n\n");
+  printf("[-T Path] Optional: Trace the steps of sampled requests - the trace is\n");
+  printf("           written to Path on SIGUSR1 in the trace event format\n");
+  printf("           Default: No tracing\n\n");
+  printf("[-t Rate] Optional: Trace one of Rate requests\n");
+  printf("           Default: %d\n\n", DEFAULT_TRACE_SAMPLING);
+  printf("[-Y Seconds] Optional: Also write the trace every Seconds\n");
+  printf("           Default: 0 (on SIGUSR1 only)\n\n");
   printf("%s\n\n", log_help);
 
   printf("(c) Max Schrimpf - ZHAW 2014\n");
@@ -68,31 +222,321 @@ void usage(char *programName, char *msg) {
   exit(1);
 }
 
-void *handleRequest(void *input) {
+/*
+ * Called by the timer thread if a client stalls - the blocked recv or writev
+ * returns and the connection is cleaned up by its own thread
+ */
+void expireConnection(void *input) {
+  Payload *payload = (Payload *) input;
+  log_info("TIMER: Connection %d timed out", payload->socket);
+  shutdown(payload->socket, SHUT_RDWR);
+}
+
+void startDeadline(Payload *payload, long timeout) {
+  if (timeout > 0) {
+    add_timer(&payload->server->timers, &payload->deadline, timeout);
+  }
+}
+
+void stopDeadline(Payload *payload) {
+  cancel_timer(&payload->server->timers, &payload->deadline);
+}
+
+const char *getClientName(Payload *payload) {
+  if (payload->client_address.ss_family != AF_INET) {
+    return "local";
+  }
+  return inet_ntoa(((struct sockaddr_in *) &payload->client_address)->sin_addr);
+}
+
+void executeText(void *input) {
+  TextExecution *execution = (TextExecution *) input;
+  execute_request(&execution->request, execution->store, execution->response);
+}
+
+void executeBinary(void *input) {
+  BinaryExecution *execution = (BinaryExecution *) input;
+  const char *key = execution->key;
+  handle_binary_message(execution->header, key, key + execution->header->key_len, 
+                        execution->store, execution->response);
+}
+
+/*
+ * Serves binary frames until the client closes the connection. The frames
+ * may be pipelined - they are answered in the order they arrived
+ */
+void serveBinaryConnection(Payload *payload, char *buffer, size_t buffered, 
+                           unsigned long traced, uint64_t traced_at) {
+  Server *server = payload->server;
+  // one arena per frame in flight - stolen frames are executed concurrently
+  Arena *arenas[MAX_PIPELINED_FRAMES];
+  int num_arenas = 0;
+  int open = TRUE;
+
+  while (open) {
+    BinaryJob *jobs[MAX_PIPELINED_FRAMES];
+    int num_jobs = 0;
+    BinaryHeader header;
+    int status = STATUS_OK;
+    // the frames of the buffer were just received
+    uint64_t started = get_stats_time();
+    uint64_t span_start = get_trace_time(traced);
+
+    // collect the complete frames of the buffer
+    size_t used = 0;
+    while (num_jobs < MAX_PIPELINED_FRAMES && buffered - used >= BINARY_HEADER_LEN) {
+      decode_binary_header(buffer + used, &header);
+
+      // without a valid header the start of the next frame is unknown
+      status = is_binary_message(buffer + used) ? validate_binary_header(&header) 
+                                                : STATUS_BAD_REQUEST;
+      if (status != STATUS_OK) {
+        break;
+      }
+
+      size_t frame_len = get_binary_frame_len(&header);
+      if (buffered - used < frame_len) {
+        break;
+      }
+
+      if (num_jobs == num_arenas) {
+        arenas[num_arenas++] = acquire_arena();
+      }
+      BinaryJob *job = arena_alloc(arenas[num_jobs], sizeof(BinaryJob));
+      job->header = header;
+      init_response(&job->response, arenas[num_jobs]);
+      job->execution.header = &job->header;
+      job->execution.key = buffer + used + BINARY_HEADER_LEN;
+      job->execution.store = server->store;
+      job->execution.response = &job->response;
+      jobs[num_jobs++] = job;
+      used += frame_len;
+    }
+    span_start = record_span(traced, SPAN_PARSE, span_start);
+
+    // the reads of a pipeline are split among the idle workers - a change 
+    // waits for the frames before it and is done before the next ones start
+    int steal = server->work_stealing && num_jobs > 1;
+    int submitted[MAX_PIPELINED_FRAMES];
+    int waited = 0;
+    int i;
+    for (i = 0; i < num_jobs; i++) {
+      int lane = classify_binary_message(&jobs[i]->header);
+      submitted[i] = steal && lane != LANE_WRITE;
+      if (submitted[i]) {
+        submit_work(&jobs[i]->work, executeBinary, &jobs[i]->execution);
+        continue;
+      }
+      for (; waited < i; waited++) {
+        if (submitted[waited]) {
+          wait_for_completion(&jobs[waited]->work.done);
+        }
+      }
+      run_in_lane(&server->lanes, lane, executeBinary, &jobs[i]->execution);
+    }
+    span_start = record_span(traced, SPAN_EXECUTE, span_start);
+
+    // all jobs use the buffer - wait for them even if the client is gone
+    for (i = 0; i < num_jobs; i++) {
+      if (submitted[i] && i >= waited) {
+        wait_for_completion(&jobs[i]->work.done);
+      }
+      if (open) {
+        startDeadline(payload, server->write_timeout);
+        open = write_response_to_socket(payload->socket, &jobs[i]->response);
+        stopDeadline(payload);
+      }
+      record_request(get_binary_command(&jobs[i]->header), jobs[i]->response.failed,
+                     get_binary_frame_len(&jobs[i]->header), 
+                     open ? jobs[i]->response.length : 0, started);
+      reset_arena(arenas[i]);
+    }
+    record_span(traced, SPAN_WRITE, span_start);
+    record_span(traced, SPAN_REQUEST, traced_at);
+
+    if (status != STATUS_OK) {
+      log_error("Invalid binary frame - closing connection");
+      Response response;
+      init_response(&response, NULL);
+      reject_binary_message(&header, status, &response);
+      if (open) {
+        startDeadline(payload, server->write_timeout);
+        open = write_response_to_socket(payload->socket, &response);
+        stopDeadline(payload);
+      }
+      record_request(CMD_INVALID, TRUE, buffered - used, open ? response.length : 0, started);
+      break;
+    }
+    if (!open) {
+      break;
+    }
+
+    // keep the incomplete frame
+    buffered -= used;
+    memmove(buffer, buffer + used, buffered);
+    traced = sample_trace();
+    traced_at = get_trace_time(traced);
+
+    // more complete frames may be left
+    if (num_jobs == MAX_PIPELINED_FRAMES) {
+      continue;
+    }
+
+    // a started frame has to arrive in time - between frames the client may idle
+    startDeadline(payload, buffered > 0 ? server->read_timeout : server->idle_timeout);
+    ssize_t received = co_recv(payload->socket, buffer + buffered, MAX_MSG_LEN - buffered, 0);
+    stopDeadline(payload);
+    record_span(traced, SPAN_READ, traced_at);
+
+    if (received <= 0) {
+      break;
+    }
+    buffered += received;
+  }
+
+  int i;
+  for (i = 0; i < num_arenas; i++) {
+    release_arena(arenas[i]);
+  }
+}
+
+/*
+ * Answers the request on the connection of the payload and closes it
+ */
+void serveConnection(Payload *payload) {
   long threadID =(long) pthread_self();
-  Payload *payload = ( Payload* ) input;
+  Server *server = payload->server;
 
   log_debug("Thread %ld: Hello - handling client %s", threadID
-      , inet_ntoa(payload->client_address.sin_addr));
+      , getClientName(payload));
+  record_connection(TRUE);
 
-  char *buffer_ptr[0];
+  // the message is parsed right where it was received
+  char *buffer = acquire_buffer(&server->receive_buffers);
 
-  // Receive command from client 
-  size_t received_msg_size = read_from_socket(payload->socket, buffer_ptr);
-  log_debug("Thread %ld: Recived: '%s'", threadID, *buffer_ptr);
+  init_timer(&payload->deadline, expireConnection, payload);
 
-  char *return_msg = handle_message(received_msg_size, *buffer_ptr, payload->file_list);
+  // the steps of a sampled request are recorded as spans
+  unsigned long traced = sample_trace();
+  uint64_t span_start = record_span(traced, SPAN_ACCEPT, payload->accepted_at);
 
-  log_info("Thread %ld: Responding: '%s'", threadID, return_msg);
-  write_to_socket(payload->socket, return_msg);
+  // Receive command from client 
+  startDeadline(payload, server->read_timeout);
+  size_t received_msg_size = receive_from_socket(payload->socket, buffer, MAX_MSG_LEN);
+  stopDeadline(payload);
+  span_start = record_span(traced, SPAN_READ, span_start);
+
+  if (received_msg_size > 0 && is_binary_message(buffer)) {
+    log_debug("Thread %ld: Binary protocol", threadID);
+    serveBinaryConnection(payload, buffer, received_msg_size, traced, payload->accepted_at);
+  } else if (received_msg_size > 0) {
+    log_debug("Thread %ld: Recived: '%s'", threadID, buffer);
+    uint64_t started = get_stats_time();
+
+    // all short lived allocations of the request are served by the arena
+    Arena *arena = acquire_arena();
+
+    Response response;
+    init_response(&response, arena);
+
+    // cheap and expensive requests are executed in separate lanes
+    TextExecution execution;
+    execution.store = server->store;
+    execution.response = &response;
+    int parsed = parse_message(received_msg_size, buffer, &execution.request, &response);
+    span_start = record_span(traced, SPAN_PARSE, span_start);
+    if (parsed) {
+      run_in_lane(&server->lanes, classify_request(&execution.request), executeText, &execution);
+      span_start = record_span(traced, SPAN_EXECUTE, span_start);
+    } else {
+      execution.request.command = CMD_INVALID;
+    }
+
+    log_info("Thread %ld: Responding: '%.*s' (%zu bytes)", threadID, 
+        (int) response.parts[0].iov_len, (char *) response.parts[0].iov_base, response.length);
+    startDeadline(payload, server->write_timeout);
+    int sent = write_response_to_socket(payload->socket, &response);
+    stopDeadline(payload);
+    record_span(traced, SPAN_WRITE, span_start);
+    record_span(traced, SPAN_REQUEST, payload->accepted_at);
+    record_request(execution.request.command, response.failed, received_msg_size,
+                   sent ? response.length : 0, started);
+
+    release_arena(arena);
+  }
 
   // Close client socket 
   close(payload->socket);    
-  free(*buffer_ptr);
+  release_buffer(&server->receive_buffers, buffer);
 
+  record_connection(FALSE);
   log_debug("Thread %ld: Bye Bye", threadID );  
   free(payload);
-  pthread_exit(NULL);
+}
+
+void *handleRequest(void *input) {
+  Payload *payload = ( Payload* ) input;
+  Server *server = payload->server;
+  AdmissionControl *admission = &server->admission;
+
+  // coroutines run on the (pinned) workers
+  if (server->pin_threads && !in_coroutine()) {
+    // wrapped before it is narrowed - the counter outgrows an int
+    unsigned long cpu = __atomic_add_fetch(&server->next_cpu, 1, __ATOMIC_RELAXED);
+    int retcode = pin_thread_to_cpu(cpu % get_num_cpus());
+    handle_thread_error(retcode, "Pin connection thread", NO_EXIT);
+  }
+
+  // connections that had to wait are served by the thread that frees the slot
+  while (payload != NULL) {
+    serveConnection(payload);
+    payload = finish_admitted(admission);
+  }
+  return NULL;
+}
+
+void handleRequestCoroutine(void *input) {
+  handleRequest(input);
+}
+
+/*
+ * Starts the handling of an admitted connection
+ * returns 0 or an error number
+ */
+int startHandler(Payload *payload) {
+  if (payload->server->coroutine_workers > 0) {
+    return spawn_coroutine(handleRequestCoroutine, payload);
+  }
+  // detached - the system reclaims the thread as soon as it is done
+  return start_tracked_thread(handleRequest, payload);
+}
+
+/*
+ * Refuses a connection without blocking the listener
+ */
+void rejectConnection(Payload *payload) {
+  send(payload->socket, BUSY, strlen(BUSY), MSG_DONTWAIT | MSG_NOSIGNAL);
+  close(payload->socket);
+  free(payload);
+}
+
+/*
+ * Refuses an admitted connection whose handler could not start - another 
+ * listener may have queued a connection meanwhile, it gets the slot
+ */
+void rejectAdmitted(AdmissionControl *admission, Payload *payload) {
+  while (payload != NULL) {
+    Payload *queued = finish_admitted(admission);
+    rejectConnection(payload);
+    payload = NULL;
+    if (queued != NULL) {
+      int retcode = startHandler(queued);
+      if (retcode != 0) {
+        handle_thread_error(retcode, "Start handler", NO_EXIT);
+        payload = queued;
+      }
+    }
+  }
 }
 
 void *createSocketListener(void *input) {
@@ -100,35 +544,68 @@ void *createSocketListener(void *input) {
   log_info("Thread %ld: Hello from LISTENER", threadID );  
 
   ListenerPayload *listenerPayload = (ListenerPayload *) input;
+  if (listenerPayload->server->pin_threads) {
+    int retcode = pin_thread_to_cpu(0);
+    handle_thread_error(retcode, "Pin listener thread", NO_EXIT);
+  }
+  AdmissionControl *admission = &listenerPayload->server->admission;
   Payload *nextListEntry = malloc(sizeof(Payload));
-  pthread_once_t once = PTHREAD_ONCE_INIT;
 
-  int server_socket = create_server_socket(listenerPayload->port_number);
-  unsigned int client_address_len = sizeof(nextListEntry->client_address);
+  int server_socket = listenerPayload->server_socket;
+  unsigned int client_address_len;
 
   int retcode;
-  pthread_t *thread= malloc(sizeof(pthread_t));
   // Run forever 
   while (TRUE) { 
     log_debug("LISTENER: Accept - payload: %p", nextListEntry);
-    log_debug("LISTENER: Allocated thread: %p", thread);
 
-    nextListEntry->file_list = listenerPayload->file_list;
+    nextListEntry->server = listenerPayload->server;
 
     // Wait for a client to connect 
     log_info("LISTENER: Accepting new connections");
+    client_address_len = sizeof(nextListEntry->client_address);
     nextListEntry->socket = accept(server_socket , (struct sockaddr *)&(nextListEntry->client_address) , &(client_address_len));
-    handle_error(nextListEntry->socket, "accept() failed", PROCESS_EXIT);
+    if (nextListEntry->socket < 0) {
+      // EMFILE under overload - the served connections free files soon
+      handle_error(nextListEntry->socket, "accept() failed", NO_EXIT);
+      usleep(ACCEPT_BACKOFF * 1000);
+      continue;
+    }
+    nextListEntry->accepted_at = trace_sampling ? get_stats_time() : 0;
 
-    log_info("LISTENER: New connection accepted");
+    // coroutines wait for the socket in their scheduler instead of blocking
+    if (listenerPayload->server->coroutine_workers > 0) {
+      fcntl(nextListEntry->socket, F_SETFL, O_NONBLOCK);
+    }
 
-    retcode = pthread_create(thread , NULL, handleRequest, nextListEntry);
-    handle_thread_error(retcode, "Create Thread", PROCESS_EXIT);
+    unsigned long executed_reads, coalesced_reads;
+    get_store_read_counters(listenerPayload->server->store, &executed_reads, &coalesced_reads);
+    log_info("LISTENER: New connection accepted - %ld threads live, %ld finished, %ld coroutines live, "
+        "%lu reads executed, %lu coalesced", get_live_threads(), get_finished_threads(), 
+        get_live_coroutines(), executed_reads, coalesced_reads);
+    if (listenerPayload->server->store->read_only) {
+      log_info("LISTENER: Replication lag %ld ms", 
+               get_replication_lag(listenerPayload->server->store->replication));
+    }
+
+    switch (admit_connection(admission, nextListEntry)) {
+      case ADMITTED:
+        retcode = startHandler(nextListEntry);
+        if (retcode != 0) {
+          handle_thread_error(retcode, "Start handler", NO_EXIT);
+          rejectAdmitted(admission, nextListEntry);
+        }
+        break;
+      case QUEUED:
+        log_debug("LISTENER: %d connections waiting", get_queued(admission));
+        break;
+      case REJECTED:
+        log_info("LISTENER: Overloaded - rejected %ld connections", get_rejected(admission));
+        rejectConnection(nextListEntry);
+        break;
+    }
 
-    appendListElement(listenerPayload->threadList,(void *) thread, sizeof(pthread_t), "NoName");
-    free(thread);
     nextListEntry = malloc(sizeof(Payload));
-    thread= malloc(sizeof(pthread_t));
   }
   close(server_socket);
   // Should never happen!
@@ -136,40 +613,48 @@ void *createSocketListener(void *input) {
   pthread_exit(NULL);
 }
 
-void *cleanUpSocketListener(void *input) {
-  long threadID =(long) pthread_self();
-  log_info("Thread %ld: Hello from CLEANUP", threadID );  
-
-  int retcode;
-  ConcurrentLinkedList *threadList = (ConcurrentLinkedList *) input;
-  log_debug("CLEANUP: ConcurrentLinkedList: %p", threadList);
-  pthread_t *thread; 
-
-  int num = 0;
-  while (TRUE) { 
-    sleep(CLEANUP_FREQUENCY);
-    log_info("CLEANUP: Start removing threads");
-
-    num = 0;
-    // gives back the shallow copy of the element
-    while(getFirstListElement(threadList, (void *)&thread) > 0){ 
-
-      log_debug("CLEANUP: about to join: %p", thread);
-      retcode = pthread_join(*thread, NULL);
-      handle_thread_error(retcode, "Join thread", PROCESS_EXIT);
-      log_debug("CLEANUP: joined");
+/*
+ * Returns the connection limit given with the option - exits with the usage
+ * if it is no number or < 1
+ */
+int get_connection_limit(char *programName, int argc, char *argv[], const char *option,
+                         int default_value) {
+  char *value = get_string_with_default(argc, argv, option, NULL);
+  if (value == NULL) {
+    return default_value;
+  }
 
-      log_debug("CLEANUP: remove thread: %p", thread);
-      free(thread);
+  char *end;
+  errno = 0;
+  long limit = strtol(value, &end, 10);
+  if (errno != 0 || end == value || *end != '\000' || limit < 1 || limit > INT_MAX) {
+    usage(programName, "-m and -q need a number of connections >= 1");
+  }
+  return limit;
+}
 
-      removeFirstListElement(threadList);
-      num++;
+/*
+ * Raises the limit of open files to what the connection limits need - 
+ * accept() fails once it is reached
+ */
+void check_file_limit(long max_connections) {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+    handle_error(-1, "getrlimit() failed", NO_EXIT);
+    return;
+  }
+  rlim_t needed = (rlim_t) max_connections + RESERVED_FILES;
+  if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < needed) {
+    if (limit.rlim_max == RLIM_INFINITY || limit.rlim_max >= needed) {
+      limit.rlim_cur = needed;
+      int retcode = setrlimit(RLIMIT_NOFILE, &limit);
+      handle_error(retcode, "setrlimit() failed", NO_EXIT);
+    } else {
+      log_error("-m and -q allow %ld connections, but only %lu files may be open - "
+                "connections are refused before the limits are reached", 
+                max_connections, (unsigned long) limit.rlim_max);
     }
-    log_info("CLEANUP: Removed %d threads", num);
   }
-  // Should never happen!
-  log_error("Thread %ld: Bye Bye from CLEANUP - ERROR!", threadID );  
-  pthread_exit(NULL);
 }
 
 int main ( int argc, char *argv[] ) {
@@ -181,33 +666,122 @@ int main ( int argc, char *argv[] ) {
 
   get_logging_properties(argc, argv);
 
-  // Creation of the file list
-  ConcurrentLinkedList *file_list = newList();
-  log_debug("MAIN: Server file_list: %p", file_list);
+  // before any other thread - they inherit the blocked signal of the trace
+  char *trace_path = get_string_with_default(argc, argv, "-T", NULL);
+  if (trace_path != NULL) {
+    start_tracing(get_number_with_default(argc, argv, "-t", DEFAULT_TRACE_SAMPLING), 
+                  trace_path, get_number_with_default(argc, argv, "-Y", 0));
+  }
+  // requests don't wait for the log output
+  start_async_logging();
+
+  Server server;
+
+  // before the lists are used by other threads
+  start_lock_profiling(get_number_with_default(argc, argv, "-C", 0));
+
+  // Creation of the file store - by default one shard per NUMA node
+  server.store = new_store(get_number_with_default(argc, argv, "-S", get_num_nodes()),
+                           get_number_with_default(argc, argv, "-N", FALSE));
+  log_debug("MAIN: Server store: %p", server.store);
+
+  // a warm restart maps the files of the last run
+  char *snapshot_path = get_string_with_default(argc, argv, "-s", NULL);
+  if (snapshot_path != NULL) {
+    load_snapshot(server.store, snapshot_path);
+    start_snapshot_thread(server.store, snapshot_path, 
+        get_number_with_default(argc, argv, "-n", DEFAULT_SNAPSHOT_INTERVAL));
+  }
+
+  // the changes since the snapshot
+  char *wal_path = get_string_with_default(argc, argv, "-l", NULL);
+  if (wal_path != NULL) {
+    int durability = parse_durability(get_string_with_default(argc, argv, "-D", "batched"));
+    if (durability < 0) {
+      usage(programName, "Unknown durability - use none, batched or request");
+    }
+    attach_store_wal(server.store, wal_path, durability);
+  }
+
+  // a follower gets its files from the primary only
+  char *primary = get_string_with_default(argc, argv, "-f", NULL);
+  long replication_port = get_number_with_default(argc, argv, "-r", 0);
+  if (primary != NULL) {
+    char *separator = strrchr(primary, ':');
+    if (separator == NULL || snapshot_path != NULL || wal_path != NULL 
+        || replication_port > 0) {
+      usage(programName, "A follower needs -f Host:Port and no -s, -l or -r");
+    }
+    *separator = '\000';
+    start_replication_follower(server.store, primary, atoi(separator + 1));
+  } else if (replication_port > 0) {
+    start_replication_primary(server.store, replication_port);
+  }
+
+  // scrapes only read the counters - the request threads never wait for them
+  long metrics_port = get_number_with_default(argc, argv, "-M", 0);
+  if (metrics_port > 0) {
+    start_metrics_listener(server.store, metrics_port);
+  }
+
+  server.pin_threads = get_number_with_default(argc, argv, "-P", FALSE);
+  server.next_cpu = 0;
+
+  start_lanes(&server.lanes, get_string_with_default(argc, argv, "-L", NULL));
+
+  // the lanes have their own threads - stealing is only done by the workers
+  server.coroutine_workers = get_number_with_default(argc, argv, "-k", 0);
+  server.work_stealing = server.coroutine_workers > 1 && !server.lanes.enabled
+                         && get_number_with_default(argc, argv, "-w", TRUE);
+  if (server.coroutine_workers > 0) {
+    start_coroutine_scheduler(server.coroutine_workers, server.pin_threads, 
+                              server.work_stealing);
+  }
+
+  // a client that vanishes during a write must not kill the server
+  signal(SIGPIPE, SIG_IGN);
 
-  // Creation of the active thread List
-  ConcurrentLinkedList *threadList = newList();
   pthread_t socketListenerThread;
 
-  ListenerPayload socketListenerPayload;
-  socketListenerPayload.port_number = get_port_with_default(argc, argv);
-  socketListenerPayload.threadList = threadList;
-  socketListenerPayload.file_list = file_list;
+  // recycled buffers for received messages
+  init_buffer_pool(&server.receive_buffers, RECEIVE_BUFFER_SIZE);
+
+  // limits for served and waiting connections
+  int max_in_flight = get_connection_limit(programName, argc, argv, "-m", 
+                                           DEFAULT_MAX_IN_FLIGHT);
+  int max_queued = get_connection_limit(programName, argc, argv, "-q", DEFAULT_MAX_QUEUED);
+  check_file_limit((long) max_in_flight + max_queued);
+  init_admission_control(&server.admission, max_in_flight, max_queued);
 
-  pthread_t cleanUpThread;
+  // deadlines for stalled clients
+  server.read_timeout = get_number_with_default(argc, argv, "-R", DEFAULT_READ_TIMEOUT);
+  server.write_timeout = get_number_with_default(argc, argv, "-W", DEFAULT_WRITE_TIMEOUT);
+  server.idle_timeout = get_number_with_default(argc, argv, "-I", DEFAULT_IDLE_TIMEOUT);
+  start_timer_wheel(&server.timers, TIMER_TICK_MS);
+
+  ListenerPayload socketListenerPayload;
+  socketListenerPayload.server_socket = create_server_socket(get_port_with_default(argc, argv));
+  socketListenerPayload.server = &server;
 
   int retcode = pthread_create(&socketListenerThread, NULL, 
                                 createSocketListener, &socketListenerPayload); 
   handle_thread_error(retcode, "Create Listener thread", PROCESS_EXIT);
 
-  // the cleanup should never happen since the threads should not finish
-  retcode = pthread_create(&cleanUpThread , NULL, cleanUpSocketListener,threadList);
-  handle_thread_error(retcode, "Create Cleanup thread", PROCESS_EXIT);
+  // local clients may skip the TCP stack - served by the same request path
+  char *unix_path = get_unix_path(argc, argv);
+  ListenerPayload unixListenerPayload;
+  if (unix_path != NULL) {
+    pthread_t unixListenerThread;
+    unixListenerPayload.server_socket = create_unix_server_socket(unix_path);
+    unixListenerPayload.server = &server;
+
+    retcode = pthread_create(&unixListenerThread, NULL, 
+                             createSocketListener, &unixListenerPayload); 
+    handle_thread_error(retcode, "Create unix Listener thread", PROCESS_EXIT);
+  }
 
   retcode = pthread_join( socketListenerThread, NULL);
   handle_thread_error(retcode, "Join Listener thread", PROCESS_EXIT);
-  retcode = pthread_join( cleanUpThread, NULL);
-  handle_thread_error(retcode, "Join Cleanup thread", PROCESS_EXIT);
 
   // something went wrong!
   log_error("MAIN: Reached exit - this should never happen - ERROR");